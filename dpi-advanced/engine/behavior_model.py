@@ -77,9 +77,6 @@ class BehaviorModel:
         # Calculate average packet size
         avg_packet_size = byte_count / packet_count if packet_count > 0 else 0
         
-        # Extract timing features (stub for Phase L)
-        # In production, would analyze inter-packet timing
-        
         features = {
             'packet_count': packet_count,
             'byte_count': byte_count,
@@ -89,6 +86,13 @@ class BehaviorModel:
             'flow_duration': self._calculate_duration(flow)
         }
         
+        # Size distribution, timing and flags are counted in the kernel by the
+        # eBPF flow tracker (log2 buckets); flows assembled here have none
+        if 'packet_size_histogram' in flow:
+            features['packet_size_histogram'] = list(flow['packet_size_histogram'])
+            features['inter_arrival_histogram'] = list(flow.get('inter_arrival_histogram', []))
+            features['tcp_flag_counts'] = dict(flow.get('tcp_flag_counts', {}))
+        
         return features
     
     def _calculate_duration(self, flow: Dict[str, Any]) -> float:
@@ -4,18 +4,52 @@ RansomEye DPI Advanced - Flow Assembler
 AUTHORITATIVE: Deterministic flow assembly from packet tuples
 """
 
-from typing import Dict, Any, List, Optional, Tuple
-from datetime import datetime, timezone
+from typing import Dict, Any, List, Optional, Tuple, Union
+from datetime import datetime, timedelta, timezone
 import hashlib
-import json
+import socket
+import struct
+import uuid
 from collections import defaultdict
 
 
+# Binary canonical encoding of flow_id and immutable_hash inputs; the byte
+# layout is documented in dpi-advanced/fastpath/flow_hash.h, which hashes
+# native flow table records the same way
+FLOW_HASH_VERSION = 1
+FLOW_ID_FORMAT = '>BBBx16s16sHHq'
+FLOW_RECORD_HASH_FORMAT = '>BBBB16s16sHHqqQQ16s64s16s16s'
+FLOW_HASH_PROTOCOLS = {'tcp': 6, 'udp': 17, 'icmp': 1}
+FLOW_HASH_PROTO_OTHER = 255
+FLOW_HASH_PRIVACY_MODES = {'STRICT': 1, 'BALANCED': 2, 'FORENSIC': 3}
+_EPOCH = datetime(1970, 1, 1, tzinfo=timezone.utc)
+
+
 class FlowAssemblyError(Exception):
     """Base exception for flow assembly errors."""
     pass
 
 
+def _address_bytes(ip: str) -> Tuple[int, bytes]:
+    """IP version and 16-byte address (IPv4 in the first 4 bytes)."""
+    if ':' in ip:
+        return 6, socket.inet_pton(socket.AF_INET6, ip)
+    return 4, socket.inet_pton(socket.AF_INET, ip) + bytes(12)
+
+
+def _epoch_us(value: Union[datetime, str]) -> int:
+    """Microseconds since the Unix epoch of a datetime or its isoformat()."""
+    if isinstance(value, str):
+        value = datetime.fromisoformat(value.replace('Z', '+00:00'))
+    if value.tzinfo is None:
+        value = value.replace(tzinfo=timezone.utc)
+    return (value - _EPOCH) // timedelta(microseconds=1)
+
+
+def _uuid_bytes(value: str) -> bytes:
+    return uuid.UUID(value).bytes if value else bytes(16)
+
+
 class FlowAssembler:
     """
     Deterministic flow assembler.
@@ -66,24 +100,9 @@ class FlowAssembler:
         
         # Get or create flow
         if flow_key not in self.active_flows:
-            flow_id = self._generate_flow_id(flow_key, timestamp)
-            self.active_flows[flow_key] = {
-                'flow_id': flow_id,
-                'src_ip': src_ip,
-                'dst_ip': dst_ip,
-                'src_port': src_port,
-                'dst_port': dst_port,
-                'protocol': protocol,
-                'flow_start': timestamp.isoformat(),
-                'flow_end': timestamp.isoformat(),
-                'packet_count': 0,
-                'byte_count': 0,
-                'l7_protocol': '',
-                'behavioral_profile_id': '',
-                'asset_profile_id': '',
-                'privacy_mode': 'FORENSIC',
-                'immutable_hash': ''
-            }
+            self.active_flows[flow_key] = self._new_flow(
+                flow_key, src_ip, dst_ip, src_port, dst_port, protocol, timestamp
+            )
         
         flow = self.active_flows[flow_key]
         
@@ -109,6 +128,90 @@ class FlowAssembler:
         
         return None
     
+    def complete_flow(
+        self,
+        src_ip: str,
+        dst_ip: str,
+        src_port: int,
+        dst_port: int,
+        protocol: str,
+        packet_count: int,
+        byte_count: int,
+        flow_start: datetime,
+        flow_end: datetime,
+        l7_protocol: str = '',
+        flow_id: Optional[str] = None,
+        immutable_hash: Optional[str] = None
+    ) -> Dict[str, Any]:
+        """
+        Build the completed record of a flow assembled outside this assembler.
+        
+        Used for flows counted by the eBPF flow tracker, so they carry the same
+        flow_id derivation and immutable hash as flows assembled here.
+        l7_protocol is the tracker's in-kernel classification ('' if none).
+        flow_id and immutable_hash may come precomputed over the same encoding
+        (native flow table records, hashed in batches by flow_hash.c).
+        
+        Returns:
+            Completed flow dictionary
+        """
+        flow_key = self._build_flow_key(src_ip, dst_ip, src_port, dst_port, protocol)
+        completed_flow = self._new_flow(flow_key, src_ip, dst_ip, src_port, dst_port, protocol, flow_start, flow_id)
+        completed_flow['packet_count'] = packet_count
+        completed_flow['byte_count'] = byte_count
+        completed_flow['flow_end'] = flow_end.isoformat()
+        completed_flow['l7_protocol'] = l7_protocol
+        completed_flow['immutable_hash'] = immutable_hash or self._calculate_hash(completed_flow)
+        return completed_flow
+
+    def flow_id(
+        self,
+        src_ip: str,
+        dst_ip: str,
+        src_port: int,
+        dst_port: int,
+        protocol: str,
+        flow_start: datetime
+    ) -> str:
+        """
+        flow_id of the flow with this 5-tuple that started at flow_start.
+
+        Links the later segments of a long flow, completed one active timeout
+        at a time, back to the record of its first segment.
+        """
+        flow_key = self._build_flow_key(src_ip, dst_ip, src_port, dst_port, protocol)
+        return self._generate_flow_id(flow_key, flow_start)
+
+    def _new_flow(
+        self,
+        flow_key: Tuple,
+        src_ip: str,
+        dst_ip: str,
+        src_port: int,
+        dst_port: int,
+        protocol: str,
+        timestamp: datetime,
+        flow_id: Optional[str] = None
+    ) -> Dict[str, Any]:
+        """Create an empty flow record starting at timestamp."""
+        return {
+            'flow_id': flow_id or self._generate_flow_id(flow_key, timestamp),
+            'src_ip': src_ip,
+            'dst_ip': dst_ip,
+            'src_port': src_port,
+            'dst_port': dst_port,
+            'protocol': protocol,
+            'flow_start': timestamp.isoformat(),
+            'flow_end': timestamp.isoformat(),
+            'packet_count': 0,
+            'byte_count': 0,
+            'l7_protocol': '',
+            'behavioral_profile_id': '',
+            'asset_profile_id': '',
+            'privacy_mode': 'FORENSIC',
+            'immutable_hash': ''
+        }
+
     def _build_flow_key(
         self,
         src_ip: str,
@@ -132,18 +235,47 @@ class FlowAssembler:
 
     def _generate_flow_id(self, flow_key: Tuple, timestamp: datetime) -> str:
         """Generate deterministic flow ID from flow key and start time."""
-        flow_start = timestamp.isoformat()
-        flow_key_str = json.dumps({"flow_key": flow_key, "flow_start": flow_start}, sort_keys=True)
-        flow_hash = hashlib.sha256(flow_key_str.encode('utf-8')).hexdigest()
-        return flow_hash[:32]
+        ip_version, addr_a = _address_bytes(flow_key[0])
+        _, addr_b = _address_bytes(flow_key[1])
+        # Endpoints by address bytes then port, as flow_hash.c orders them
+        low, high = sorted(((addr_a, flow_key[2]), (addr_b, flow_key[3])))
+        encoded = struct.pack(
+            FLOW_ID_FORMAT,
+            FLOW_HASH_VERSION,
+            ip_version,
+            FLOW_HASH_PROTOCOLS.get(flow_key[4], FLOW_HASH_PROTO_OTHER),
+            low[0],
+            high[0],
+            low[1],
+            high[1],
+            _epoch_us(timestamp)
+        )
+        return hashlib.sha256(encoded).hexdigest()[:32]
     
     def _calculate_hash(self, flow: Dict[str, Any]) -> str:
-        """Calculate SHA256 hash of flow record."""
-        hashable_content = {k: v for k, v in flow.items() if k != 'immutable_hash'}
-        canonical_json = json.dumps(hashable_content, sort_keys=True, separators=(',', ':'), ensure_ascii=False)
-        content_bytes = canonical_json.encode('utf-8')
-        hash_obj = hashlib.sha256(content_bytes)
-        return hash_obj.hexdigest()
+        """Calculate SHA256 hash of flow record over its fixed binary encoding."""
+        ip_version, src_addr = _address_bytes(flow['src_ip'])
+        _, dst_addr = _address_bytes(flow['dst_ip'])
+        encoded = struct.pack(
+            FLOW_RECORD_HASH_FORMAT,
+            FLOW_HASH_VERSION,
+            ip_version,
+            FLOW_HASH_PROTOCOLS.get(flow['protocol'], FLOW_HASH_PROTO_OTHER),
+            FLOW_HASH_PRIVACY_MODES[flow['privacy_mode']],
+            src_addr,
+            dst_addr,
+            flow['src_port'],
+            flow['dst_port'],
+            _epoch_us(flow['flow_start']),
+            _epoch_us(flow['flow_end']),
+            flow['packet_count'],
+            flow['byte_count'],
+            bytes.fromhex(flow['flow_id']),
+            flow['l7_protocol'].encode('utf-8'),
+            _uuid_bytes(flow['behavioral_profile_id']),
+            _uuid_bytes(flow['asset_profile_id'])
+        )
+        return hashlib.sha256(encoded).hexdigest()
 
     def flush_expired(self, now: datetime) -> List[Dict[str, Any]]:
         """Flush expired flows based on timeout."""
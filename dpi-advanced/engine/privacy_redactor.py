@@ -4,8 +4,9 @@ RansomEye DPI Advanced - Privacy Redactor
 AUTHORITATIVE: Policy-driven privacy redaction
 """
 
-from typing import Dict, Any
+from typing import Dict, Any, Optional
 import hashlib
+import hmac
 import ipaddress
 
 
@@ -22,6 +23,9 @@ class PrivacyRedactor:
     - Policy-driven: Redaction based on privacy policy
     - Deterministic: Same input + same policy = same output
     - Before storage: Redaction happens before storage and upload
+    - Keyed: with ip_hash_key, hashed IPs are HMAC-SHA256 pseudonyms that
+      cannot be reversed by hashing the address space
+    - Same output as the native batch redactor (fastpath/privacy_redact.c)
     """
     
     def __init__(self, privacy_policy: Dict[str, Any]):
@@ -36,33 +40,41 @@ class PrivacyRedactor:
         self.ip_redaction = privacy_policy.get('ip_redaction', 'none')
         self.port_redaction = privacy_policy.get('port_redaction', 'none')
         self.dns_redaction = privacy_policy.get('dns_redaction', 'none')
+        key = privacy_policy.get('ip_hash_key') or b''
+        # HMAC hashes keys longer than a block first; doing it here keeps them within the native limit
+        self.ip_hash_key = hashlib.sha256(key).digest() if len(key) > 64 else key
+        # Per-run cache of redacted IPs, cleared when full; 0 disables
+        self.ip_cache_size = int(privacy_policy.get('ip_cache_size', 0))
+        self._ip_cache: Dict[str, str] = {}
     
-    def redact_flow(self, flow: Dict[str, Any]) -> Dict[str, Any]:
+    def redact_flow(self, flow: Dict[str, Any], redacted_endpoints: Optional[Dict[str, Any]] = None) -> Dict[str, Any]:
         """
         Redact flow according to privacy policy.
         
         Args:
             flow: Flow dictionary
+            redacted_endpoints: src_ip, dst_ip, src_port and dst_port already
+                redacted under this policy (native batch redaction); used
+                instead of redacting them here
         
         Returns:
             Redacted flow dictionary
         """
         redacted = flow.copy()
         
-        # Redact IPs
-        if self.ip_redaction == 'hash':
-            redacted['src_ip'] = self._hash_ip(flow.get('src_ip', ''))
-            redacted['dst_ip'] = self._hash_ip(flow.get('dst_ip', ''))
-        elif self.ip_redaction == 'partial':
-            redacted['src_ip'] = self._partial_ip(flow.get('src_ip', ''))
-            redacted['dst_ip'] = self._partial_ip(flow.get('dst_ip', ''))
-        # 'none' means no redaction
-        
-        # Redact ports
-        if self.port_redaction == 'truncate':
-            redacted['src_port'] = redacted.get('src_port', 0) & 0xFF00  # Keep high byte
-            redacted['dst_port'] = redacted.get('dst_port', 0) & 0xFF00
-        # 'none' means no redaction
+        if redacted_endpoints is not None:
+            # Redacted natively, a batch at a time
+            redacted.update(redacted_endpoints)
+        else:
+            # Redact IPs
+            redacted['src_ip'] = self.redact_ip(flow.get('src_ip', ''))
+            redacted['dst_ip'] = self.redact_ip(flow.get('dst_ip', ''))
+            
+            # Redact ports
+            if self.port_redaction == 'truncate':
+                redacted['src_port'] = redacted.get('src_port', 0) & 0xFF00  # Keep high byte
+                redacted['dst_port'] = redacted.get('dst_port', 0) & 0xFF00
+            # 'none' means no redaction
         
         # DNS redaction (if DNS data in event_data)
         if self.dns_redaction == 'second_level_only':
@@ -76,12 +88,41 @@ class PrivacyRedactor:
         
         return redacted
     
+    def redact_ip(self, ip: str) -> str:
+        """
+        Redact one IP address according to privacy policy.
+        
+        Args:
+            ip: IP address string
+        
+        Returns:
+            Redacted IP address string
+        """
+        if self.ip_redaction not in ('hash', 'partial'):
+            # 'none' means no redaction
+            return ip
+        cached = self._ip_cache.get(ip)
+        if cached is not None:
+            return cached
+        if self.ip_redaction == 'hash':
+            redacted = self._hash_ip(ip)
+        else:
+            redacted = self._partial_ip(ip)
+        if self.ip_cache_size:
+            if len(self._ip_cache) >= self.ip_cache_size:
+                self._ip_cache.clear()
+            self._ip_cache[ip] = redacted
+        return redacted
+    
     def _hash_ip(self, ip: str) -> str:
-        """Hash IP address deterministically."""
+        """Hash IP address deterministically (HMAC-SHA256 when a key is set)."""
         try:
             ip_obj = ipaddress.ip_address(ip)
             ip_bytes = ip_obj.packed
-            hash_obj = hashlib.sha256(ip_bytes)
+            if self.ip_hash_key:
+                hash_obj = hmac.new(self.ip_hash_key, ip_bytes, hashlib.sha256)
+            else:
+                hash_obj = hashlib.sha256(ip_bytes)
             return hash_obj.hexdigest()[:16]  # Return first 16 chars as identifier
         except Exception:
             return ip
@@ -5,91 +5,249 @@
  * NOTE:
  * - This implementation is intentionally minimal and deterministic.
  * - It provides a C-backed capture path used by the DPI runtime via ctypes.
- * - It does not use PACKET_MMAP to keep runtime complexity bounded.
+ * - Two modes are provided: single-packet recvfrom() and a TPACKET_V3
+ *   PACKET_RX_RING whose blocks are walked in place and handed back to
+ *   the kernel by the caller (no per-packet syscall, no kernel copy-out).
+ * - Timestamps come from the kernel (software RX or NIC hardware clock)
+ *   via SO_TIMESTAMPING; clock_gettime() is only a last-resort fallback.
  */
 
+#include "af_packet_capture.h"
+
 #include <linux/if_packet.h>
 #include <linux/if_ether.h>
 #include <linux/ip.h>
 #include <linux/tcp.h>
 #include <linux/udp.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <net/if.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <time.h>
+#include <linux/errqueue.h>
+
+struct af_packet_ring {
+    int fd;
+    unsigned char *map;
+    size_t map_len;
+    uint32_t block_size;
+    uint32_t block_count;
+    uint32_t current_block;
+    struct tpacket_block_desc *block;   /* Block currently owned by userspace */
+    struct tpacket3_hdr *frame;         /* Next frame to hand out */
+    uint32_t frames_left;
+    struct af_packet_stats stats;       /* Accumulated by af_packet_ring_stats() */
+};
 
 /*
- * Initialize AF_PACKET socket
- * Returns socket fd on success, -1 on error.
+ * Bind socket to interface for all ethertypes.
+ * Returns 0 on success, -1 on error.
  */
-int af_packet_open(const char *interface) {
-    int sockfd;
+static int af_packet_bind(int sockfd, const char *interface) {
     struct sockaddr_ll sll;
     struct ifreq ifr;
-    
-    // Create AF_PACKET socket
-    sockfd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
-    if (sockfd < 0) {
-        return -1;
-    }
-    
+
     // Get interface index
-    strncpy(ifr.ifr_name, interface, IFNAMSIZ);
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
     if (ioctl(sockfd, SIOCGIFINDEX, &ifr) < 0) {
-        close(sockfd);
         return -1;
     }
-    
+
     // Bind to interface
     memset(&sll, 0, sizeof(sll));
     sll.sll_family = AF_PACKET;
     sll.sll_ifindex = ifr.ifr_ifindex;
     sll.sll_protocol = htons(ETH_P_ALL);
-    
+
     if (bind(sockfd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Initialize AF_PACKET socket
+ * Returns socket fd on success, -1 on error.
+ */
+int af_packet_open(const char *interface) {
+    int sockfd;
+    int one = 1;
+
+    if (!interface) {
+        return -1;
+    }
+
+    // Create AF_PACKET socket
+    sockfd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (sockfd < 0) {
+        return -1;
+    }
+
+    // Auxdata carries the on-wire length once a capture filter truncates
+    if (setsockopt(sockfd, SOL_PACKET, PACKET_AUXDATA, &one, sizeof(one)) < 0) {
+        close(sockfd);
+        return -1;
+    }
+
+    if (af_packet_bind(sockfd, interface) < 0) {
         close(sockfd);
         return -1;
     }
     return sockfd;
 }
 
+/*
+ * Enable kernel packet timestamps on an AF_PACKET socket.
+ * Software RX stamps are always requested so arrival time is taken at
+ * netif receive instead of when the reader is scheduled. For
+ * AF_PACKET_TS_SOURCE_HARDWARE the NIC is switched to stamp all RX frames;
+ * drivers that refuse (or only stamp PTP) fall back to software.
+ * For rings, PACKET_TIMESTAMP selects the stamp written to tp_sec/tp_nsec.
+ * Returns the effective AF_PACKET_TS_SOURCE_*, -1 on error.
+ */
+int af_packet_enable_timestamps(int sockfd, const char *interface, int requested_source) {
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    int ring_flags = SOF_TIMESTAMPING_SOFTWARE;
+    int effective = AF_PACKET_TS_SOURCE_SOFTWARE;
+
+    if (sockfd < 0 || !interface) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (requested_source == AF_PACKET_TS_SOURCE_HARDWARE) {
+        struct hwtstamp_config hwconfig;
+        struct ifreq ifr;
+
+        memset(&hwconfig, 0, sizeof(hwconfig));
+        hwconfig.tx_type = HWTSTAMP_TX_OFF;
+        hwconfig.rx_filter = HWTSTAMP_FILTER_ALL;
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
+        ifr.ifr_data = (char *)&hwconfig;
+        if (ioctl(sockfd, SIOCSHWTSTAMP, &ifr) == 0 && hwconfig.rx_filter == HWTSTAMP_FILTER_ALL) {
+            flags |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+            ring_flags |= SOF_TIMESTAMPING_RAW_HARDWARE;
+            effective = AF_PACKET_TS_SOURCE_HARDWARE;
+        }
+    }
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+        return -1;
+    }
+    if (setsockopt(sockfd, SOL_PACKET, PACKET_TIMESTAMP, &ring_flags, sizeof(ring_flags)) < 0) {
+        return -1;
+    }
+    return effective;
+}
+
 /*
  * Read a single packet into buffer.
+ * out_len is the captured length, out_wirelen (optional) the on-wire
+ * length before snaplen truncation.
+ * The timestamp is the raw hardware stamp if present, else the kernel
+ * software RX stamp, else the time of return from recvmsg().
  * Returns 0 on success, -1 on error.
  */
-int af_packet_read(int sockfd, unsigned char *buffer, int buffer_len, int *out_len, long *out_sec, long *out_nsec) {
+int af_packet_read(int sockfd, unsigned char *buffer, int buffer_len, int *out_len, int *out_wirelen,
+                   long *out_sec, long *out_nsec) {
+    union {
+        char buf[CMSG_SPACE(sizeof(struct scm_timestamping)) +
+                 CMSG_SPACE(sizeof(struct tpacket_auxdata))];
+        struct cmsghdr align;
+    } control;
+    struct timespec ts = {0, 0};
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    ssize_t received;
+    int wirelen = -1;
+
     if (!buffer || buffer_len <= 0 || !out_len) {
         return -1;
     }
 
-    struct timespec ts;
-    ssize_t received = recvfrom(sockfd, buffer, (size_t)buffer_len, 0, NULL, NULL);
+    iov.iov_base = buffer;
+    iov.iov_len = (size_t)buffer_len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    received = recvmsg(sockfd, &msg, 0);
     if (received < 0) {
         return -1;
     }
 
-    if (clock_gettime(CLOCK_REALTIME, &ts) == 0) {
-        if (out_sec) {
-            *out_sec = (long)ts.tv_sec;
-        }
-        if (out_nsec) {
-            *out_nsec = (long)ts.tv_nsec;
-        }
-    } else {
-        if (out_sec) {
-            *out_sec = 0;
-        }
-        if (out_nsec) {
-            *out_nsec = 0;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING) {
+            const struct scm_timestamping *stamps = (const struct scm_timestamping *)CMSG_DATA(cmsg);
+
+            // ts[2] is the raw hardware stamp, ts[0] the software stamp
+            if (stamps->ts[2].tv_sec || stamps->ts[2].tv_nsec) {
+                ts = stamps->ts[2];
+            } else {
+                ts = stamps->ts[0];
+            }
+        } else if (cmsg->cmsg_level == SOL_PACKET && cmsg->cmsg_type == PACKET_AUXDATA) {
+            const struct tpacket_auxdata *aux = (const struct tpacket_auxdata *)CMSG_DATA(cmsg);
+
+            wirelen = (int)aux->tp_len;
         }
     }
+    if (ts.tv_sec == 0 && ts.tv_nsec == 0 && clock_gettime(CLOCK_REALTIME, &ts) != 0) {
+        ts.tv_sec = 0;
+        ts.tv_nsec = 0;
+    }
 
+    if (out_sec) {
+        *out_sec = (long)ts.tv_sec;
+    }
+    if (out_nsec) {
+        *out_nsec = (long)ts.tv_nsec;
+    }
     *out_len = (int)received;
+    if (out_wirelen) {
+        *out_wirelen = wirelen >= 0 ? wirelen : (int)received;
+    }
+    return 0;
+}
+
+/*
+ * Add the kernel counters collected since the previous call to stats.
+ * tpacket_stats_v3 is a superset of the V1/V2 layout, so one buffer
+ * serves both recvfrom sockets (freeze count stays 0) and V3 rings.
+ * Returns 0 on success, -1 on error.
+ */
+int af_packet_socket_stats(int sockfd, struct af_packet_stats *stats) {
+    struct tpacket_stats_v3 kstats;
+    socklen_t len = sizeof(kstats);
+
+    if (sockfd < 0 || !stats) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&kstats, 0, sizeof(kstats));
+    if (getsockopt(sockfd, SOL_PACKET, PACKET_STATISTICS, &kstats, &len) < 0) {
+        return -1;
+    }
+    // tp_packets counts every frame the filter accepted, including drops
+    stats->packets += kstats.tp_packets;
+    stats->drops += kstats.tp_drops;
+    if (len >= sizeof(kstats)) {
+        stats->freeze_q_cnt += kstats.tp_freeze_q_cnt;
+    }
     return 0;
 }
 
@@ -98,3 +256,391 @@ void af_packet_close(int sockfd) {
         close(sockfd);
     }
 }
+
+/*
+ * Open a TPACKET_V3 RX ring on interface.
+ * block_size must be a power of two and a multiple of the page size.
+ * Zero arguments select the AF_PACKET_RING_DEFAULT_* geometry.
+ * Returns ring handle on success, NULL on error (errno set).
+ */
+struct af_packet_ring *af_packet_ring_open(const char *interface, uint32_t block_size,
+                                           uint32_t block_count, uint32_t retire_timeout_ms) {
+    struct af_packet_ring *ring;
+    struct tpacket_req3 req;
+    int version = TPACKET_V3;
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    if (!interface) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (block_size == 0) {
+        block_size = AF_PACKET_RING_DEFAULT_BLOCK_SIZE;
+    }
+    if (block_count == 0) {
+        block_count = AF_PACKET_RING_DEFAULT_BLOCK_COUNT;
+    }
+    if (retire_timeout_ms == 0) {
+        retire_timeout_ms = AF_PACKET_RING_DEFAULT_RETIRE_MS;
+    }
+    if (page_size <= 0 || (block_size & (block_size - 1)) != 0 ||
+        block_size % (uint32_t)page_size != 0 || block_size < AF_PACKET_RING_FRAME_SIZE) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    ring = calloc(1, sizeof(*ring));
+    if (!ring) {
+        return NULL;
+    }
+    ring->map = MAP_FAILED;
+
+    ring->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (ring->fd < 0) {
+        free(ring);
+        return NULL;
+    }
+
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        goto fail;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = block_size;
+    req.tp_block_nr = block_count;
+    req.tp_frame_size = AF_PACKET_RING_FRAME_SIZE;
+    req.tp_frame_nr = (block_size / AF_PACKET_RING_FRAME_SIZE) * block_count;
+    req.tp_retire_blk_tov = retire_timeout_ms;
+    req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        goto fail;
+    }
+
+    ring->map_len = (size_t)block_size * block_count;
+    ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_LOCKED | MAP_POPULATE, ring->fd, 0);
+    if (ring->map == MAP_FAILED) {
+        // MAP_LOCKED needs RLIMIT_MEMLOCK headroom; fall back to pageable ring
+        ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, 0);
+        if (ring->map == MAP_FAILED) {
+            goto fail;
+        }
+    }
+
+    ring->block_size = block_size;
+    ring->block_count = block_count;
+
+    // Bind last so no frames are queued before the ring exists
+    if (af_packet_bind(ring->fd, interface) < 0) {
+        goto fail;
+    }
+    return ring;
+
+fail:
+    {
+        int saved_errno = errno;
+        af_packet_ring_close(ring);
+        errno = saved_errno;
+    }
+    return NULL;
+}
+
+int af_packet_ring_fd(const struct af_packet_ring *ring) {
+    return ring ? ring->fd : -1;
+}
+
+/*
+ * Acquire the next block from the kernel.
+ * Returns 1 when a block is held (frames can be walked), 0 on timeout,
+ * -1 on error (errno set). A block that is already held is returned again as-is.
+ */
+int af_packet_ring_next_block(struct af_packet_ring *ring, int timeout_ms) {
+    struct tpacket_block_desc *desc;
+    struct pollfd pfd;
+
+    if (!ring) {
+        return -1;
+    }
+    if (ring->block) {
+        return 1;
+    }
+
+    desc = (struct tpacket_block_desc *)(ring->map + (size_t)ring->current_block * ring->block_size);
+    while ((__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+        int rc;
+
+        pfd.fd = ring->fd;
+        pfd.events = POLLIN | POLLERR;
+        pfd.revents = 0;
+        rc = poll(&pfd, 1, timeout_ms);
+        if (rc == 0) {
+            return 0;
+        }
+        if (rc < 0) {
+            if (errno == EINTR) {
+                return 0;
+            }
+            return -1;
+        }
+        if (pfd.revents & POLLERR) {
+            int err = 0;
+            socklen_t err_len = sizeof(err);
+
+            // Reading SO_ERROR clears it, so the next poll() does not fire on it again
+            if (getsockopt(ring->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err == 0) {
+                err = EIO;
+            }
+            errno = err;
+            return -1;
+        }
+        // Retry once without blocking; poll() wakes on any ready block
+        timeout_ms = 0;
+    }
+
+    ring->block = desc;
+    ring->frames_left = desc->hdr.bh1.num_pkts;
+    ring->frame = (struct tpacket3_hdr *)((unsigned char *)desc + desc->hdr.bh1.offset_to_first_pkt);
+    return 1;
+}
+
+/*
+ * Hand out the next frame of the held block in place.
+ * The returned pointer stays valid until af_packet_ring_release_block().
+ * Returns 1 when a frame was produced, 0 when the block is exhausted,
+ * -1 when no block is held.
+ */
+int af_packet_ring_next_frame(struct af_packet_ring *ring, const unsigned char **out_data,
+                              uint32_t *out_caplen, uint32_t *out_wirelen,
+                              long *out_sec, long *out_nsec) {
+    struct tpacket3_hdr *hdr;
+
+    if (!ring || !ring->block || !out_data || !out_caplen) {
+        return -1;
+    }
+    if (ring->frames_left == 0) {
+        return 0;
+    }
+
+    hdr = ring->frame;
+    *out_data = (const unsigned char *)hdr + hdr->tp_mac;
+    *out_caplen = hdr->tp_snaplen;
+    if (out_wirelen) {
+        *out_wirelen = hdr->tp_len;
+    }
+    if (out_sec) {
+        *out_sec = (long)hdr->tp_sec;
+    }
+    if (out_nsec) {
+        *out_nsec = (long)hdr->tp_nsec;
+    }
+
+    ring->frames_left--;
+    if (ring->frames_left > 0) {
+        ring->frame = (struct tpacket3_hdr *)((unsigned char *)hdr + hdr->tp_next_offset);
+    }
+    return 1;
+}
+
+/*
+ * Copy the next frame of the held block into dst (at most dst_len bytes)
+ * and describe it. A VLAN tag stripped by the NIC/kernel is re-inserted so
+ * the copy matches the frame on the wire. desc->offset is left untouched.
+ * Returns 1 when a frame was copied, 0 when the block is exhausted,
+ * -1 when no block is held.
+ */
+int af_packet_ring_copy_frame(struct af_packet_ring *ring, unsigned char *dst, uint32_t dst_len,
+                              struct af_packet_frame_desc *desc) {
+    const struct tpacket3_hdr *hdr;
+    const struct sockaddr_ll *sll;
+    const unsigned char *mac;
+    uint32_t caplen;
+    uint32_t wirelen;
+    uint32_t copied;
+    uint32_t flags = 0;
+
+    if (!ring || !ring->block || !dst || !desc) {
+        return -1;
+    }
+    if (ring->frames_left == 0) {
+        return 0;
+    }
+
+    hdr = ring->frame;
+    mac = (const unsigned char *)hdr + hdr->tp_mac;
+    sll = (const struct sockaddr_ll *)((const unsigned char *)hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+    caplen = hdr->tp_snaplen;
+    wirelen = hdr->tp_len;
+
+    if ((hdr->tp_status & TP_STATUS_VLAN_VALID) && caplen >= 2 * ETH_ALEN && dst_len >= 2 * ETH_ALEN + 4) {
+        uint16_t tpid = (hdr->tp_status & TP_STATUS_VLAN_TPID_VALID) ? hdr->hv1.tp_vlan_tpid : ETH_P_8021Q;
+        uint16_t tci = hdr->hv1.tp_vlan_tci;
+        uint32_t rest = caplen - 2 * ETH_ALEN;
+
+        if (rest > dst_len - (2 * ETH_ALEN + 4)) {
+            rest = dst_len - (2 * ETH_ALEN + 4);
+        }
+        memcpy(dst, mac, 2 * ETH_ALEN);
+        dst[12] = (unsigned char)(tpid >> 8);
+        dst[13] = (unsigned char)(tpid & 0xff);
+        dst[14] = (unsigned char)(tci >> 8);
+        dst[15] = (unsigned char)(tci & 0xff);
+        memcpy(dst + 2 * ETH_ALEN + 4, mac + 2 * ETH_ALEN, rest);
+        copied = 2 * ETH_ALEN + 4 + rest;
+        wirelen += 4;
+        flags |= AF_PACKET_FRAME_VLAN_RESTORED;
+    } else {
+        copied = caplen < dst_len ? caplen : dst_len;
+        memcpy(dst, mac, copied);
+    }
+
+    if (copied < wirelen) {
+        flags |= AF_PACKET_FRAME_TRUNCATED;
+    }
+    if (hdr->tp_status & TP_STATUS_TS_RAW_HARDWARE) {
+        flags |= AF_PACKET_FRAME_TS_HARDWARE;
+    } else if (hdr->tp_status & TP_STATUS_TS_SOFTWARE) {
+        flags |= AF_PACKET_FRAME_TS_SOFTWARE;
+    }
+    if (sll->sll_pkttype == PACKET_OUTGOING) {
+        flags |= AF_PACKET_FRAME_OUTGOING;
+    }
+    desc->caplen = copied;
+    desc->wirelen = wirelen;
+    desc->flags = flags;
+    desc->ts_ns = (int64_t)hdr->tp_sec * 1000000000LL + (int64_t)hdr->tp_nsec;
+    desc->source = 0;
+    desc->reserved = 0;
+
+    ring->frames_left--;
+    if (ring->frames_left > 0) {
+        ring->frame = (struct tpacket3_hdr *)((unsigned char *)hdr + hdr->tp_next_offset);
+    }
+    return 1;
+}
+
+/*
+ * Read up to max_descs frames across as many ready blocks as needed,
+ * copying at most snaplen bytes of each frame into buffer.
+ * Only the first block wait may block (timeout_ms); fully walked blocks are
+ * released back to the kernel before returning.
+ * Returns number of frames described (0 on timeout), -1 on error
+ * (EINVAL when buffer_len < snaplen).
+ */
+int af_packet_read_batch(struct af_packet_ring *ring, int timeout_ms,
+                         unsigned char *buffer, uint32_t buffer_len, uint32_t snaplen,
+                         struct af_packet_frame_desc *descs, uint32_t max_descs) {
+    uint32_t count = 0;
+    uint32_t used = 0;
+
+    // A buffer that cannot hold one snaplen frame would read as a timeout forever
+    if (!ring || !buffer || !descs || snaplen == 0 || buffer_len < snaplen) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    while (count < max_descs && buffer_len - used >= snaplen) {
+        int rc;
+
+        if (!ring->block) {
+            rc = af_packet_ring_next_block(ring, count == 0 ? timeout_ms : 0);
+            if (rc < 0) {
+                return count > 0 ? (int)count : -1;
+            }
+            if (rc == 0) {
+                break;
+            }
+        }
+
+        rc = af_packet_ring_copy_frame(ring, buffer + used, snaplen, &descs[count]);
+        if (rc == 0) {
+            af_packet_ring_release_block(ring);
+            // Only keep going if the next block is already retired
+            timeout_ms = 0;
+            continue;
+        }
+        descs[count].offset = used;
+        used += descs[count].caplen;
+        count++;
+    }
+
+    // Never keep a fully walked block away from the kernel
+    if (ring->block && ring->frames_left == 0) {
+        af_packet_ring_release_block(ring);
+    }
+    return (int)count;
+}
+
+/*
+ * Return the held block to the kernel and advance to the next one.
+ */
+void af_packet_ring_release_block(struct af_packet_ring *ring) {
+    if (!ring || !ring->block) {
+        return;
+    }
+    __atomic_store_n(&ring->block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    ring->block = NULL;
+    ring->frame = NULL;
+    ring->frames_left = 0;
+    ring->current_block = (ring->current_block + 1) % ring->block_count;
+}
+
+/*
+ * Snapshot cumulative loss counters and current block occupancy.
+ * Safe to call from a thread other than the one walking the ring, as long
+ * as calls for one ring are not concurrent with each other.
+ * Returns 0 on success, -1 on error.
+ */
+int af_packet_ring_stats(struct af_packet_ring *ring, struct af_packet_stats *out) {
+    uint32_t in_use = 0;
+    uint32_t i;
+
+    if (!ring || !out) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (af_packet_socket_stats(ring->fd, &ring->stats) < 0) {
+        return -1;
+    }
+    for (i = 0; i < ring->block_count; i++) {
+        const struct tpacket_block_desc *desc =
+            (const struct tpacket_block_desc *)(ring->map + (size_t)i * ring->block_size);
+
+        if (__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) {
+            in_use++;
+        }
+    }
+    *out = ring->stats;
+    out->blocks_in_use = in_use;
+    out->block_count = ring->block_count;
+    return 0;
+}
+
+/*
+ * Join a PACKET_FANOUT group (PACKET_FANOUT_* type plus flags).
+ * Must be called after the ring is bound. Returns 0 on success, -1 on error.
+ */
+int af_packet_ring_join_fanout(struct af_packet_ring *ring, uint16_t group_id, uint16_t fanout_type) {
+    int arg;
+
+    if (!ring) {
+        errno = EINVAL;
+        return -1;
+    }
+    arg = (int)((uint32_t)group_id | ((uint32_t)fanout_type << 16));
+    return setsockopt(ring->fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg));
+}
+
+void af_packet_ring_close(struct af_packet_ring *ring) {
+    if (!ring) {
+        return;
+    }
+    if (ring->map != MAP_FAILED && ring->map != NULL) {
+        munmap(ring->map, ring->map_len);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    free(ring);
+}
@@ -0,0 +1,89 @@
+/*
+ * RansomEye DPI Advanced - AF_PACKET Capture
+ * AUTHORITATIVE: Public interface of the AF_PACKET capture backend
+ *
+ * NOTE:
+ * - All entry points use plain C types so they can be bound via ctypes.
+ * - Ring handles are opaque; callers never touch the mapped memory layout.
+ */
+
+#ifndef RANSOMEYE_AF_PACKET_CAPTURE_H
+#define RANSOMEYE_AF_PACKET_CAPTURE_H
+
+#include <stdint.h>
+
+/* Default TPACKET_V3 ring geometry (64 x 1 MiB blocks, 50 ms retire) */
+#define AF_PACKET_RING_DEFAULT_BLOCK_SIZE (1u << 20)
+#define AF_PACKET_RING_DEFAULT_BLOCK_COUNT 64u
+#define AF_PACKET_RING_DEFAULT_RETIRE_MS 50u
+
+/* Nominal frame size reported to the kernel (V3 packs frames variably) */
+#define AF_PACKET_RING_FRAME_SIZE 2048u
+
+/* Frame descriptor flags */
+#define AF_PACKET_FRAME_TRUNCATED 0x1u        /* caplen < wirelen */
+#define AF_PACKET_FRAME_OUTGOING 0x2u         /* Locally originated (PACKET_OUTGOING) */
+#define AF_PACKET_FRAME_VLAN_RESTORED 0x4u    /* Offloaded 802.1Q tag re-inserted */
+#define AF_PACKET_FRAME_TS_HARDWARE 0x8u      /* ts_ns is the NIC raw hardware stamp */
+#define AF_PACKET_FRAME_TS_SOFTWARE 0x10u     /* ts_ns is the kernel software RX stamp */
+
+/* Timestamp sources (requested and effective) */
+#define AF_PACKET_TS_SOURCE_USERSPACE 0       /* clock_gettime() at pickup */
+#define AF_PACKET_TS_SOURCE_SOFTWARE 1
+#define AF_PACKET_TS_SOURCE_HARDWARE 2
+
+struct af_packet_ring;
+
+/*
+ * Capture loss and ring occupancy, cumulative since the socket was opened.
+ * The kernel resets PACKET_STATISTICS on every read; these do not.
+ */
+struct af_packet_stats {
+    uint64_t packets;               /* tp_packets: frames that reached the socket */
+    uint64_t drops;                 /* tp_drops: frames lost for lack of ring/queue space */
+    uint64_t freeze_q_cnt;          /* tp_freeze_q_cnt: times a full V3 ring froze the queue */
+    uint32_t blocks_in_use;         /* Ring blocks currently owned by userspace */
+    uint32_t block_count;           /* 0 in recvfrom mode */
+};
+
+/*
+ * Batched frame descriptor (32 bytes, fixed layout for ctypes/struct).
+ * Frame bytes live in the caller buffer at [offset, offset + caplen).
+ */
+struct af_packet_frame_desc {
+    uint32_t offset;
+    uint32_t caplen;
+    uint32_t wirelen;
+    uint32_t flags;
+    int64_t ts_ns;
+    uint32_t source;        /* Worker or RX queue the frame came from */
+    uint32_t reserved;
+};
+
+/* Single-packet recvfrom() mode */
+int af_packet_open(const char *interface);
+int af_packet_read(int sockfd, unsigned char *buffer, int buffer_len, int *out_len, int *out_wirelen,
+                   long *out_sec, long *out_nsec);
+void af_packet_close(int sockfd);
+int af_packet_enable_timestamps(int sockfd, const char *interface, int requested_source);
+int af_packet_socket_stats(int sockfd, struct af_packet_stats *stats);
+
+/* TPACKET_V3 block-based PACKET_RX_RING mode */
+struct af_packet_ring *af_packet_ring_open(const char *interface, uint32_t block_size,
+                                           uint32_t block_count, uint32_t retire_timeout_ms);
+int af_packet_ring_fd(const struct af_packet_ring *ring);
+int af_packet_ring_next_block(struct af_packet_ring *ring, int timeout_ms);
+int af_packet_ring_next_frame(struct af_packet_ring *ring, const unsigned char **out_data,
+                              uint32_t *out_caplen, uint32_t *out_wirelen,
+                              long *out_sec, long *out_nsec);
+void af_packet_ring_release_block(struct af_packet_ring *ring);
+int af_packet_ring_copy_frame(struct af_packet_ring *ring, unsigned char *dst, uint32_t dst_len,
+                              struct af_packet_frame_desc *desc);
+int af_packet_read_batch(struct af_packet_ring *ring, int timeout_ms,
+                         unsigned char *buffer, uint32_t buffer_len, uint32_t snaplen,
+                         struct af_packet_frame_desc *descs, uint32_t max_descs);
+int af_packet_ring_stats(struct af_packet_ring *ring, struct af_packet_stats *out);
+int af_packet_ring_join_fanout(struct af_packet_ring *ring, uint16_t group_id, uint16_t fanout_type);
+void af_packet_ring_close(struct af_packet_ring *ring);
+
+#endif /* RANSOMEYE_AF_PACKET_CAPTURE_H */
@@ -0,0 +1,419 @@
+/*
+ * RansomEye DPI Advanced - Benchmark Driver
+ * AUTHORITATIVE: Native traffic source and cycle counter for fastpath benchmarks
+ *
+ * NOTE:
+ * - Frames go out through an AF_PACKET socket with PACKET_QDISC_BYPASS in
+ *   sendmmsg() batches of BENCH_TX_BATCH. The socket binds protocol 0, so
+ *   it never receives (and never competes with) the captured traffic.
+ * - Synthetic frames are IPv4/UDP; only the headers are rewritten per
+ *   frame, payload bytes are whatever the slot last held.
+ * - Rate limiting follows a fixed schedule (frame n is due at n / rate),
+ *   so a late batch is caught up rather than shifting every later frame.
+ */
+
+#define _GNU_SOURCE
+
+#include "bench_driver.h"
+#include "pcap_replay.h"
+
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/perf_event.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+#define BENCH_TX_SLOT_LEN 2048u
+
+/* Largest frame taken from a pcap file; longer records are sent truncated */
+#define BENCH_TX_PCAP_SNAPLEN 9216u
+
+#define NSEC_PER_SEC 1000000000ULL
+
+struct bench_tx {
+    int fd;
+    struct bench_tx_config config;
+    uint32_t frame_sizes[BENCH_TX_MAX_SIZES];
+    struct pcap_replay *replay;
+
+    unsigned char *slots;           /* BENCH_TX_BATCH frames of BENCH_TX_SLOT_LEN (synthetic) */
+    unsigned char *pcap_buffer;     /* BENCH_TX_BATCH frames of BENCH_TX_PCAP_SNAPLEN (pcap) */
+    struct af_packet_frame_desc pcap_descs[BENCH_TX_BATCH];
+    struct mmsghdr msgs[BENCH_TX_BATCH];
+    struct iovec iovs[BENCH_TX_BATCH];
+
+    pthread_t thread;
+    int started;
+    int running;
+    int stop;
+
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t cpu_ns;                /* Set when the sender thread exits */
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t thread_cpu_ns(clockid_t clock) {
+    struct timespec ts;
+
+    if (clock_gettime(clock, &ts) != 0) {
+        return 0;
+    }
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+static uint16_t ipv4_checksum(const unsigned char *header) {
+    uint32_t sum = 0;
+    uint32_t i;
+
+    for (i = 0; i < 20; i += 2) {
+        sum += (uint32_t)((header[i] << 8) | header[i + 1]);
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+/* Write Ethernet/IPv4/UDP headers for synthetic frame seq into slot */
+static uint32_t bench_tx_build_frame(const struct bench_tx *tx, unsigned char *slot, uint64_t seq) {
+    static const unsigned char dst_mac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+    static const unsigned char src_mac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+    uint32_t frame_len = tx->frame_sizes[seq % tx->config.frame_size_count];
+    uint32_t flow = (uint32_t)(seq % tx->config.flows);
+    uint32_t src_ip = 0x0A010000u + flow / 60000u;
+    uint16_t src_port = (uint16_t)(1024u + flow % 60000u);
+    unsigned char *ip = slot + ETH_HLEN;
+    unsigned char *udp = ip + 20;
+    uint16_t ip_len = (uint16_t)(frame_len - ETH_HLEN);
+    uint16_t udp_len = (uint16_t)(ip_len - 20);
+    uint16_t checksum;
+
+    memcpy(slot, dst_mac, 6);
+    memcpy(slot + 6, src_mac, 6);
+    slot[12] = 0x08;
+    slot[13] = 0x00;
+
+    memset(ip, 0, 20);
+    ip[0] = 0x45;
+    ip[2] = (unsigned char)(ip_len >> 8);
+    ip[3] = (unsigned char)ip_len;
+    ip[8] = 64;
+    ip[9] = IPPROTO_UDP;
+    ip[12] = (unsigned char)(src_ip >> 24);
+    ip[13] = (unsigned char)(src_ip >> 16);
+    ip[14] = (unsigned char)(src_ip >> 8);
+    ip[15] = (unsigned char)src_ip;
+    ip[16] = 10;
+    ip[17] = 2;
+    ip[18] = 0;
+    ip[19] = 1;
+    checksum = ipv4_checksum(ip);
+    ip[10] = (unsigned char)(checksum >> 8);
+    ip[11] = (unsigned char)checksum;
+
+    udp[0] = (unsigned char)(src_port >> 8);
+    udp[1] = (unsigned char)src_port;
+    udp[2] = 0x13;                  /* 5000 */
+    udp[3] = 0x88;
+    udp[4] = (unsigned char)(udp_len >> 8);
+    udp[5] = (unsigned char)udp_len;
+    udp[6] = 0;
+    udp[7] = 0;
+    return frame_len;
+}
+
+/* Stage up to want frames in tx->iovs. Returns frames staged, 0 when the source is exhausted */
+static uint32_t bench_tx_fill(struct bench_tx *tx, uint64_t seq, uint32_t want) {
+    uint32_t i;
+
+    if (!tx->replay) {
+        for (i = 0; i < want; i++) {
+            unsigned char *slot = tx->slots + (size_t)i * BENCH_TX_SLOT_LEN;
+
+            tx->iovs[i].iov_base = slot;
+            tx->iovs[i].iov_len = bench_tx_build_frame(tx, slot, seq + i);
+        }
+        return want;
+    }
+
+    for (;;) {
+        struct pcap_replay_stats replay_stats;
+        int count = pcap_replay_read_batch(tx->replay, 0, tx->pcap_buffer,
+                                           BENCH_TX_BATCH * BENCH_TX_PCAP_SNAPLEN, BENCH_TX_PCAP_SNAPLEN,
+                                           tx->pcap_descs, want);
+
+        if (count > 0) {
+            for (i = 0; i < (uint32_t)count; i++) {
+                tx->iovs[i].iov_base = tx->pcap_buffer + tx->pcap_descs[i].offset;
+                tx->iovs[i].iov_len = tx->pcap_descs[i].caplen;
+            }
+            return (uint32_t)count;
+        }
+        if (count < 0 || pcap_replay_stats(tx->replay, &replay_stats) != 0 || replay_stats.finished) {
+            return 0;
+        }
+    }
+}
+
+static void *bench_tx_main(void *arg) {
+    struct bench_tx *tx = arg;
+    uint64_t start = monotonic_ns();
+    uint64_t seq = 0;
+
+    if (tx->config.cpu >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(tx->config.cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    while (!__atomic_load_n(&tx->stop, __ATOMIC_ACQUIRE)) {
+        uint64_t want = BENCH_TX_BATCH;
+        uint32_t staged;
+        uint32_t i;
+        int sent;
+
+        if (tx->config.packets) {
+            if (seq >= tx->config.packets) {
+                break;
+            }
+            if (tx->config.packets - seq < want) {
+                want = tx->config.packets - seq;
+            }
+        }
+        if (tx->config.rate_pps) {
+            // Frames due by now on the fixed schedule, sleeping until the next one if none are
+            uint64_t elapsed = monotonic_ns() - start;
+            uint64_t due = (uint64_t)(((unsigned __int128)elapsed * tx->config.rate_pps) / NSEC_PER_SEC) + 1;
+
+            if (due <= seq) {
+                uint64_t next = start + (uint64_t)(((unsigned __int128)seq * NSEC_PER_SEC) / tx->config.rate_pps);
+                struct timespec ts = {(time_t)(next / NSEC_PER_SEC), (long)(next % NSEC_PER_SEC)};
+
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+                continue;
+            }
+            if (due - seq < want) {
+                want = due - seq;
+            }
+        }
+
+        staged = bench_tx_fill(tx, seq, (uint32_t)want);
+        if (staged == 0) {
+            break;
+        }
+        for (i = 0; i < staged; i++) {
+            memset(&tx->msgs[i], 0, sizeof(tx->msgs[i]));
+            tx->msgs[i].msg_hdr.msg_iov = &tx->iovs[i];
+            tx->msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        i = 0;
+        while (i < staged) {
+            sent = sendmmsg(tx->fd, &tx->msgs[i], staged - i, 0);
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                // The frame at the head of the batch was refused; skip it
+                __atomic_store_n(&tx->errors, tx->errors + 1, __ATOMIC_RELAXED);
+                i++;
+                continue;
+            }
+            for (; sent > 0; sent--, i++) {
+                __atomic_store_n(&tx->packets, tx->packets + 1, __ATOMIC_RELAXED);
+                __atomic_store_n(&tx->bytes, tx->bytes + tx->iovs[i].iov_len, __ATOMIC_RELAXED);
+            }
+        }
+        seq += staged;
+    }
+
+    __atomic_store_n(&tx->cpu_ns, thread_cpu_ns(CLOCK_THREAD_CPUTIME_ID), __ATOMIC_RELAXED);
+    __atomic_store_n(&tx->running, 0, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/*
+ * Open a sender bound to config->interface.
+ * Returns sender handle on success, NULL on error (errno set).
+ */
+struct bench_tx *bench_tx_open(const struct bench_tx_config *config) {
+    struct bench_tx *tx;
+    struct sockaddr_ll sll;
+    struct ifreq ifr;
+    int one = 1;
+    int sndbuf = 4 * 1024 * 1024;
+    uint32_t i;
+
+    if (!config || !config->interface || (!config->pcap_path &&
+        (config->frame_size_count == 0 || config->frame_size_count > BENCH_TX_MAX_SIZES || !config->frame_sizes))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!config->pcap_path) {
+        for (i = 0; i < config->frame_size_count; i++) {
+            if (config->frame_sizes[i] < BENCH_TX_MIN_FRAME || config->frame_sizes[i] > BENCH_TX_MAX_FRAME) {
+                errno = EINVAL;
+                return NULL;
+            }
+        }
+    }
+
+    tx = calloc(1, sizeof(*tx));
+    if (!tx) {
+        return NULL;
+    }
+    tx->fd = -1;
+    tx->config = *config;
+    tx->config.pcap_path = NULL;
+    if (tx->config.flows == 0) {
+        tx->config.flows = 1;
+    }
+    if (!config->pcap_path) {
+        memcpy(tx->frame_sizes, config->frame_sizes, config->frame_size_count * sizeof(uint32_t));
+        tx->config.frame_sizes = tx->frame_sizes;
+        tx->slots = calloc(BENCH_TX_BATCH, BENCH_TX_SLOT_LEN);
+        if (!tx->slots) {
+            goto fail;
+        }
+    } else {
+        // Loop the file until packets (or stop) ends the run
+        struct pcap_replay_config replay_config = {config->pcap_path, PCAP_REPLAY_PACE_UNTHROTTLED, 0, 0};
+
+        tx->replay = pcap_replay_open(&replay_config);
+        tx->pcap_buffer = malloc((size_t)BENCH_TX_BATCH * BENCH_TX_PCAP_SNAPLEN);
+        if (!tx->replay || !tx->pcap_buffer) {
+            goto fail;
+        }
+    }
+
+    tx->fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (tx->fd < 0) {
+        goto fail;
+    }
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, config->interface, IFNAMSIZ - 1);
+    if (ioctl(tx->fd, SIOCGIFINDEX, &ifr) < 0) {
+        goto fail;
+    }
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_ifindex = ifr.ifr_ifindex;
+    if (bind(tx->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+        goto fail;
+    }
+    // Best effort: both only shorten the TX path
+    setsockopt(tx->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+    setsockopt(tx->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    return tx;
+
+fail:
+    {
+        int saved_errno = errno;
+        bench_tx_close(tx);
+        errno = saved_errno;
+    }
+    return NULL;
+}
+
+int bench_tx_start(struct bench_tx *tx) {
+    int rc;
+
+    if (!tx || tx->started) {
+        errno = EINVAL;
+        return -1;
+    }
+    __atomic_store_n(&tx->running, 1, __ATOMIC_RELEASE);
+    rc = pthread_create(&tx->thread, NULL, bench_tx_main, tx);
+    if (rc != 0) {
+        __atomic_store_n(&tx->running, 0, __ATOMIC_RELEASE);
+        errno = rc;
+        return -1;
+    }
+    tx->started = 1;
+    return 0;
+}
+
+/* Stop the sender and wait for it; counters stay readable afterwards */
+int bench_tx_stop(struct bench_tx *tx) {
+    if (!tx) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (tx->started) {
+        __atomic_store_n(&tx->stop, 1, __ATOMIC_RELEASE);
+        pthread_join(tx->thread, NULL);
+        tx->started = 0;
+    }
+    return 0;
+}
+
+int bench_tx_stats(struct bench_tx *tx, struct bench_tx_stats *out) {
+    if (!tx || !out) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(out, 0, sizeof(*out));
+    out->packets = __atomic_load_n(&tx->packets, __ATOMIC_RELAXED);
+    out->bytes = __atomic_load_n(&tx->bytes, __ATOMIC_RELAXED);
+    out->errors = __atomic_load_n(&tx->errors, __ATOMIC_RELAXED);
+    out->running = __atomic_load_n(&tx->running, __ATOMIC_ACQUIRE);
+    if (out->running && tx->started) {
+        clockid_t clock;
+
+        out->cpu_ns = pthread_getcpuclockid(tx->thread, &clock) == 0 ? thread_cpu_ns(clock) : 0;
+    } else {
+        out->cpu_ns = __atomic_load_n(&tx->cpu_ns, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+void bench_tx_close(struct bench_tx *tx) {
+    if (!tx) {
+        return;
+    }
+    bench_tx_stop(tx);
+    if (tx->fd >= 0) {
+        close(tx->fd);
+    }
+    pcap_replay_close(tx->replay);
+    free(tx->pcap_buffer);
+    free(tx->slots);
+    free(tx);
+}
+
+/*
+ * Open a perf counter of CPU cycles spent by the calling thread (user and
+ * kernel). Read it as a native-endian uint64 with read(2).
+ * Returns the counter fd, -1 when hardware counters are unavailable
+ * (virtual machines, perf_event_paranoid).
+ */
+int bench_cycle_counter_open(void) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
@@ -0,0 +1,54 @@
+/*
+ * RansomEye DPI Advanced - Benchmark Driver
+ * AUTHORITATIVE: Native traffic source and cycle counter for fastpath benchmarks
+ *
+ * NOTE:
+ * - The sender transmits synthetic UDP frames (or a pcap/pcapng file) on
+ *   one end of a veth pair from its own thread, so the capture side sees
+ *   real kernel RX traffic rather than an in-process shortcut.
+ * - Benchmark use only; not part of the installed probe library.
+ */
+
+#ifndef RANSOMEYE_BENCH_DRIVER_H
+#define RANSOMEYE_BENCH_DRIVER_H
+
+#include <stdint.h>
+
+#define BENCH_TX_MAX_SIZES 16u
+#define BENCH_TX_BATCH 64u
+
+/* Synthetic frame length bounds (Ethernet header to end of payload, no FCS) */
+#define BENCH_TX_MIN_FRAME 60u
+#define BENCH_TX_MAX_FRAME 1514u
+
+struct bench_tx;
+
+struct bench_tx_config {
+    const char *interface;
+    const char *pcap_path;          /* Send this file's frames instead of synthetic ones, NULL for synthetic */
+    const uint32_t *frame_sizes;    /* Synthetic frame lengths, sent in this repeating order */
+    uint32_t frame_size_count;
+    uint32_t flows;                 /* Distinct synthetic 5-tuples, 0 selects 1 */
+    uint64_t rate_pps;              /* 0 sends as fast as the interface accepts */
+    uint64_t packets;               /* Stop after this many frames, 0 runs until stopped */
+    int cpu;                        /* Pin the sender thread, -1 leaves it unpinned */
+};
+
+struct bench_tx_stats {
+    uint64_t packets;               /* Frames accepted by the interface */
+    uint64_t bytes;
+    uint64_t errors;                /* Frames the interface refused (ENOBUFS and friends) */
+    uint64_t cpu_ns;                /* CPU time of the sender thread */
+    uint32_t running;
+    uint32_t reserved;
+};
+
+struct bench_tx *bench_tx_open(const struct bench_tx_config *config);
+int bench_tx_start(struct bench_tx *tx);
+int bench_tx_stop(struct bench_tx *tx);
+int bench_tx_stats(struct bench_tx *tx, struct bench_tx_stats *out);
+void bench_tx_close(struct bench_tx *tx);
+
+int bench_cycle_counter_open(void);
+
+#endif /* RANSOMEYE_BENCH_DRIVER_H */
@@ -0,0 +1,544 @@
+/*
+ * RansomEye DPI Advanced - Capture Engine
+ * AUTHORITATIVE: PACKET_FANOUT multi-worker capture with per-core pinned threads
+ *
+ * NOTE:
+ * - Workers are producers, the DPI runtime is the single consumer.
+ * - Queue slots are preallocated at open time; no allocation on the hot path.
+ * - The consumer sleeps on an eventfd that workers only signal when it is
+ *   actually waiting, so the steady state is syscall-free on both sides.
+ */
+
+#define _GNU_SOURCE
+
+#include "capture_engine.h"
+#include "af_packet_capture.h"
+#include "capture_filter.h"
+
+#include <linux/if_packet.h>
+#include <sys/eventfd.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+struct capture_slot {
+    struct af_packet_frame_desc desc;
+    unsigned char data[CAPTURE_ENGINE_SLOT_SNAPLEN];
+};
+
+struct capture_worker {
+    struct capture_engine *engine;
+    struct af_packet_ring *ring;
+    pthread_t thread;
+    int thread_started;
+    int cpu;
+    uint32_t index;
+
+    /* SPSC queue: head written by the worker, tail by the consumer */
+    struct capture_slot *slots;
+    uint32_t mask;
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t tail __attribute__((aligned(64)));
+
+    /* Worker-owned counters (read by the consumer without locking) */
+    uint64_t packets __attribute__((aligned(64)));
+    uint64_t queue_drops;
+    uint64_t ring_errors;
+    int last_error;
+    uint32_t state;
+    int backoff_ms;
+    int link_down;
+};
+
+struct capture_engine {
+    struct capture_worker workers[CAPTURE_ENGINE_MAX_WORKERS];
+    uint32_t worker_count;
+    uint32_t next_worker;
+    int running;
+    int consumer_waiting;
+    int wake_fd;
+    int timestamp_source;
+    unsigned int ifindex;
+    char interface[IF_NAMESIZE];
+};
+
+/* Ring error back-off bounds */
+#define CAPTURE_WORKER_BACKOFF_MIN_MS 10
+#define CAPTURE_WORKER_BACKOFF_MAX_MS 1000
+
+static uint16_t capture_engine_fanout_type(int mode) {
+    switch (mode) {
+    case CAPTURE_FANOUT_MODE_CPU:
+        return PACKET_FANOUT_CPU;
+    case CAPTURE_FANOUT_MODE_ROLLOVER:
+        return PACKET_FANOUT_ROLLOVER;
+    case CAPTURE_FANOUT_MODE_HASH:
+    default:
+        // Defragment so every fragment of a datagram hashes to one worker
+        return PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG;
+    }
+}
+
+static void capture_engine_wake_consumer(struct capture_engine *engine) {
+    uint64_t one = 1;
+
+    if (__atomic_exchange_n(&engine->consumer_waiting, 0, __ATOMIC_ACQ_REL)) {
+        ssize_t ignored = write(engine->wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+/*
+ * Errors a ring cannot recover from. A down link comes back on its own, but a
+ * packet socket whose device was unregistered (even if a namesake reappears)
+ * stays unbound and only ever reports ENETDOWN.
+ */
+static int capture_worker_error_is_fatal(const struct capture_engine *engine, int err) {
+    switch (err) {
+    case ENODEV:
+    case ENXIO:
+    case EBADF:
+    case EINVAL:
+        return 1;
+    case ENETDOWN:
+        return if_nametoindex(engine->interface) != engine->ifindex;
+    default:
+        return 0;
+    }
+}
+
+static void capture_worker_stop(struct capture_worker *worker) {
+    __atomic_store_n(&worker->state, CAPTURE_WORKER_STATE_FAILED, __ATOMIC_RELEASE);
+    // Let a sleeping consumer notice the failure instead of waiting out its timeout
+    capture_engine_wake_consumer(worker->engine);
+}
+
+/*
+ * Account a failed af_packet_ring_next_block().
+ * Returns 0 after backing off on a transient error, -1 when the worker must stop.
+ */
+static int capture_worker_ring_error(struct capture_worker *worker, int err) {
+    __atomic_store_n(&worker->ring_errors, worker->ring_errors + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&worker->last_error, err, __ATOMIC_RELAXED);
+    if (capture_worker_error_is_fatal(worker->engine, err)) {
+        capture_worker_stop(worker);
+        return -1;
+    }
+    worker->link_down = err == ENETDOWN;
+
+    worker->backoff_ms = worker->backoff_ms ? worker->backoff_ms * 2 : CAPTURE_WORKER_BACKOFF_MIN_MS;
+    if (worker->backoff_ms > CAPTURE_WORKER_BACKOFF_MAX_MS) {
+        worker->backoff_ms = CAPTURE_WORKER_BACKOFF_MAX_MS;
+    }
+    poll(NULL, 0, worker->backoff_ms);
+    return 0;
+}
+
+/*
+ * Errno of the first failed worker once every worker has stopped, 0 otherwise.
+ */
+static int capture_engine_failed(const struct capture_engine *engine) {
+    uint32_t i;
+
+    for (i = 0; i < engine->worker_count; i++) {
+        if (__atomic_load_n(&engine->workers[i].state, __ATOMIC_ACQUIRE) != CAPTURE_WORKER_STATE_FAILED) {
+            return 0;
+        }
+    }
+    return engine->worker_count ? __atomic_load_n(&engine->workers[0].last_error, __ATOMIC_RELAXED) : 0;
+}
+
+static void *capture_worker_main(void *arg) {
+    struct capture_worker *worker = arg;
+    struct capture_engine *engine = worker->engine;
+
+    if (worker->cpu >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(worker->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    while (__atomic_load_n(&engine->running, __ATOMIC_ACQUIRE)) {
+        int produced = 0;
+        int rc = af_packet_ring_next_block(worker->ring, 100);
+
+        if (rc < 0) {
+            if (capture_worker_ring_error(worker, errno) < 0) {
+                break;
+            }
+            continue;
+        }
+        if (rc == 0) {
+            // A device removed while its link was down raises no further error
+            if (worker->link_down && capture_worker_error_is_fatal(engine, ENETDOWN)) {
+                capture_worker_stop(worker);
+                break;
+            }
+            continue;
+        }
+        worker->backoff_ms = 0;
+        worker->link_down = 0;
+
+        for (;;) {
+            uint32_t head = worker->head;
+            uint32_t tail = __atomic_load_n(&worker->tail, __ATOMIC_ACQUIRE);
+            struct capture_slot *slot = &worker->slots[head & worker->mask];
+
+            if (head - tail > worker->mask) {
+                // Queue full: step over the frame without copying it
+                const unsigned char *data;
+                uint32_t caplen;
+
+                if (af_packet_ring_next_frame(worker->ring, &data, &caplen, NULL, NULL, NULL) != 1) {
+                    break;
+                }
+                __atomic_store_n(&worker->packets, worker->packets + 1, __ATOMIC_RELAXED);
+                __atomic_store_n(&worker->queue_drops, worker->queue_drops + 1, __ATOMIC_RELAXED);
+                continue;
+            }
+
+            if (af_packet_ring_copy_frame(worker->ring, slot->data, CAPTURE_ENGINE_SLOT_SNAPLEN, &slot->desc) != 1) {
+                break;
+            }
+            slot->desc.offset = 0;
+            slot->desc.source = worker->index;
+            __atomic_store_n(&worker->packets, worker->packets + 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&worker->head, head + 1, __ATOMIC_RELEASE);
+            produced = 1;
+        }
+        af_packet_ring_release_block(worker->ring);
+
+        if (produced) {
+            capture_engine_wake_consumer(engine);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Open one fanout ring per worker.
+ * Returns engine handle on success, NULL on error (errno set).
+ */
+struct capture_engine *capture_engine_open(const struct capture_engine_config *config) {
+    struct capture_engine *engine;
+    uint32_t queue_slots;
+    uint16_t group_id;
+    uint16_t fanout_type;
+    uint32_t i;
+
+    if (!config || !config->interface || config->workers == 0 ||
+        config->workers > CAPTURE_ENGINE_MAX_WORKERS) {
+        errno = EINVAL;
+        return NULL;
+    }
+    queue_slots = config->queue_slots ? config->queue_slots : CAPTURE_ENGINE_DEFAULT_QUEUE_SLOTS;
+    if ((queue_slots & (queue_slots - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    engine = calloc(1, sizeof(*engine));
+    if (!engine) {
+        return NULL;
+    }
+    engine->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (engine->wake_fd < 0) {
+        free(engine);
+        return NULL;
+    }
+
+    engine->timestamp_source = config->timestamp_source;
+    strncpy(engine->interface, config->interface, sizeof(engine->interface) - 1);
+    engine->ifindex = if_nametoindex(config->interface);
+    group_id = config->fanout_group_id ? config->fanout_group_id : (uint16_t)(getpid() & 0xffff);
+    fanout_type = capture_engine_fanout_type(config->fanout_mode);
+
+    for (i = 0; i < config->workers; i++) {
+        struct capture_worker *worker = &engine->workers[i];
+
+        engine->worker_count = i + 1;
+        worker->engine = engine;
+        worker->index = i;
+        worker->cpu = config->worker_cpus ? config->worker_cpus[i] : -1;
+        worker->mask = queue_slots - 1;
+        worker->slots = calloc(queue_slots, sizeof(struct capture_slot));
+        if (!worker->slots) {
+            goto fail;
+        }
+        worker->ring = af_packet_ring_open(config->interface, config->ring_block_size,
+                                           config->ring_block_count, config->ring_retire_timeout_ms);
+        if (!worker->ring) {
+            goto fail;
+        }
+        if (config->timestamp_source != AF_PACKET_TS_SOURCE_USERSPACE) {
+            int effective = af_packet_enable_timestamps(af_packet_ring_fd(worker->ring), config->interface,
+                                                        config->timestamp_source);
+
+            if (effective < 0) {
+                goto fail;
+            }
+            // The engine reports the weakest source any worker ended up with
+            if (effective < engine->timestamp_source) {
+                engine->timestamp_source = effective;
+            }
+        }
+        // Fanout picks the member before its filter runs, so every ring needs one
+        if (config->filter &&
+            capture_filter_attach(af_packet_ring_fd(worker->ring), config->filter, config->filter_len) < 0) {
+            goto fail;
+        }
+        if (af_packet_ring_join_fanout(worker->ring, group_id, fanout_type) < 0) {
+            goto fail;
+        }
+    }
+    return engine;
+
+fail:
+    {
+        int saved_errno = errno;
+        capture_engine_close(engine);
+        errno = saved_errno;
+    }
+    return NULL;
+}
+
+/*
+ * Start all worker threads. Returns 0 on success, -1 on error.
+ */
+int capture_engine_start(struct capture_engine *engine) {
+    uint32_t i;
+
+    if (!engine) {
+        errno = EINVAL;
+        return -1;
+    }
+    __atomic_store_n(&engine->running, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < engine->worker_count; i++) {
+        struct capture_worker *worker = &engine->workers[i];
+        int rc = pthread_create(&worker->thread, NULL, capture_worker_main, worker);
+
+        if (rc != 0) {
+            errno = rc;
+            return -1;
+        }
+        worker->thread_started = 1;
+    }
+    return 0;
+}
+
+/*
+ * Move up to max_descs queued frames into buffer, round-robin across workers.
+ * Returns number of frames moved.
+ */
+static uint32_t capture_engine_pop(struct capture_engine *engine, unsigned char *buffer, uint32_t buffer_len,
+                                   struct af_packet_frame_desc *descs, uint32_t max_descs) {
+    uint32_t count = 0;
+    uint32_t used = 0;
+    uint32_t idle = 0;
+
+    while (count < max_descs && idle < engine->worker_count) {
+        uint32_t index = engine->next_worker;
+        struct capture_worker *worker = &engine->workers[index];
+        uint32_t tail = worker->tail;
+        uint32_t head = __atomic_load_n(&worker->head, __ATOMIC_ACQUIRE);
+        const struct capture_slot *slot;
+        uint32_t copy_len;
+
+        engine->next_worker = (index + 1) % engine->worker_count;
+        if (head == tail) {
+            idle++;
+            continue;
+        }
+
+        slot = &worker->slots[tail & worker->mask];
+        copy_len = slot->desc.caplen;
+        if (copy_len > buffer_len - used) {
+            // Out of buffer space; revisit this worker first next call
+            engine->next_worker = index;
+            break;
+        }
+        memcpy(buffer + used, slot->data, copy_len);
+        descs[count] = slot->desc;
+        descs[count].offset = used;
+        used += copy_len;
+        count++;
+        idle = 0;
+        __atomic_store_n(&worker->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    return count;
+}
+
+/*
+ * Wait until at least one worker queue is non-empty or timeout expires.
+ */
+static void capture_engine_wait(struct capture_engine *engine, int timeout_ms) {
+    struct pollfd pfd;
+    uint64_t drained;
+    uint32_t i;
+    int rc;
+
+    // Announce the wait, then re-check to close the race with a producer
+    __atomic_store_n(&engine->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+    for (i = 0; i < engine->worker_count; i++) {
+        const struct capture_worker *worker = &engine->workers[i];
+
+        if (__atomic_load_n(&worker->head, __ATOMIC_ACQUIRE) != worker->tail) {
+            __atomic_store_n(&engine->consumer_waiting, 0, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+
+    pfd.fd = engine->wake_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    rc = poll(&pfd, 1, timeout_ms);
+    __atomic_store_n(&engine->consumer_waiting, 0, __ATOMIC_RELEASE);
+    if (rc > 0) {
+        ssize_t ignored = read(engine->wake_fd, &drained, sizeof(drained));
+        (void)ignored;
+    }
+}
+
+/*
+ * Read one frame from any worker queue (round-robin across workers).
+ * Returns 1 when a frame was copied, 0 on timeout, -1 on error
+ * (including every worker having stopped on a fatal ring error; errno set).
+ */
+int capture_engine_read(struct capture_engine *engine, int timeout_ms,
+                        unsigned char *buffer, uint32_t buffer_len,
+                        uint32_t *out_caplen, uint32_t *out_wirelen,
+                        long *out_sec, long *out_nsec, uint32_t *out_worker) {
+    struct af_packet_frame_desc desc;
+    uint32_t count;
+
+    if (!engine || !buffer || buffer_len < CAPTURE_ENGINE_SLOT_SNAPLEN || !out_caplen) {
+        return -1;
+    }
+
+    count = capture_engine_pop(engine, buffer, buffer_len, &desc, 1);
+    if (count == 0) {
+        capture_engine_wait(engine, timeout_ms);
+        count = capture_engine_pop(engine, buffer, buffer_len, &desc, 1);
+    }
+    if (count == 0) {
+        int err = capture_engine_failed(engine);
+
+        if (err) {
+            errno = err;
+            return -1;
+        }
+        return 0;
+    }
+
+    *out_caplen = desc.caplen;
+    if (out_wirelen) {
+        *out_wirelen = desc.wirelen;
+    }
+    if (out_sec) {
+        *out_sec = (long)(desc.ts_ns / 1000000000LL);
+    }
+    if (out_nsec) {
+        *out_nsec = (long)(desc.ts_ns % 1000000000LL);
+    }
+    if (out_worker) {
+        *out_worker = desc.source;
+    }
+    return 1;
+}
+
+/*
+ * Read up to max_descs frames from the worker queues in one call.
+ * buffer must hold at least CAPTURE_ENGINE_SLOT_SNAPLEN bytes.
+ * Returns number of frames described (0 on timeout), -1 on error
+ * (including every worker having stopped on a fatal ring error; errno set).
+ */
+int capture_engine_read_batch(struct capture_engine *engine, int timeout_ms,
+                              unsigned char *buffer, uint32_t buffer_len,
+                              struct af_packet_frame_desc *descs, uint32_t max_descs) {
+    uint32_t count;
+
+    if (!engine || !buffer || buffer_len < CAPTURE_ENGINE_SLOT_SNAPLEN || !descs || max_descs == 0) {
+        return -1;
+    }
+
+    count = capture_engine_pop(engine, buffer, buffer_len, descs, max_descs);
+    if (count == 0) {
+        capture_engine_wait(engine, timeout_ms);
+        count = capture_engine_pop(engine, buffer, buffer_len, descs, max_descs);
+    }
+    if (count == 0) {
+        int err = capture_engine_failed(engine);
+
+        if (err) {
+            errno = err;
+            return -1;
+        }
+    }
+    return (int)count;
+}
+
+uint32_t capture_engine_worker_count(const struct capture_engine *engine) {
+    return engine ? engine->worker_count : 0;
+}
+
+int capture_engine_timestamp_source(const struct capture_engine *engine) {
+    return engine ? engine->timestamp_source : -1;
+}
+
+/*
+ * Fill one stats entry per worker (call from the consumer thread).
+ * Returns number of entries written, -1 on error.
+ */
+int capture_engine_stats(struct capture_engine *engine, struct capture_worker_stats *out, uint32_t max_workers) {
+    uint32_t count;
+    uint32_t i;
+
+    if (!engine || !out) {
+        errno = EINVAL;
+        return -1;
+    }
+    count = engine->worker_count < max_workers ? engine->worker_count : max_workers;
+    for (i = 0; i < count; i++) {
+        struct capture_worker *worker = &engine->workers[i];
+
+        memset(&out[i], 0, sizeof(out[i]));
+        out[i].packets = __atomic_load_n(&worker->packets, __ATOMIC_RELAXED);
+        out[i].queue_drops = __atomic_load_n(&worker->queue_drops, __ATOMIC_RELAXED);
+        out[i].ring_errors = __atomic_load_n(&worker->ring_errors, __ATOMIC_RELAXED);
+        out[i].last_error = __atomic_load_n(&worker->last_error, __ATOMIC_RELAXED);
+        out[i].state = __atomic_load_n(&worker->state, __ATOMIC_ACQUIRE);
+        if (af_packet_ring_stats(worker->ring, &out[i].ring) < 0) {
+            return -1;
+        }
+        out[i].queue_depth = __atomic_load_n(&worker->head, __ATOMIC_ACQUIRE) - worker->tail;
+        out[i].queue_slots = worker->mask + 1;
+    }
+    return (int)count;
+}
+
+void capture_engine_close(struct capture_engine *engine) {
+    uint32_t i;
+
+    if (!engine) {
+        return;
+    }
+    __atomic_store_n(&engine->running, 0, __ATOMIC_RELEASE);
+    for (i = 0; i < engine->worker_count; i++) {
+        if (engine->workers[i].thread_started) {
+            pthread_join(engine->workers[i].thread, NULL);
+        }
+    }
+    for (i = 0; i < engine->worker_count; i++) {
+        af_packet_ring_close(engine->workers[i].ring);
+        free(engine->workers[i].slots);
+    }
+    close(engine->wake_fd);
+    free(engine);
+}
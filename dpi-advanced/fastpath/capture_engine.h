@@ -0,0 +1,79 @@
+/*
+ * RansomEye DPI Advanced - Capture Engine
+ * AUTHORITATIVE: PACKET_FANOUT multi-worker capture with per-core pinned threads
+ *
+ * NOTE:
+ * - One TPACKET_V3 ring per worker, all rings joined to one PACKET_FANOUT group.
+ * - Each worker thread is pinned to its configured CPU and walks its own ring.
+ * - Workers hand frames to the consumer through bounded per-worker SPSC queues;
+ *   a full queue drops the frame and counts it (backpressure, never OOM).
+ * - Transient ring errors are counted and backed off; a fatal one (the
+ *   interface is gone) stops its worker, and reads fail once all have stopped.
+ */
+
+#ifndef RANSOMEYE_CAPTURE_ENGINE_H
+#define RANSOMEYE_CAPTURE_ENGINE_H
+
+#include <stdint.h>
+
+#include "af_packet_capture.h"
+#include "capture_filter.h"
+
+#define CAPTURE_ENGINE_MAX_WORKERS 64u
+
+/* Bytes of each frame kept in a queue slot (headers only, no payload) */
+#define CAPTURE_ENGINE_SLOT_SNAPLEN 256u
+#define CAPTURE_ENGINE_DEFAULT_QUEUE_SLOTS 4096u
+
+/* Fanout modes selectable from probe configuration */
+#define CAPTURE_FANOUT_MODE_HASH 0
+#define CAPTURE_FANOUT_MODE_CPU 1
+#define CAPTURE_FANOUT_MODE_ROLLOVER 2
+
+/* Worker states reported in capture_worker_stats.state */
+#define CAPTURE_WORKER_STATE_RUNNING 0u
+#define CAPTURE_WORKER_STATE_FAILED 1u  /* Stopped on a fatal ring error (see last_error) */
+
+struct capture_engine;
+
+struct capture_worker_stats {
+    uint64_t packets;               /* Frames taken off the ring by the worker */
+    uint64_t queue_drops;           /* Frames skipped because the consumer queue was full */
+    uint64_t ring_errors;           /* Socket errors raised while polling the ring */
+    struct af_packet_stats ring;    /* Kernel loss counters and block occupancy */
+    uint32_t queue_depth;           /* Frames waiting in the worker queue */
+    uint32_t queue_slots;
+    int32_t last_error;             /* errno of the most recent ring error, 0 for none */
+    uint32_t state;                 /* CAPTURE_WORKER_STATE_* */
+};
+
+struct capture_engine_config {
+    const char *interface;
+    uint32_t workers;
+    int fanout_mode;
+    uint16_t fanout_group_id;       /* 0 derives the group from the process id */
+    const int *worker_cpus;         /* workers entries, -1 leaves a worker unpinned; NULL pins none */
+    uint32_t queue_slots;           /* Power of two, 0 selects the default */
+    uint32_t ring_block_size;
+    uint32_t ring_block_count;
+    uint32_t ring_retire_timeout_ms;
+    int timestamp_source;           /* Requested AF_PACKET_TS_SOURCE_* */
+    const struct sock_filter *filter;   /* Compiled capture filter for every ring, NULL for none */
+    uint32_t filter_len;
+};
+
+struct capture_engine *capture_engine_open(const struct capture_engine_config *config);
+int capture_engine_start(struct capture_engine *engine);
+int capture_engine_read(struct capture_engine *engine, int timeout_ms,
+                        unsigned char *buffer, uint32_t buffer_len,
+                        uint32_t *out_caplen, uint32_t *out_wirelen,
+                        long *out_sec, long *out_nsec, uint32_t *out_worker);
+int capture_engine_read_batch(struct capture_engine *engine, int timeout_ms,
+                              unsigned char *buffer, uint32_t buffer_len,
+                              struct af_packet_frame_desc *descs, uint32_t max_descs);
+uint32_t capture_engine_worker_count(const struct capture_engine *engine);
+int capture_engine_timestamp_source(const struct capture_engine *engine);
+int capture_engine_stats(struct capture_engine *engine, struct capture_worker_stats *out, uint32_t max_workers);
+void capture_engine_close(struct capture_engine *engine);
+
+#endif /* RANSOMEYE_CAPTURE_ENGINE_H */
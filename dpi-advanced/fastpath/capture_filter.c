@@ -0,0 +1,414 @@
+/*
+ * RansomEye DPI Advanced - Capture Filter
+ * AUTHORITATIVE: Classic BPF socket filter compiled from probe configuration
+ *
+ * NOTE:
+ * - Code generation is straight-line: each clause either falls through to
+ *   the next clause or hits a local "ret #0", so conditional jumps stay
+ *   within the 8-bit cBPF jump range for the configured list limits.
+ * - Forward jumps are emitted with a placeholder and patched once their
+ *   target is known; an out-of-range jump fails compilation (E2BIG).
+ * - A prelude walks the VLAN tags and stores the network header offset,
+ *   L4 protocol, L4 offset and IP version in scratch memory, so every
+ *   clause after it is the same for tagged, untagged, IPv4 and IPv6.
+ * - Frames the prelude cannot see into (a third VLAN tag, MPLS, an IPv6
+ *   extension header) are accepted and left to the frame parser.
+ */
+
+#include "capture_filter.h"
+
+#include <linux/if_ether.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#ifndef ETH_P_QINQ1
+#define ETH_P_QINQ1 0x9100
+#endif
+
+/* Absolute offset of the outer ethertype; each VLAN tag moves the next one 4 bytes on */
+#define FILTER_OFF_ETHERTYPE 12u
+#define FILTER_VLAN_TAG_LEN 4u
+#define FILTER_MAX_VLAN_TAGS 2u
+
+/* Offsets from the network header */
+#define FILTER_IP_FRAG 6u
+#define FILTER_IP_PROTO 9u
+#define FILTER_IP_SRC 12u
+#define FILTER_IP_DST 16u
+#define FILTER_IPV6_NEXT 6u
+#define FILTER_IPV6_HDR_LEN 40u
+
+/* Scratch memory filled by the prelude */
+#define FILTER_MEM_NET 0u                   /* Network header offset */
+#define FILTER_MEM_PROTO 1u                 /* L4 protocol */
+#define FILTER_MEM_L4 2u                    /* L4 header offset, 0 for non-first IPv4 fragments */
+#define FILTER_MEM_VERSION 3u               /* 4 or 6 */
+
+#define FILTER_MAX_PENDING_JUMPS (CAPTURE_FILTER_MAX_CIDRS * 2u + CAPTURE_FILTER_MAX_PORT_RANGES * 2u)
+#define FILTER_MAX_PRELUDE_JUMPS 16u
+
+struct filter_builder {
+    struct sock_filter *insns;
+    uint32_t max;
+    uint32_t count;
+    int error;
+};
+
+static uint32_t fb_emit(struct filter_builder *b, uint16_t code, uint8_t jt, uint8_t jf, uint32_t k) {
+    if (b->count >= b->max) {
+        b->error = ENOSPC;
+        return b->count;
+    }
+    b->insns[b->count].code = code;
+    b->insns[b->count].jt = jt;
+    b->insns[b->count].jf = jf;
+    b->insns[b->count].k = k;
+    return b->count++;
+}
+
+/* Point the true (which != 0) or false branch of insn at to target */
+static void fb_patch(struct filter_builder *b, uint32_t at, int which, uint32_t target) {
+    uint32_t offset;
+
+    if (b->error || at >= b->count || target <= at) {
+        return;
+    }
+    offset = target - at - 1;
+    if (offset > 255) {
+        b->error = E2BIG;
+        return;
+    }
+    if (which) {
+        b->insns[at].jt = (uint8_t)offset;
+    } else {
+        b->insns[at].jf = (uint8_t)offset;
+    }
+}
+
+/* Point BPF_JA insn at to target; BPF_JA takes a 32-bit offset in k */
+static void fb_patch_ja(struct filter_builder *b, uint32_t at, uint32_t target) {
+    if (b->error || at >= b->count || target <= at) {
+        return;
+    }
+    b->insns[at].k = target - at - 1;
+}
+
+static uint32_t prefix_mask(uint32_t prefix_len) {
+    return prefix_len == 0 ? 0 : (uint32_t)(0xFFFFFFFFull << (32 - prefix_len));
+}
+
+/*
+ * Emit a CIDR match over source and destination address, with X holding
+ * the network header offset. Each matching compare's true branch is
+ * recorded in jumps for the caller to patch.
+ * Returns the number of recorded jumps.
+ */
+static uint32_t fb_emit_cidr_list(struct filter_builder *b, const struct capture_filter_cidr *cidrs,
+                                  uint32_t count, uint32_t *jumps) {
+    static const uint32_t offsets[2] = {FILTER_IP_SRC, FILTER_IP_DST};
+    uint32_t n = 0;
+    uint32_t i;
+    int dir;
+
+    for (dir = 0; dir < 2; dir++) {
+        for (i = 0; i < count; i++) {
+            uint32_t mask = prefix_mask(cidrs[i].prefix_len);
+
+            fb_emit(b, BPF_LD | BPF_W | BPF_IND, 0, 0, offsets[dir]);
+            fb_emit(b, BPF_ALU | BPF_AND | BPF_K, 0, 0, mask);
+            jumps[n++] = fb_emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, 0, cidrs[i].addr & mask);
+        }
+    }
+    return n;
+}
+
+/* Emit a test of the accumulator against each VLAN ethertype; true branches recorded in jumps */
+static uint32_t fb_emit_vlan_test(struct filter_builder *b, uint32_t *jumps) {
+    jumps[0] = fb_emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, 0, ETH_P_8021Q);
+    jumps[1] = fb_emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, 0, ETH_P_8021AD);
+    jumps[2] = fb_emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, 0, ETH_P_QINQ1);
+    return 3;
+}
+
+/*
+ * Emit the prelude: find the network header behind up to
+ * FILTER_MAX_VLAN_TAGS tags and fill the FILTER_MEM_* slots. Rejects
+ * frames that are not IP and falls through for the ones it parsed.
+ * Returns the BPF_JA taken by frames it cannot parse, for the caller to
+ * point at the accept. It must be a jump rather than a "ret": the kernel
+ * checks scratch memory loads along the fall-through of a "ret" too.
+ */
+static uint32_t fb_emit_prelude(struct filter_builder *b) {
+    static const uint32_t ipv6_ext_headers[] = {
+        IPPROTO_HOPOPTS, IPPROTO_ROUTING, IPPROTO_FRAGMENT, IPPROTO_DSTOPTS, IPPROTO_AH, IPPROTO_MH,
+    };
+    uint32_t pass_jumps[FILTER_MAX_PRELUDE_JUMPS];
+    uint32_t tag_jumps[3];
+    uint32_t net_jumps[FILTER_MAX_VLAN_TAGS];
+    uint32_t pass_count = 0;
+    uint32_t tag_count = 0;
+    uint32_t depth;
+    uint32_t ipv4;
+    uint32_t ipv6;
+    uint32_t done;
+    uint32_t pass;
+    uint32_t i;
+
+    // Ethertype in A and network header offset in X after 0..FILTER_MAX_VLAN_TAGS tags
+    for (depth = 0; depth <= FILTER_MAX_VLAN_TAGS; depth++) {
+        uint32_t off = FILTER_OFF_ETHERTYPE + depth * FILTER_VLAN_TAG_LEN;
+
+        for (i = 0; i < tag_count; i++) {
+            fb_patch(b, tag_jumps[i], 1, b->count);
+        }
+        fb_emit(b, BPF_LD | BPF_H | BPF_ABS, 0, 0, off);
+        if (depth < FILTER_MAX_VLAN_TAGS) {
+            tag_count = fb_emit_vlan_test(b, tag_jumps);
+            fb_emit(b, BPF_LDX | BPF_IMM, 0, 0, off + 2);
+            net_jumps[depth] = fb_emit(b, BPF_JMP | BPF_JA, 0, 0, 0);
+        } else {
+            // One tag too many
+            pass_count += fb_emit_vlan_test(b, pass_jumps + pass_count);
+            fb_emit(b, BPF_LDX | BPF_IMM, 0, 0, off + 2);
+        }
+    }
+    for (i = 0; i < FILTER_MAX_VLAN_TAGS; i++) {
+        fb_patch_ja(b, net_jumps[i], b->count);
+    }
+    fb_emit(b, BPF_STX, 0, 0, FILTER_MEM_NET);
+    ipv4 = fb_emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, 0, ETH_P_IP);
+    ipv6 = fb_emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, 0, ETH_P_IPV6);
+    pass_jumps[pass_count++] = fb_emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, 0, ETH_P_MPLS_UC);
+    pass_jumps[pass_count++] = fb_emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, 0, ETH_P_MPLS_MC);
+    fb_emit(b, BPF_RET | BPF_K, 0, 0, 0);
+
+    // IPv4: L4 offset is X + 4 * IHL, or 0 for a non-first fragment
+    fb_patch(b, ipv4, 1, b->count);
+    fb_emit(b, BPF_LD | BPF_IMM, 0, 0, 4);
+    fb_emit(b, BPF_ST, 0, 0, FILTER_MEM_VERSION);
+    fb_emit(b, BPF_LD | BPF_B | BPF_IND, 0, 0, FILTER_IP_PROTO);
+    fb_emit(b, BPF_ST, 0, 0, FILTER_MEM_PROTO);
+    fb_emit(b, BPF_LD | BPF_H | BPF_IND, 0, 0, FILTER_IP_FRAG);
+    fb_emit(b, BPF_JMP | BPF_JSET | BPF_K, 5, 0, 0x1FFF);
+    fb_emit(b, BPF_LD | BPF_B | BPF_IND, 0, 0, 0);
+    fb_emit(b, BPF_ALU | BPF_AND | BPF_K, 0, 0, 0xF);
+    fb_emit(b, BPF_ALU | BPF_LSH | BPF_K, 0, 0, 2);
+    fb_emit(b, BPF_ALU | BPF_ADD | BPF_X, 0, 0, 0);
+    fb_emit(b, BPF_JMP | BPF_JA, 0, 0, 1);
+    fb_emit(b, BPF_LD | BPF_IMM, 0, 0, 0);
+    fb_emit(b, BPF_ST, 0, 0, FILTER_MEM_L4);
+    done = fb_emit(b, BPF_JMP | BPF_JA, 0, 0, 0);
+
+    // IPv6: upper-layer header right after the fixed header, unless an extension header comes first
+    fb_patch(b, ipv6, 1, b->count);
+    fb_emit(b, BPF_LD | BPF_IMM, 0, 0, 6);
+    fb_emit(b, BPF_ST, 0, 0, FILTER_MEM_VERSION);
+    fb_emit(b, BPF_LD | BPF_B | BPF_IND, 0, 0, FILTER_IPV6_NEXT);
+    for (i = 0; i < sizeof(ipv6_ext_headers) / sizeof(ipv6_ext_headers[0]); i++) {
+        pass_jumps[pass_count++] = fb_emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, 0, ipv6_ext_headers[i]);
+    }
+    fb_emit(b, BPF_ST, 0, 0, FILTER_MEM_PROTO);
+    fb_emit(b, BPF_MISC | BPF_TXA, 0, 0, 0);
+    fb_emit(b, BPF_ALU | BPF_ADD | BPF_K, 0, 0, FILTER_IPV6_HDR_LEN);
+    fb_emit(b, BPF_ST, 0, 0, FILTER_MEM_L4);
+    fb_emit(b, BPF_JMP | BPF_JA, 0, 0, 1);
+
+    for (i = 0; i < pass_count; i++) {
+        fb_patch(b, pass_jumps[i], 1, b->count);
+    }
+    pass = fb_emit(b, BPF_JMP | BPF_JA, 0, 0, 0);
+    fb_patch_ja(b, done, b->count);
+    return pass;
+}
+
+/* Emit range checks on the accumulator; true branches recorded in jumps */
+static uint32_t fb_emit_port_ranges(struct filter_builder *b, const struct capture_filter_port_range *ports,
+                                    uint32_t count, uint32_t *jumps) {
+    uint32_t n = 0;
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        // A < first: skip the upper-bound test and try the next range
+        fb_emit(b, BPF_JMP | BPF_JGE | BPF_K, 0, 1, ports[i].first);
+        // A > last: next range; otherwise matched (patched into jf)
+        jumps[n++] = fb_emit(b, BPF_JMP | BPF_JGT | BPF_K, 0, 0, ports[i].last);
+    }
+    return n;
+}
+
+static int filter_spec_valid(const struct capture_filter_spec *spec) {
+    uint32_t i;
+
+    if (spec->include_count > CAPTURE_FILTER_MAX_CIDRS ||
+        spec->exclude_count > CAPTURE_FILTER_MAX_CIDRS ||
+        spec->port_range_count > CAPTURE_FILTER_MAX_PORT_RANGES) {
+        return 0;
+    }
+    if (spec->snaplen != 0 && spec->snaplen < CAPTURE_FILTER_MIN_SNAPLEN) {
+        return 0;
+    }
+    if (spec->protocols & ~(CAPTURE_FILTER_PROTO_TCP | CAPTURE_FILTER_PROTO_UDP | CAPTURE_FILTER_PROTO_ICMP)) {
+        return 0;
+    }
+    for (i = 0; i < spec->include_count; i++) {
+        if (spec->include[i].prefix_len > 32) {
+            return 0;
+        }
+    }
+    for (i = 0; i < spec->exclude_count; i++) {
+        if (spec->exclude[i].prefix_len > 32) {
+            return 0;
+        }
+    }
+    for (i = 0; i < spec->port_range_count; i++) {
+        if (spec->ports[i].first > spec->ports[i].last) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Compile spec into a cBPF program.
+ * Returns the instruction count on success, -1 on error (errno set:
+ * EINVAL bad spec, ENOSPC out_insns too small, E2BIG jump out of range).
+ */
+int capture_filter_compile(const struct capture_filter_spec *spec,
+                           struct sock_filter *out_insns, uint32_t max_insns) {
+    static const struct {
+        uint32_t bit;
+        uint32_t proto;
+    } protocols[] = {
+        {CAPTURE_FILTER_PROTO_TCP, IPPROTO_TCP},
+        {CAPTURE_FILTER_PROTO_UDP, IPPROTO_UDP},
+        {CAPTURE_FILTER_PROTO_ICMP, IPPROTO_ICMP},
+        {CAPTURE_FILTER_PROTO_ICMP, IPPROTO_ICMPV6},
+    };
+    struct filter_builder b;
+    uint32_t jumps[FILTER_MAX_PENDING_JUMPS];
+    uint32_t accept_jumps[2];           /* Prelude pass, non-TCP/UDP past the port ranges */
+    uint32_t accept_count = 0;
+    uint32_t n;
+    uint32_t i;
+    uint32_t target;
+    uint32_t skip;
+    uint32_t snaplen;
+
+    if (!spec || !out_insns || max_insns == 0 || !filter_spec_valid(spec)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(&b, 0, sizeof(b));
+    b.insns = out_insns;
+    b.max = max_insns;
+    snaplen = spec->snaplen ? spec->snaplen : CAPTURE_FILTER_SNAPLEN_MAX;
+
+    // Snaplen-only configuration: keep every frame, just truncate
+    if (spec->protocols == 0 && spec->include_count == 0 &&
+        spec->exclude_count == 0 && spec->port_range_count == 0) {
+        fb_emit(&b, BPF_RET | BPF_K, 0, 0, snaplen);
+        return (int)b.count;
+    }
+
+    accept_jumps[accept_count++] = fb_emit_prelude(&b);
+
+    // Protocol list: any match skips the reject
+    if (spec->protocols) {
+        n = 0;
+        fb_emit(&b, BPF_LD | BPF_MEM, 0, 0, FILTER_MEM_PROTO);
+        for (i = 0; i < sizeof(protocols) / sizeof(protocols[0]); i++) {
+            if (spec->protocols & protocols[i].bit) {
+                jumps[n++] = fb_emit(&b, BPF_JMP | BPF_JEQ | BPF_K, 0, 0, protocols[i].proto);
+            }
+        }
+        fb_emit(&b, BPF_RET | BPF_K, 0, 0, 0);
+        for (i = 0; i < n; i++) {
+            fb_patch(&b, jumps[i], 1, b.count);
+        }
+    }
+
+    // Include CIDRs (IPv4 only): either endpoint inside any network skips the reject
+    if (spec->include_count) {
+        fb_emit(&b, BPF_LD | BPF_MEM, 0, 0, FILTER_MEM_VERSION);
+        skip = fb_emit(&b, BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 4);
+        fb_emit(&b, BPF_LDX | BPF_MEM, 0, 0, FILTER_MEM_NET);
+        n = fb_emit_cidr_list(&b, spec->include, spec->include_count, jumps);
+        fb_emit(&b, BPF_RET | BPF_K, 0, 0, 0);
+        for (i = 0; i < n; i++) {
+            fb_patch(&b, jumps[i], 1, b.count);
+        }
+        fb_patch(&b, skip, 0, b.count);
+    }
+
+    // Exclude CIDRs (IPv4 only): either endpoint inside any network hits the reject
+    if (spec->exclude_count) {
+        fb_emit(&b, BPF_LD | BPF_MEM, 0, 0, FILTER_MEM_VERSION);
+        skip = fb_emit(&b, BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 4);
+        fb_emit(&b, BPF_LDX | BPF_MEM, 0, 0, FILTER_MEM_NET);
+        n = fb_emit_cidr_list(&b, spec->exclude, spec->exclude_count, jumps);
+        fb_emit(&b, BPF_JMP | BPF_JA, 0, 0, 1);
+        target = fb_emit(&b, BPF_RET | BPF_K, 0, 0, 0);
+        for (i = 0; i < n; i++) {
+            fb_patch(&b, jumps[i], 1, target);
+        }
+        fb_patch(&b, skip, 0, b.count);
+    }
+
+    // Port ranges apply to TCP and UDP; other protocols pass through
+    if (spec->port_range_count) {
+        fb_emit(&b, BPF_LD | BPF_MEM, 0, 0, FILTER_MEM_PROTO);
+        fb_emit(&b, BPF_JMP | BPF_JEQ | BPF_K, 2, 0, IPPROTO_TCP);
+        fb_emit(&b, BPF_JMP | BPF_JEQ | BPF_K, 1, 0, IPPROTO_UDP);
+        accept_jumps[accept_count++] = fb_emit(&b, BPF_JMP | BPF_JA, 0, 0, 0);
+
+        // Non-first fragments carry no ports
+        fb_emit(&b, BPF_LD | BPF_MEM, 0, 0, FILTER_MEM_L4);
+        fb_emit(&b, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0);
+        fb_emit(&b, BPF_RET | BPF_K, 0, 0, 0);
+
+        fb_emit(&b, BPF_MISC | BPF_TAX, 0, 0, 0);
+        fb_emit(&b, BPF_LD | BPF_H | BPF_IND, 0, 0, 0);
+        n = fb_emit_port_ranges(&b, spec->ports, spec->port_range_count, jumps);
+        fb_emit(&b, BPF_LD | BPF_H | BPF_IND, 0, 0, 2);
+        n += fb_emit_port_ranges(&b, spec->ports, spec->port_range_count, jumps + n);
+        fb_emit(&b, BPF_RET | BPF_K, 0, 0, 0);
+        for (i = 0; i < n; i++) {
+            fb_patch(&b, jumps[i], 0, b.count);
+        }
+    }
+
+    target = fb_emit(&b, BPF_RET | BPF_K, 0, 0, snaplen);
+    for (i = 0; i < accept_count; i++) {
+        // BPF_JA takes a 32-bit offset in k
+        if (!b.error) {
+            b.insns[accept_jumps[i]].k = target - accept_jumps[i] - 1;
+        }
+    }
+
+    if (b.error) {
+        errno = b.error;
+        return -1;
+    }
+    return (int)b.count;
+}
+
+/*
+ * Attach a compiled program with SO_ATTACH_FILTER, replacing any filter
+ * already on the socket. Frames queued before the call are not filtered.
+ * Returns 0 on success, -1 on error.
+ */
+int capture_filter_attach(int sockfd, const struct sock_filter *insns, uint32_t insn_count) {
+    struct sock_fprog prog;
+
+    if (sockfd < 0 || !insns || insn_count == 0 || insn_count > CAPTURE_FILTER_MAX_INSNS) {
+        errno = EINVAL;
+        return -1;
+    }
+    prog.len = (unsigned short)insn_count;
+    prog.filter = (struct sock_filter *)insns;
+    return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
@@ -0,0 +1,71 @@
+/*
+ * RansomEye DPI Advanced - Capture Filter
+ * AUTHORITATIVE: Classic BPF socket filter compiled from probe configuration
+ *
+ * NOTE:
+ * - The spec is a fixed-layout struct so it can be filled via ctypes.
+ * - The generated program runs in the kernel before any copy to userspace:
+ *   rejected frames never reach the socket queue or ring, accepted frames
+ *   are truncated to snaplen (on-wire length is still reported).
+ * - Evaluates Ethernet with up to two VLAN tags (802.1Q, 802.1ad, 0x9100)
+ *   carrying IPv4, or IPv6 whose upper-layer header follows the fixed
+ *   header. Other IP frames the probe parses (a third tag, MPLS, IPv6
+ *   extension headers) are accepted unfiltered; non-IP frames are dropped.
+ */
+
+#ifndef RANSOMEYE_CAPTURE_FILTER_H
+#define RANSOMEYE_CAPTURE_FILTER_H
+
+#include <stdint.h>
+#include <linux/filter.h>
+
+#define CAPTURE_FILTER_MAX_CIDRS 32u
+#define CAPTURE_FILTER_MAX_PORT_RANGES 32u
+#define CAPTURE_FILTER_MAX_INSNS 1024u
+
+/* Smallest snaplen that still holds two VLAN tags + IPv4 with options + TCP/UDP ports (86) */
+#define CAPTURE_FILTER_MIN_SNAPLEN 96u
+
+/* Accept-verdict length when no snaplen is configured */
+#define CAPTURE_FILTER_SNAPLEN_MAX 262144u
+
+/* Protocol bits */
+#define CAPTURE_FILTER_PROTO_TCP 0x1u
+#define CAPTURE_FILTER_PROTO_UDP 0x2u
+#define CAPTURE_FILTER_PROTO_ICMP 0x4u
+
+/* IPv4 network in host byte order; does not constrain IPv6 frames */
+struct capture_filter_cidr {
+    uint32_t addr;
+    uint32_t prefix_len;
+};
+
+/* Inclusive port range, host byte order */
+struct capture_filter_port_range {
+    uint16_t first;
+    uint16_t last;
+};
+
+/*
+ * Empty lists / zero fields do not constrain. A frame is accepted when it
+ * is IPv4 or IPv6, its protocol is listed (CAPTURE_FILTER_PROTO_ICMP
+ * covers ICMPv6), source or destination is inside an include CIDR and
+ * neither endpoint is inside an exclude CIDR (IPv4 only), and (for TCP
+ * and UDP) source or destination port falls in a listed range.
+ */
+struct capture_filter_spec {
+    uint32_t protocols;             /* CAPTURE_FILTER_PROTO_* bits, 0 = any */
+    uint32_t snaplen;               /* Bytes kept per accepted frame, 0 = whole frame */
+    uint32_t include_count;
+    uint32_t exclude_count;
+    uint32_t port_range_count;
+    struct capture_filter_cidr include[CAPTURE_FILTER_MAX_CIDRS];
+    struct capture_filter_cidr exclude[CAPTURE_FILTER_MAX_CIDRS];
+    struct capture_filter_port_range ports[CAPTURE_FILTER_MAX_PORT_RANGES];
+};
+
+int capture_filter_compile(const struct capture_filter_spec *spec,
+                           struct sock_filter *out_insns, uint32_t max_insns);
+int capture_filter_attach(int sockfd, const struct sock_filter *insns, uint32_t insn_count);
+
+#endif /* RANSOMEYE_CAPTURE_FILTER_H */
@@ -8,62 +8,566 @@
  * - Per-flow counters
  * - No loops
  * - Verifier-safe
+ * - Optional AF_XDP hand-off: frames are redirected into xsks_map when an
+ *   XSK socket is registered for the RX queue, otherwise passed to the stack
+ * - Per-CPU LRU flow map: no cross-CPU contention on the hot path, and a
+ *   full map evicts the stalest flow instead of dropping new ones
+ * - TCP RST, or FIN in both directions, pushes the flow into the
+ *   flow_events ring buffer; idle flows are swept from userspace
+ * - Per-source byte (count-min) and destination fan-out (HyperLogLog)
+ *   sketches in per-CPU arrays: constant memory however many sources or
+ *   single-packet flows a scan produces
+ * - TC clsact ingress/egress pair sharing the same maps, for hosts that
+ *   must see both directions (inline, or no XDP on the interface). Flows
+ *   are keyed on the canonical 5-tuple with forward/reverse counters, so
+ *   both directions land in one entry.
  */
 
-#include <linux/bpf.h>
-#include <linux/if_ether.h>
-#include <linux/ip.h>
-#include <linux/tcp.h>
-#include <linux/udp.h>
-#include <linux/in.h>
+/*
+ * Build: make -C dpi-advanced/fastpath bpf (see Makefile). vmlinux.h is
+ * generated from kernel BTF, so no UAPI headers of the build host are
+ * involved; the programs touch only packet bytes and the stable xdp_md /
+ * __sk_buff context, so the object loads unchanged on any kernel with
+ * BTF, ring buffers and batch map ops (5.8+).
+ */
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+
+#include "ebpf_flow_tracker.h"
 
-#define MAX_FLOWS 65536
+#define MAX_XSK_QUEUES 64
 
-struct flow_key {
-    __be32 src_ip;
-    __be32 dst_ip;
-    __be16 src_port;
-    __be16 dst_port;
-    __u8 protocol;
-};
+/* Macros vmlinux.h cannot carry (it holds types and enums only) */
+#ifndef ETH_P_IP
+#define ETH_P_IP 0x0800
+#endif
 
-struct flow_stats {
-    __u64 packet_count;
-    __u64 byte_count;
-    __u32 l7_protocol;
-    __u64 first_seen;
-    __u64 last_seen;
-};
+#ifndef TC_ACT_OK
+#define TC_ACT_OK 0
+#endif
 
+#ifndef EEXIST
+#define EEXIST 17
+#endif
+
+#ifndef NULL
+#define NULL ((void *)0)
+#endif
+
+/*
+ * Flow table. Values are per CPU (aggregated by the reader), so updates
+ * are plain stores; size with -DFLOW_MAP_MAX_ENTRIES or at load time.
+ */
 struct {
-    __uint(type, BPF_MAP_TYPE_HASH);
-    __uint(max_entries, MAX_FLOWS);
+    __uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+    __uint(max_entries, FLOW_MAP_MAX_ENTRIES);
     __type(key, struct flow_key);
     __type(value, struct flow_stats);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
 } flow_map SEC(".maps");
 
 /*
- * eBPF program: Extract flow tuple and update counters
- * Attached to XDP or TC hook
+ * Ended flows (struct flow_record). Pinned by name for the consumer, which
+ * completes each record from flow_map and removes the entry.
  */
-SEC("xdp_flow_tracker")
-int xdp_flow_tracker(struct xdp_md *ctx) {
-    void *data_end = (void *)(long)ctx->data_end;
-    void *data = (void *)(long)ctx->data;
-    
+struct {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, FLOW_EVENTS_RINGBUF_BYTES);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} flow_events SEC(".maps");
+
+/* Datapath counters, see FLOW_COUNTER_* */
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, FLOW_COUNTER_MAX);
+    __type(key, __u32);
+    __type(value, __u64);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} flow_counters SEC(".maps");
+
+/* Count-min sketch cells, row * TALKER_CMS_WIDTH + column, bytes */
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, TALKER_CMS_DEPTH * TALKER_CMS_WIDTH);
+    __type(key, __u32);
+    __type(value, __u64);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} talker_cms SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, TALKER_CANDIDATES);
+    __type(key, __u32);
+    __type(value, struct talker_candidate);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} talker_candidates SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, FANOUT_SLOTS);
+    __type(key, __u32);
+    __type(value, struct fanout_slot);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} fanout_hll SEC(".maps");
+
+/*
+ * AF_XDP sockets per RX queue (populated by the af_xdp capture backend).
+ * Pinned by name so userspace can find it without owning the program.
+ */
+struct {
+    __uint(type, BPF_MAP_TYPE_XSKMAP);
+    __uint(max_entries, MAX_XSK_QUEUES);
+    __type(key, __u32);
+    __type(value, __u32);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} xsks_map SEC(".maps");
+
+/*
+ * Verdict for every frame: redirect to the AF_XDP socket of this RX queue
+ * when one is registered, otherwise pass to the network stack.
+ */
+static __always_inline int xdp_verdict(struct xdp_md *ctx) {
+    return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS);
+}
+
+static __always_inline void flow_counter_add(__u32 index, __u64 value) {
+    __u64 *counter = bpf_map_lookup_elem(&flow_counters, &index);
+    if (counter) {
+        *counter += value;
+    }
+}
+
+/*
+ * Put key in canonical order (lower ip, then lower port, as src) and
+ * return the direction the packet travels relative to it.
+ */
+static __always_inline __u32 flow_key_canonicalize(struct flow_key *key) {
+    __u32 src_ip = bpf_ntohl(key->src_ip);
+    __u32 dst_ip = bpf_ntohl(key->dst_ip);
+    __be32 ip;
+    __be16 port;
+
+    if (src_ip < dst_ip || (src_ip == dst_ip && bpf_ntohs(key->src_port) <= bpf_ntohs(key->dst_port))) {
+        return FLOW_DIR_FORWARD;
+    }
+    ip = key->src_ip;
+    key->src_ip = key->dst_ip;
+    key->dst_ip = ip;
+    port = key->src_port;
+    key->src_port = key->dst_port;
+    key->dst_port = port;
+    return FLOW_DIR_REVERSE;
+}
+
+/* Count each flag of a TCP flags byte; eight constant-index adds, no loop */
+static __always_inline void flow_count_tcp_flags(struct flow_stats *stats, __u8 tcp_flags) {
+    stats->tcp_flags[FLOW_TCP_FIN] += (tcp_flags >> FLOW_TCP_FIN) & 1;
+    stats->tcp_flags[FLOW_TCP_SYN] += (tcp_flags >> FLOW_TCP_SYN) & 1;
+    stats->tcp_flags[FLOW_TCP_RST] += (tcp_flags >> FLOW_TCP_RST) & 1;
+    stats->tcp_flags[FLOW_TCP_PSH] += (tcp_flags >> FLOW_TCP_PSH) & 1;
+    stats->tcp_flags[FLOW_TCP_ACK] += (tcp_flags >> FLOW_TCP_ACK) & 1;
+    stats->tcp_flags[FLOW_TCP_URG] += (tcp_flags >> FLOW_TCP_URG) & 1;
+    stats->tcp_flags[FLOW_TCP_ECE] += (tcp_flags >> FLOW_TCP_ECE) & 1;
+    stats->tcp_flags[FLOW_TCP_CWR] += (tcp_flags >> FLOW_TCP_CWR) & 1;
+}
+
+/*
+ * Histogram one frame. The masks restate the clamp in the bucket helpers
+ * so the verifier sees a bounded index.
+ */
+static __always_inline void flow_count_shape(struct flow_stats *stats, __u64 bytes, __u8 tcp_flags) {
+    stats->size_hist[flow_size_bucket(bytes) & (FLOW_HIST_BUCKETS - 1)]++;
+    flow_count_tcp_flags(stats, tcp_flags);
+}
+
+/*
+ * Account one frame travelling dir to its flow and return this CPU's slot
+ * (NULL if the map refused the flow). The lookup returns a zeroed slot if
+ * the flow was created on another CPU. A BPF_NOEXIST insert that loses
+ * the race to another CPU falls back to writing this CPU's slot of the
+ * winner's entry, so every insert is counted exactly once. The first
+ * packet a CPU sees records the flow's origin for that CPU; later ones
+ * add their gap since the CPU's previous packet to iat_hist.
+ */
+static __always_inline struct flow_stats *flow_account(struct flow_key *key, __u32 dir, __u64 bytes,
+                                                       __u8 tcp_flags) {
+    __u64 now = bpf_ktime_get_ns();
+    struct flow_stats *stats = bpf_map_lookup_elem(&flow_map, key);
+    __u32 origin = dir == FLOW_DIR_REVERSE ? FLOW_STATS_ORIGIN_REVERSE : 0;
+
+    flow_counter_add(FLOW_COUNTER_PACKETS, 1);
+    if (stats) {
+        if (stats->first_seen == 0) {
+            stats->first_seen = now;
+            stats->flags |= origin;
+        } else {
+            stats->iat_hist[flow_iat_bucket(now - stats->last_seen) & (FLOW_HIST_BUCKETS - 1)]++;
+        }
+        if (dir == FLOW_DIR_FORWARD) {
+            stats->packets[FLOW_DIR_FORWARD]++;
+            stats->bytes[FLOW_DIR_FORWARD] += bytes;
+        } else {
+            stats->packets[FLOW_DIR_REVERSE]++;
+            stats->bytes[FLOW_DIR_REVERSE] += bytes;
+        }
+        flow_count_shape(stats, bytes, tcp_flags);
+        stats->last_seen = now;
+        return stats;
+    }
+
+    struct flow_stats new_stats = {
+        .first_seen = now,
+        .last_seen = now,
+        .flags = origin
+    };
+    if (dir == FLOW_DIR_FORWARD) {
+        new_stats.packets[FLOW_DIR_FORWARD] = 1;
+        new_stats.bytes[FLOW_DIR_FORWARD] = bytes;
+    } else {
+        new_stats.packets[FLOW_DIR_REVERSE] = 1;
+        new_stats.bytes[FLOW_DIR_REVERSE] = bytes;
+    }
+    flow_count_shape(&new_stats, bytes, tcp_flags);
+    long err = bpf_map_update_elem(&flow_map, key, &new_stats, BPF_NOEXIST);
+    if (err == 0) {
+        flow_counter_add(FLOW_COUNTER_INSERTS, 1);
+        return bpf_map_lookup_elem(&flow_map, key);
+    }
+    if (err == -EEXIST && bpf_map_update_elem(&flow_map, key, &new_stats, BPF_EXIST) == 0) {
+        return bpf_map_lookup_elem(&flow_map, key);
+    }
+    flow_counter_add(FLOW_COUNTER_INSERT_FAILURES, 1);
+    return NULL;
+}
+
+/* Add bytes to src_ip's cell in one count-min row; returns min(estimate, cell) */
+static __always_inline __u64 sketch_cms_add(__be32 src_ip, __u32 row, __u64 bytes, __u64 estimate) {
+    __u32 index = sketch_cms_cell(src_ip, row);
+    __u64 *cell = bpf_map_lookup_elem(&talker_cms, &index);
+
+    if (!cell) {
+        return estimate;
+    }
+    *cell += bytes;
+    return *cell < estimate ? *cell : estimate;
+}
+
+/* HyperLogLog rank: leading zeros of the 26 hash bits left after the register index, plus one */
+static __always_inline __u8 sketch_hll_rank(__u32 hash) {
+    __u32 x = (hash >> FANOUT_HLL_BITS) << FANOUT_HLL_BITS;
+    __u8 rank = 1;
+
+    if (x == 0) {
+        return 33 - FANOUT_HLL_BITS;
+    }
+    if (!(x & 0xFFFF0000u)) {
+        rank += 16;
+        x <<= 16;
+    }
+    if (!(x & 0xFF000000u)) {
+        rank += 8;
+        x <<= 8;
+    }
+    if (!(x & 0xF0000000u)) {
+        rank += 4;
+        x <<= 4;
+    }
+    if (!(x & 0xC0000000u)) {
+        rank += 2;
+        x <<= 2;
+    }
+    if (!(x & 0x80000000u)) {
+        rank += 1;
+    }
+    return rank;
+}
+
+/*
+ * Account one IPv4 packet to its source's sketches: bytes into the
+ * count-min rows (unrolled), the source into its heavy-hitter candidate
+ * slot if it now outweighs the occupant, and (dst_ip, dst_port) into the
+ * source's HyperLogLog.
+ */
+_Static_assert(TALKER_CMS_DEPTH == 4, "sketch_update unrolls one sketch_cms_add per count-min row");
+
+static __always_inline void sketch_update(__be32 src_ip, __be32 dst_ip, __be16 dst_port, __u64 bytes) {
+    struct talker_candidate *candidate;
+    struct fanout_slot *fanout;
+    __u64 estimate = ~0ULL;
+    __u32 slot;
+    __u32 hash;
+    __u32 reg;
+    __u8 rank;
+
+    estimate = sketch_cms_add(src_ip, 0, bytes, estimate);
+    estimate = sketch_cms_add(src_ip, 1, bytes, estimate);
+    estimate = sketch_cms_add(src_ip, 2, bytes, estimate);
+    estimate = sketch_cms_add(src_ip, 3, bytes, estimate);
+
+    slot = sketch_hash(src_ip, SKETCH_SEED_CANDIDATE) & (TALKER_CANDIDATES - 1);
+    candidate = bpf_map_lookup_elem(&talker_candidates, &slot);
+    if (candidate && (candidate->src_ip == src_ip || estimate > candidate->estimate)) {
+        candidate->src_ip = src_ip;
+        candidate->estimate = estimate;
+    }
+
+    slot = sketch_hash(src_ip, SKETCH_SEED_FANOUT) & (FANOUT_SLOTS - 1);
+    fanout = bpf_map_lookup_elem(&fanout_hll, &slot);
+    if (!fanout) {
+        return;
+    }
+    // A colliding source wears the owner down instead of merging into its registers
+    if (fanout->src_ip != src_ip) {
+        if (fanout->votes > 0) {
+            fanout->votes--;
+            return;
+        }
+        __builtin_memset(fanout, 0, sizeof(*fanout));
+        fanout->src_ip = src_ip;
+    }
+    fanout->votes++;
+    fanout->updates++;
+    hash = sketch_hash(dst_ip ^ ((__u32)dst_port * 0x9E3779B1u), SKETCH_SEED_DESTINATION);
+    rank = sketch_hll_rank(hash);
+    reg = hash & (FANOUT_HLL_REGISTERS - 1);
+    if (fanout->registers[reg] < rank) {
+        fanout->registers[reg] = rank;
+    }
+}
+
+/*
+ * L7 classifiers. Each one looks at the first L7_PEEK_BYTES of a payload
+ * at constant offsets only (metadata, nothing is copied out). Signatures
+ * too weak to stand alone are gated on the service port.
+ */
+static __always_inline int l7_port(const struct flow_key *key, __u16 port) {
+    return key->src_port == bpf_htons(port) || key->dst_port == bpf_htons(port);
+}
+
+/* TLS handshake record, version 3.x, carrying a ClientHello or ServerHello */
+static __always_inline int l7_is_tls(const __u8 *p) {
+    return p[0] == 0x16 && p[1] == 0x03 && p[2] <= 0x04 && (p[5] == 0x01 || p[5] == 0x02);
+}
+
+/* HTTP/1.x request line or status line */
+static __always_inline int l7_is_http(const __u8 *p) {
+    __u32 word = (__u32)p[0] << 24 | (__u32)p[1] << 16 | (__u32)p[2] << 8 | p[3];
+
+    switch (word) {
+    case 0x47455420:                    /* "GET " */
+    case 0x504F5354:                    /* "POST" */
+    case 0x50555420:                    /* "PUT " */
+    case 0x48454144:                    /* "HEAD" */
+    case 0x44454C45:                    /* "DELE" */
+    case 0x4F505449:                    /* "OPTI" */
+    case 0x50415443:                    /* "PATC" */
+    case 0x434F4E4E:                    /* "CONN" */
+        return 1;
+    case 0x48545450:                    /* "HTTP" */
+        return p[4] == '/' && p[5] == '1' && p[6] == '.';
+    }
+    return 0;
+}
+
+/* SSH identification string, sent first by both sides */
+static __always_inline int l7_is_ssh(const __u8 *p) {
+    return p[0] == 'S' && p[1] == 'S' && p[2] == 'H' && p[3] == '-' && (p[4] == '2' || p[4] == '1');
+}
+
+/*
+ * NetBIOS session message carrying SMB2/3 (0xFE 'SMB'), or the SMB1
+ * negotiate (0xFF 'SMB') that multi-dialect clients still open with
+ */
+static __always_inline int l7_is_smb(const __u8 *p) {
+    return p[0] == 0x00 && (p[4] == 0xFE || p[4] == 0xFF) && p[5] == 'S' && p[6] == 'M' && p[7] == 'B';
+}
+
+/* TPKT version 3 wrapping an X.224 connection request or confirm */
+static __always_inline int l7_is_rdp(const __u8 *p) {
+    return p[0] == 0x03 && p[1] == 0x00 && p[4] >= 6 && (p[5] == 0xE0 || p[5] == 0xD0);
+}
+
+/* Kerberos AS-REQ/AS-REP/TGS-REQ/TGS-REP/KRB-ERROR application tags */
+static __always_inline int l7_is_krb_tag(__u8 tag) {
+    return tag == 0x6A || tag == 0x6B || tag == 0x6C || tag == 0x6D || tag == 0x7E;
+}
+
+/* DNS header: standard, inverse or status opcode, Z clear, one question, no answers in a query */
+static __always_inline int l7_is_dns(const __u8 *h) {
+    if (h[4] != 0 || h[5] != 1 || ((h[2] >> 3) & 0xF) > 2 || (h[3] & 0x40)) {
+        return 0;
+    }
+    return (h[2] & 0x80) || (h[6] == 0 && h[7] == 0);
+}
+
+static __always_inline int l7_dns_port(const struct flow_key *key) {
+    return l7_port(key, 53) || l7_port(key, 5353) || l7_port(key, 5355);
+}
+
+/* LDAPMessage protocolOp: APPLICATION 0..24, constructed or primitive */
+static __always_inline int l7_ldap_op(__u8 tag) {
+    return tag >= 0x40 && tag <= 0x78 && ((tag & 0x1F) <= 24);
+}
+
+/* messageID INTEGER of 1-4 bytes at id_at, then protocolOp */
+static __always_inline int l7_ldap_message_id(const __u8 *p, __u32 id_at) {
+    if (p[id_at] != 0x02) {
+        return 0;
+    }
+    switch (p[id_at + 1]) {
+    case 1:
+        return l7_ldap_op(p[id_at + 3]);
+    case 2:
+        return l7_ldap_op(p[id_at + 4]);
+    case 3:
+        return l7_ldap_op(p[id_at + 5]);
+    case 4:
+        return l7_ldap_op(p[id_at + 6]);
+    }
+    return 0;
+}
+
+/*
+ * BER LDAPMessage SEQUENCE. Each length form is handled by its own branch
+ * so every read stays at a constant offset.
+ */
+static __always_inline int l7_is_ldap(const __u8 *p) {
+    if (p[0] != 0x30) {
+        return 0;
+    }
+    switch (p[1]) {
+    case 0x81:
+        return l7_ldap_message_id(p, 3);
+    case 0x82:
+        return l7_ldap_message_id(p, 4);
+    case 0x84:
+        return l7_ldap_message_id(p, 6);
+    }
+    return p[1] < 0x80 && l7_ldap_message_id(p, 2);
+}
+
+static __always_inline __u32 l7_classify(const __u8 *p, const struct flow_key *key) {
+    if (key->protocol == IPPROTO_TCP) {
+        if (l7_is_tls(p)) {
+            return L7_PROTO_TLS;
+        }
+        if (l7_is_http(p)) {
+            return L7_PROTO_HTTP;
+        }
+        if (l7_is_ssh(p)) {
+            return L7_PROTO_SSH;
+        }
+        if (l7_is_smb(p)) {
+            return L7_PROTO_SMB;
+        }
+        if (l7_is_rdp(p)) {
+            return L7_PROTO_RDP;
+        }
+        // TCP Kerberos and DNS carry a record length prefix (4 and 2 bytes)
+        if (l7_port(key, 88) && p[0] == 0 && l7_is_krb_tag(p[4])) {
+            return L7_PROTO_KERBEROS;
+        }
+        if (l7_dns_port(key) && l7_is_dns(p + 2)) {
+            return L7_PROTO_DNS;
+        }
+        if (l7_is_ldap(p)) {
+            return L7_PROTO_LDAP;
+        }
+    } else if (key->protocol == IPPROTO_UDP) {
+        if (l7_dns_port(key) && l7_is_dns(p)) {
+            return L7_PROTO_DNS;
+        }
+        if (l7_port(key, 88) && l7_is_krb_tag(p[0])) {
+            return L7_PROTO_KERBEROS;
+        }
+        if (l7_port(key, 389) && l7_is_ldap(p)) {
+            return L7_PROTO_LDAP;
+        }
+    }
+    return L7_PROTO_UNKNOWN;
+}
+
+/*
+ * Classify the flow from this payload unless this CPU already settled it.
+ * Runs on at most L7_MAX_ATTEMPTS payload packets per flow.
+ */
+static __always_inline void flow_classify(struct flow_stats *stats, const struct flow_key *key,
+                                          const __u8 *payload, const void *data_end) {
+    __u32 tries;
+    __u32 l7;
+
+    if (stats->flags & FLOW_STATS_L7_DONE) {
+        return;
+    }
+    if ((const void *)(payload + L7_PEEK_BYTES) > data_end) {
+        return;
+    }
+    l7 = l7_classify(payload, key);
+    tries = ((stats->flags & FLOW_STATS_L7_TRIES_MASK) >> FLOW_STATS_L7_TRIES_SHIFT) + 1;
+    stats->flags = (stats->flags & ~FLOW_STATS_L7_TRIES_MASK) | (tries << FLOW_STATS_L7_TRIES_SHIFT);
+    if (l7 != L7_PROTO_UNKNOWN || tries >= L7_MAX_ATTEMPTS) {
+        stats->l7_protocol = l7;
+        stats->flags |= FLOW_STATS_L7_DONE;
+    }
+}
+
+/*
+ * Tell the consumer a flow ended: on RST, or once this CPU has seen FIN
+ * in both directions. A FIN only marks its direction until then, so the
+ * peer's FIN/ACK and the last ACK stay in the same entry. The entry stays
+ * in flow_map so the consumer can sum every CPU's slot; the flags keep
+ * retransmitted FINs and RSTs from queueing duplicates. If the ring is
+ * full, or the FINs landed on different CPUs, the sweeper ends the flow.
+ */
+static __always_inline void flow_end(struct flow_stats *stats, struct flow_key *key, __u32 dir, __u32 reason) {
+    struct flow_record *record;
+    __u32 fin = dir == FLOW_DIR_FORWARD ? FLOW_STATS_FIN_FORWARD : FLOW_STATS_FIN_REVERSE;
+
+    if (reason == FLOW_END_FIN) {
+        if (stats->flags & fin) {
+            return;
+        }
+        stats->flags |= fin;
+        if ((stats->flags & FLOW_STATS_FIN_BOTH) != FLOW_STATS_FIN_BOTH) {
+            return;
+        }
+    } else if (stats->flags & FLOW_STATS_ENDED) {
+        return;
+    }
+    record = bpf_ringbuf_reserve(&flow_events, sizeof(*record), 0);
+    if (!record) {
+        flow_counter_add(FLOW_COUNTER_RECORD_DROPS, 1);
+        return;
+    }
+    stats->flags |= FLOW_STATS_ENDED;
+    record->key = *key;
+    record->stats = *stats;
+    record->end_reason = reason;
+    record->cpu = bpf_get_smp_processor_id();
+    bpf_ringbuf_submit(record, 0);
+    flow_counter_add(FLOW_COUNTER_RECORDS, 1);
+}
+
+/*
+ * Extract the flow tuple from an Ethernet frame, update counters and
+ * classify L7. Shared by every hook; bytes is the frame length the hook
+ * reports.
+ */
+static __always_inline void flow_track(void *data, void *data_end, __u64 bytes) {
     struct ethhdr *eth = data;
     if ((void *)(eth + 1) > data_end) {
-        return XDP_PASS;
+        return;
     }
     
     // Check for IP
-    if (eth->h_proto != htons(ETH_P_IP)) {
-        return XDP_PASS;
+    if (eth->h_proto != bpf_htons(ETH_P_IP)) {
+        return;
     }
     
     struct iphdr *ip = (struct iphdr *)(eth + 1);
-    if ((void *)(ip + 1) > data_end) {
-        return XDP_PASS;
+    if ((void *)(ip + 1) > data_end || ip->ihl < 5) {
+        return;
     }
     
     // Build flow key
@@ -73,43 +577,79 @@ int xdp_flow_tracker(struct xdp_md *ctx) {
         .protocol = ip->protocol
     };
     
+    __u8 *l4 = (__u8 *)ip + ip->ihl * 4;
+    __u8 *payload = NULL;
+    __u32 end_reason = 0;
+    __u8 tcp_flags = 0;
+
     // Extract ports for TCP/UDP
-    if (ip->protocol == IPPROTO_TCP || ip->protocol == IPPROTO_UDP) {
-        struct tcphdr *tcp = (struct tcphdr *)(ip + 1);
+    if (ip->protocol == IPPROTO_TCP) {
+        struct tcphdr *tcp = (struct tcphdr *)l4;
         if ((void *)(tcp + 1) > data_end) {
-            return XDP_PASS;
+            return;
         }
-        
-        if (ip->protocol == IPPROTO_TCP) {
-            key.src_port = tcp->source;
-            key.dst_port = tcp->dest;
-        } else {
-            struct udphdr *udp = (struct udphdr *)(ip + 1);
-            if ((void *)(udp + 1) > data_end) {
-                return XDP_PASS;
-            }
-            key.src_port = udp->source;
-            key.dst_port = udp->dest;
+        key.src_port = tcp->source;
+        key.dst_port = tcp->dest;
+        if (tcp->doff >= 5) {
+            payload = (__u8 *)tcp + tcp->doff * 4;
         }
+        tcp_flags = ((__u8 *)tcp)[13];      /* CWR..FIN, the byte after doff */
+        if (tcp->rst) {
+            end_reason = FLOW_END_RST;
+        } else if (tcp->fin) {
+            end_reason = FLOW_END_FIN;
+        }
+    } else if (ip->protocol == IPPROTO_UDP) {
+        struct udphdr *udp = (struct udphdr *)l4;
+        if ((void *)(udp + 1) > data_end) {
+            return;
+        }
+        key.src_port = udp->source;
+        key.dst_port = udp->dest;
+        payload = (__u8 *)(udp + 1);
     }
     
+    // Sketches see every packet, before the flow map can refuse it
+    sketch_update(key.src_ip, key.dst_ip, key.dst_port, bytes);
+
     // Update flow stats
-    struct flow_stats *stats = bpf_map_lookup_elem(&flow_map, &key);
+    __u32 dir = flow_key_canonicalize(&key);
+    struct flow_stats *stats = flow_account(&key, dir, bytes, tcp_flags);
     if (!stats) {
-        struct flow_stats new_stats = {
-            .packet_count = 1,
-            .byte_count = ctx->data_end - ctx->data,
-            .first_seen = bpf_ktime_get_ns(),
-            .last_seen = bpf_ktime_get_ns()
-        };
-        bpf_map_update_elem(&flow_map, &key, &new_stats, BPF_ANY);
-    } else {
-        stats->packet_count++;
-        stats->byte_count += (ctx->data_end - ctx->data);
-        stats->last_seen = bpf_ktime_get_ns();
+        return;
     }
-    
-    return XDP_PASS;
+    if (payload) {
+        flow_classify(stats, &key, payload, data_end);
+    }
+    if (end_reason) {
+        flow_end(stats, &key, dir, end_reason);
+    }
+}
+
+/*
+ * eBPF program: Flow tracking on XDP (ingress only)
+ */
+SEC("xdp")
+int xdp_flow_tracker(struct xdp_md *ctx) {
+    flow_track((void *)(long)ctx->data, (void *)(long)ctx->data_end, ctx->data_end - ctx->data);
+    return xdp_verdict(ctx);
+}
+
+/*
+ * eBPF programs: Flow tracking on a clsact qdisc, one per direction.
+ * Attach both to the same interface (not to both sides of a forwarding
+ * path, which would count routed packets twice). Never alter the verdict.
+ */
+SEC("tc")
+int tc_flow_ingress(struct __sk_buff *skb) {
+    flow_track((void *)(long)skb->data, (void *)(long)skb->data_end, skb->len);
+    return TC_ACT_OK;
+}
+
+SEC("tc")
+int tc_flow_egress(struct __sk_buff *skb) {
+    flow_track((void *)(long)skb->data, (void *)(long)skb->data_end, skb->len);
+    return TC_ACT_OK;
 }
 
 char _license[] SEC("license") = "GPL";
@@ -0,0 +1,307 @@
+/*
+ * RansomEye DPI Advanced - eBPF Flow Tracker
+ * AUTHORITATIVE: Map layouts shared by the flow tracker program and its userspace readers
+ *
+ * NOTE:
+ * - flow_map is BPF_MAP_TYPE_LRU_PERCPU_HASH: every CPU owns its own
+ *   flow_stats slot per key, so the datapath never races, and a full map
+ *   evicts the least recently used flow instead of refusing new ones.
+ * - Readers get one flow_stats per possible CPU for each key and combine
+ *   them with flow_stats_aggregate().
+ * - LRU eviction is silent in the kernel. The datapath counts inserts;
+ *   evictions = inserts - flows removed by userspace - live entries.
+ * - A TCP RST, or FIN seen in both directions, pushes a flow_record into
+ *   the flow_events ring buffer. The consumer completes it from flow_map
+ *   (all CPUs) and removes the entry, at once for RST and after a linger
+ *   for the closing ACKs for FIN; idle flows, and flows whose FINs were
+ *   seen on different CPUs, are swept out of flow_map by the consumer.
+ * - Per-source sketches (talker_cms, talker_candidates, fanout_hll) are
+ *   per-CPU arrays updated for every IPv4 packet, so scans and floods are
+ *   measured without a flow_map entry per probe. Readers sum (count-min)
+ *   or max-merge (HyperLogLog) the CPUs' copies. A fanout_hll slot belongs
+ *   to one source at a time (see struct fanout_slot), and readers merge
+ *   only the CPUs' copies that agree on the owner.
+ * - Each slot also keeps log2-bucketed packet-size and inter-arrival
+ *   histograms and TCP flag counts. Inter-arrival times are measured
+ *   between packets of the flow on the same CPU; readers sum the CPUs'
+ *   buckets, so a flow spread over CPUs reports fewer, longer gaps.
+ * - flow_key is canonical: the lower (ip, port) endpoint is always src, so
+ *   both directions of a conversation share one entry, whichever hook
+ *   (XDP, TC ingress, TC egress) saw the packet. Counters are split by
+ *   FLOW_DIR_* relative to the canonical key.
+ */
+
+#ifndef RANSOMEYE_EBPF_FLOW_TRACKER_H
+#define RANSOMEYE_EBPF_FLOW_TRACKER_H
+
+/* The BPF build gets these types from vmlinux.h */
+#ifndef __VMLINUX_H__
+#include <linux/types.h>
+#endif
+
+/* Capacity of flow_map; loaders may also resize it before load */
+#ifndef FLOW_MAP_MAX_ENTRIES
+#define FLOW_MAP_MAX_ENTRIES 262144
+#endif
+
+/* Size of flow_events; power of two and a page multiple */
+#ifndef FLOW_EVENTS_RINGBUF_BYTES
+#define FLOW_EVENTS_RINGBUF_BYTES (4u * 1024u * 1024u)
+#endif
+
+/* Count-min sketch of bytes sent per source: DEPTH rows of WIDTH cells */
+#define TALKER_CMS_DEPTH 4
+#define TALKER_CMS_WIDTH 4096             /* Power of two */
+/* Heavy-hitter candidates (the sketch cannot enumerate its keys), one source per slot */
+#define TALKER_CANDIDATES 1024            /* Power of two */
+/* HyperLogLog of distinct destinations (ip, port) per source slot */
+#define FANOUT_SLOTS 4096                 /* Power of two */
+#define FANOUT_HLL_BITS 6
+#define FANOUT_HLL_REGISTERS (1u << FANOUT_HLL_BITS)
+
+#define SKETCH_SEED_CANDIDATE 0x85EBCA6Bu
+#define SKETCH_SEED_FANOUT 0xC2B2AE35u
+#define SKETCH_SEED_DESTINATION 0x27D4EB2Fu
+
+/* flow_counters indexes (per-CPU array, sum across CPUs) */
+#define FLOW_COUNTER_PACKETS 0            /* IPv4 frames accounted to a flow */
+#define FLOW_COUNTER_INSERTS 1            /* New flow_map entries */
+#define FLOW_COUNTER_INSERT_FAILURES 2    /* Inserts the map refused (LRU free list exhausted) */
+#define FLOW_COUNTER_RECORDS 3            /* flow_records pushed to flow_events */
+#define FLOW_COUNTER_RECORD_DROPS 4       /* flow_records lost to a full flow_events (flow left to the sweeper) */
+#define FLOW_COUNTER_MAX 5
+
+/* flow_stats.flags */
+#define FLOW_STATS_ENDED 0x1               /* This CPU already pushed a flow_record for the flow */
+#define FLOW_STATS_ORIGIN_REVERSE 0x4      /* This CPU's first packet ran dst -> src of the canonical key */
+
+#define FLOW_STATS_L7_DONE 0x2             /* Classifiers finished on this CPU (l7_protocol final) */
+#define FLOW_STATS_L7_TRIES_SHIFT 4
+#define FLOW_STATS_L7_TRIES_MASK 0xF0     /* Payload packets this CPU has classified so far */
+#define FLOW_STATS_FIN_FORWARD 0x100      /* This CPU saw a FIN in FLOW_DIR_FORWARD */
+#define FLOW_STATS_FIN_REVERSE 0x200      /* ... and in FLOW_DIR_REVERSE */
+#define FLOW_STATS_FIN_BOTH (FLOW_STATS_FIN_FORWARD | FLOW_STATS_FIN_REVERSE)
+
+/* flow_stats.l7_protocol */
+#define L7_PROTO_UNKNOWN 0
+#define L7_PROTO_TLS 1
+#define L7_PROTO_HTTP 2
+#define L7_PROTO_DNS 3
+#define L7_PROTO_SMB 4
+#define L7_PROTO_RDP 5
+#define L7_PROTO_SSH 6
+#define L7_PROTO_KERBEROS 7
+#define L7_PROTO_LDAP 8
+
+/* Classifiers read this many payload bytes; shorter payloads are skipped */
+#define L7_PEEK_BYTES 16
+/* Payload packets per flow the classifiers try before settling on UNKNOWN */
+#define L7_MAX_ATTEMPTS 4
+
+/* flow_stats.packets[] / bytes[] index */
+#define FLOW_DIR_FORWARD 0                /* Canonical src -> dst */
+#define FLOW_DIR_REVERSE 1
+
+/* flow_stats.size_hist[]: bucket b counts frames of [2^(b+5), 2^(b+6)) bytes, ends open */
+#define FLOW_HIST_BUCKETS 8
+#define FLOW_SIZE_HIST_SHIFT 5            /* Bucket 0: < 64 bytes, bucket 7: >= 4096 */
+/* flow_stats.iat_hist[]: bucket b counts gaps of [8^b, 8^(b+1)) microseconds, ends open */
+#define FLOW_IAT_HIST_SHIFT 10            /* ns -> ~us */
+#define FLOW_IAT_HIST_LOG2_STEP 3         /* Bucket 0: < 8 us, bucket 7: >= ~2.1 s */
+
+/* flow_stats.tcp_flags[] index: bit position in the TCP flags byte */
+#define FLOW_TCP_FIN 0
+#define FLOW_TCP_SYN 1
+#define FLOW_TCP_RST 2
+#define FLOW_TCP_PSH 3
+#define FLOW_TCP_ACK 4
+#define FLOW_TCP_URG 5
+#define FLOW_TCP_ECE 6
+#define FLOW_TCP_CWR 7
+#define FLOW_TCP_FLAGS 8
+
+/* flow_record.end_reason */
+#define FLOW_END_FIN 1
+#define FLOW_END_RST 2
+#define FLOW_END_IDLE 3                   /* Set by the userspace sweeper, never by the datapath */
+#define FLOW_END_DETACH 4                 /* Drained by userspace after the tracker was detached */
+
+/* Canonical: (src_ip, src_port) <= (dst_ip, dst_port), compared in host order */
+struct flow_key {
+    __be32 src_ip;
+    __be32 dst_ip;
+    __be16 src_port;
+    __be16 dst_port;
+    __u8 protocol;
+    __u8 pad[3];                    /* Keys are hashed bytewise; always zero */
+};
+
+/* One per CPU per flow, 152 bytes */
+struct flow_stats {
+    __u64 packets[2];               /* FLOW_DIR_* */
+    __u64 bytes[2];
+    __u64 first_seen;               /* bpf_ktime_get_ns(), 0 if this CPU never saw the flow */
+    __u64 last_seen;
+    __u32 l7_protocol;
+    __u32 flags;                    /* FLOW_STATS_* */
+    __u32 size_hist[FLOW_HIST_BUCKETS];     /* Both directions */
+    __u32 iat_hist[FLOW_HIST_BUCKETS];      /* Both directions; packets - 1 entries on one CPU */
+    __u32 tcp_flags[FLOW_TCP_FLAGS];        /* Packets carrying each flag, FLOW_TCP_* */
+};
+
+/* flow_events entry, 176 bytes */
+struct flow_record {
+    struct flow_key key;
+    struct flow_stats stats;        /* Ending CPU's slot in the ring; all CPUs once completed */
+    __u32 end_reason;               /* FLOW_END_* */
+    __u32 cpu;                      /* CPU that ended the flow */
+};
+
+/* talker_candidates value */
+struct talker_candidate {
+    __be32 src_ip;
+    __u32 pad;
+    __u64 estimate;                 /* This CPU's count-min estimate for src_ip when last written */
+};
+
+/*
+ * fanout_hll value, 80 bytes. Sources share a slot when their hashes
+ * collide, but the registers only ever count one source's destinations:
+ * the slot's owner. Every packet from another source costs the owner one
+ * vote (majority vote); once the votes are gone the next colliding source
+ * takes the slot over with cleared registers. A fan-out source outweighs
+ * a colliding ordinary source and keeps the slot. A source that loses the
+ * slot to a busier one goes unreported for the period. It is never
+ * credited with the owner's destinations.
+ */
+struct fanout_slot {
+    __be32 src_ip;                  /* Owner on this CPU */
+    __u32 updates;                  /* Owner packets since it took the slot */
+    __u32 votes;                    /* Owner packets minus other sources' packets */
+    __u32 pad;
+    __u8 registers[FANOUT_HLL_REGISTERS];   /* Owner's (dst_ip, dst_port) HyperLogLog */
+};
+
+/* murmur3 finalizer; addresses are hashed as raw network-order words */
+static inline __u32 sketch_hash(__u32 value, __u32 seed) {
+    __u32 h = value ^ seed;
+
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+/* talker_cms index of src_ip's cell in row */
+static inline __u32 sketch_cms_cell(__be32 src_ip, __u32 row) {
+    return row * TALKER_CMS_WIDTH + (sketch_hash(src_ip, 0x9E3779B9u * (row + 1)) & (TALKER_CMS_WIDTH - 1));
+}
+
+/* floor(log2(value)), 0 for 0 and 1; branchy but loop-free for the verifier */
+static inline __u32 flow_log2(__u64 value) {
+    __u32 log = 0;
+
+    if (value >> 32) {
+        value >>= 32;
+        log += 32;
+    }
+    if (value >> 16) {
+        value >>= 16;
+        log += 16;
+    }
+    if (value >> 8) {
+        value >>= 8;
+        log += 8;
+    }
+    if (value >> 4) {
+        value >>= 4;
+        log += 4;
+    }
+    if (value >> 2) {
+        value >>= 2;
+        log += 2;
+    }
+    if (value >> 1) {
+        log += 1;
+    }
+    return log;
+}
+
+/* size_hist bucket of a frame */
+static inline __u32 flow_size_bucket(__u64 bytes) {
+    __u32 log = flow_log2(bytes);
+
+    if (log <= FLOW_SIZE_HIST_SHIFT) {
+        return 0;
+    }
+    log -= FLOW_SIZE_HIST_SHIFT;
+    return log < FLOW_HIST_BUCKETS ? log : FLOW_HIST_BUCKETS - 1;
+}
+
+/* iat_hist bucket of a gap in nanoseconds */
+static inline __u32 flow_iat_bucket(__u64 gap_ns) {
+    __u32 bucket = flow_log2(gap_ns >> FLOW_IAT_HIST_SHIFT) / FLOW_IAT_HIST_LOG2_STEP;
+
+    return bucket < FLOW_HIST_BUCKETS ? bucket : FLOW_HIST_BUCKETS - 1;
+}
+
+/*
+ * Combine the per-CPU values of one flow_map entry. The flow's origin is
+ * the direction of the earliest first packet over all CPUs.
+ */
+static inline void flow_stats_aggregate(const struct flow_stats *percpu, unsigned int ncpus,
+                                        struct flow_stats *out) {
+    __u32 origin = 0;
+    unsigned int cpu;
+    unsigned int i;
+
+    out->packets[FLOW_DIR_FORWARD] = 0;
+    out->packets[FLOW_DIR_REVERSE] = 0;
+    out->bytes[FLOW_DIR_FORWARD] = 0;
+    out->bytes[FLOW_DIR_REVERSE] = 0;
+    out->first_seen = 0;
+    out->last_seen = 0;
+    out->l7_protocol = 0;
+    out->flags = 0;
+    for (i = 0; i < FLOW_HIST_BUCKETS; i++) {
+        out->size_hist[i] = 0;
+        out->iat_hist[i] = 0;
+    }
+    for (i = 0; i < FLOW_TCP_FLAGS; i++) {
+        out->tcp_flags[i] = 0;
+    }
+    for (cpu = 0; cpu < ncpus; cpu++) {
+        const struct flow_stats *slot = &percpu[cpu];
+
+        out->flags |= slot->flags & ~FLOW_STATS_ORIGIN_REVERSE;
+        if (slot->packets[FLOW_DIR_FORWARD] + slot->packets[FLOW_DIR_REVERSE] == 0) {
+            continue;
+        }
+        out->packets[FLOW_DIR_FORWARD] += slot->packets[FLOW_DIR_FORWARD];
+        out->packets[FLOW_DIR_REVERSE] += slot->packets[FLOW_DIR_REVERSE];
+        out->bytes[FLOW_DIR_FORWARD] += slot->bytes[FLOW_DIR_FORWARD];
+        out->bytes[FLOW_DIR_REVERSE] += slot->bytes[FLOW_DIR_REVERSE];
+        if (out->first_seen == 0 || slot->first_seen < out->first_seen) {
+            out->first_seen = slot->first_seen;
+            origin = slot->flags & FLOW_STATS_ORIGIN_REVERSE;
+        }
+        if (slot->last_seen > out->last_seen) {
+            out->last_seen = slot->last_seen;
+        }
+        if (out->l7_protocol == 0) {
+            out->l7_protocol = slot->l7_protocol;
+        }
+        for (i = 0; i < FLOW_HIST_BUCKETS; i++) {
+            out->size_hist[i] += slot->size_hist[i];
+            out->iat_hist[i] += slot->iat_hist[i];
+        }
+        for (i = 0; i < FLOW_TCP_FLAGS; i++) {
+            out->tcp_flags[i] += slot->tcp_flags[i];
+        }
+    }
+    out->flags |= origin;
+}
+
+#endif /* RANSOMEYE_EBPF_FLOW_TRACKER_H */
@@ -0,0 +1,1461 @@
+/*
+ * RansomEye DPI Advanced - eBPF Flow Export
+ * AUTHORITATIVE: Consumer for flows completed by the XDP flow tracker
+ *
+ * NOTE:
+ * - Raw bpf(2) and ring buffer mmap only (no libbpf dependency).
+ * - The ring buffer's data area is mapped twice back to back by the
+ *   kernel, so a record that wraps the end is still read linearly.
+ * - Work is O(ended flows) per read plus one flow_map walk per sweep
+ *   interval; packets never cross into userspace.
+ * - FIN notifications linger FLOW_EXPORT_FIN_LINGER_NS before the flow is
+ *   completed, so the closing ACK is counted in the same record; RST
+ *   notifications are completed at once.
+ * - Sweeps read flow_map with BPF_MAP_LOOKUP_BATCH and remove idle flows
+ *   with BPF_MAP_DELETE_BATCH, thousands of entries per syscall. Kernels
+ *   without batch ops (pre-5.6) fall back to a per-key walk.
+ */
+
+#define _GNU_SOURCE
+
+#include "flow_export.h"
+
+#include <linux/bpf.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+/* Kernel-internal ENOTSUPP, returned by kernels without LOOKUP_AND_DELETE for hash maps */
+#define FLOW_EXPORT_ENOTSUPP 524
+
+/* flow_record.cpu for records produced by the idle sweeper */
+#define FLOW_EXPORT_SWEEPER_CPU 0xFFFFFFFFu
+
+#define FLOW_EXPORT_PENDING_INITIAL 1024u
+
+/* Time a flow closed by FIN in both directions stays in flow_map (as FLOW_TABLE_FIN_LINGER_NS) */
+#define FLOW_EXPORT_FIN_LINGER_NS 1000000000ULL
+
+/* HyperLogLog bias constant for 64 registers */
+#define FLOW_EXPORT_HLL_ALPHA 0.709
+
+#if FANOUT_HLL_REGISTERS != 64
+#error "flow_export_linear_counting is tabulated for 64 HyperLogLog registers"
+#endif
+
+/* Entries per batch syscall, bounded by the per-CPU value buffer size */
+#define FLOW_EXPORT_BATCH_MAX 4096u
+#define FLOW_EXPORT_BATCH_MIN 64u
+#define FLOW_EXPORT_BATCH_BYTES (8u * 1024u * 1024u)
+
+/* A FIN notification waiting out the linger */
+struct flow_export_linger {
+    struct flow_record record;
+    uint64_t deadline_ns;           /* CLOCK_MONOTONIC */
+};
+
+struct flow_export {
+    int map_fd;
+    int events_fd;
+    int counters_fd;
+    int epoll_fd;
+    uint32_t ncpus;                 /* Possible CPUs: per-CPU values come back in this many slots */
+    uint32_t map_max_entries;
+
+    uint64_t *consumer_pos;
+    const uint64_t *producer_pos;
+    const unsigned char *ring_data;
+    uint64_t ring_mask;
+    void *consumer_map;
+    void *producer_map;
+    size_t page_size;
+    size_t producer_map_len;
+
+    struct flow_stats *percpu_stats;
+    uint64_t *percpu_counter;
+    int lookup_and_delete;          /* Kernel supports BPF_MAP_LOOKUP_AND_DELETE_ELEM on flow_map */
+
+    /* Sweeper output not yet returned, records [pending_head, pending_count) */
+    struct flow_record *pending;
+    uint32_t pending_head;
+    uint32_t pending_count;
+    uint32_t pending_cap;
+    /* FIN notifications not yet completed, [linger_head, linger_count) in deadline order */
+    struct flow_export_linger *linger;
+    uint32_t linger_head;
+    uint32_t linger_count;
+    uint32_t linger_cap;
+    struct flow_key *sweep_keys;
+    struct flow_stats *sweep_totals;    /* Stats of sweep_keys[i] when the batch scan read it */
+    uint32_t sweep_cap;
+
+    /* Source sketches, -1 when the pinned tracker predates them */
+    int cms_fd;
+    int candidates_fd;
+    int fanout_fd;
+    uint64_t *cms_totals;           /* talker_cms summed over CPUs */
+    uint32_t *candidate_ips;        /* Distinct talker_candidates sources, TALKER_CANDIDATES * ncpus */
+    uint32_t *sketch_keys;
+    unsigned char *sketch_values;   /* One chunk of a per-CPU array */
+    size_t sketch_values_len;
+
+    int batch_ops;                  /* Kernel supports batch ops on flow_map */
+    uint32_t batch_size;
+    struct flow_key *batch_keys;
+    struct flow_stats *batch_values;    /* batch_size * ncpus */
+
+    uint64_t idle_timeout_ns;
+    uint64_t sweep_interval_ns;
+    uint64_t next_sweep_ns;
+    uint64_t removed;               /* flow_map entries this consumer deleted */
+
+    struct flow_export_stats stats;
+};
+
+/* 64 * ln(64 / V): HyperLogLog's small-range (linear counting) estimate with V zero registers */
+static const double flow_export_linear_counting[FANOUT_HLL_REGISTERS + 1] = {
+    0.0, 266.168517, 221.807098, 195.857331, 177.445678, 163.164491,
+    151.495911, 141.630268, 133.084259, 125.546144, 118.803071, 112.703220,
+    107.134492, 102.011758, 97.268848, 92.853304, 88.722839, 84.842863,
+    81.184725, 77.724423, 74.441652, 71.319081, 68.341800, 65.496888,
+    62.773072, 60.160465, 57.650339, 55.234958, 52.907429, 50.661584,
+    48.491885, 46.393336, 44.361420, 42.392033, 40.481444, 38.626241,
+    36.823305, 35.069771, 33.363003, 31.700572, 30.080232, 28.499905,
+    26.957662, 25.451710, 23.980381, 22.542118, 21.135468, 19.759071,
+    18.411653, 17.092018, 15.799045, 14.531677, 13.288919, 12.069835,
+    10.873538, 9.699193, 8.546009, 7.413236, 6.300165, 5.206121,
+    4.130465, 3.072590, 2.031917, 1.007895, 0.000000
+};
+
+static long flow_export_bpf(int cmd, union bpf_attr *attr) {
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Number of possible CPUs (highest id in /sys/devices/system/cpu/possible
+ * plus one), which is what per-CPU map lookups are sized by.
+ */
+static int possible_cpus(void) {
+    char buf[256];
+    char *cursor = buf;
+    unsigned long highest = 0;
+    ssize_t len;
+    int fd;
+
+    fd = open("/sys/devices/system/cpu/possible", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) {
+        errno = EIO;
+        return -1;
+    }
+    buf[len] = '\0';
+    while (*cursor) {
+        char *end;
+        unsigned long value = strtoul(cursor, &end, 10);
+
+        if (end == cursor) {
+            cursor++;
+            continue;
+        }
+        if (value > highest) {
+            highest = value;
+        }
+        cursor = end;
+    }
+    return (int)highest + 1;
+}
+
+static int pinned_map(const char *pin_dir, const char *name, uint32_t key_size, uint32_t value_size,
+                      struct bpf_map_info *info) {
+    char path[512];
+    union bpf_attr attr;
+    int fd;
+
+    if (snprintf(path, sizeof(path), "%s/%s", pin_dir, name) >= (int)sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&attr, 0, sizeof(attr));
+    attr.pathname = (uint64_t)(uintptr_t)path;
+    fd = (int)flow_export_bpf(BPF_OBJ_GET, &attr);
+    if (fd < 0) {
+        return -1;
+    }
+
+    memset(info, 0, sizeof(*info));
+    memset(&attr, 0, sizeof(attr));
+    attr.info.bpf_fd = (uint32_t)fd;
+    attr.info.info_len = sizeof(*info);
+    attr.info.info = (uint64_t)(uintptr_t)info;
+    if (flow_export_bpf(BPF_OBJ_GET_INFO_BY_FD, &attr) < 0) {
+        close(fd);
+        return -1;
+    }
+    // A tracker built from a different ebpf_flow_tracker.h must not be misread
+    if (info->key_size != key_size || info->value_size != value_size) {
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+    return fd;
+}
+
+static int flow_export_map_ring(struct flow_export *export, uint32_t ring_size) {
+    export->page_size = (size_t)sysconf(_SC_PAGESIZE);
+    export->consumer_map = mmap(NULL, export->page_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                export->events_fd, 0);
+    if (export->consumer_map == MAP_FAILED) {
+        return -1;
+    }
+    export->producer_map_len = export->page_size + 2 * (size_t)ring_size;
+    export->producer_map = mmap(NULL, export->producer_map_len, PROT_READ, MAP_SHARED,
+                                export->events_fd, (off_t)export->page_size);
+    if (export->producer_map == MAP_FAILED) {
+        return -1;
+    }
+    export->consumer_pos = export->consumer_map;
+    export->producer_pos = export->producer_map;
+    export->ring_data = (const unsigned char *)export->producer_map + export->page_size;
+    export->ring_mask = ring_size - 1;
+    return 0;
+}
+
+/*
+ * Open the source sketch maps if the pinned tracker has them. Returns 0
+ * when they are open or absent (sketches then report ENOENT), -1 on error.
+ */
+static int flow_export_open_sketches(struct flow_export *export, const char *pin_dir) {
+    struct bpf_map_info info;
+    size_t largest;
+
+    export->cms_fd = pinned_map(pin_dir, "talker_cms", sizeof(uint32_t), sizeof(uint64_t), &info);
+    if (export->cms_fd < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    if (info.max_entries != TALKER_CMS_DEPTH * TALKER_CMS_WIDTH) {
+        errno = EPROTO;
+        return -1;
+    }
+    export->candidates_fd = pinned_map(pin_dir, "talker_candidates", sizeof(uint32_t),
+                                       sizeof(struct talker_candidate), &info);
+    if (export->candidates_fd < 0) {
+        return -1;
+    }
+    if (info.max_entries != TALKER_CANDIDATES) {
+        errno = EPROTO;
+        return -1;
+    }
+    export->fanout_fd = pinned_map(pin_dir, "fanout_hll", sizeof(uint32_t), sizeof(struct fanout_slot), &info);
+    if (export->fanout_fd < 0) {
+        return -1;
+    }
+    if (info.max_entries != FANOUT_SLOTS) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    largest = (size_t)FANOUT_SLOTS * sizeof(struct fanout_slot);
+    if ((size_t)TALKER_CMS_DEPTH * TALKER_CMS_WIDTH * sizeof(uint64_t) > largest) {
+        largest = (size_t)TALKER_CMS_DEPTH * TALKER_CMS_WIDTH * sizeof(uint64_t);
+    }
+    largest *= export->ncpus;
+    export->sketch_values_len = largest < FLOW_EXPORT_BATCH_BYTES ? largest : FLOW_EXPORT_BATCH_BYTES;
+    export->sketch_values = malloc(export->sketch_values_len);
+    export->sketch_keys = calloc(TALKER_CMS_DEPTH * TALKER_CMS_WIDTH, sizeof(uint32_t));
+    export->cms_totals = calloc(TALKER_CMS_DEPTH * TALKER_CMS_WIDTH, sizeof(uint64_t));
+    export->candidate_ips = calloc((size_t)TALKER_CANDIDATES * export->ncpus, sizeof(uint32_t));
+    if (!export->sketch_values || !export->sketch_keys || !export->cms_totals || !export->candidate_ips) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Open the tracker's pinned maps and the ring buffer consumer.
+ * Returns handle on success, NULL on error (errno set; EPROTO when the
+ * pinned maps do not match this build's record layout).
+ */
+struct flow_export *flow_export_open(const struct flow_export_config *config) {
+    struct flow_export *export;
+    struct bpf_map_info info;
+    struct epoll_event event;
+    int ncpus;
+
+    if (!config || !config->pin_dir) {
+        errno = EINVAL;
+        return NULL;
+    }
+    ncpus = possible_cpus();
+    if (ncpus <= 0) {
+        return NULL;
+    }
+
+    export = calloc(1, sizeof(*export));
+    if (!export) {
+        return NULL;
+    }
+    export->map_fd = -1;
+    export->events_fd = -1;
+    export->counters_fd = -1;
+    export->epoll_fd = -1;
+    export->cms_fd = -1;
+    export->candidates_fd = -1;
+    export->fanout_fd = -1;
+    export->consumer_map = MAP_FAILED;
+    export->producer_map = MAP_FAILED;
+    export->ncpus = (uint32_t)ncpus;
+    export->lookup_and_delete = 1;
+    export->idle_timeout_ns = config->idle_timeout_ns;
+    export->sweep_interval_ns = config->sweep_interval_ns ? config->sweep_interval_ns : config->idle_timeout_ns / 4;
+    if (export->idle_timeout_ns) {
+        export->next_sweep_ns = clock_ns(CLOCK_MONOTONIC) + export->sweep_interval_ns;
+    }
+
+    export->batch_ops = 1;
+    export->batch_size = FLOW_EXPORT_BATCH_BYTES / (export->ncpus * (uint32_t)sizeof(struct flow_stats));
+    if (export->batch_size > FLOW_EXPORT_BATCH_MAX) {
+        export->batch_size = FLOW_EXPORT_BATCH_MAX;
+    } else if (export->batch_size < FLOW_EXPORT_BATCH_MIN) {
+        export->batch_size = FLOW_EXPORT_BATCH_MIN;
+    }
+
+    export->percpu_stats = calloc(export->ncpus, sizeof(struct flow_stats));
+    export->percpu_counter = calloc(export->ncpus, sizeof(uint64_t));
+    export->pending_cap = FLOW_EXPORT_PENDING_INITIAL;
+    export->pending = calloc(export->pending_cap, sizeof(struct flow_record));
+    export->batch_keys = calloc(export->batch_size, sizeof(struct flow_key));
+    export->batch_values = calloc((size_t)export->batch_size * export->ncpus, sizeof(struct flow_stats));
+    if (!export->percpu_stats || !export->percpu_counter || !export->pending ||
+        !export->batch_keys || !export->batch_values) {
+        goto fail;
+    }
+
+    export->map_fd = pinned_map(config->pin_dir, "flow_map", sizeof(struct flow_key),
+                                sizeof(struct flow_stats), &info);
+    if (export->map_fd < 0) {
+        goto fail;
+    }
+    export->map_max_entries = info.max_entries;
+    export->counters_fd = pinned_map(config->pin_dir, "flow_counters", sizeof(uint32_t),
+                                     sizeof(uint64_t), &info);
+    if (export->counters_fd < 0) {
+        goto fail;
+    }
+    export->events_fd = pinned_map(config->pin_dir, "flow_events", 0, 0, &info);
+    if (export->events_fd < 0) {
+        goto fail;
+    }
+    if (flow_export_map_ring(export, info.max_entries) != 0) {
+        goto fail;
+    }
+    if (flow_export_open_sketches(export, config->pin_dir) != 0) {
+        goto fail;
+    }
+
+    export->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (export->epoll_fd < 0) {
+        goto fail;
+    }
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    if (epoll_ctl(export->epoll_fd, EPOLL_CTL_ADD, export->events_fd, &event) < 0) {
+        goto fail;
+    }
+    return export;
+
+fail:
+    {
+        int saved_errno = errno;
+        flow_export_close(export);
+        errno = saved_errno;
+    }
+    return NULL;
+}
+
+int flow_export_fd(const struct flow_export *export) {
+    return export ? export->epoll_fd : -1;
+}
+
+/*
+ * Turn a canonical record around so src is the endpoint that sent the
+ * first packet and FLOW_DIR_FORWARD counts initiator -> responder.
+ */
+static void flow_record_orient(struct flow_record *record) {
+    struct flow_key *key = &record->key;
+    struct flow_stats *stats = &record->stats;
+    uint32_t ip;
+    uint16_t port;
+    uint64_t count;
+
+    if (!(stats->flags & FLOW_STATS_ORIGIN_REVERSE)) {
+        return;
+    }
+    ip = key->src_ip;
+    key->src_ip = key->dst_ip;
+    key->dst_ip = ip;
+    port = key->src_port;
+    key->src_port = key->dst_port;
+    key->dst_port = port;
+    count = stats->packets[FLOW_DIR_FORWARD];
+    stats->packets[FLOW_DIR_FORWARD] = stats->packets[FLOW_DIR_REVERSE];
+    stats->packets[FLOW_DIR_REVERSE] = count;
+    count = stats->bytes[FLOW_DIR_FORWARD];
+    stats->bytes[FLOW_DIR_FORWARD] = stats->bytes[FLOW_DIR_REVERSE];
+    stats->bytes[FLOW_DIR_REVERSE] = count;
+    stats->flags &= ~FLOW_STATS_ORIGIN_REVERSE;
+}
+
+/*
+ * Replace record->stats with the flow's totals over every CPU, remove the
+ * flow from flow_map and orient the record by its initiator.
+ * Returns 1 on success, 0 if the flow is already gone, -1 on error.
+ */
+static int flow_export_complete(struct flow_export *export, struct flow_record *record) {
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = (uint32_t)export->map_fd;
+    attr.key = (uint64_t)(uintptr_t)&record->key;
+    attr.value = (uint64_t)(uintptr_t)export->percpu_stats;
+
+    if (export->lookup_and_delete) {
+        if (flow_export_bpf(BPF_MAP_LOOKUP_AND_DELETE_ELEM, &attr) == 0) {
+            goto found;
+        }
+        if (errno == ENOENT) {
+            return 0;
+        }
+        if (errno != EINVAL && errno != EOPNOTSUPP && errno != FLOW_EXPORT_ENOTSUPP) {
+            return -1;
+        }
+        // Pre-5.14 kernel: lookup then delete, losing only packets that land in between
+        export->lookup_and_delete = 0;
+    }
+    if (flow_export_bpf(BPF_MAP_LOOKUP_ELEM, &attr) != 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    attr.value = 0;
+    if (flow_export_bpf(BPF_MAP_DELETE_ELEM, &attr) != 0 && errno != ENOENT) {
+        return -1;
+    }
+
+found:
+    flow_stats_aggregate(export->percpu_stats, export->ncpus, &record->stats);
+    flow_record_orient(record);
+    export->removed++;
+    return 1;
+}
+
+static void flow_export_count(struct flow_export *export, const struct flow_record *record) {
+    export->stats.records++;
+    if (record->end_reason == FLOW_END_FIN) {
+        export->stats.fin_records++;
+    } else if (record->end_reason == FLOW_END_RST) {
+        export->stats.rst_records++;
+    } else if (record->end_reason == FLOW_END_DETACH) {
+        export->stats.detach_records++;
+    } else {
+        export->stats.idle_records++;
+    }
+}
+
+static int flow_export_push_linger(struct flow_export *export, const struct flow_record *record,
+                                   uint64_t deadline_ns) {
+    if (export->linger_count == export->linger_cap) {
+        if (export->linger_head > 0) {
+            memmove(export->linger, export->linger + export->linger_head,
+                    (size_t)(export->linger_count - export->linger_head) * sizeof(*export->linger));
+            export->linger_count -= export->linger_head;
+            export->linger_head = 0;
+        } else {
+            uint32_t cap = export->linger_cap ? export->linger_cap * 2 : FLOW_EXPORT_PENDING_INITIAL;
+            struct flow_export_linger *grown = realloc(export->linger, (size_t)cap * sizeof(*grown));
+
+            if (!grown) {
+                return -1;
+            }
+            export->linger = grown;
+            export->linger_cap = cap;
+        }
+    }
+    export->linger[export->linger_count].record = *record;
+    export->linger[export->linger_count].deadline_ns = deadline_ns;
+    export->linger_count++;
+    return 0;
+}
+
+/*
+ * Consume ring buffer notifications into records, completing each RST at
+ * once and holding each FIN back for FLOW_EXPORT_FIN_LINGER_NS.
+ * Returns number of records written, -1 on error before any record (the
+ * failing notification stays in the ring and is retried).
+ */
+static int flow_export_consume(struct flow_export *export, uint64_t now_mono, struct flow_record *records,
+                               uint32_t max_records) {
+    uint64_t cons = *export->consumer_pos;
+    uint64_t prod = __atomic_load_n(export->producer_pos, __ATOMIC_ACQUIRE);
+    uint32_t count = 0;
+
+    while (cons < prod && count < max_records) {
+        const uint32_t *header = (const uint32_t *)(export->ring_data + (cons & export->ring_mask));
+        uint32_t len = __atomic_load_n(header, __ATOMIC_ACQUIRE);
+        uint32_t record_len;
+
+        if (len & BPF_RINGBUF_BUSY_BIT) {
+            break;
+        }
+        record_len = len & ~(BPF_RINGBUF_BUSY_BIT | BPF_RINGBUF_DISCARD_BIT);
+        if (!(len & BPF_RINGBUF_DISCARD_BIT) && record_len == sizeof(struct flow_record)) {
+            struct flow_record *record = &records[count];
+            int rc;
+
+            memcpy(record, (const unsigned char *)header + BPF_RINGBUF_HDR_SZ, sizeof(*record));
+            if (record->end_reason == FLOW_END_FIN) {
+                // Completed by flow_export_expire_linger() once the closing ACK is in
+                if (flow_export_push_linger(export, record, now_mono + FLOW_EXPORT_FIN_LINGER_NS) != 0) {
+                    return count > 0 ? (int)count : -1;
+                }
+            } else {
+                rc = flow_export_complete(export, record);
+                if (rc < 0) {
+                    return count > 0 ? (int)count : -1;
+                }
+                if (rc > 0) {
+                    flow_export_count(export, record);
+                    count++;
+                } else {
+                    export->stats.stale_records++;
+                }
+            }
+        }
+        cons += (record_len + BPF_RINGBUF_HDR_SZ + 7) & ~7ULL;
+        __atomic_store_n(export->consumer_pos, cons, __ATOMIC_RELEASE);
+    }
+    return (int)count;
+}
+
+static int flow_export_push_pending(struct flow_export *export, const struct flow_record *record) {
+    if (export->pending_count == export->pending_cap) {
+        if (export->pending_head > 0) {
+            memmove(export->pending, export->pending + export->pending_head,
+                    (size_t)(export->pending_count - export->pending_head) * sizeof(*record));
+            export->pending_count -= export->pending_head;
+            export->pending_head = 0;
+        } else {
+            struct flow_record *grown = realloc(export->pending,
+                                                (size_t)export->pending_cap * 2 * sizeof(*record));
+            if (!grown) {
+                return -1;
+            }
+            export->pending = grown;
+            export->pending_cap *= 2;
+        }
+    }
+    export->pending[export->pending_count++] = *record;
+    return 0;
+}
+
+static uint32_t flow_export_drain_pending(struct flow_export *export, struct flow_record *records,
+                                          uint32_t max_records) {
+    uint32_t count = export->pending_count - export->pending_head;
+
+    if (count > max_records) {
+        count = max_records;
+    }
+    memcpy(records, export->pending + export->pending_head, (size_t)count * sizeof(*records));
+    export->pending_head += count;
+    if (export->pending_head == export->pending_count) {
+        export->pending_head = 0;
+        export->pending_count = 0;
+    }
+    return count;
+}
+
+/*
+ * Complete the lingering FIN notifications due by now_mono into the
+ * pending records. Returns 0 on success, -1 on error (the failing entry
+ * stays queued).
+ */
+static int flow_export_expire_linger(struct flow_export *export, uint64_t now_mono) {
+    while (export->linger_head < export->linger_count) {
+        struct flow_export_linger *entry = &export->linger[export->linger_head];
+        int rc;
+
+        if (entry->deadline_ns > now_mono) {
+            break;
+        }
+        rc = flow_export_complete(export, &entry->record);
+        if (rc < 0) {
+            return -1;
+        }
+        if (rc > 0) {
+            if (flow_export_push_pending(export, &entry->record) != 0) {
+                return -1;
+            }
+            flow_export_count(export, &entry->record);
+        } else {
+            export->stats.stale_records++;
+        }
+        export->linger_head++;
+    }
+    if (export->linger_head == export->linger_count) {
+        export->linger_head = 0;
+        export->linger_count = 0;
+    }
+    return 0;
+}
+
+static uint64_t flow_export_counter(struct flow_export *export, uint32_t index) {
+    union bpf_attr attr;
+    uint64_t total = 0;
+    uint32_t cpu;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = (uint32_t)export->counters_fd;
+    attr.key = (uint64_t)(uintptr_t)&index;
+    attr.value = (uint64_t)(uintptr_t)export->percpu_counter;
+    if (flow_export_bpf(BPF_MAP_LOOKUP_ELEM, &attr) != 0) {
+        return 0;
+    }
+    for (cpu = 0; cpu < export->ncpus; cpu++) {
+        total += export->percpu_counter[cpu];
+    }
+    return total;
+}
+
+/* Errors that mean the kernel has no batch ops for this map type */
+static int flow_export_batch_unsupported(int err) {
+    return err == EINVAL || err == EOPNOTSUPP || err == FLOW_EXPORT_ENOTSUPP;
+}
+
+/* FIN was seen in both directions, on one CPU or split across two */
+static int flow_export_fin_closed(const struct flow_stats *total) {
+    return (total->flags & FLOW_STATS_FIN_BOTH) == FLOW_STATS_FIN_BOTH;
+}
+
+/*
+ * A flow is due once idle for idle_timeout_ns, or once FIN_LINGER past
+ * its closing FINs when no CPU queued a notification for it (the FINs
+ * landed on different CPUs, or the ring was full).
+ */
+static int flow_export_due(const struct flow_export *export, const struct flow_stats *total, uint64_t now_mono) {
+    uint64_t timeout = export->idle_timeout_ns;
+
+    if (flow_export_fin_closed(total) && !(total->flags & FLOW_STATS_ENDED) && FLOW_EXPORT_FIN_LINGER_NS < timeout) {
+        timeout = FLOW_EXPORT_FIN_LINGER_NS;
+    }
+    return total->last_seen + timeout <= now_mono;
+}
+
+/* Remember an idle flow found by a scan (total: its stats as scanned) */
+static int flow_export_collect(struct flow_export *export, uint32_t *key_count,
+                               const struct flow_key *key, const struct flow_stats *total) {
+    if (*key_count == export->sweep_cap) {
+        uint32_t cap = export->sweep_cap ? export->sweep_cap * 2 : FLOW_EXPORT_PENDING_INITIAL;
+        struct flow_key *keys = realloc(export->sweep_keys, (size_t)cap * sizeof(*keys));
+        struct flow_stats *totals;
+
+        if (!keys) {
+            return -1;
+        }
+        export->sweep_keys = keys;
+        totals = realloc(export->sweep_totals, (size_t)cap * sizeof(*totals));
+        if (!totals) {
+            return -1;
+        }
+        export->sweep_totals = totals;
+        export->sweep_cap = cap;
+    }
+    export->sweep_keys[*key_count] = *key;
+    export->sweep_totals[*key_count] = *total;
+    (*key_count)++;
+    return 0;
+}
+
+/*
+ * Read flow_map batch_size entries per syscall and collect idle flows.
+ * Returns 0 on success, -1 on error (errno EINVAL/EOPNOTSUPP before the
+ * first batch when the kernel lacks batch ops).
+ */
+static int flow_export_scan_batch(struct flow_export *export, uint64_t now_mono,
+                                  uint64_t *live, uint32_t *key_count) {
+    union bpf_attr attr;
+    uint32_t in_batch = 0;
+    uint32_t out_batch = 0;           /* Hash maps use a 4-byte bucket cursor */
+    int first = 1;
+    int done = 0;
+
+    while (!done) {
+        uint32_t i;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.batch.map_fd = (uint32_t)export->map_fd;
+        attr.batch.in_batch = first ? 0 : (uint64_t)(uintptr_t)&in_batch;
+        attr.batch.out_batch = (uint64_t)(uintptr_t)&out_batch;
+        attr.batch.keys = (uint64_t)(uintptr_t)export->batch_keys;
+        attr.batch.values = (uint64_t)(uintptr_t)export->batch_values;
+        attr.batch.count = export->batch_size;
+        if (flow_export_bpf(BPF_MAP_LOOKUP_BATCH, &attr) != 0) {
+            if (errno != ENOENT) {
+                return -1;
+            }
+            done = 1;
+        }
+        first = 0;
+        in_batch = out_batch;
+
+        for (i = 0; i < attr.batch.count; i++) {
+            struct flow_stats total;
+
+            flow_stats_aggregate(export->batch_values + (size_t)i * export->ncpus, export->ncpus, &total);
+            (*live)++;
+            if (!flow_export_due(export, &total, now_mono)) {
+                continue;
+            }
+            if (flow_export_collect(export, key_count, &export->batch_keys[i], &total) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Remove the collected idle flows with BPF_MAP_DELETE_BATCH and queue
+ * their records from the scanned stats. A packet landing between scan
+ * and delete is lost, as with the lookup-then-delete fallback; by then
+ * the flow has been idle for idle_timeout_ns.
+ */
+static int flow_export_expire_batch(struct flow_export *export, uint32_t key_count, uint64_t *live) {
+    union bpf_attr attr;
+    uint32_t done = 0;
+
+    while (done < key_count) {
+        uint32_t chunk = key_count - done;
+        uint32_t deleted;
+        uint32_t i;
+        int gone = 0;
+
+        if (chunk > export->batch_size) {
+            chunk = export->batch_size;
+        }
+        memset(&attr, 0, sizeof(attr));
+        attr.batch.map_fd = (uint32_t)export->map_fd;
+        attr.batch.keys = (uint64_t)(uintptr_t)(export->sweep_keys + done);
+        attr.batch.count = chunk;
+        if (flow_export_bpf(BPF_MAP_DELETE_BATCH, &attr) != 0) {
+            // The batch stops at a key the datapath evicted since the scan; skip it
+            if (errno != ENOENT) {
+                return -1;
+            }
+            gone = 1;
+        }
+        deleted = attr.batch.count;
+
+        for (i = done; i < done + deleted; i++) {
+            struct flow_record record;
+
+            memset(&record, 0, sizeof(record));
+            record.key = export->sweep_keys[i];
+            record.stats = export->sweep_totals[i];
+            record.end_reason = flow_export_fin_closed(&record.stats) ? FLOW_END_FIN : FLOW_END_IDLE;
+            record.cpu = FLOW_EXPORT_SWEEPER_CPU;
+            flow_record_orient(&record);
+            export->removed++;
+            (*live)--;
+            if (flow_export_push_pending(export, &record) != 0) {
+                return -1;
+            }
+            flow_export_count(export, &record);
+        }
+        done += deleted + (uint32_t)gone;
+        if (gone) {
+            (*live)--;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Walk flow_map one key at a time (kernels without batch ops). Keys are
+ * collected first and deleted after the walk: deleting the cursor key
+ * would restart GET_NEXT_KEY from the top.
+ */
+static int flow_export_scan_walk(struct flow_export *export, uint64_t now_mono,
+                                 uint64_t *live, uint32_t *key_count) {
+    union bpf_attr attr;
+    struct flow_key key;
+    struct flow_key next_key;
+    struct flow_stats total;
+    uint64_t steps = 0;
+    int have_key = 0;
+
+    for (;;) {
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = (uint32_t)export->map_fd;
+        attr.key = have_key ? (uint64_t)(uintptr_t)&key : 0;
+        attr.next_key = (uint64_t)(uintptr_t)&next_key;
+        if (flow_export_bpf(BPF_MAP_GET_NEXT_KEY, &attr) != 0) {
+            if (errno == ENOENT) {
+                break;
+            }
+            return -1;
+        }
+        // LRU evictions of the cursor key restart the walk; bound it
+        if (++steps > 2ULL * export->map_max_entries) {
+            break;
+        }
+        key = next_key;
+        have_key = 1;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = (uint32_t)export->map_fd;
+        attr.key = (uint64_t)(uintptr_t)&key;
+        attr.value = (uint64_t)(uintptr_t)export->percpu_stats;
+        if (flow_export_bpf(BPF_MAP_LOOKUP_ELEM, &attr) != 0) {
+            if (errno == ENOENT) {
+                continue;
+            }
+            return -1;
+        }
+        (*live)++;
+        flow_stats_aggregate(export->percpu_stats, export->ncpus, &total);
+        if (!flow_export_due(export, &total, now_mono)) {
+            continue;
+        }
+        if (flow_export_collect(export, key_count, &key, &total) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Complete each collected flow from flow_map, one syscall per flow */
+static int flow_export_expire_each(struct flow_export *export, uint32_t key_count, uint64_t *live) {
+    uint32_t i;
+
+    for (i = 0; i < key_count; i++) {
+        struct flow_record record;
+        int rc;
+
+        memset(&record, 0, sizeof(record));
+        record.key = export->sweep_keys[i];
+        record.cpu = FLOW_EXPORT_SWEEPER_CPU;
+        rc = flow_export_complete(export, &record);
+        if (rc < 0) {
+            return -1;
+        }
+        if (rc == 0) {
+            continue;
+        }
+        record.end_reason = flow_export_fin_closed(&record.stats) ? FLOW_END_FIN : FLOW_END_IDLE;
+        (*live)--;
+        if (flow_export_push_pending(export, &record) != 0) {
+            return -1;
+        }
+        flow_export_count(export, &record);
+    }
+    return 0;
+}
+
+/* Move every idle flow, and every closed flow nobody was notified of, to the pending records */
+static int flow_export_sweep(struct flow_export *export, uint64_t now_mono) {
+    uint32_t key_count = 0;
+    uint64_t live = 0;
+    uint64_t inserts;
+    int rc = -1;
+
+    if (export->batch_ops) {
+        rc = flow_export_scan_batch(export, now_mono, &live, &key_count);
+        if (rc != 0 && live == 0 && flow_export_batch_unsupported(errno)) {
+            export->batch_ops = 0;
+        } else if (rc == 0) {
+            rc = flow_export_expire_batch(export, key_count, &live);
+        }
+    }
+    if (!export->batch_ops) {
+        rc = flow_export_scan_walk(export, now_mono, &live, &key_count);
+        if (rc == 0) {
+            rc = flow_export_expire_each(export, key_count, &live);
+        }
+    }
+    if (rc != 0) {
+        return -1;
+    }
+
+    inserts = flow_export_counter(export, FLOW_COUNTER_INSERTS);
+    export->stats.live_flows = live;
+    export->stats.evictions = inserts > export->removed + live ? inserts - export->removed - live : 0;
+    export->stats.sweeps++;
+    return 0;
+}
+
+/*
+ * Move every flow left in flow_map to the pending records: lingering FINs
+ * with end_reason FLOW_END_FIN, the rest with FLOW_END_DETACH. Meant for
+ * after the tracker is detached: with no writer left,
+ * BPF_MAP_LOOKUP_AND_DELETE_BATCH empties the map exactly.
+ * Returns number of flows queued (returned by the next reads), -1 on error.
+ */
+int flow_export_drain(struct flow_export *export) {
+    union bpf_attr attr;
+    uint32_t in_batch = 0;
+    uint32_t out_batch = 0;
+    uint64_t steps = 0;
+    int queued = 0;
+    int first = 1;
+    int done = 0;
+
+    if (!export) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    queued = (int)(export->pending_count - export->pending_head);
+    if (flow_export_expire_linger(export, UINT64_MAX) != 0) {
+        return -1;
+    }
+    queued = (int)(export->pending_count - export->pending_head) - queued;
+
+    while (export->batch_ops && !done) {
+        uint32_t i;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.batch.map_fd = (uint32_t)export->map_fd;
+        attr.batch.in_batch = first ? 0 : (uint64_t)(uintptr_t)&in_batch;
+        attr.batch.out_batch = (uint64_t)(uintptr_t)&out_batch;
+        attr.batch.keys = (uint64_t)(uintptr_t)export->batch_keys;
+        attr.batch.values = (uint64_t)(uintptr_t)export->batch_values;
+        attr.batch.count = export->batch_size;
+        if (flow_export_bpf(BPF_MAP_LOOKUP_AND_DELETE_BATCH, &attr) != 0) {
+            if (first && flow_export_batch_unsupported(errno)) {
+                export->batch_ops = 0;
+                break;
+            }
+            if (errno != ENOENT) {
+                return queued > 0 ? queued : -1;
+            }
+            done = 1;
+        }
+        first = 0;
+        in_batch = out_batch;
+
+        for (i = 0; i < attr.batch.count; i++) {
+            struct flow_record record;
+
+            memset(&record, 0, sizeof(record));
+            record.key = export->batch_keys[i];
+            flow_stats_aggregate(export->batch_values + (size_t)i * export->ncpus, export->ncpus,
+                                 &record.stats);
+            record.end_reason = FLOW_END_DETACH;
+            record.cpu = FLOW_EXPORT_SWEEPER_CPU;
+            flow_record_orient(&record);
+            export->removed++;
+            if (flow_export_push_pending(export, &record) != 0) {
+                return queued > 0 ? queued : -1;
+            }
+            flow_export_count(export, &record);
+            queued++;
+        }
+    }
+
+    // Per-key fallback: always take the first key, since completing it deletes it
+    while (!export->batch_ops && steps++ < 2ULL * export->map_max_entries) {
+        struct flow_record record;
+        int rc;
+
+        memset(&record, 0, sizeof(record));
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = (uint32_t)export->map_fd;
+        attr.next_key = (uint64_t)(uintptr_t)&record.key;
+        if (flow_export_bpf(BPF_MAP_GET_NEXT_KEY, &attr) != 0) {
+            if (errno == ENOENT) {
+                break;
+            }
+            return queued > 0 ? queued : -1;
+        }
+        record.end_reason = FLOW_END_DETACH;
+        record.cpu = FLOW_EXPORT_SWEEPER_CPU;
+        rc = flow_export_complete(export, &record);
+        if (rc < 0) {
+            return queued > 0 ? queued : -1;
+        }
+        if (rc == 0) {
+            continue;
+        }
+        if (flow_export_push_pending(export, &record) != 0) {
+            return queued > 0 ? queued : -1;
+        }
+        flow_export_count(export, &record);
+        queued++;
+    }
+    return queued;
+}
+
+/*
+ * Read up to max_records completed flows: ring buffer notifications first,
+ * then FINs done lingering, then idle flows whenever a sweep is due. Waits up to timeout_ms (<0:
+ * indefinitely) for the first record.
+ * Returns number of records, 0 on timeout, -1 on error.
+ */
+int flow_export_read(struct flow_export *export, int timeout_ms,
+                     struct flow_record *records, uint32_t max_records) {
+    uint64_t deadline = 0;
+    uint64_t now;
+    uint64_t offset;
+    uint32_t count = 0;
+    uint32_t i;
+
+    if (!export || !records || max_records == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    now = clock_ns(CLOCK_MONOTONIC);
+    if (timeout_ms > 0) {
+        deadline = now + (uint64_t)timeout_ms * 1000000ULL;
+    }
+
+    for (;;) {
+        struct epoll_event event;
+        uint64_t wake = 0;
+        int wait_ms = -1;
+        int rc;
+
+        // Records already taken out of flow_map are returned before any error
+        count += flow_export_drain_pending(export, records + count, max_records - count);
+        now = clock_ns(CLOCK_MONOTONIC);
+        rc = flow_export_consume(export, now, records + count, max_records - count);
+        if (rc < 0) {
+            if (count == 0) {
+                return -1;
+            }
+            break;
+        }
+        count += (uint32_t)rc;
+
+        if (flow_export_expire_linger(export, now) != 0 && count == 0 &&
+            export->pending_count == export->pending_head) {
+            return -1;
+        }
+        count += flow_export_drain_pending(export, records + count, max_records - count);
+        if (export->idle_timeout_ns && now >= export->next_sweep_ns) {
+            if (flow_export_sweep(export, now) != 0 && count == 0 &&
+                export->pending_count == export->pending_head) {
+                return -1;
+            }
+            export->next_sweep_ns = now + export->sweep_interval_ns;
+            count += flow_export_drain_pending(export, records + count, max_records - count);
+        }
+        if (count > 0 || timeout_ms == 0 || (timeout_ms > 0 && now >= deadline)) {
+            break;
+        }
+
+        if (timeout_ms > 0) {
+            wake = deadline;
+        }
+        if (export->idle_timeout_ns && (wake == 0 || export->next_sweep_ns < wake)) {
+            wake = export->next_sweep_ns;
+        }
+        if (export->linger_head < export->linger_count &&
+            (wake == 0 || export->linger[export->linger_head].deadline_ns < wake)) {
+            wake = export->linger[export->linger_head].deadline_ns;
+        }
+        if (wake) {
+            wait_ms = wake > now ? (int)((wake - now + 999999ULL) / 1000000ULL) : 0;
+        }
+        if (epoll_wait(export->epoll_fd, &event, 1, wait_ms) < 0) {
+            if (errno == EINTR) {
+                break;
+            }
+            return -1;
+        }
+    }
+
+    // bpf_ktime_get_ns() is CLOCK_MONOTONIC; hand out wall-clock times
+    offset = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC);
+    for (i = 0; i < count; i++) {
+        if (records[i].stats.first_seen) {
+            records[i].stats.first_seen += offset;
+        }
+        if (records[i].stats.last_seen) {
+            records[i].stats.last_seen += offset;
+        }
+    }
+    return (int)count;
+}
+
+/* Elements of a per-CPU array (value_size bytes each) that fit one sketch_values chunk */
+static uint32_t flow_export_sketch_chunk(const struct flow_export *export, uint32_t value_size) {
+    return (uint32_t)(export->sketch_values_len / ((size_t)value_size * export->ncpus));
+}
+
+/*
+ * Read elements [first, first + count) of a per-CPU array into
+ * sketch_values, element-major, one value per possible CPU.
+ */
+static int flow_export_array_read(struct flow_export *export, int fd, uint32_t first, uint32_t count,
+                                  uint32_t value_size) {
+    size_t stride = (size_t)value_size * export->ncpus;
+    union bpf_attr attr;
+    uint32_t i;
+
+    if (export->batch_ops) {
+        uint32_t in_batch = first - 1;    /* Array batches resume after the previous key */
+        uint32_t out_batch = 0;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.batch.map_fd = (uint32_t)fd;
+        attr.batch.in_batch = first ? (uint64_t)(uintptr_t)&in_batch : 0;
+        attr.batch.out_batch = (uint64_t)(uintptr_t)&out_batch;
+        attr.batch.keys = (uint64_t)(uintptr_t)export->sketch_keys;
+        attr.batch.values = (uint64_t)(uintptr_t)export->sketch_values;
+        attr.batch.count = count;
+        if (flow_export_bpf(BPF_MAP_LOOKUP_BATCH, &attr) == 0 ||
+            (errno == ENOENT && attr.batch.count == count)) {
+            return 0;
+        }
+        if (!flow_export_batch_unsupported(errno)) {
+            return -1;
+        }
+        export->batch_ops = 0;
+    }
+    for (i = 0; i < count; i++) {
+        uint32_t key = first + i;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = (uint32_t)fd;
+        attr.key = (uint64_t)(uintptr_t)&key;
+        attr.value = (uint64_t)(uintptr_t)(export->sketch_values + i * stride);
+        if (flow_export_bpf(BPF_MAP_LOOKUP_ELEM, &attr) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Zero every element of a per-CPU array, a chunk per BPF_MAP_UPDATE_BATCH */
+static int flow_export_array_clear(struct flow_export *export, int fd, uint32_t max_entries, uint32_t value_size) {
+    size_t stride = (size_t)value_size * export->ncpus;
+    uint32_t chunk = flow_export_sketch_chunk(export, value_size);
+    union bpf_attr attr;
+    uint32_t first;
+    uint32_t i;
+
+    memset(export->sketch_values, 0, (size_t)chunk * stride);
+    for (first = 0; first < max_entries; first += chunk) {
+        uint32_t count = max_entries - first < chunk ? max_entries - first : chunk;
+
+        for (i = 0; i < count; i++) {
+            export->sketch_keys[i] = first + i;
+        }
+        if (export->batch_ops) {
+            memset(&attr, 0, sizeof(attr));
+            attr.batch.map_fd = (uint32_t)fd;
+            attr.batch.keys = (uint64_t)(uintptr_t)export->sketch_keys;
+            attr.batch.values = (uint64_t)(uintptr_t)export->sketch_values;
+            attr.batch.count = count;
+            if (flow_export_bpf(BPF_MAP_UPDATE_BATCH, &attr) == 0) {
+                continue;
+            }
+            if (!flow_export_batch_unsupported(errno)) {
+                return -1;
+            }
+            export->batch_ops = 0;
+        }
+        for (i = 0; i < count; i++) {
+            memset(&attr, 0, sizeof(attr));
+            attr.map_fd = (uint32_t)fd;
+            attr.key = (uint64_t)(uintptr_t)&export->sketch_keys[i];
+            attr.value = (uint64_t)(uintptr_t)export->sketch_values;
+            if (flow_export_bpf(BPF_MAP_UPDATE_ELEM, &attr) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Insert into entries, kept sorted by value (descending) and at most max long */
+static void flow_export_top_insert(struct flow_sketch_entry *entries, uint32_t *count, uint32_t max,
+                                   uint32_t src_ip, uint64_t value) {
+    uint32_t pos = *count;
+
+    if (max == 0 || value == 0) {
+        return;
+    }
+    if (pos == max) {
+        if (value <= entries[max - 1].value) {
+            return;
+        }
+        pos = max - 1;
+    } else {
+        (*count)++;
+    }
+    while (pos > 0 && entries[pos - 1].value < value) {
+        entries[pos] = entries[pos - 1];
+        pos--;
+    }
+    entries[pos].src_ip = src_ip;
+    entries[pos].reserved = 0;
+    entries[pos].value = value;
+}
+
+static int flow_export_compare_u32(const void *a, const void *b) {
+    uint32_t left = *(const uint32_t *)a;
+    uint32_t right = *(const uint32_t *)b;
+
+    return left < right ? -1 : left > right;
+}
+
+/* HyperLogLog cardinality of one merged register set */
+static uint64_t flow_export_hll_estimate(const uint8_t *registers) {
+    double sum = 0.0;
+    double estimate;
+    uint32_t zeros = 0;
+    uint32_t i;
+
+    for (i = 0; i < FANOUT_HLL_REGISTERS; i++) {
+        sum += 1.0 / (double)(1ULL << registers[i]);
+        zeros += registers[i] == 0;
+    }
+    estimate = FLOW_EXPORT_HLL_ALPHA * FANOUT_HLL_REGISTERS * FANOUT_HLL_REGISTERS / sum;
+    if (estimate <= 2.5 * FANOUT_HLL_REGISTERS && zeros > 0) {
+        estimate = flow_export_linear_counting[zeros];
+    }
+    return (uint64_t)(estimate + 0.5);
+}
+
+static int flow_export_top_talkers(struct flow_export *export, struct flow_sketch_entry *talkers,
+                                   uint32_t *talker_count) {
+    const uint32_t cells = TALKER_CMS_DEPTH * TALKER_CMS_WIDTH;
+    uint32_t chunk = flow_export_sketch_chunk(export, sizeof(uint64_t));
+    uint32_t max_talkers = *talker_count;
+    uint32_t ip_count = 0;
+    uint32_t first;
+    uint32_t i;
+    uint32_t cpu;
+
+    *talker_count = 0;
+    for (first = 0; first < cells; first += chunk) {
+        uint32_t count = cells - first < chunk ? cells - first : chunk;
+        const uint64_t *values = (const uint64_t *)export->sketch_values;
+
+        if (flow_export_array_read(export, export->cms_fd, first, count, sizeof(uint64_t)) != 0) {
+            return -1;
+        }
+        for (i = 0; i < count; i++) {
+            uint64_t total = 0;
+
+            for (cpu = 0; cpu < export->ncpus; cpu++) {
+                total += values[(size_t)i * export->ncpus + cpu];
+            }
+            export->cms_totals[first + i] = total;
+        }
+    }
+
+    chunk = flow_export_sketch_chunk(export, sizeof(struct talker_candidate));
+    for (first = 0; first < TALKER_CANDIDATES; first += chunk) {
+        uint32_t count = TALKER_CANDIDATES - first < chunk ? TALKER_CANDIDATES - first : chunk;
+        const struct talker_candidate *candidates = (const struct talker_candidate *)export->sketch_values;
+
+        if (flow_export_array_read(export, export->candidates_fd, first, count,
+                                   sizeof(struct talker_candidate)) != 0) {
+            return -1;
+        }
+        for (i = 0; i < count * export->ncpus; i++) {
+            if (candidates[i].src_ip != 0 && candidates[i].estimate != 0) {
+                export->candidate_ips[ip_count++] = candidates[i].src_ip;
+            }
+        }
+    }
+    qsort(export->candidate_ips, ip_count, sizeof(uint32_t), flow_export_compare_u32);
+
+    for (i = 0; i < ip_count; i++) {
+        uint32_t src_ip = export->candidate_ips[i];
+        uint64_t estimate = UINT64_MAX;
+        uint32_t row;
+
+        if (i > 0 && src_ip == export->candidate_ips[i - 1]) {
+            continue;
+        }
+        for (row = 0; row < TALKER_CMS_DEPTH; row++) {
+            uint64_t cell = export->cms_totals[sketch_cms_cell(src_ip, row)];
+            if (cell < estimate) {
+                estimate = cell;
+            }
+        }
+        flow_export_top_insert(talkers, talker_count, max_talkers, src_ip, estimate);
+    }
+    return 0;
+}
+
+static int flow_export_top_fanout(struct flow_export *export, struct flow_sketch_entry *fanout,
+                                  uint32_t *fanout_count) {
+    uint32_t chunk = flow_export_sketch_chunk(export, sizeof(struct fanout_slot));
+    uint32_t max_fanout = *fanout_count;
+    uint32_t first;
+    uint32_t i;
+    uint32_t cpu;
+    uint32_t reg;
+
+    *fanout_count = 0;
+    for (first = 0; first < FANOUT_SLOTS; first += chunk) {
+        uint32_t count = FANOUT_SLOTS - first < chunk ? FANOUT_SLOTS - first : chunk;
+
+        if (flow_export_array_read(export, export->fanout_fd, first, count, sizeof(struct fanout_slot)) != 0) {
+            return -1;
+        }
+        for (i = 0; i < count; i++) {
+            const struct fanout_slot *slots = (const struct fanout_slot *)export->sketch_values +
+                                              (size_t)i * export->ncpus;
+            uint8_t registers[FANOUT_HLL_REGISTERS];
+            uint64_t weight = 0;
+            uint32_t owner = 0;
+            int used = 0;
+
+            // CPUs can settle on different owners: the weighted majority owns the slot
+            for (cpu = 0; cpu < export->ncpus; cpu++) {
+                uint32_t updates = slots[cpu].updates;
+
+                if (updates == 0) {
+                    continue;
+                }
+                used = 1;
+                if (weight == 0 || slots[cpu].src_ip == owner) {
+                    owner = slots[cpu].src_ip;
+                    weight += updates;
+                } else if (updates > weight) {
+                    owner = slots[cpu].src_ip;
+                    weight = updates - weight;
+                } else {
+                    weight -= updates;
+                }
+            }
+            if (!used) {
+                continue;
+            }
+            // Registers merge by max, over the owner's copies only
+            memset(registers, 0, sizeof(registers));
+            for (cpu = 0; cpu < export->ncpus; cpu++) {
+                if (slots[cpu].updates == 0 || slots[cpu].src_ip != owner) {
+                    continue;
+                }
+                for (reg = 0; reg < FANOUT_HLL_REGISTERS; reg++) {
+                    if (slots[cpu].registers[reg] > registers[reg]) {
+                        registers[reg] = slots[cpu].registers[reg];
+                    }
+                }
+            }
+            flow_export_top_insert(fanout, fanout_count, max_fanout, owner, flow_export_hll_estimate(registers));
+        }
+    }
+    return 0;
+}
+
+/*
+ * Report the top *talker_count sources by bytes and the top *fanout_count
+ * sources by distinct destinations since the previous call, then reset
+ * the sketches for the next interval. Counts are capacities on entry and
+ * entries written on return. Packets counted between the read and the
+ * reset are lost to both intervals.
+ * Returns 0 on success, -1 on error (ENOENT: the tracker has no sketches).
+ */
+int flow_export_sketches(struct flow_export *export, struct flow_sketch_entry *talkers, uint32_t *talker_count,
+                         struct flow_sketch_entry *fanout, uint32_t *fanout_count) {
+    if (!export || !talkers || !talker_count || !fanout || !fanout_count) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (export->cms_fd < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (flow_export_top_talkers(export, talkers, talker_count) != 0 ||
+        flow_export_top_fanout(export, fanout, fanout_count) != 0) {
+        return -1;
+    }
+    if (flow_export_array_clear(export, export->cms_fd, TALKER_CMS_DEPTH * TALKER_CMS_WIDTH, sizeof(uint64_t)) != 0 ||
+        flow_export_array_clear(export, export->candidates_fd, TALKER_CANDIDATES,
+                                sizeof(struct talker_candidate)) != 0 ||
+        flow_export_array_clear(export, export->fanout_fd, FANOUT_SLOTS, sizeof(struct fanout_slot)) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int flow_export_stats(struct flow_export *export, struct flow_export_stats *out) {
+    if (!export || !out) {
+        errno = EINVAL;
+        return -1;
+    }
+    export->stats.datapath_packets = flow_export_counter(export, FLOW_COUNTER_PACKETS);
+    export->stats.flow_inserts = flow_export_counter(export, FLOW_COUNTER_INSERTS);
+    export->stats.insert_failures = flow_export_counter(export, FLOW_COUNTER_INSERT_FAILURES);
+    export->stats.ring_drops = flow_export_counter(export, FLOW_COUNTER_RECORD_DROPS);
+    *out = export->stats;
+    return 0;
+}
+
+void flow_export_close(struct flow_export *export) {
+    if (!export) {
+        return;
+    }
+    if (export->epoll_fd >= 0) {
+        close(export->epoll_fd);
+    }
+    if (export->producer_map != MAP_FAILED) {
+        munmap(export->producer_map, export->producer_map_len);
+    }
+    if (export->consumer_map != MAP_FAILED) {
+        munmap(export->consumer_map, export->page_size);
+    }
+    if (export->events_fd >= 0) {
+        close(export->events_fd);
+    }
+    if (export->counters_fd >= 0) {
+        close(export->counters_fd);
+    }
+    if (export->map_fd >= 0) {
+        close(export->map_fd);
+    }
+    if (export->fanout_fd >= 0) {
+        close(export->fanout_fd);
+    }
+    if (export->candidates_fd >= 0) {
+        close(export->candidates_fd);
+    }
+    if (export->cms_fd >= 0) {
+        close(export->cms_fd);
+    }
+    free(export->candidate_ips);
+    free(export->cms_totals);
+    free(export->sketch_keys);
+    free(export->sketch_values);
+    free(export->batch_values);
+    free(export->batch_keys);
+    free(export->sweep_totals);
+    free(export->sweep_keys);
+    free(export->linger);
+    free(export->pending);
+    free(export->percpu_counter);
+    free(export->percpu_stats);
+    free(export);
+}
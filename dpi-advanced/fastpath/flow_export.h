@@ -0,0 +1,74 @@
+/*
+ * RansomEye DPI Advanced - eBPF Flow Export
+ * AUTHORITATIVE: Consumer for flows completed by the XDP flow tracker
+ *
+ * NOTE:
+ * - Opens the tracker's pinned maps (flow_map, flow_events, flow_counters);
+ *   it does not load or attach the program.
+ * - Ended-flow notifications are read from the flow_events ring buffer
+ *   (epoll on the map fd, records consumed in place from the mmap) and
+ *   completed from flow_map, summed over every CPU, as the entry is
+ *   deleted: at once after RST, one second after the closing FINs so the
+ *   last ACK is in the same record. Idle flows, and flows whose FINs went
+ *   to different CPUs, are found by a periodic sweep of flow_map.
+ * - flow_export_sketches() reports the interval's top sources by bytes
+ *   (count-min) and by distinct destinations (HyperLogLog) from the
+ *   tracker's per-CPU sketch maps, then resets them.
+ * - flow_export_drain() empties flow_map once the tracker is detached
+ *   (flow_loader_close()), so a probe that loaded the tracker itself
+ *   exports every flow before it exits.
+ * - Returned records carry CLOCK_REALTIME first_seen/last_seen, so the
+ *   caller never deals with the kernel's monotonic clock.
+ * - Returned records are oriented by initiator rather than canonical
+ *   order: key.src is the endpoint that sent the first packet, and
+ *   stats.packets/bytes[FLOW_DIR_FORWARD] count what it sent.
+ */
+
+#ifndef RANSOMEYE_FLOW_EXPORT_H
+#define RANSOMEYE_FLOW_EXPORT_H
+
+#include <stdint.h>
+
+#include "ebpf_flow_tracker.h"
+
+struct flow_export;
+
+struct flow_export_config {
+    const char *pin_dir;            /* Directory the tracker's maps are pinned in */
+    uint64_t idle_timeout_ns;       /* Export flows idle this long, 0 disables the sweeper */
+    uint64_t sweep_interval_ns;     /* Time between sweeps, 0 selects idle_timeout_ns / 4 */
+};
+
+struct flow_export_stats {
+    uint64_t records;               /* Flow records returned */
+    uint64_t fin_records;
+    uint64_t rst_records;
+    uint64_t idle_records;
+    uint64_t detach_records;        /* Flows drained by flow_export_drain() */
+    uint64_t stale_records;         /* Notifications for flows already gone (duplicate FIN, evicted) */
+    uint64_t datapath_packets;      /* flow_counters, summed over CPUs */
+    uint64_t flow_inserts;
+    uint64_t insert_failures;
+    uint64_t ring_drops;
+    uint64_t live_flows;            /* flow_map entries seen by the last sweep */
+    uint64_t evictions;             /* LRU evictions as of the last sweep */
+    uint64_t sweeps;
+};
+
+struct flow_sketch_entry {
+    uint32_t src_ip;                /* Network order */
+    uint32_t reserved;
+    uint64_t value;                 /* Bytes (talkers) or distinct destinations (fan-out), estimated */
+};
+
+struct flow_export *flow_export_open(const struct flow_export_config *config);
+int flow_export_fd(const struct flow_export *export);
+int flow_export_read(struct flow_export *export, int timeout_ms,
+                     struct flow_record *records, uint32_t max_records);
+int flow_export_drain(struct flow_export *export);
+int flow_export_sketches(struct flow_export *export, struct flow_sketch_entry *talkers, uint32_t *talker_count,
+                         struct flow_sketch_entry *fanout, uint32_t *fanout_count);
+int flow_export_stats(struct flow_export *export, struct flow_export_stats *out);
+void flow_export_close(struct flow_export *export);
+
+#endif /* RANSOMEYE_FLOW_EXPORT_H */
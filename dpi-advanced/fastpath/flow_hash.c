@@ -0,0 +1,335 @@
+/*
+ * RansomEye DPI Advanced - Flow Hash
+ * AUTHORITATIVE: flow_id and immutable_hash over a fixed binary encoding
+ *
+ * NOTE:
+ * - SHA-256 per FIPS 180-4. The compression function is the only part
+ *   with two implementations; padding and encoding are shared.
+ * - The SHA-NI path keeps the state as ABEF/CDGH halves, as
+ *   _mm_sha256rnds2_epu32 expects, and builds the message schedule four
+ *   words at a time with _mm_sha256msg1/msg2.
+ */
+
+#include "flow_hash.h"
+
+#include <string.h>
+#include <errno.h>
+
+#if defined(__x86_64__) && !defined(FLOW_HASH_NO_SHA_NI)
+#include <cpuid.h>
+#include <immintrin.h>
+#define FLOW_HASH_SHA_NI 1
+#endif
+
+typedef void (*flow_hash_compress_fn)(uint32_t state[8], const uint8_t *data, size_t blocks);
+
+static const uint32_t flow_hash_k[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t flow_hash_h0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static inline void flow_hash_put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static inline void flow_hash_put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static inline void flow_hash_put64(uint8_t *p, uint64_t v) {
+    flow_hash_put32(p, (uint32_t)(v >> 32));
+    flow_hash_put32(p + 4, (uint32_t)v);
+}
+
+static inline uint32_t flow_hash_get32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline uint32_t flow_hash_ror(uint32_t x, unsigned n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+static void flow_hash_compress_portable(uint32_t state[8], const uint8_t *data, size_t blocks) {
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+    unsigned i;
+
+    for (; blocks; blocks--, data += 64) {
+        for (i = 0; i < 16; i++) {
+            w[i] = flow_hash_get32(data + 4 * i);
+        }
+        for (i = 16; i < 64; i++) {
+            uint32_t s0 = flow_hash_ror(w[i - 15], 7) ^ flow_hash_ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = flow_hash_ror(w[i - 2], 17) ^ flow_hash_ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        a = state[0];
+        b = state[1];
+        c = state[2];
+        d = state[3];
+        e = state[4];
+        f = state[5];
+        g = state[6];
+        h = state[7];
+        for (i = 0; i < 64; i++) {
+            uint32_t t1 = h + (flow_hash_ror(e, 6) ^ flow_hash_ror(e, 11) ^ flow_hash_ror(e, 25)) +
+                          ((e & f) ^ (~e & g)) + flow_hash_k[i] + w[i];
+            uint32_t t2 = (flow_hash_ror(a, 2) ^ flow_hash_ror(a, 13) ^ flow_hash_ror(a, 22)) +
+                          ((a & b) ^ (a & c) ^ (b & c));
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef FLOW_HASH_SHA_NI
+__attribute__((target("sha,sse4.1")))
+static void flow_hash_compress_sha_ni(uint32_t state[8], const uint8_t *data, size_t blocks) {
+    const __m128i byteswap = _mm_set_epi64x(0x0c0d0e0f08090a0bLL, 0x0405060700010203LL);
+    __m128i abef;
+    __m128i cdgh;
+    __m128i tmp;
+
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);    /* CDAB */
+    cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);   /* EFGH */
+    abef = _mm_alignr_epi8(tmp, cdgh, 8);
+    cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+    for (; blocks; blocks--, data += 64) {
+        __m128i abef_in = abef;
+        __m128i cdgh_in = cdgh;
+        __m128i w[4];
+        unsigned g;
+
+        for (g = 0; g < 4; g++) {
+            w[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * g)), byteswap);
+        }
+        // 16 groups of four rounds; group g >= 4 schedules W[4g..4g+3] from the four before it
+        for (g = 0; g < 16; g++) {
+            __m128i msg;
+
+            if (g >= 4) {
+                tmp = _mm_sha256msg1_epu32(w[g & 3], w[(g + 1) & 3]);
+                tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(w[(g + 3) & 3], w[(g + 2) & 3], 4));
+                w[g & 3] = _mm_sha256msg2_epu32(tmp, w[(g + 3) & 3]);
+            }
+            msg = _mm_add_epi32(w[g & 3], _mm_load_si128((const __m128i *)&flow_hash_k[4 * g]));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(msg, 0x0E));
+        }
+        abef = _mm_add_epi32(abef, abef_in);
+        cdgh = _mm_add_epi32(cdgh, cdgh_in);
+    }
+
+    tmp = _mm_shuffle_epi32(abef, 0x1B);                                           /* FEBA */
+    cdgh = _mm_shuffle_epi32(cdgh, 0xB1);                                          /* DCHG */
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, cdgh, 0xF0));      /* DCBA */
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(cdgh, tmp, 8));         /* HGFE */
+}
+#endif
+
+/* SHA-NI when the CPU has it (and the SSSE3/SSE4.1 shuffles around it), decided once */
+static flow_hash_compress_fn flow_hash_compress(void) {
+#ifdef FLOW_HASH_SHA_NI
+    static int sha_ni = -1;
+    int have = __atomic_load_n(&sha_ni, __ATOMIC_RELAXED);
+
+    if (have < 0) {
+        unsigned int eax, ebx, ecx, edx;
+
+        have = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSSE3) && (ecx & bit_SSE4_1) &&
+               __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA);
+        __atomic_store_n(&sha_ni, have, __ATOMIC_RELAXED);
+    }
+    if (have) {
+        return flow_hash_compress_sha_ni;
+    }
+#endif
+    return flow_hash_compress_portable;
+}
+
+/* Hash data into state, which has already absorbed prefix_len bytes (whole blocks), and pad */
+static void flow_hash_finish(flow_hash_compress_fn compress, uint32_t state[8], size_t prefix_len,
+                             const uint8_t *data, size_t len, uint8_t digest[FLOW_HASH_DIGEST_SIZE]) {
+    uint8_t tail[128];
+    size_t full = len / 64;
+    size_t rest = len % 64;
+    size_t tail_len = rest + 9 <= 64 ? 64 : 128;
+    unsigned i;
+
+    compress(state, data, full);
+    memcpy(tail, data + full * 64, rest);
+    tail[rest] = 0x80;
+    memset(tail + rest + 1, 0, tail_len - rest - 9);
+    flow_hash_put64(tail + tail_len - 8, (uint64_t)(prefix_len + len) * 8);
+    compress(state, tail, tail_len / 64);
+    for (i = 0; i < 8; i++) {
+        flow_hash_put32(digest + 4 * i, state[i]);
+    }
+}
+
+static void flow_hash_sha256_with(flow_hash_compress_fn compress, const uint8_t *data, size_t len,
+                                  uint8_t digest[FLOW_HASH_DIGEST_SIZE]) {
+    uint32_t state[8];
+
+    memcpy(state, flow_hash_h0, sizeof(state));
+    flow_hash_finish(compress, state, 0, data, len, digest);
+}
+
+void flow_hash_sha256(const uint8_t *data, size_t len, uint8_t digest[FLOW_HASH_DIGEST_SIZE]) {
+    flow_hash_sha256_with(flow_hash_compress(), data, len, digest);
+}
+
+/* HMAC-SHA256 (RFC 2104): keep the states after the ipad and opad blocks so each message costs
+   only its own blocks plus one for the outer hash */
+void flow_hash_hmac_init(struct flow_hash_hmac *hmac, const uint8_t *key, size_t key_len) {
+    flow_hash_compress_fn compress = flow_hash_compress();
+    uint8_t block[64];
+    unsigned i;
+
+    memset(block, 0, sizeof(block));
+    if (key_len > sizeof(block)) {
+        flow_hash_sha256_with(compress, key, key_len, block);
+    } else if (key_len) {
+        memcpy(block, key, key_len);
+    }
+    for (i = 0; i < sizeof(block); i++) {
+        block[i] ^= 0x36;
+    }
+    memcpy(hmac->inner, flow_hash_h0, sizeof(hmac->inner));
+    compress(hmac->inner, block, 1);
+    for (i = 0; i < sizeof(block); i++) {
+        block[i] ^= 0x36 ^ 0x5c;
+    }
+    memcpy(hmac->outer, flow_hash_h0, sizeof(hmac->outer));
+    compress(hmac->outer, block, 1);
+}
+
+void flow_hash_hmac(const struct flow_hash_hmac *hmac, const uint8_t *data, size_t len,
+                    uint8_t digest[FLOW_HASH_DIGEST_SIZE]) {
+    flow_hash_compress_fn compress = flow_hash_compress();
+    uint32_t state[8];
+    uint8_t inner[FLOW_HASH_DIGEST_SIZE];
+
+    memcpy(state, hmac->inner, sizeof(state));
+    flow_hash_finish(compress, state, 64, data, len, inner);
+    memcpy(state, hmac->outer, sizeof(state));
+    flow_hash_finish(compress, state, 64, inner, sizeof(inner), digest);
+}
+
+/* Code of the protocol name the record is reported under (PROTOCOL_NAMES in the probe) */
+static uint8_t flow_hash_protocol(uint8_t protocol) {
+    switch (protocol) {
+    case 6:
+    case 17:
+        return protocol;
+    case 1:
+    case 58:
+        return 1;
+    default:
+        return FLOW_HASH_PROTO_OTHER;
+    }
+}
+
+/* Nanoseconds to microseconds, rounding down */
+static int64_t flow_hash_us(int64_t ns) {
+    return ns >= 0 ? ns / 1000 : -((-(ns + 1)) / 1000) - 1;
+}
+
+static void flow_hash_id(flow_hash_compress_fn compress, const struct flow_table_record *record, uint8_t protocol,
+                         int64_t start_ns, uint8_t out[FLOW_HASH_ID_SIZE]) {
+    uint8_t input[FLOW_HASH_ID_INPUT_SIZE];
+    uint8_t digest[FLOW_HASH_DIGEST_SIZE];
+    int order = memcmp(record->src_addr, record->dst_addr, sizeof(record->src_addr));
+    int src_low = order < 0 || (order == 0 && record->src_port <= record->dst_port);
+
+    input[0] = FLOW_HASH_VERSION;
+    input[1] = record->ip_version;
+    input[2] = protocol;
+    input[3] = 0;
+    memcpy(input + 4, src_low ? record->src_addr : record->dst_addr, 16);
+    memcpy(input + 20, src_low ? record->dst_addr : record->src_addr, 16);
+    flow_hash_put16(input + 36, src_low ? record->src_port : record->dst_port);
+    flow_hash_put16(input + 38, src_low ? record->dst_port : record->src_port);
+    flow_hash_put64(input + 40, (uint64_t)flow_hash_us(start_ns));
+    flow_hash_sha256_with(compress, input, sizeof(input), digest);
+    memcpy(out, digest, FLOW_HASH_ID_SIZE);
+}
+
+/*
+ * Hash count flow table records as the probe completes them: FORENSIC
+ * privacy mode, no L7 protocol and no profile ids (those are added after
+ * the hash). Addresses beyond the first 4 bytes of an IPv4 record must be
+ * zero, as flow_table_record leaves them.
+ * Returns 0 on success, -1 on error (errno set).
+ */
+int flow_hash_table_records(const struct flow_table_record *records, uint32_t count,
+                            struct flow_hash_digest *out) {
+    flow_hash_compress_fn compress = flow_hash_compress();
+    uint8_t input[FLOW_HASH_RECORD_INPUT_SIZE];
+    uint32_t i;
+
+    if (count && (!records || !out)) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        const struct flow_table_record *record = &records[i];
+        uint8_t protocol = flow_hash_protocol(record->protocol);
+
+        flow_hash_id(compress, record, protocol, record->first_ns, out[i].flow_id);
+        if (record->origin_ns == record->first_ns) {
+            memcpy(out[i].origin_flow_id, out[i].flow_id, FLOW_HASH_ID_SIZE);
+        } else {
+            flow_hash_id(compress, record, protocol, record->origin_ns, out[i].origin_flow_id);
+        }
+
+        memset(input, 0, sizeof(input));
+        input[0] = FLOW_HASH_VERSION;
+        input[1] = record->ip_version;
+        input[2] = protocol;
+        input[3] = FLOW_HASH_PRIVACY_FORENSIC;
+        memcpy(input + 4, record->src_addr, 16);
+        memcpy(input + 20, record->dst_addr, 16);
+        flow_hash_put16(input + 36, record->src_port);
+        flow_hash_put16(input + 38, record->dst_port);
+        flow_hash_put64(input + 40, (uint64_t)flow_hash_us(record->first_ns));
+        flow_hash_put64(input + 48, (uint64_t)flow_hash_us(record->last_ns));
+        flow_hash_put64(input + 56, record->packets[FLOW_TABLE_DIR_FORWARD] + record->packets[FLOW_TABLE_DIR_REVERSE]);
+        flow_hash_put64(input + 64, record->bytes[FLOW_TABLE_DIR_FORWARD] + record->bytes[FLOW_TABLE_DIR_REVERSE]);
+        memcpy(input + 72, out[i].flow_id, FLOW_HASH_ID_SIZE);
+        // l7_protocol and both profile ids stay zero
+        flow_hash_sha256_with(compress, input, sizeof(input), out[i].immutable_hash);
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * RansomEye DPI Advanced - Flow Hash
+ * AUTHORITATIVE: flow_id and immutable_hash over a fixed binary encoding
+ *
+ * NOTE:
+ * - Both values are SHA-256 over a fixed-size byte string, never JSON, so
+ *   the same flow hashes the same in C (flow_hash_table_records) and in
+ *   Python (FlowAssembler, dpi-advanced/engine/flow_assembler.py). The
+ *   layouts below are version FLOW_HASH_VERSION and must not change
+ *   without bumping it.
+ * - Integers are big-endian. Addresses are 16 bytes, IPv4 in the first 4
+ *   and the rest zero. Times are microseconds since the Unix epoch (the
+ *   precision of the emitted RFC 3339 timestamps), nanoseconds floored.
+ * - Protocol is the code of the flow's protocol name: tcp 6, udp 17,
+ *   icmp 1 (ICMPv6 included), other FLOW_HASH_PROTO_OTHER.
+ *
+ * flow_id input, FLOW_HASH_ID_INPUT_SIZE bytes; flow_id is the first
+ * FLOW_HASH_ID_SIZE bytes of its digest, in hex:
+ *
+ *     0   u8      version
+ *     1   u8      ip_version (4 or 6)
+ *     2   u8      protocol code
+ *     3   u8      0
+ *     4   16      lower endpoint address  (endpoints ordered by address
+ *    20   16      higher endpoint address  bytes, then port, so both
+ *    36   u16     lower endpoint port      directions give one flow_id)
+ *    38   u16     higher endpoint port
+ *    40   i64     flow start, us
+ *
+ * immutable_hash input, FLOW_HASH_RECORD_INPUT_SIZE bytes:
+ *
+ *     0   u8      version
+ *     1   u8      ip_version
+ *     2   u8      protocol code
+ *     3   u8      privacy mode (FLOW_HASH_PRIVACY_*)
+ *     4   16      src address (initiator)
+ *    20   16      dst address
+ *    36   u16     src port
+ *    38   u16     dst port
+ *    40   i64     flow_start, us
+ *    48   i64     flow_end, us
+ *    56   u64     packet_count
+ *    64   u64     byte_count
+ *    72   16      flow_id (binary)
+ *    88   64      l7_protocol, UTF-8, zero padded
+ *   152   16      behavioral_profile_id (UUID bytes, zero if unset)
+ *   168   16      asset_profile_id (UUID bytes, zero if unset)
+ *
+ * - flow_hash_hmac is HMAC-SHA256 on the same compression function, for
+ *   keyed pseudonyms (privacy_redact.c); the key schedule is done once.
+ * - SHA-256 runs on the x86 SHA extensions when the CPU has them (checked
+ *   once at run time; build with -DFLOW_HASH_NO_SHA_NI to leave them out),
+ *   otherwise portable C; the output is identical.
+ */
+
+#ifndef RANSOMEYE_FLOW_HASH_H
+#define RANSOMEYE_FLOW_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flow_table.h"
+
+#define FLOW_HASH_VERSION 1
+#define FLOW_HASH_ID_INPUT_SIZE 48
+#define FLOW_HASH_RECORD_INPUT_SIZE 184
+#define FLOW_HASH_ID_SIZE 16
+#define FLOW_HASH_DIGEST_SIZE 32
+#define FLOW_HASH_L7_SIZE 64
+
+#define FLOW_HASH_PROTO_OTHER 255
+
+#define FLOW_HASH_PRIVACY_STRICT 1
+#define FLOW_HASH_PRIVACY_BALANCED 2
+#define FLOW_HASH_PRIVACY_FORENSIC 3
+
+/* Hashes of one flow_table_record, 64 bytes */
+struct flow_hash_digest {
+    uint8_t flow_id[FLOW_HASH_ID_SIZE];          /* Flow starting at the record's first_ns */
+    uint8_t origin_flow_id[FLOW_HASH_ID_SIZE];   /* Flow starting at origin_ns: segment 0's flow_id */
+    uint8_t immutable_hash[FLOW_HASH_DIGEST_SIZE];
+};
+
+/* HMAC-SHA256 key, as the hash states after the ipad and opad blocks */
+struct flow_hash_hmac {
+    uint32_t inner[8];
+    uint32_t outer[8];
+};
+
+void flow_hash_sha256(const uint8_t *data, size_t len, uint8_t digest[FLOW_HASH_DIGEST_SIZE]);
+void flow_hash_hmac_init(struct flow_hash_hmac *hmac, const uint8_t *key, size_t key_len);
+void flow_hash_hmac(const struct flow_hash_hmac *hmac, const uint8_t *data, size_t len,
+                    uint8_t digest[FLOW_HASH_DIGEST_SIZE]);
+int flow_hash_table_records(const struct flow_table_record *records, uint32_t count,
+                            struct flow_hash_digest *out);
+
+#endif /* RANSOMEYE_FLOW_HASH_H */
@@ -0,0 +1,214 @@
+/*
+ * RansomEye DPI Advanced - eBPF Flow Tracker Loader
+ * AUTHORITATIVE: Loads the flow tracker object, pins its maps and attaches it to an interface
+ *
+ * NOTE:
+ * - Built with -DFLOW_LOADER_EMBEDDED (make loader), the bpftool skeleton
+ *   carries the tracker object; a NULL object_path loads that copy.
+ * - Only the programs of the selected attach mode are loaded.
+ * - Every failure path releases what was attached so far.
+ */
+
+#define _GNU_SOURCE
+
+#include "flow_loader.h"
+
+#include <bpf/libbpf.h>
+#include <bpf/bpf.h>
+#include <net/if.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef FLOW_LOADER_EMBEDDED
+#include "ebpf_flow_tracker.skel.h"
+#endif
+
+struct flow_loader {
+#ifdef FLOW_LOADER_EMBEDDED
+    struct ebpf_flow_tracker *skeleton;     /* Owns object when the embedded tracker is loaded */
+#endif
+    struct bpf_object *object;
+    struct bpf_link *xdp_link;
+    struct bpf_tc_hook tc_hook;
+    int tc_ingress_attached;
+    int tc_egress_attached;
+};
+
+/* libbpf 1.x returns -errno and sets errno; keep errno meaningful for callers */
+static int flow_loader_err(int err) {
+    if (err < 0) {
+        errno = -err;
+        return -1;
+    }
+    return 0;
+}
+
+/* Open the tracker object compiled into this library */
+static int flow_loader_open_embedded(struct flow_loader *loader, const struct bpf_object_open_opts *open_opts) {
+#ifdef FLOW_LOADER_EMBEDDED
+    loader->skeleton = ebpf_flow_tracker__open_opts(open_opts);
+    if (!loader->skeleton) {
+        return -1;
+    }
+    loader->object = loader->skeleton->obj;
+    return 0;
+#else
+    (void)loader;
+    (void)open_opts;
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+static int flow_loader_attach_tc(struct flow_loader *loader, struct bpf_program *program,
+                                 enum bpf_tc_attach_point direction, int *attached) {
+    LIBBPF_OPTS(bpf_tc_opts, opts,
+        .handle = FLOW_LOADER_TC_HANDLE,
+        .priority = FLOW_LOADER_TC_PRIORITY,
+        .prog_fd = bpf_program__fd(program),
+        .flags = BPF_TC_F_REPLACE);
+
+    loader->tc_hook.attach_point = direction;
+    if (flow_loader_err(bpf_tc_attach(&loader->tc_hook, &opts)) != 0) {
+        return -1;
+    }
+    *attached = 1;
+    return 0;
+}
+
+static void flow_loader_detach_tc(struct flow_loader *loader, enum bpf_tc_attach_point direction,
+                                  int *attached) {
+    LIBBPF_OPTS(bpf_tc_opts, opts,
+        .handle = FLOW_LOADER_TC_HANDLE,
+        .priority = FLOW_LOADER_TC_PRIORITY);
+
+    if (!*attached) {
+        return;
+    }
+    loader->tc_hook.attach_point = direction;
+    bpf_tc_detach(&loader->tc_hook, &opts);
+    *attached = 0;
+}
+
+/*
+ * Open, load and attach the flow tracker (config->object_path, or the
+ * embedded object when it is NULL).
+ * Returns handle on success, NULL on error (errno set; EEXIST or EBUSY
+ * when another XDP program owns the interface, EINVAL when maps pinned
+ * under pin_dir do not match the object, EOPNOTSUPP when no object is
+ * embedded).
+ */
+struct flow_loader *flow_loader_open(const struct flow_loader_config *config) {
+    struct flow_loader *loader;
+    struct bpf_program *xdp_program;
+    struct bpf_program *tc_ingress;
+    struct bpf_program *tc_egress;
+    int use_tc;
+    int ifindex;
+
+    if (!config || !config->pin_dir || !config->interface ||
+        config->attach_mode > FLOW_LOADER_ATTACH_TC) {
+        errno = EINVAL;
+        return NULL;
+    }
+    ifindex = (int)if_nametoindex(config->interface);
+    if (ifindex == 0) {
+        return NULL;
+    }
+    use_tc = config->attach_mode == FLOW_LOADER_ATTACH_TC;
+
+    loader = calloc(1, sizeof(*loader));
+    if (!loader) {
+        return NULL;
+    }
+    loader->tc_hook.sz = sizeof(loader->tc_hook);
+    loader->tc_hook.ifindex = ifindex;
+
+    LIBBPF_OPTS(bpf_object_open_opts, open_opts, .pin_root_path = config->pin_dir);
+    if (config->object_path) {
+        loader->object = bpf_object__open_file(config->object_path, &open_opts);
+        if (!loader->object) {
+            goto fail;
+        }
+    } else if (flow_loader_open_embedded(loader, &open_opts) != 0) {
+        goto fail;
+    }
+    xdp_program = bpf_object__find_program_by_name(loader->object, "xdp_flow_tracker");
+    tc_ingress = bpf_object__find_program_by_name(loader->object, "tc_flow_ingress");
+    tc_egress = bpf_object__find_program_by_name(loader->object, "tc_flow_egress");
+    if (!xdp_program || !tc_ingress || !tc_egress) {
+        errno = ENOENT;
+        goto fail;
+    }
+    // Program types come from the SEC("xdp") / SEC("tc") names
+    bpf_program__set_autoload(xdp_program, !use_tc);
+    bpf_program__set_autoload(tc_ingress, use_tc);
+    bpf_program__set_autoload(tc_egress, use_tc);
+
+    if (config->flow_map_max_entries) {
+        struct bpf_map *flow_map = bpf_object__find_map_by_name(loader->object, "flow_map");
+
+        if (!flow_map) {
+            errno = ENOENT;
+            goto fail;
+        }
+        if (flow_loader_err(bpf_map__set_max_entries(flow_map, config->flow_map_max_entries)) != 0) {
+            goto fail;
+        }
+    }
+    if (flow_loader_err(bpf_object__load(loader->object)) != 0) {
+        goto fail;
+    }
+
+    if (!use_tc) {
+        loader->xdp_link = bpf_program__attach_xdp(xdp_program, ifindex);
+        if (!loader->xdp_link) {
+            goto fail;
+        }
+        return loader;
+    }
+
+    loader->tc_hook.attach_point = BPF_TC_INGRESS | BPF_TC_EGRESS;
+    if (bpf_tc_hook_create(&loader->tc_hook) < 0 && errno != EEXIST) {
+        goto fail;
+    }
+    if (flow_loader_attach_tc(loader, tc_ingress, BPF_TC_INGRESS, &loader->tc_ingress_attached) != 0 ||
+        flow_loader_attach_tc(loader, tc_egress, BPF_TC_EGRESS, &loader->tc_egress_attached) != 0) {
+        goto fail;
+    }
+    return loader;
+
+fail:
+    {
+        int saved_errno = errno;
+        flow_loader_close(loader);
+        errno = saved_errno;
+    }
+    return NULL;
+}
+
+/*
+ * Detach the tracker. The clsact qdisc is left in place (other filters
+ * may share it), and so are the pinned maps.
+ */
+void flow_loader_close(struct flow_loader *loader) {
+    if (!loader) {
+        return;
+    }
+    flow_loader_detach_tc(loader, BPF_TC_EGRESS, &loader->tc_egress_attached);
+    flow_loader_detach_tc(loader, BPF_TC_INGRESS, &loader->tc_ingress_attached);
+    if (loader->xdp_link) {
+        bpf_link__destroy(loader->xdp_link);
+    }
+#ifdef FLOW_LOADER_EMBEDDED
+    if (loader->skeleton) {
+        ebpf_flow_tracker__destroy(loader->skeleton);
+        loader->object = NULL;
+    }
+#endif
+    if (loader->object) {
+        bpf_object__close(loader->object);
+    }
+    free(loader);
+}
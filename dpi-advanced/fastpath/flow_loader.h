@@ -0,0 +1,44 @@
+/*
+ * RansomEye DPI Advanced - eBPF Flow Tracker Loader
+ * AUTHORITATIVE: Loads the flow tracker object, pins its maps and attaches it to an interface
+ *
+ * NOTE:
+ * - libbpf based, and built as its own library so the capture library
+ *   keeps no libbpf dependency.
+ * - Maps are pinned by name under pin_dir. Maps already pinned there (a
+ *   previous run, or the af_xdp backend's xsks_map user) are reused, so
+ *   flows in flight survive a probe restart.
+ * - FLOW_LOADER_ATTACH_XDP attaches xdp_flow_tracker through a BPF link
+ *   (ingress only; detached by the kernel if the process dies).
+ *   FLOW_LOADER_ATTACH_TC attaches tc_flow_ingress/tc_flow_egress to the
+ *   interface's clsact qdisc at a fixed handle and priority, so a filter
+ *   left behind by a crashed run is replaced rather than duplicated.
+ * - Closing detaches the programs; the pinned maps stay for flow_export.
+ */
+
+#ifndef RANSOMEYE_FLOW_LOADER_H
+#define RANSOMEYE_FLOW_LOADER_H
+
+#include <stdint.h>
+
+#define FLOW_LOADER_ATTACH_XDP 0
+#define FLOW_LOADER_ATTACH_TC 1
+
+/* cls_bpf filter identity on the clsact qdisc (both directions) */
+#define FLOW_LOADER_TC_HANDLE 0x7265u
+#define FLOW_LOADER_TC_PRIORITY 0x7265u
+
+struct flow_loader;
+
+struct flow_loader_config {
+    const char *object_path;        /* Compiled ebpf_flow_tracker.c; NULL for the embedded object */
+    const char *pin_dir;            /* Map pin directory, shared with flow_export_config.pin_dir */
+    const char *interface;
+    uint32_t attach_mode;           /* FLOW_LOADER_ATTACH_* */
+    uint32_t flow_map_max_entries;  /* 0 keeps the object's FLOW_MAP_MAX_ENTRIES */
+};
+
+struct flow_loader *flow_loader_open(const struct flow_loader_config *config);
+void flow_loader_close(struct flow_loader *loader);
+
+#endif /* RANSOMEYE_FLOW_LOADER_H */
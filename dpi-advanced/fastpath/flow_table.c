@@ -0,0 +1,886 @@
+/*
+ * RansomEye DPI Advanced - Flow Table
+ * AUTHORITATIVE: Native flow assembly over parsed packet descriptors
+ *
+ * NOTE:
+ * - ctrl[] holds one byte per index slot: FLOW_TABLE_CTRL_EMPTY or the
+ *   top 7 bits of the slot's hash. It is mirrored FLOW_TABLE_GROUP bytes
+ *   past the end so a group load starting near the end never wraps.
+ * - A lookup loads 8 control bytes at a time, compares all of them with
+ *   the tag in one word operation and checks candidates before the first
+ *   empty byte; the empty byte ends the probe.
+ * - Index slots hold (hash, entry) pairs; entries live in a fixed pool and
+ *   never move, so an entry index stays valid for the flow's lifetime.
+ * - Timer wheel: FLOW_TABLE_WHEEL_LEVELS levels of 64 slots, level L slot
+ *   i holding flows due in tick i * 64^L of the level's current rotation.
+ *   Each tick moves level 0's slot to the due list; every 64^L ticks the
+ *   next level L slot is cascaded down. A bitmap per level lets the clock
+ *   jump over empty slots. Flows are linked in by pool index.
+ * - Age lists (only kept by the evicting overload policies): a flow is on
+ *   FLOW_TABLE_AGE_YOUNG from its first packet and moves to the back of
+ *   FLOW_TABLE_AGE_SEEN on its second. Packets on SEEN flows only set a
+ *   referenced bit; a victim search sends referenced flows to the back and
+ *   clears the bit (second chance), approximating least recently active
+ *   without relinking on every packet.
+ */
+
+#include "flow_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define FLOW_TABLE_GROUP 8u
+#define FLOW_TABLE_CTRL_EMPTY 0x80u
+#define FLOW_TABLE_MIN_SLOTS 16u
+#define FLOW_TABLE_NO_ENTRY UINT32_MAX
+#define FLOW_TABLE_PREFETCH 16u           /* Packets hashed and prefetched ahead of their lookups */
+
+#define FLOW_TABLE_TICK_SHIFT 26u         /* 67 ms ticks */
+#define FLOW_TABLE_WHEEL_BITS 6u
+#define FLOW_TABLE_WHEEL_SLOTS (1u << FLOW_TABLE_WHEEL_BITS)
+#define FLOW_TABLE_WHEEL_LEVELS 4u        /* Level 3 spans 13 days; later deadlines wait there */
+#define FLOW_TABLE_DUE_LIST (FLOW_TABLE_WHEEL_LEVELS * FLOW_TABLE_WHEEL_SLOTS)
+#define FLOW_TABLE_TIMER_LISTS (FLOW_TABLE_DUE_LIST + 1)
+
+#define FLOW_TABLE_AGE_YOUNG 0u          /* One packet so far */
+#define FLOW_TABLE_AGE_SEEN 1u
+
+#define FLOW_TABLE_LSB 0x0101010101010101ULL
+#define FLOW_TABLE_MSB 0x8080808080808080ULL
+
+/* flow_table_entry.flags */
+#define FLOW_TABLE_ENTRY_LIVE 0x1u
+#define FLOW_TABLE_ENTRY_ORIGIN_REVERSE 0x2u   /* First packet ran dst -> src of the canonical key */
+#define FLOW_TABLE_ENTRY_FIN_FORWARD 0x4u      /* FIN sent src -> dst of the canonical key */
+#define FLOW_TABLE_ENTRY_FIN_REVERSE 0x8u
+#define FLOW_TABLE_ENTRY_CLOSING 0x10u         /* FIN both ways, lingering for the last ACKs */
+#define FLOW_TABLE_ENTRY_SEEN 0x20u            /* On FLOW_TABLE_AGE_SEEN, not YOUNG */
+#define FLOW_TABLE_ENTRY_REFERENCED 0x40u      /* Packet since the last victim search passed it */
+
+/* TCP header flag bits (frame_packet_desc.tcp_flags) */
+#define FLOW_TABLE_TCP_FIN 0x01u
+#define FLOW_TABLE_TCP_SYN 0x02u
+#define FLOW_TABLE_TCP_RST 0x04u
+#define FLOW_TABLE_TCP_ACK 0x10u
+#define FLOW_TABLE_IPPROTO_TCP 6u
+
+/* Canonical: (src_addr, src_port) <= (dst_addr, dst_port), 40 bytes, padding zeroed */
+struct flow_table_key {
+    uint8_t src_addr[16];
+    uint8_t dst_addr[16];
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t ip_version;
+    uint8_t protocol;
+    uint8_t pad[2];
+};
+
+struct flow_table_entry {
+    struct flow_table_key key;
+    uint64_t packets[2];            /* Current segment, relative to the canonical key */
+    uint64_t bytes[2];
+    int64_t first_ns;               /* Current segment */
+    int64_t last_ns;
+    int64_t origin_ns;              /* Segment 0 */
+    uint32_t segment;
+    uint32_t slot;                  /* Index slot while live, next free entry otherwise */
+    uint32_t timer_next;            /* Timer list links, pool indexes */
+    uint32_t timer_prev;
+    uint32_t age_next;              /* Age list links, pool indexes */
+    uint32_t age_prev;
+    uint16_t timer_list;            /* Wheel slot (level * 64 + slot) or FLOW_TABLE_DUE_LIST */
+    uint16_t flags;                 /* FLOW_TABLE_ENTRY_* */
+};
+
+struct flow_table_slot {
+    uint32_t hash;
+    uint32_t entry;
+};
+
+struct flow_table {
+    uint8_t *ctrl;                  /* slot_count + FLOW_TABLE_GROUP */
+    struct flow_table_slot *slots;
+    struct flow_table_entry *entries;
+    uint32_t slot_mask;
+    uint32_t max_flows;
+    uint32_t free_head;
+    uint32_t overload_policy;
+    int64_t active_timeout_ns;
+    int64_t idle_timeout_ns;
+    uint64_t seed;
+    uint64_t tick;                  /* Wheel position, clock_ns >> FLOW_TABLE_TICK_SHIFT */
+    uint32_t wheel_flows;           /* Linked on a wheel level, not counting the due list */
+    uint32_t timer_heads[FLOW_TABLE_TIMER_LISTS];
+    uint64_t wheel_occupied[FLOW_TABLE_WHEEL_LEVELS];
+    uint32_t age_heads[2];          /* FLOW_TABLE_AGE_*, oldest first */
+    uint32_t age_tails[2];
+    struct flow_table_stats stats;
+};
+
+_Static_assert(sizeof(struct flow_table_key) == 40, "flow_table_key is hashed as five words");
+_Static_assert(sizeof(struct flow_table_entry) == 128, "flow_table_entry spans two cache lines");
+
+/* 64x64->128 multiply folded to 64 bits */
+static inline uint64_t flow_table_mix(uint64_t a, uint64_t b) {
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static inline uint64_t flow_table_word(const uint8_t *p) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+/* Keyed hash of the whole key, three multiplies */
+static uint32_t flow_table_hash(const struct flow_table *table, const struct flow_table_key *key) {
+    const uint8_t *p = (const uint8_t *)key;
+    uint64_t h;
+
+    h = flow_table_mix(flow_table_word(p) ^ table->seed ^ 0xA0761D6478BD642FULL,
+                       flow_table_word(p + 8) ^ 0xE7037ED1A0B428DBULL);
+    h ^= flow_table_mix(flow_table_word(p + 16) ^ 0x8EBC6AF09C88C6E3ULL,
+                        flow_table_word(p + 24) ^ 0x589965CC75374CC3ULL);
+    h = flow_table_mix(h ^ flow_table_word(p + 32), table->seed ^ 0x1D8E4E27C47D124FULL);
+    return (uint32_t)h ^ (uint32_t)(h >> 32);
+}
+
+static inline uint8_t flow_table_tag(uint32_t hash) {
+    return (uint8_t)(hash >> 25);
+}
+
+/* Eight control bytes, byte i of the group in bits 8i..8i+7 */
+static inline uint64_t flow_table_group(const struct flow_table *table, uint32_t pos) {
+    uint64_t group = flow_table_word(table->ctrl + pos);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    group = __builtin_bswap64(group);
+#endif
+    return group;
+}
+
+/* High bit set in every byte equal to tag (false positives possible above a match; keys are compared) */
+static inline uint64_t flow_table_match_tag(uint64_t group, uint8_t tag) {
+    uint64_t x = group ^ (FLOW_TABLE_LSB * tag);
+    return (x - FLOW_TABLE_LSB) & ~x & FLOW_TABLE_MSB;
+}
+
+/* Tags never have the high bit, so it marks exactly the empty bytes */
+static inline uint64_t flow_table_match_empty(uint64_t group) {
+    return group & FLOW_TABLE_MSB;
+}
+
+static inline void flow_table_set_ctrl(struct flow_table *table, uint32_t slot, uint8_t value) {
+    table->ctrl[slot] = value;
+    if (slot < FLOW_TABLE_GROUP) {
+        table->ctrl[table->slot_mask + 1 + slot] = value;
+    }
+}
+
+/*
+ * Find key. Returns its entry, or FLOW_TABLE_NO_ENTRY with *insert_slot
+ * set to the first empty slot of its probe sequence.
+ */
+static uint32_t flow_table_find(const struct flow_table *table, const struct flow_table_key *key,
+                                uint32_t hash, uint32_t *insert_slot) {
+    uint8_t tag = flow_table_tag(hash);
+    uint32_t pos = hash & table->slot_mask;
+    uint32_t probed;
+
+    // The pool never fills the index past 7/8, so an empty byte always ends the walk
+    for (probed = 0; probed <= table->slot_mask; probed += FLOW_TABLE_GROUP) {
+        uint64_t group = flow_table_group(table, pos);
+        uint64_t candidates = flow_table_match_tag(group, tag);
+        uint64_t empty = flow_table_match_empty(group);
+
+        if (empty) {
+            candidates &= (empty & -empty) - 1;
+        }
+        while (candidates) {
+            uint32_t slot = (pos + (uint32_t)(__builtin_ctzll(candidates) >> 3)) & table->slot_mask;
+            const struct flow_table_slot *entry_slot = &table->slots[slot];
+
+            if (entry_slot->hash == hash &&
+                memcmp(&table->entries[entry_slot->entry].key, key, sizeof(*key)) == 0) {
+                return entry_slot->entry;
+            }
+            candidates &= candidates - 1;
+        }
+        if (empty) {
+            *insert_slot = (pos + (uint32_t)(__builtin_ctzll(empty) >> 3)) & table->slot_mask;
+            return FLOW_TABLE_NO_ENTRY;
+        }
+        pos = (pos + FLOW_TABLE_GROUP) & table->slot_mask;
+    }
+    *insert_slot = FLOW_TABLE_NO_ENTRY;
+    return FLOW_TABLE_NO_ENTRY;
+}
+
+/* Empty slot, shifting back followers whose probe sequence passes through it */
+static void flow_table_erase_slot(struct flow_table *table, uint32_t hole) {
+    uint32_t mask = table->slot_mask;
+    uint32_t next = hole;
+
+    for (;;) {
+        uint32_t home;
+
+        next = (next + 1) & mask;
+        if (table->ctrl[next] == FLOW_TABLE_CTRL_EMPTY) {
+            break;
+        }
+        home = table->slots[next].hash & mask;
+        // Movable unless its home lies cyclically in (hole, next]
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            table->slots[hole] = table->slots[next];
+            table->entries[table->slots[hole].entry].slot = hole;
+            flow_table_set_ctrl(table, hole, table->ctrl[next]);
+            hole = next;
+        }
+    }
+    flow_table_set_ctrl(table, hole, FLOW_TABLE_CTRL_EMPTY);
+}
+
+static void flow_table_timer_link(struct flow_table *table, uint32_t index, uint32_t list) {
+    struct flow_table_entry *entry = &table->entries[index];
+    uint32_t head = table->timer_heads[list];
+
+    entry->timer_list = (uint16_t)list;
+    entry->timer_prev = FLOW_TABLE_NO_ENTRY;
+    entry->timer_next = head;
+    if (head != FLOW_TABLE_NO_ENTRY) {
+        table->entries[head].timer_prev = index;
+    }
+    table->timer_heads[list] = index;
+    if (list != FLOW_TABLE_DUE_LIST) {
+        table->wheel_occupied[list / FLOW_TABLE_WHEEL_SLOTS] |= 1ULL << (list % FLOW_TABLE_WHEEL_SLOTS);
+        table->wheel_flows++;
+    }
+}
+
+static void flow_table_timer_unlink(struct flow_table *table, uint32_t index) {
+    struct flow_table_entry *entry = &table->entries[index];
+    uint32_t list = entry->timer_list;
+
+    if (entry->timer_prev != FLOW_TABLE_NO_ENTRY) {
+        table->entries[entry->timer_prev].timer_next = entry->timer_next;
+    } else {
+        table->timer_heads[list] = entry->timer_next;
+    }
+    if (entry->timer_next != FLOW_TABLE_NO_ENTRY) {
+        table->entries[entry->timer_next].timer_prev = entry->timer_prev;
+    }
+    if (list != FLOW_TABLE_DUE_LIST) {
+        if (table->timer_heads[list] == FLOW_TABLE_NO_ENTRY) {
+            table->wheel_occupied[list / FLOW_TABLE_WHEEL_SLOTS] &= ~(1ULL << (list % FLOW_TABLE_WHEEL_SLOTS));
+        }
+        table->wheel_flows--;
+    }
+}
+
+/* Last instant the flow is still open; *reason says which timeout ends it */
+static int64_t flow_table_deadline(const struct flow_table *table, const struct flow_table_entry *entry,
+                                   uint8_t *reason) {
+    int64_t deadline = entry->first_ns + table->active_timeout_ns;
+
+    *reason = FLOW_TABLE_END_ACTIVE;
+    if (table->idle_timeout_ns > 0 && entry->last_ns + table->idle_timeout_ns < deadline) {
+        deadline = entry->last_ns + table->idle_timeout_ns;
+        *reason = FLOW_TABLE_END_IDLE;
+    }
+    if ((entry->flags & FLOW_TABLE_ENTRY_CLOSING) && entry->last_ns + FLOW_TABLE_FIN_LINGER_NS < deadline) {
+        deadline = entry->last_ns + FLOW_TABLE_FIN_LINGER_NS;
+        *reason = FLOW_TABLE_END_FIN;
+    }
+    return deadline;
+}
+
+/* Link the flow where it fires on the first tick after its deadline */
+static void flow_table_timer_schedule(struct flow_table *table, uint32_t index) {
+    uint8_t reason;
+    int64_t deadline = flow_table_deadline(table, &table->entries[index], &reason);
+    uint64_t due = deadline < 0 ? 0 : ((uint64_t)deadline >> FLOW_TABLE_TICK_SHIFT) + 1;
+    uint64_t delta;
+    uint32_t level = 0;
+
+    if (due <= table->tick) {
+        flow_table_timer_link(table, index, FLOW_TABLE_DUE_LIST);
+        return;
+    }
+    delta = due - table->tick;
+    while (level + 1 < FLOW_TABLE_WHEEL_LEVELS && delta >= 1ULL << (FLOW_TABLE_WHEEL_BITS * (level + 1))) {
+        level++;
+    }
+    if (delta >= 1ULL << (FLOW_TABLE_WHEEL_BITS * (level + 1))) {
+        // Beyond the top level: park in its last slot and reschedule when it cascades
+        due = table->tick + (1ULL << (FLOW_TABLE_WHEEL_BITS * (level + 1))) - 1;
+    }
+    flow_table_timer_link(table, index,
+                          level * FLOW_TABLE_WHEEL_SLOTS +
+                          (uint32_t)((due >> (FLOW_TABLE_WHEEL_BITS * level)) & (FLOW_TABLE_WHEEL_SLOTS - 1)));
+}
+
+/* Detach a whole wheel slot; returns its first flow */
+static uint32_t flow_table_timer_take(struct flow_table *table, uint32_t level, uint32_t slot) {
+    uint32_t list = level * FLOW_TABLE_WHEEL_SLOTS + slot;
+    uint32_t head = table->timer_heads[list];
+    uint32_t index;
+
+    table->timer_heads[list] = FLOW_TABLE_NO_ENTRY;
+    table->wheel_occupied[level] &= ~(1ULL << slot);
+    for (index = head; index != FLOW_TABLE_NO_ENTRY; index = table->entries[index].timer_next) {
+        table->wheel_flows--;
+    }
+    return head;
+}
+
+/* Run the wheel's work for the tick it has just reached */
+static void flow_table_timer_tick(struct flow_table *table) {
+    uint64_t tick = table->tick;
+    uint32_t level;
+    uint32_t index;
+
+    // Cascade every level whose rotation position changed, top down
+    for (level = FLOW_TABLE_WHEEL_LEVELS - 1; level > 0; level--) {
+        if (tick & ((1ULL << (FLOW_TABLE_WHEEL_BITS * level)) - 1)) {
+            continue;
+        }
+        index = flow_table_timer_take(table, level,
+                                      (uint32_t)((tick >> (FLOW_TABLE_WHEEL_BITS * level)) & (FLOW_TABLE_WHEEL_SLOTS - 1)));
+        while (index != FLOW_TABLE_NO_ENTRY) {
+            uint32_t next = table->entries[index].timer_next;
+
+            flow_table_timer_schedule(table, index);
+            index = next;
+        }
+    }
+    index = flow_table_timer_take(table, 0, (uint32_t)(tick & (FLOW_TABLE_WHEEL_SLOTS - 1)));
+    while (index != FLOW_TABLE_NO_ENTRY) {
+        uint32_t next = table->entries[index].timer_next;
+
+        flow_table_timer_link(table, index, FLOW_TABLE_DUE_LIST);
+        index = next;
+    }
+}
+
+/* Move the wheel up to clock_ns, collecting fired flows on the due list */
+static void flow_table_timer_advance(struct flow_table *table) {
+    uint64_t target = table->stats.clock_ns < 0 ? 0 : (uint64_t)table->stats.clock_ns >> FLOW_TABLE_TICK_SHIFT;
+
+    while (table->tick < target) {
+        uint64_t rotation_end = (table->tick | (FLOW_TABLE_WHEEL_SLOTS - 1)) + 1;
+        uint32_t slot = (uint32_t)(table->tick & (FLOW_TABLE_WHEEL_SLOTS - 1));
+        uint64_t ahead = slot + 1 < FLOW_TABLE_WHEEL_SLOTS ? table->wheel_occupied[0] >> (slot + 1) : 0;
+        uint64_t next;
+
+        if (table->wheel_flows == 0) {
+            table->tick = target;
+            break;
+        }
+        // Next occupied level 0 slot this rotation, else the rotation boundary (cascades)
+        next = ahead ? table->tick + 1 + (uint64_t)__builtin_ctzll(ahead) : rotation_end;
+        if (next > target) {
+            table->tick = target;
+            break;
+        }
+        table->tick = next;
+        flow_table_timer_tick(table);
+    }
+}
+
+/* Append to the back of an age list */
+static void flow_table_age_link(struct flow_table *table, uint32_t index, uint32_t list) {
+    struct flow_table_entry *entry = &table->entries[index];
+    uint32_t tail = table->age_tails[list];
+
+    entry->age_next = FLOW_TABLE_NO_ENTRY;
+    entry->age_prev = tail;
+    if (tail == FLOW_TABLE_NO_ENTRY) {
+        table->age_heads[list] = index;
+    } else {
+        table->entries[tail].age_next = index;
+    }
+    table->age_tails[list] = index;
+}
+
+static void flow_table_age_unlink(struct flow_table *table, uint32_t index) {
+    struct flow_table_entry *entry = &table->entries[index];
+    uint32_t list = (entry->flags & FLOW_TABLE_ENTRY_SEEN) ? FLOW_TABLE_AGE_SEEN : FLOW_TABLE_AGE_YOUNG;
+
+    if (entry->age_prev == FLOW_TABLE_NO_ENTRY) {
+        table->age_heads[list] = entry->age_next;
+    } else {
+        table->entries[entry->age_prev].age_next = entry->age_next;
+    }
+    if (entry->age_next == FLOW_TABLE_NO_ENTRY) {
+        table->age_tails[list] = entry->age_prev;
+    } else {
+        table->entries[entry->age_next].age_prev = entry->age_prev;
+    }
+}
+
+/* Flow to export for a new one when every entry is in use */
+static uint32_t flow_table_victim(struct flow_table *table) {
+    uint32_t young = table->age_heads[FLOW_TABLE_AGE_YOUNG];
+    uint32_t index;
+
+    if (table->overload_policy == FLOW_TABLE_OVERLOAD_EVICT_SINGLE_PACKET && young != FLOW_TABLE_NO_ENTRY) {
+        return young;
+    }
+    // Second chance: each pass clears the bit, so this ends within one rotation
+    while ((index = table->age_heads[FLOW_TABLE_AGE_SEEN]) != FLOW_TABLE_NO_ENTRY &&
+           (table->entries[index].flags & FLOW_TABLE_ENTRY_REFERENCED)) {
+        table->entries[index].flags &= ~FLOW_TABLE_ENTRY_REFERENCED;
+        flow_table_age_unlink(table, index);
+        flow_table_age_link(table, index, FLOW_TABLE_AGE_SEEN);
+    }
+    if (index == FLOW_TABLE_NO_ENTRY ||
+        (young != FLOW_TABLE_NO_ENTRY && table->entries[young].last_ns < table->entries[index].last_ns)) {
+        return young;
+    }
+    return index;
+}
+
+static void flow_table_release(struct flow_table *table, uint32_t index) {
+    struct flow_table_entry *entry = &table->entries[index];
+
+    flow_table_timer_unlink(table, index);
+    if (table->overload_policy != FLOW_TABLE_OVERLOAD_AGGREGATE) {
+        flow_table_age_unlink(table, index);
+    }
+    flow_table_erase_slot(table, entry->slot);
+    entry->flags = 0;
+    entry->slot = table->free_head;
+    table->free_head = index;
+    table->stats.live_flows--;
+}
+
+/* Write entry as a record oriented by initiator */
+static void flow_table_emit(struct flow_table *table, const struct flow_table_entry *entry, uint8_t reason,
+                            struct flow_table_record *out) {
+    int reverse = (entry->flags & FLOW_TABLE_ENTRY_ORIGIN_REVERSE) != 0;
+    int forward = reverse ? FLOW_TABLE_DIR_REVERSE : FLOW_TABLE_DIR_FORWARD;
+
+    memcpy(out->src_addr, reverse ? entry->key.dst_addr : entry->key.src_addr, sizeof(out->src_addr));
+    memcpy(out->dst_addr, reverse ? entry->key.src_addr : entry->key.dst_addr, sizeof(out->dst_addr));
+    out->src_port = reverse ? entry->key.dst_port : entry->key.src_port;
+    out->dst_port = reverse ? entry->key.src_port : entry->key.dst_port;
+    out->ip_version = entry->key.ip_version;
+    out->protocol = entry->key.protocol;
+    out->end_reason = reason;
+    out->reserved = 0;
+    out->segment = entry->segment;
+    out->reserved2 = 0;
+    out->packets[FLOW_TABLE_DIR_FORWARD] = entry->packets[forward];
+    out->packets[FLOW_TABLE_DIR_REVERSE] = entry->packets[!forward];
+    out->bytes[FLOW_TABLE_DIR_FORWARD] = entry->bytes[forward];
+    out->bytes[FLOW_TABLE_DIR_REVERSE] = entry->bytes[!forward];
+    out->first_ns = entry->first_ns;
+    out->last_ns = entry->last_ns;
+    out->origin_ns = entry->origin_ns;
+    table->stats.records++;
+    switch (reason) {
+    case FLOW_TABLE_END_ACTIVE:
+        table->stats.active_records++;
+        break;
+    case FLOW_TABLE_END_IDLE:
+        table->stats.idle_records++;
+        break;
+    case FLOW_TABLE_END_FIN:
+        table->stats.fin_records++;
+        break;
+    case FLOW_TABLE_END_RST:
+        table->stats.rst_records++;
+        break;
+    case FLOW_TABLE_END_EVICTED:
+        table->stats.evicted_records++;
+        break;
+    }
+}
+
+/* Start the next segment of a flow exported at its active timeout */
+static void flow_table_continue(struct flow_table_entry *entry, int64_t start_ns) {
+    entry->segment++;
+    memset(entry->packets, 0, sizeof(entry->packets));
+    memset(entry->bytes, 0, sizeof(entry->bytes));
+    // Replaced by the segment's first packet; until then it anchors the next active deadline
+    entry->first_ns = start_ns;
+}
+
+/* Reschedule after a change that can bring the deadline forward */
+static void flow_table_timer_reset(struct flow_table *table, uint32_t index) {
+    if (table->entries[index].timer_list != FLOW_TABLE_DUE_LIST) {
+        flow_table_timer_unlink(table, index);
+        flow_table_timer_schedule(table, index);
+    }
+}
+
+/* Build the canonical key of a parsed packet; returns the packet's FLOW_TABLE_DIR_* */
+static int flow_table_key_from(const struct frame_packet_desc *packet, struct flow_table_key *key) {
+    size_t addr_len = packet->ip_version == 4 ? 4 : 16;
+    int order;
+
+    memset(key, 0, sizeof(*key));
+    key->ip_version = packet->ip_version;
+    key->protocol = packet->protocol;
+    order = memcmp(packet->src_addr, packet->dst_addr, addr_len);
+    if (order < 0 || (order == 0 && packet->src_port <= packet->dst_port)) {
+        memcpy(key->src_addr, packet->src_addr, addr_len);
+        memcpy(key->dst_addr, packet->dst_addr, addr_len);
+        key->src_port = packet->src_port;
+        key->dst_port = packet->dst_port;
+        return FLOW_TABLE_DIR_FORWARD;
+    }
+    memcpy(key->src_addr, packet->dst_addr, addr_len);
+    memcpy(key->dst_addr, packet->src_addr, addr_len);
+    key->src_port = packet->dst_port;
+    key->dst_port = packet->src_port;
+    return FLOW_TABLE_DIR_REVERSE;
+}
+
+/* Account one IP packet; returns records written to out (at most FLOW_TABLE_RECORDS_PER_PACKET) */
+static uint32_t flow_table_account(struct flow_table *table, const struct af_packet_frame_desc *frame,
+                                   const struct frame_packet_desc *packet, const struct flow_table_key *key,
+                                   uint32_t hash, int dir, struct flow_table_record *out) {
+    int64_t ts_ns = frame->ts_ns;
+    uint8_t tcp_flags = packet->protocol == FLOW_TABLE_IPPROTO_TCP ? packet->tcp_flags : 0;
+    struct flow_table_entry *entry;
+    uint32_t written = 0;
+    uint32_t insert_slot;
+    uint32_t index;
+    uint8_t reason;
+
+    if (ts_ns > table->stats.clock_ns) {
+        table->stats.clock_ns = ts_ns;
+        flow_table_timer_advance(table);
+    }
+    index = flow_table_find(table, key, hash, &insert_slot);
+    if (index != FLOW_TABLE_NO_ENTRY) {
+        entry = &table->entries[index];
+        if ((entry->flags & FLOW_TABLE_ENTRY_CLOSING) &&
+            (tcp_flags & (FLOW_TABLE_TCP_SYN | FLOW_TABLE_TCP_ACK)) == FLOW_TABLE_TCP_SYN) {
+            // Port reuse: a new connection on a tuple that has just closed
+            if (entry->packets[0] + entry->packets[1]) {
+                flow_table_emit(table, entry, FLOW_TABLE_END_FIN, &out[written++]);
+            }
+            flow_table_release(table, index);
+            index = flow_table_find(table, key, hash, &insert_slot);
+        } else if (ts_ns > flow_table_deadline(table, entry, &reason)) {
+            // Timer fired but not yet collected, or still pending within its tick
+            int idle_segment = entry->packets[0] + entry->packets[1] == 0;
+
+            if (!idle_segment) {
+                flow_table_emit(table, entry, reason, &out[written++]);
+            }
+            if (reason == FLOW_TABLE_END_ACTIVE && !idle_segment) {
+                flow_table_continue(entry, ts_ns);
+            } else {
+                flow_table_release(table, index);
+                index = flow_table_find(table, key, hash, &insert_slot);
+            }
+        }
+    }
+    if (index == FLOW_TABLE_NO_ENTRY && table->free_head == FLOW_TABLE_NO_ENTRY &&
+        table->overload_policy != FLOW_TABLE_OVERLOAD_AGGREGATE) {
+        uint32_t victim = flow_table_victim(table);
+
+        entry = &table->entries[victim];
+        if (!(entry->flags & FLOW_TABLE_ENTRY_SEEN)) {
+            table->stats.single_packet_evictions++;
+        }
+        if (entry->packets[0] + entry->packets[1]) {
+            flow_table_emit(table, entry, FLOW_TABLE_END_EVICTED, &out[written++]);
+        }
+        flow_table_release(table, victim);
+        // The backward shift can move the empty slot the insert was going to use
+        index = flow_table_find(table, key, hash, &insert_slot);
+    }
+    if (index == FLOW_TABLE_NO_ENTRY) {
+        if (table->free_head == FLOW_TABLE_NO_ENTRY || insert_slot == FLOW_TABLE_NO_ENTRY) {
+            table->stats.insert_failures++;
+            table->stats.aggregate_packets++;
+            table->stats.aggregate_bytes += frame->wirelen;
+            return written;
+        }
+        index = table->free_head;
+        entry = &table->entries[index];
+        table->free_head = entry->slot;
+        memset(entry, 0, sizeof(*entry));
+        entry->key = *key;
+        entry->first_ns = ts_ns;
+        entry->last_ns = ts_ns;
+        entry->origin_ns = ts_ns;
+        entry->slot = insert_slot;
+        entry->flags = FLOW_TABLE_ENTRY_LIVE |
+                       (dir == FLOW_TABLE_DIR_REVERSE ? FLOW_TABLE_ENTRY_ORIGIN_REVERSE : 0);
+        table->slots[insert_slot].hash = hash;
+        table->slots[insert_slot].entry = index;
+        flow_table_set_ctrl(table, insert_slot, flow_table_tag(hash));
+        table->stats.flows++;
+        table->stats.live_flows++;
+        flow_table_timer_schedule(table, index);
+        if (table->overload_policy != FLOW_TABLE_OVERLOAD_AGGREGATE) {
+            flow_table_age_link(table, index, FLOW_TABLE_AGE_YOUNG);
+        }
+    } else if (table->overload_policy != FLOW_TABLE_OVERLOAD_AGGREGATE) {
+        entry = &table->entries[index];
+        if (entry->flags & FLOW_TABLE_ENTRY_SEEN) {
+            entry->flags |= FLOW_TABLE_ENTRY_REFERENCED;
+        } else {
+            // Second packet: no longer a single-packet flow
+            flow_table_age_unlink(table, index);
+            entry->flags |= FLOW_TABLE_ENTRY_SEEN;
+            flow_table_age_link(table, index, FLOW_TABLE_AGE_SEEN);
+        }
+    }
+    entry = &table->entries[index];
+    if (entry->packets[0] + entry->packets[1] == 0) {
+        int64_t anchor_ns = entry->first_ns;
+
+        entry->first_ns = ts_ns;
+        if (ts_ns < anchor_ns) {
+            // Packet older than a clock-anchored continuation: the deadline came forward
+            flow_table_timer_reset(table, index);
+        }
+    }
+    entry->packets[dir]++;
+    entry->bytes[dir] += frame->wirelen;
+    if (ts_ns > entry->last_ns) {
+        entry->last_ns = ts_ns;
+    }
+    table->stats.packets++;
+
+    if (tcp_flags & FLOW_TABLE_TCP_RST) {
+        flow_table_emit(table, entry, FLOW_TABLE_END_RST, &out[written++]);
+        flow_table_release(table, index);
+    } else if ((tcp_flags & FLOW_TABLE_TCP_FIN) && !(entry->flags & FLOW_TABLE_ENTRY_CLOSING)) {
+        entry->flags |= dir == FLOW_TABLE_DIR_FORWARD ? FLOW_TABLE_ENTRY_FIN_FORWARD : FLOW_TABLE_ENTRY_FIN_REVERSE;
+        if ((entry->flags & FLOW_TABLE_ENTRY_FIN_FORWARD) && (entry->flags & FLOW_TABLE_ENTRY_FIN_REVERSE)) {
+            entry->flags |= FLOW_TABLE_ENTRY_CLOSING;
+            flow_table_timer_reset(table, index);
+        }
+    }
+    return written;
+}
+
+/*
+ * Bytes a table for max_flows allocates, with its index slot count in
+ * *slots. Returns 0 if the index would not fit 32-bit slot numbers.
+ */
+static uint64_t flow_table_footprint(uint64_t max_flows, uint32_t *slots) {
+    // At most 7/8 of the slots in use keeps probes short and guarantees an empty byte
+    uint64_t wanted = max_flows + max_flows / 7 + 1;
+    uint32_t count = FLOW_TABLE_MIN_SLOTS;
+
+    while (count < wanted) {
+        if (count > UINT32_MAX / 2) {
+            return 0;
+        }
+        count <<= 1;
+    }
+    *slots = count;
+    return (uint64_t)count * (sizeof(struct flow_table_slot) + 1) + FLOW_TABLE_GROUP +
+           max_flows * sizeof(struct flow_table_entry) + sizeof(struct flow_table);
+}
+
+/*
+ * Open a table for config->max_flows concurrent flows, or fewer if
+ * config->memory_budget cannot hold that many.
+ * Returns handle on success, NULL on error (errno set).
+ */
+struct flow_table *flow_table_open(const struct flow_table_config *config) {
+    struct flow_table *table;
+    uint64_t max_flows;
+    uint64_t memory_bytes;
+    uint32_t slots;
+    uint32_t i;
+
+    if (!config || (config->max_flows == 0 && config->memory_budget == 0) || config->active_timeout_ns <= 0 ||
+        config->idle_timeout_ns < 0 || config->overload_policy > FLOW_TABLE_OVERLOAD_EVICT_SINGLE_PACKET) {
+        errno = EINVAL;
+        return NULL;
+    }
+    max_flows = config->max_flows ? config->max_flows : UINT32_MAX - 1;
+    if (config->memory_budget) {
+        // Largest table within the budget; the footprint only grows with max_flows
+        uint64_t low = 0;
+        uint64_t high = max_flows;
+
+        while (low < high) {
+            uint64_t mid = low + (high - low + 1) / 2;
+            uint64_t bytes = flow_table_footprint(mid, &slots);
+
+            if (bytes && bytes <= config->memory_budget) {
+                low = mid;
+            } else {
+                high = mid - 1;
+            }
+        }
+        max_flows = low;
+    }
+    memory_bytes = max_flows ? flow_table_footprint(max_flows, &slots) : 0;
+    if (!memory_bytes) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    table = calloc(1, sizeof(*table));
+    if (!table) {
+        return NULL;
+    }
+    table->ctrl = malloc((size_t)slots + FLOW_TABLE_GROUP);
+    table->slots = malloc((size_t)slots * sizeof(*table->slots));
+    table->entries = calloc(max_flows, sizeof(*table->entries));
+    if (!table->ctrl || !table->slots || !table->entries) {
+        flow_table_close(table);
+        errno = ENOMEM;
+        return NULL;
+    }
+    // Every page is written here (the free list below covers the pool), so the
+    // budget is committed at open rather than faulted in under a flood
+    memset(table->ctrl, FLOW_TABLE_CTRL_EMPTY, (size_t)slots + FLOW_TABLE_GROUP);
+    memset(table->slots, 0, (size_t)slots * sizeof(*table->slots));
+    for (i = 0; i < max_flows; i++) {
+        table->entries[i].slot = i + 1 < max_flows ? i + 1 : FLOW_TABLE_NO_ENTRY;
+    }
+    for (i = 0; i < FLOW_TABLE_TIMER_LISTS; i++) {
+        table->timer_heads[i] = FLOW_TABLE_NO_ENTRY;
+    }
+    for (i = 0; i < 2; i++) {
+        table->age_heads[i] = FLOW_TABLE_NO_ENTRY;
+        table->age_tails[i] = FLOW_TABLE_NO_ENTRY;
+    }
+    table->free_head = 0;
+    table->slot_mask = slots - 1;
+    table->max_flows = (uint32_t)max_flows;
+    table->overload_policy = config->overload_policy;
+    table->active_timeout_ns = config->active_timeout_ns;
+    table->idle_timeout_ns = config->idle_timeout_ns;
+    table->seed = config->hash_seed;
+    table->stats.max_flows = max_flows;
+    table->stats.index_slots = slots;
+    table->stats.memory_bytes = memory_bytes;
+    return table;
+}
+
+/*
+ * Account count parsed packets (frames[i] / packets[i] from one batch read)
+ * to their flows. Frames without an IP packet are skipped. Packet times
+ * drive the table's clock; flows whose timers fire wait for
+ * flow_table_expire. Records completed by a packet (RST, a packet after
+ * its flow's deadline, a SYN on a closing flow) are written to out,
+ * which must hold
+ * count * FLOW_TABLE_RECORDS_PER_PACKET records.
+ * Returns records written, -1 on error (errno set). *accounted receives
+ * the number of packets accounted to a flow.
+ */
+int flow_table_update_batch(struct flow_table *table, const struct af_packet_frame_desc *frames,
+                            const struct frame_packet_desc *packets, uint32_t count,
+                            struct flow_table_record *out, uint32_t out_cap, uint32_t *accounted) {
+    struct flow_table_key keys[FLOW_TABLE_PREFETCH];
+    uint32_t hashes[FLOW_TABLE_PREFETCH];
+    int dirs[FLOW_TABLE_PREFETCH];
+    uint64_t packets_before;
+    uint32_t written = 0;
+    uint32_t base;
+    uint32_t i;
+
+    if (!table || (count && (!frames || !packets || !out)) ||
+        (uint64_t)out_cap < (uint64_t)count * FLOW_TABLE_RECORDS_PER_PACKET) {
+        errno = EINVAL;
+        return -1;
+    }
+    packets_before = table->stats.packets;
+    for (base = 0; base < count; base += FLOW_TABLE_PREFETCH) {
+        uint32_t chunk = count - base < FLOW_TABLE_PREFETCH ? count - base : FLOW_TABLE_PREFETCH;
+
+        // Hash the chunk first so its index lines are in flight before the first lookup
+        for (i = 0; i < chunk; i++) {
+            if (packets[base + i].ip_version == 0) {
+                continue;
+            }
+            dirs[i] = flow_table_key_from(&packets[base + i], &keys[i]);
+            hashes[i] = flow_table_hash(table, &keys[i]);
+            __builtin_prefetch(&table->ctrl[hashes[i] & table->slot_mask]);
+            __builtin_prefetch(&table->slots[hashes[i] & table->slot_mask]);
+        }
+        for (i = 0; i < chunk; i++) {
+            if (packets[base + i].ip_version == 0) {
+                continue;
+            }
+            written += flow_table_account(table, &frames[base + i], &packets[base + i], &keys[i], hashes[i], dirs[i],
+                                          &out[written]);
+        }
+    }
+    if (accounted) {
+        *accounted = (uint32_t)(table->stats.packets - packets_before);
+    }
+    return (int)written;
+}
+
+/*
+ * Complete up to out_cap flows whose idle, active or FIN linger deadline
+ * has passed; flows at their active timeout are exported and continue.
+ * now_ns moves the clock forward when it is ahead of the newest packet
+ * (pass 0 to expire on packet time alone). A record's end time is its
+ * last packet. Call again while it fills out; cost is proportional to the
+ * flows whose timers fire, not to the table size.
+ * Returns records written, -1 on error (errno set).
+ */
+int flow_table_expire(struct flow_table *table, int64_t now_ns, struct flow_table_record *out, uint32_t out_cap) {
+    uint32_t written = 0;
+
+    if (!table || (out_cap && !out)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (now_ns > table->stats.clock_ns) {
+        table->stats.clock_ns = now_ns;
+    }
+    flow_table_timer_advance(table);
+    while (written < out_cap && table->timer_heads[FLOW_TABLE_DUE_LIST] != FLOW_TABLE_NO_ENTRY) {
+        uint32_t index = table->timer_heads[FLOW_TABLE_DUE_LIST];
+        struct flow_table_entry *entry = &table->entries[index];
+        uint8_t reason;
+
+        if (table->stats.clock_ns > flow_table_deadline(table, entry, &reason)) {
+            int idle_segment = entry->packets[0] + entry->packets[1] == 0;
+
+            if (!idle_segment) {
+                flow_table_emit(table, entry, reason, &out[written++]);
+            }
+            if (reason == FLOW_TABLE_END_ACTIVE && !idle_segment) {
+                flow_table_continue(entry, table->stats.clock_ns);
+                flow_table_timer_unlink(table, index);
+                flow_table_timer_schedule(table, index);
+            } else {
+                // A continuation that saw no packet ends without a record
+                flow_table_release(table, index);
+            }
+        } else {
+            // Packets arrived after the timer was set: the deadline moved on
+            flow_table_timer_unlink(table, index);
+            flow_table_timer_schedule(table, index);
+            table->stats.timer_reschedules++;
+        }
+    }
+    return (int)written;
+}
+
+int flow_table_stats(const struct flow_table *table, struct flow_table_stats *out) {
+    if (!table || !out) {
+        errno = EINVAL;
+        return -1;
+    }
+    *out = table->stats;
+    return 0;
+}
+
+void flow_table_close(struct flow_table *table) {
+    if (!table) {
+        return;
+    }
+    free(table->entries);
+    free(table->slots);
+    free(table->ctrl);
+    free(table);
+}
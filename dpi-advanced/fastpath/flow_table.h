@@ -0,0 +1,127 @@
+/*
+ * RansomEye DPI Advanced - Flow Table
+ * AUTHORITATIVE: Native flow assembly over parsed packet descriptors
+ *
+ * NOTE:
+ * - Fixed memory: the entry pool and the index are sized at open, from
+ *   max_flows or the largest table memory_budget holds, written once so
+ *   every page is committed up front, and never grow.
+ * - When every entry is in use, overload_policy decides a new flow's fate:
+ *   counted only in the aggregate_* totals, or admitted by exporting a
+ *   victim (the least recently active flow, or single-packet flows first,
+ *   which is what a SYN flood or scan fills the table with).
+ * - Keys are a packed binary 5-tuple (16-byte addresses, IPv4 in the
+ *   first 4), canonical so both directions share one entry; records are
+ *   turned around so src is the endpoint that sent the first packet.
+ * - The index is open addressing with linear probing over 1-byte control
+ *   tags, matched 8 at a time with word-wide (SWAR) compares; deletion
+ *   shifts followers back, so there are no tombstones to clean up.
+ * - Timestamps are integer nanoseconds from the frame descriptors. The
+ *   table's clock is the newest packet time it has seen; flow_table_expire
+ *   may only move it forward (for a link that has gone quiet).
+ * - Idle and active deadlines are kept on a hierarchical timer wheel with
+ *   67 ms ticks, so expiry costs O(flows that fire), never a scan of the
+ *   table, and a flow is collected at most one tick after its deadline.
+ *   Packets do not touch the wheel: a firing flow whose deadline has
+ *   moved is rescheduled instead of completed.
+ * - TCP flows end on RST at once, and FLOW_TABLE_FIN_LINGER_NS after both
+ *   sides have sent FIN (so the closing ACKs stay in the flow); a bare SYN
+ *   on a closing flow starts a new one.
+ * - A flow open past the active timeout is exported and keeps its entry:
+ *   the next record continues it with segment + 1 and the same origin_ns,
+ *   so long flows arrive as a linked series, not as unrelated flows.
+ * - Not thread-safe; one table per consuming thread.
+ */
+
+#ifndef RANSOMEYE_FLOW_TABLE_H
+#define RANSOMEYE_FLOW_TABLE_H
+
+#include <stdint.h>
+
+#include "af_packet_capture.h"
+#include "frame_parser.h"
+
+/* flow_table_record.packets[] / bytes[] index, relative to the record's src */
+#define FLOW_TABLE_DIR_FORWARD 0
+#define FLOW_TABLE_DIR_REVERSE 1
+
+/* flow_table_record.end_reason */
+#define FLOW_TABLE_END_ACTIVE 1           /* Open longer than active_timeout_ns; continues in segment + 1 */
+#define FLOW_TABLE_END_IDLE 2             /* No packet for idle_timeout_ns */
+#define FLOW_TABLE_END_FIN 3              /* Both sides sent FIN */
+#define FLOW_TABLE_END_RST 4              /* RST seen */
+#define FLOW_TABLE_END_EVICTED 5          /* Exported early to admit a new flow into a full table */
+
+/* flow_table_config.overload_policy */
+#define FLOW_TABLE_OVERLOAD_AGGREGATE 0          /* New flows are not tracked; their packets count in aggregate_* */
+#define FLOW_TABLE_OVERLOAD_EVICT_OLDEST 1       /* Evict the least recently active flow (second chance) */
+#define FLOW_TABLE_OVERLOAD_EVICT_SINGLE_PACKET 2 /* Evict the oldest single-packet flow, else as EVICT_OLDEST */
+
+/* Time a TCP flow stays open after both FINs, for the final ACKs */
+#define FLOW_TABLE_FIN_LINGER_NS 1000000000LL
+
+/* Records one packet can complete (its flow's deadline passed or a victim
+   was evicted for it, then RST);
+   update_batch output must hold count * this */
+#define FLOW_TABLE_RECORDS_PER_PACKET 2u
+
+struct flow_table;
+
+struct flow_table_config {
+    uint32_t max_flows;             /* Concurrent flows; sizes every allocation. 0: as many as memory_budget holds */
+    uint32_t overload_policy;       /* FLOW_TABLE_OVERLOAD_* */
+    int64_t active_timeout_ns;      /* Flows are completed once open longer than this */
+    int64_t idle_timeout_ns;        /* ... or once this long without a packet; 0 disables */
+    uint64_t hash_seed;             /* Keyed index hash; use a random value per run */
+    uint64_t memory_budget;         /* Bytes for the whole table, max_flows is lowered to fit; 0 = no cap */
+};
+
+/* Completed flow or flow segment, 104 bytes */
+struct flow_table_record {
+    uint8_t src_addr[16];           /* Initiator */
+    uint8_t dst_addr[16];
+    uint16_t src_port;              /* Host order */
+    uint16_t dst_port;
+    uint8_t ip_version;
+    uint8_t protocol;
+    uint8_t end_reason;             /* FLOW_TABLE_END_* */
+    uint8_t reserved;
+    uint32_t segment;               /* 0 for a flow's first record, then one per active timeout */
+    uint32_t reserved2;
+    uint64_t packets[2];            /* FLOW_TABLE_DIR_*, this segment only */
+    uint64_t bytes[2];              /* On-wire lengths */
+    int64_t first_ns;               /* First and last packet of this segment */
+    int64_t last_ns;
+    int64_t origin_ns;              /* first_ns of segment 0 */
+};
+
+struct flow_table_stats {
+    uint64_t packets;               /* IP packets accounted to a flow */
+    uint64_t flows;                 /* Flows created */
+    uint64_t records;               /* Completed flows handed out */
+    uint64_t insert_failures;       /* Packets of new flows not admitted: every entry in use */
+    uint64_t aggregate_packets;     /* ... counted here instead, on-wire lengths in aggregate_bytes */
+    uint64_t aggregate_bytes;
+    uint64_t active_records;        /* Records by end reason */
+    uint64_t idle_records;
+    uint64_t fin_records;
+    uint64_t rst_records;
+    uint64_t evicted_records;
+    uint64_t single_packet_evictions; /* Evicted flows that had seen one packet */
+    uint64_t timer_reschedules;     /* Fired timers whose flow had seen packets since */
+    uint64_t live_flows;
+    uint64_t max_flows;
+    uint64_t index_slots;
+    uint64_t memory_bytes;          /* Entry pool + index + wheel, fixed at open */
+    int64_t clock_ns;               /* Newest packet time, or the time expiry was driven to */
+};
+
+struct flow_table *flow_table_open(const struct flow_table_config *config);
+int flow_table_update_batch(struct flow_table *table, const struct af_packet_frame_desc *frames,
+                            const struct frame_packet_desc *packets, uint32_t count,
+                            struct flow_table_record *out, uint32_t out_cap, uint32_t *accounted);
+int flow_table_expire(struct flow_table *table, int64_t now_ns, struct flow_table_record *out, uint32_t out_cap);
+int flow_table_stats(const struct flow_table *table, struct flow_table_stats *out);
+void flow_table_close(struct flow_table *table);
+
+#endif /* RANSOMEYE_FLOW_TABLE_H */
@@ -0,0 +1,67 @@
+/*
+ * RansomEye DPI Advanced - Frame Parser
+ * AUTHORITATIVE: Native L2-L4 header parser producing fixed packet descriptors
+ *
+ * NOTE:
+ * - Handles Ethernet with 802.1Q/802.1ad (QinQ) tags, MPLS label stacks
+ *   (including Ethernet pseudowires), IPv4 with options, IPv6 with
+ *   extension headers, and TCP/UDP/ICMP/ICMPv6.
+ * - Never allocates and never reads past caplen; safe to call from any
+ *   capture worker thread.
+ */
+
+#ifndef RANSOMEYE_FRAME_PARSER_H
+#define RANSOMEYE_FRAME_PARSER_H
+
+#include <stdint.h>
+
+#include "af_packet_capture.h"
+
+/* Nesting limits; deeper stacks are reported as unparsed */
+#define FRAME_PARSER_MAX_VLAN_TAGS 4u
+#define FRAME_PARSER_MAX_MPLS_LABELS 8u
+#define FRAME_PARSER_MAX_IPV6_EXT_HEADERS 8u
+
+/* Packet descriptor flags */
+#define FRAME_PACKET_L4_VALID 0x1u        /* Ports / ICMP type were read */
+#define FRAME_PACKET_FRAGMENT 0x2u        /* IP fragment (first or later) */
+#define FRAME_PACKET_LATER_FRAGMENT 0x4u  /* Non-first fragment, no L4 header */
+#define FRAME_PACKET_TRUNCATED 0x8u       /* Headers continue past caplen */
+#define FRAME_PACKET_PSEUDOWIRE 0x10u     /* Inner Ethernet carried over MPLS */
+#define FRAME_PACKET_MALFORMED 0x20u      /* Invalid IP header or over-deep tag/label stack */
+
+/*
+ * Parsed packet descriptor (64 bytes, fixed layout for ctypes/struct).
+ * ip_version 0 means the frame carried no parseable IP packet.
+ * IPv4 addresses occupy the first 4 bytes of src_addr/dst_addr.
+ */
+struct frame_packet_desc {
+    uint8_t src_addr[16];
+    uint8_t dst_addr[16];
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint16_t outer_vlan;        /* VLAN ID of the outermost tag, 0 if untagged */
+    uint16_t inner_vlan;        /* VLAN ID of the second tag (QinQ) */
+    uint16_t l3_offset;
+    uint16_t l4_offset;
+    uint16_t payload_offset;
+    uint16_t flags;
+    uint32_t mpls_label;        /* Bottom-of-stack label */
+    uint8_t ip_version;
+    uint8_t protocol;           /* Final L4 protocol / IPv6 next header */
+    uint8_t vlan_count;
+    uint8_t mpls_count;
+    uint8_t tcp_flags;
+    uint8_t icmp_type;
+    uint8_t icmp_code;
+    uint8_t ttl;                /* IPv4 TTL / IPv6 hop limit */
+    uint32_t reserved;
+};
+
+int frame_parse(const unsigned char *frame, uint32_t caplen, struct frame_packet_desc *out);
+int frame_parse_batch(const unsigned char *buffer, uint32_t buffer_len,
+                      const struct af_packet_frame_desc *frames, uint32_t count,
+                      struct frame_packet_desc *out,
+                      uint64_t *parse_errors, uint32_t error_slots);
+
+#endif /* RANSOMEYE_FRAME_PARSER_H */
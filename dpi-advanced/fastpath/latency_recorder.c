@@ -0,0 +1,379 @@
+/*
+ * RansomEye DPI Advanced - Latency Recorder
+ * AUTHORITATIVE: TSC-stamped per-stage latency histograms for fastpath benchmarks
+ *
+ * NOTE:
+ * - Stamps are raw TSC reads (rdtsc, no serialisation) on x86; other
+ *   architectures fall back to CLOCK_MONOTONIC nanoseconds. The tick rate
+ *   is calibrated once against CLOCK_MONOTONIC when the recorder opens.
+ * - Kernel RX timestamps are CLOCK_REALTIME; a TSC stamp is mapped onto
+ *   that clock through a fresh (TSC, CLOCK_REALTIME) pair per call, so
+ *   calibration error never accumulates over a long run.
+ * - Correction only applies to stages timed from ring pickup. Stages timed
+ *   from the kernel RX stamp already see every queued packet's wait.
+ */
+
+#include "latency_recorder.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* 256 exact values, then HIST_HALF sub-buckets per power of two */
+#define HIST_SUB_BITS 8u
+#define HIST_EXACT (1u << HIST_SUB_BITS)
+#define HIST_HALF (1u << (HIST_SUB_BITS - 1))
+
+#define TSC_CALIBRATION_NS 20000000LL
+#define NSEC_PER_SEC 1000000000LL
+
+struct latency_histogram {
+    uint64_t *counts;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+};
+
+struct latency_recorder {
+    uint64_t highest_ns;
+    uint64_t expected_interval_ns;
+    uint32_t bucket_count;
+    double ns_per_tick;
+    struct latency_histogram raw[LATENCY_STAGE_COUNT];
+    struct latency_histogram corrected[LATENCY_STAGE_COUNT];
+};
+
+static int64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static uint32_t hist_index(uint64_t value) {
+    uint32_t shift;
+
+    if (value < HIST_EXACT) {
+        return (uint32_t)value;
+    }
+    shift = (uint32_t)(63 - __builtin_clzll(value)) - (HIST_SUB_BITS - 1);
+    return HIST_EXACT + (shift - 1) * HIST_HALF + (uint32_t)((value >> shift) - HIST_HALF);
+}
+
+/* Highest value that lands in bucket index */
+static uint64_t hist_bucket_value(uint32_t index) {
+    uint32_t shift;
+    uint64_t mantissa;
+
+    if (index < HIST_EXACT) {
+        return index;
+    }
+    shift = (index - HIST_EXACT) / HIST_HALF + 1;
+    mantissa = HIST_HALF + (index - HIST_EXACT) % HIST_HALF;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+/* Stages timed from ring pickup miss the packets that queued meanwhile */
+static int stage_is_corrected(uint32_t stage) {
+    return stage == LATENCY_STAGE_PARSE || stage == LATENCY_STAGE_FLOW || stage == LATENCY_STAGE_PACKET;
+}
+
+static void hist_reset(struct latency_histogram *hist, uint32_t bucket_count) {
+    memset(hist->counts, 0, (size_t)bucket_count * sizeof(uint64_t));
+    hist->total = 0;
+    hist->min = UINT64_MAX;
+    hist->max = 0;
+    hist->sum = 0.0;
+}
+
+static void hist_record(const struct latency_recorder *recorder, struct latency_histogram *hist,
+                        uint64_t value_ns, uint64_t count) {
+    if (value_ns > recorder->highest_ns) {
+        value_ns = recorder->highest_ns;
+    }
+    hist->counts[hist_index(value_ns)] += count;
+    hist->total += count;
+    hist->sum += (double)value_ns * (double)count;
+    if (value_ns < hist->min) {
+        hist->min = value_ns;
+    }
+    if (value_ns > hist->max) {
+        hist->max = value_ns;
+    }
+}
+
+static void recorder_record(struct latency_recorder *recorder, uint32_t stage, uint64_t value_ns, uint64_t count) {
+    uint64_t interval = recorder->expected_interval_ns;
+    uint64_t missing;
+
+    hist_record(recorder, &recorder->raw[stage], value_ns, count);
+    if (!stage_is_corrected(stage) || interval == 0) {
+        return;
+    }
+    hist_record(recorder, &recorder->corrected[stage], value_ns, count);
+    // A sample of value_ns means the packets due every interval behind it
+    // waited value_ns - interval, value_ns - 2 * interval, ... One stall
+    // hides one packet per interval however many packets the batch held,
+    // so the back-fill is recorded once, not count times.
+    if (value_ns > recorder->highest_ns) {
+        value_ns = recorder->highest_ns;
+    }
+    for (missing = value_ns > interval ? value_ns - interval : 0; missing >= interval; missing -= interval) {
+        hist_record(recorder, &recorder->corrected[stage], missing, 1);
+    }
+}
+
+static const struct latency_histogram *recorder_hist(const struct latency_recorder *recorder,
+                                                     uint32_t stage, int corrected) {
+    if (corrected && stage_is_corrected(stage) && recorder->expected_interval_ns) {
+        return &recorder->corrected[stage];
+    }
+    return &recorder->raw[stage];
+}
+
+static uint64_t ticks_to_ns(const struct latency_recorder *recorder, uint64_t start_tsc, uint64_t end_tsc) {
+    if (end_tsc <= start_tsc) {
+        return 0;
+    }
+    return (uint64_t)((double)(end_tsc - start_tsc) * recorder->ns_per_tick);
+}
+
+uint64_t latency_tsc_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return (uint64_t)clock_ns(CLOCK_MONOTONIC);
+#endif
+}
+
+/*
+ * Create a recorder and calibrate the TSC (blocks ~20 ms on x86).
+ * Returns recorder on success, NULL on error (errno set).
+ */
+struct latency_recorder *latency_recorder_open(const struct latency_recorder_config *config) {
+    struct latency_recorder *recorder;
+    uint32_t stage;
+
+    if (!config) {
+        errno = EINVAL;
+        return NULL;
+    }
+    recorder = calloc(1, sizeof(*recorder));
+    if (!recorder) {
+        return NULL;
+    }
+    recorder->highest_ns = config->highest_ns ? config->highest_ns : LATENCY_DEFAULT_HIGHEST_NS;
+    recorder->expected_interval_ns = config->expected_interval_ns;
+    recorder->bucket_count = hist_index(recorder->highest_ns) + 1;
+
+    for (stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+        recorder->raw[stage].counts = calloc(recorder->bucket_count, sizeof(uint64_t));
+        recorder->corrected[stage].counts = calloc(recorder->bucket_count, sizeof(uint64_t));
+        if (!recorder->raw[stage].counts || !recorder->corrected[stage].counts) {
+            latency_recorder_close(recorder);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    latency_recorder_reset(recorder);
+
+#if defined(__x86_64__) || defined(__i386__)
+    {
+        struct timespec pause = {0, TSC_CALIBRATION_NS};
+        int64_t mono_start = clock_ns(CLOCK_MONOTONIC);
+        uint64_t tsc_start = latency_tsc_now();
+        int64_t mono_end;
+        uint64_t tsc_end;
+
+        while (nanosleep(&pause, &pause) != 0 && errno == EINTR) {
+        }
+        mono_end = clock_ns(CLOCK_MONOTONIC);
+        tsc_end = latency_tsc_now();
+        recorder->ns_per_tick = (double)(mono_end - mono_start) / (double)(tsc_end - tsc_start);
+    }
+#else
+    recorder->ns_per_tick = 1.0;
+#endif
+    return recorder;
+}
+
+double latency_recorder_tsc_hz(const struct latency_recorder *recorder) {
+    return recorder ? 1e9 / recorder->ns_per_tick : 0.0;
+}
+
+/* Record end_tsc - start_tsc for count packets */
+int latency_recorder_record(struct latency_recorder *recorder, uint32_t stage,
+                            uint64_t start_tsc, uint64_t end_tsc, uint32_t count) {
+    if (!recorder || stage >= LATENCY_STAGE_COUNT) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (count) {
+        recorder_record(recorder, stage, ticks_to_ns(recorder, start_tsc, end_tsc), count);
+    }
+    return 0;
+}
+
+/* Record end_tsc[i] - start_tsc for each packet */
+int latency_recorder_record_stamps(struct latency_recorder *recorder, uint32_t stage,
+                                   uint64_t start_tsc, const uint64_t *end_tsc, uint32_t count) {
+    uint32_t i;
+
+    if (!recorder || stage >= LATENCY_STAGE_COUNT || (count && !end_tsc)) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        recorder_record(recorder, stage, ticks_to_ns(recorder, start_tsc, end_tsc[i]), 1);
+    }
+    return 0;
+}
+
+/* Record the time from each frame's kernel RX timestamp (ts_ns) to end_tsc */
+int latency_recorder_record_frames(struct latency_recorder *recorder, uint32_t stage,
+                                   const struct af_packet_frame_desc *frames, uint32_t count,
+                                   uint64_t end_tsc) {
+    int64_t real_now;
+    uint64_t tsc_now;
+    int64_t end_real;
+    uint32_t i;
+
+    if (!recorder || stage >= LATENCY_STAGE_COUNT || (count && !frames)) {
+        errno = EINVAL;
+        return -1;
+    }
+    tsc_now = latency_tsc_now();
+    real_now = clock_ns(CLOCK_REALTIME);
+    end_real = real_now - (int64_t)ticks_to_ns(recorder, end_tsc, tsc_now);
+    for (i = 0; i < count; i++) {
+        int64_t latency = end_real - frames[i].ts_ns;
+
+        // Userspace-stamped frames can land marginally after end_tsc
+        recorder_record(recorder, stage, latency > 0 ? (uint64_t)latency : 0, 1);
+    }
+    return 0;
+}
+
+int latency_recorder_summary(const struct latency_recorder *recorder, uint32_t stage, int corrected,
+                             struct latency_summary *out) {
+    const struct latency_histogram *hist;
+
+    if (!recorder || stage >= LATENCY_STAGE_COUNT || !out) {
+        errno = EINVAL;
+        return -1;
+    }
+    hist = recorder_hist(recorder, stage, corrected);
+    out->count = hist->total;
+    out->min_ns = hist->total ? hist->min : 0;
+    out->max_ns = hist->max;
+    out->mean_ns = hist->total ? hist->sum / (double)hist->total : 0.0;
+    return 0;
+}
+
+/*
+ * Values at the given percentiles (0-100), each reported as the highest
+ * value of its bucket (never above the recorded maximum).
+ */
+int latency_recorder_percentiles(const struct latency_recorder *recorder, uint32_t stage, int corrected,
+                                 const double *percentiles, uint64_t *out_ns, uint32_t count) {
+    const struct latency_histogram *hist;
+    uint32_t i;
+
+    if (!recorder || stage >= LATENCY_STAGE_COUNT || (count && (!percentiles || !out_ns))) {
+        errno = EINVAL;
+        return -1;
+    }
+    hist = recorder_hist(recorder, stage, corrected);
+    for (i = 0; i < count; i++) {
+        uint64_t target;
+        uint64_t seen = 0;
+        uint32_t index;
+
+        out_ns[i] = 0;
+        if (hist->total == 0) {
+            continue;
+        }
+        if (percentiles[i] <= 0.0) {
+            out_ns[i] = hist->min;
+            continue;
+        }
+        target = (uint64_t)((percentiles[i] / 100.0) * (double)hist->total + 0.5);
+        if (target == 0) {
+            target = 1;
+        }
+        if (target > hist->total) {
+            target = hist->total;
+        }
+        for (index = 0; index < recorder->bucket_count; index++) {
+            seen += hist->counts[index];
+            if (seen >= target) {
+                uint64_t value = hist_bucket_value(index);
+
+                out_ns[i] = value < hist->max ? value : hist->max;
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Export the non-empty buckets in ascending order.
+ * Returns number of buckets written (at most max_buckets), -1 on error.
+ */
+int latency_recorder_distribution(const struct latency_recorder *recorder, uint32_t stage, int corrected,
+                                  uint64_t *values_ns, uint64_t *counts, uint32_t max_buckets) {
+    const struct latency_histogram *hist;
+    uint32_t written = 0;
+    uint32_t index;
+
+    if (!recorder || stage >= LATENCY_STAGE_COUNT || !values_ns || !counts) {
+        errno = EINVAL;
+        return -1;
+    }
+    hist = recorder_hist(recorder, stage, corrected);
+    for (index = 0; index < recorder->bucket_count && written < max_buckets; index++) {
+        uint64_t value;
+
+        if (hist->counts[index] == 0) {
+            continue;
+        }
+        value = hist_bucket_value(index);
+        values_ns[written] = value < hist->max ? value : hist->max;
+        counts[written] = hist->counts[index];
+        written++;
+    }
+    return (int)written;
+}
+
+void latency_recorder_reset(struct latency_recorder *recorder) {
+    uint32_t stage;
+
+    if (!recorder) {
+        return;
+    }
+    for (stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+        hist_reset(&recorder->raw[stage], recorder->bucket_count);
+        hist_reset(&recorder->corrected[stage], recorder->bucket_count);
+    }
+}
+
+void latency_recorder_close(struct latency_recorder *recorder) {
+    uint32_t stage;
+
+    if (!recorder) {
+        return;
+    }
+    for (stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+        free(recorder->raw[stage].counts);
+        free(recorder->corrected[stage].counts);
+    }
+    free(recorder);
+}
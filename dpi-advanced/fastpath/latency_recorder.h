@@ -0,0 +1,67 @@
+/*
+ * RansomEye DPI Advanced - Latency Recorder
+ * AUTHORITATIVE: TSC-stamped per-stage latency histograms for fastpath benchmarks
+ *
+ * NOTE:
+ * - Histograms are log-linear (HDR style): exact below 256 ns, then 128
+ *   sub-buckets per power of two, so any recorded value is reported within
+ *   0.8% and memory stays fixed regardless of sample count.
+ * - Every stage keeps a raw histogram and, when an expected interval is
+ *   configured, a coordinated-omission corrected one that back-fills the
+ *   samples a stalled pipeline would otherwise never have taken.
+ * - Benchmark use only; not part of the installed probe library.
+ */
+
+#ifndef RANSOMEYE_LATENCY_RECORDER_H
+#define RANSOMEYE_LATENCY_RECORDER_H
+
+#include <stdint.h>
+
+#include "af_packet_capture.h"
+
+/* Pipeline stages, each measured between two TSC stamps */
+#define LATENCY_STAGE_RING_WAIT 0         /* Kernel RX timestamp to ring pickup */
+#define LATENCY_STAGE_PARSE 1             /* Ring pickup to parsed */
+#define LATENCY_STAGE_FLOW 2              /* Parsed to flow-table update */
+#define LATENCY_STAGE_PACKET 3            /* Ring pickup to flow-table update */
+#define LATENCY_STAGE_EMIT 4              /* Flow-table update to flow emission (per flow) */
+#define LATENCY_STAGE_END_TO_END 5        /* Kernel RX timestamp to batch fully processed */
+#define LATENCY_STAGE_COUNT 6
+
+#define LATENCY_DEFAULT_HIGHEST_NS (60ULL * 1000000000ULL)
+
+struct latency_recorder;
+
+struct latency_recorder_config {
+    uint64_t highest_ns;            /* Larger values are clamped, 0 selects LATENCY_DEFAULT_HIGHEST_NS */
+    uint64_t expected_interval_ns;  /* Expected packet interarrival for correction, 0 disables it */
+};
+
+struct latency_summary {
+    uint64_t count;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    double mean_ns;
+};
+
+uint64_t latency_tsc_now(void);
+
+struct latency_recorder *latency_recorder_open(const struct latency_recorder_config *config);
+double latency_recorder_tsc_hz(const struct latency_recorder *recorder);
+int latency_recorder_record(struct latency_recorder *recorder, uint32_t stage,
+                            uint64_t start_tsc, uint64_t end_tsc, uint32_t count);
+int latency_recorder_record_stamps(struct latency_recorder *recorder, uint32_t stage,
+                                   uint64_t start_tsc, const uint64_t *end_tsc, uint32_t count);
+int latency_recorder_record_frames(struct latency_recorder *recorder, uint32_t stage,
+                                   const struct af_packet_frame_desc *frames, uint32_t count,
+                                   uint64_t end_tsc);
+int latency_recorder_summary(const struct latency_recorder *recorder, uint32_t stage, int corrected,
+                             struct latency_summary *out);
+int latency_recorder_percentiles(const struct latency_recorder *recorder, uint32_t stage, int corrected,
+                                 const double *percentiles, uint64_t *out_ns, uint32_t count);
+int latency_recorder_distribution(const struct latency_recorder *recorder, uint32_t stage, int corrected,
+                                  uint64_t *values_ns, uint64_t *counts, uint32_t max_buckets);
+void latency_recorder_reset(struct latency_recorder *recorder);
+void latency_recorder_close(struct latency_recorder *recorder);
+
+#endif /* RANSOMEYE_LATENCY_RECORDER_H */
@@ -0,0 +1,540 @@
+/*
+ * RansomEye DPI Advanced - PCAP Replay
+ * AUTHORITATIVE: Native pcap/pcapng replay behind the capture descriptor interface
+ *
+ * NOTE:
+ * - Records are walked in place inside the mapping; a batch read copies
+ *   only the due frames (up to snaplen) into the caller buffer.
+ * - Pacing is schedule-based: every frame has a due time on CLOCK_MONOTONIC
+ *   and a batch returns all frames already due, sleeping only when ahead
+ *   of schedule. Falling behind never accumulates sleep debt.
+ * - Frame timestamps are the schedule mapped onto CLOCK_REALTIME, so flow
+ *   timing downstream matches what was replayed, pass after pass.
+ */
+
+#include "pcap_replay.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+#define PCAP_MAGIC_USEC 0xA1B2C3D4u
+#define PCAP_MAGIC_NSEC 0xA1B23C4Du
+#define PCAP_GLOBAL_HEADER_LEN 24u
+#define PCAP_RECORD_HEADER_LEN 16u
+
+#define PCAPNG_BLOCK_SHB 0x0A0D0D0Au
+#define PCAPNG_BLOCK_IDB 0x00000001u
+#define PCAPNG_BLOCK_SPB 0x00000003u
+#define PCAPNG_BLOCK_EPB 0x00000006u
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4Du
+#define PCAPNG_OPT_END 0u
+#define PCAPNG_OPT_IF_TSRESOL 9u
+
+#define LINKTYPE_ETHERNET 1u
+
+/* Records larger than this are treated as file corruption */
+#define PCAP_REPLAY_MAX_RECORD (256u * 1024u)
+
+/* Gap inserted between the last frame of a pass and the first of the next */
+#define PCAP_REPLAY_PASS_GAP_NS 1000LL
+
+#define NSEC_PER_SEC 1000000000LL
+
+enum pcap_format {
+    PCAP_FORMAT_PCAP,
+    PCAP_FORMAT_PCAPNG,
+};
+
+struct pcapng_interface {
+    uint16_t linktype;
+    uint8_t tsresol;                /* if_tsresol option, default 6 (microseconds) */
+};
+
+struct replay_record {
+    const unsigned char *data;
+    uint32_t caplen;
+    uint32_t wirelen;
+    int64_t ts_ns;
+    uint32_t source;
+};
+
+struct pcap_replay {
+    int fd;
+    const unsigned char *map;
+    size_t map_len;
+    enum pcap_format format;
+    int swapped;                    /* File (or current pcapng section) is opposite-endian */
+    int pcap_nsec;
+    size_t data_start;
+    size_t cursor;
+
+    struct pcapng_interface interfaces[PCAP_REPLAY_MAX_INTERFACES];
+    uint32_t interface_count;
+
+    int pacing;
+    uint64_t rate;
+    uint32_t loops;
+
+    /* Schedule state */
+    int64_t start_mono_ns;
+    int64_t start_real_ns;
+    int64_t first_ts_ns;            /* Recorded time of the first frame of pass 0 */
+    int64_t last_ts_ns;             /* Recorded time of the latest frame read */
+    int64_t pass_offset_ns;         /* Recorded-time shift applied to the current pass */
+    uint64_t bits_scheduled;
+    int first_seen;
+    uint64_t pass_packets;
+
+    struct replay_record pending;   /* Read from the file but not yet due */
+    int have_pending;
+
+    struct pcap_replay_stats stats;
+};
+
+static int64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+
+    if (clock_gettime(clock, &ts) != 0) {
+        return 0;
+    }
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void sleep_until_mono(int64_t deadline_ns) {
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(deadline_ns / NSEC_PER_SEC);
+    ts.tv_nsec = (long)(deadline_ns % NSEC_PER_SEC);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+static uint16_t rd16(const struct pcap_replay *replay, const unsigned char *p) {
+    uint16_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return replay->swapped ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t rd32(const struct pcap_replay *replay, const unsigned char *p) {
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return replay->swapped ? __builtin_bswap32(v) : v;
+}
+
+/* Convert a pcapng timestamp in if_tsresol units to nanoseconds */
+static int64_t pcapng_ts_to_ns(uint64_t ts, uint8_t tsresol) {
+    uint8_t exponent = tsresol & 0x7F;
+    uint64_t scale = 1;
+    uint8_t i;
+
+    if (tsresol & 0x80) {
+        // Negative power of two
+        if (exponent >= 64) {
+            return 0;
+        }
+        return (int64_t)((ts >> exponent) * (uint64_t)NSEC_PER_SEC +
+                         (uint64_t)(((unsigned __int128)(ts & ((1ull << exponent) - 1)) * NSEC_PER_SEC) >> exponent));
+    }
+    if (exponent <= 9) {
+        for (i = exponent; i < 9; i++) {
+            scale *= 10;
+        }
+        return (int64_t)(ts * scale);
+    }
+    for (i = 9; i < exponent && i < 28; i++) {
+        scale *= 10;
+    }
+    return (int64_t)(ts / scale);
+}
+
+static void pcapng_parse_idb(struct pcap_replay *replay, const unsigned char *block, uint32_t block_len) {
+    struct pcapng_interface *iface;
+    uint32_t off = 16;
+
+    if (replay->interface_count >= PCAP_REPLAY_MAX_INTERFACES || block_len < 20) {
+        replay->interface_count++;
+        return;
+    }
+    iface = &replay->interfaces[replay->interface_count++];
+    iface->linktype = rd16(replay, block + 8);
+    iface->tsresol = 6;
+
+    // Options run up to the trailing block length
+    while (off + 4 <= block_len - 4) {
+        uint16_t code = rd16(replay, block + off);
+        uint16_t len = rd16(replay, block + off + 2);
+
+        if (code == PCAPNG_OPT_END || off + 4 + len > block_len - 4) {
+            break;
+        }
+        if (code == PCAPNG_OPT_IF_TSRESOL && len >= 1) {
+            iface->tsresol = block[off + 4];
+        }
+        off += 4 + ((len + 3u) & ~3u);
+    }
+}
+
+/* Next Ethernet frame of a classic pcap file. Returns 1, or 0 at end of file */
+static int pcap_next_record(struct pcap_replay *replay, struct replay_record *rec) {
+    const unsigned char *hdr;
+    uint32_t incl_len;
+    uint32_t frac;
+
+    if (replay->cursor + PCAP_RECORD_HEADER_LEN > replay->map_len) {
+        return 0;
+    }
+    hdr = replay->map + replay->cursor;
+    incl_len = rd32(replay, hdr + 8);
+    if (incl_len > PCAP_REPLAY_MAX_RECORD ||
+        incl_len > replay->map_len - replay->cursor - PCAP_RECORD_HEADER_LEN) {
+        // Truncated or corrupt tail ends the pass
+        return 0;
+    }
+    frac = rd32(replay, hdr + 4);
+    rec->ts_ns = (int64_t)rd32(replay, hdr) * NSEC_PER_SEC + (replay->pcap_nsec ? frac : (int64_t)frac * 1000);
+    rec->caplen = incl_len;
+    rec->wirelen = rd32(replay, hdr + 12);
+    rec->data = hdr + PCAP_RECORD_HEADER_LEN;
+    rec->source = 0;
+    replay->cursor += PCAP_RECORD_HEADER_LEN + incl_len;
+    return 1;
+}
+
+/* Next Ethernet frame of a pcapng file. Returns 1, or 0 at end of file */
+static int pcapng_next_record(struct pcap_replay *replay, struct replay_record *rec) {
+    for (;;) {
+        const unsigned char *block;
+        uint32_t block_type;
+        uint32_t block_len;
+        const struct pcapng_interface *iface;
+        uint32_t iface_id;
+
+        if (replay->cursor + 12 > replay->map_len) {
+            return 0;
+        }
+        block = replay->map + replay->cursor;
+        memcpy(&block_type, block, sizeof(block_type));
+        if (block_type == PCAPNG_BLOCK_SHB) {
+            // New section: byte order and interface numbering restart
+            uint32_t bom;
+
+            memcpy(&bom, block + 8, sizeof(bom));
+            if (bom == PCAPNG_BYTE_ORDER_MAGIC) {
+                replay->swapped = 0;
+            } else if (bom == __builtin_bswap32(PCAPNG_BYTE_ORDER_MAGIC)) {
+                replay->swapped = 1;
+            } else {
+                return 0;
+            }
+            replay->interface_count = 0;
+        } else {
+            block_type = rd32(replay, block);
+        }
+        block_len = rd32(replay, block + 4);
+        if (block_len < 12 || (block_len & 3) != 0 || block_len > replay->map_len - replay->cursor) {
+            return 0;
+        }
+        replay->cursor += block_len;
+
+        switch (block_type) {
+        case PCAPNG_BLOCK_IDB:
+            pcapng_parse_idb(replay, block, block_len);
+            continue;
+        case PCAPNG_BLOCK_EPB:
+            if (block_len < 32) {
+                return 0;
+            }
+            iface_id = rd32(replay, block + 8);
+            rec->caplen = rd32(replay, block + 20);
+            rec->wirelen = rd32(replay, block + 24);
+            if (rec->caplen > PCAP_REPLAY_MAX_RECORD || rec->caplen > block_len - 32) {
+                return 0;
+            }
+            if (iface_id >= replay->interface_count || iface_id >= PCAP_REPLAY_MAX_INTERFACES) {
+                replay->stats.skipped++;
+                continue;
+            }
+            iface = &replay->interfaces[iface_id];
+            rec->ts_ns = pcapng_ts_to_ns(((uint64_t)rd32(replay, block + 12) << 32) | rd32(replay, block + 16),
+                                         iface->tsresol);
+            rec->data = block + 28;
+            break;
+        case PCAPNG_BLOCK_SPB:
+            // Simple packets carry no timestamp and belong to interface 0
+            if (block_len < 16 || replay->interface_count == 0) {
+                replay->stats.skipped++;
+                continue;
+            }
+            iface_id = 0;
+            iface = &replay->interfaces[0];
+            rec->wirelen = rd32(replay, block + 8);
+            rec->caplen = rec->wirelen < block_len - 16 ? rec->wirelen : block_len - 16;
+            // Inherit the previous frame's file time; fetch re-applies the pass offset
+            rec->ts_ns = replay->last_ts_ns - replay->pass_offset_ns;
+            rec->data = block + 12;
+            break;
+        default:
+            continue;
+        }
+
+        if (iface->linktype != LINKTYPE_ETHERNET) {
+            replay->stats.skipped++;
+            continue;
+        }
+        rec->source = iface_id;
+        return 1;
+    }
+}
+
+/*
+ * Fetch the next frame into replay->pending, rewinding between passes.
+ * Returns 1 when a frame is pending, 0 once all passes are done.
+ */
+static int pcap_replay_fetch(struct pcap_replay *replay) {
+    for (;;) {
+        int rc;
+
+        if (replay->stats.finished) {
+            return 0;
+        }
+        rc = replay->format == PCAP_FORMAT_PCAP ? pcap_next_record(replay, &replay->pending)
+                                                 : pcapng_next_record(replay, &replay->pending);
+        if (rc == 1) {
+            if (!replay->first_seen) {
+                replay->first_ts_ns = replay->pending.ts_ns;
+                replay->last_ts_ns = replay->pending.ts_ns;
+                replay->first_seen = 1;
+            }
+            replay->pending.ts_ns += replay->pass_offset_ns;
+            // Recorded time never runs backwards within the replay
+            if (replay->pending.ts_ns < replay->last_ts_ns) {
+                replay->pending.ts_ns = replay->last_ts_ns;
+            }
+            replay->last_ts_ns = replay->pending.ts_ns;
+            replay->pass_packets++;
+            replay->have_pending = 1;
+            return 1;
+        }
+
+        // End of pass; an empty pass would loop forever, so it ends the replay
+        replay->stats.passes++;
+        if (replay->pass_packets == 0 || (replay->loops && replay->stats.passes >= replay->loops)) {
+            replay->stats.finished = 1;
+            return 0;
+        }
+        replay->pass_packets = 0;
+        replay->pass_offset_ns = replay->last_ts_ns + PCAP_REPLAY_PASS_GAP_NS - replay->first_ts_ns;
+        replay->cursor = replay->data_start;
+        replay->swapped = replay->format == PCAP_FORMAT_PCAP ? replay->swapped : 0;
+        replay->interface_count = 0;
+    }
+}
+
+/* Due time of the pending frame, as an offset from replay start */
+static int64_t pcap_replay_due_offset(const struct pcap_replay *replay) {
+    switch (replay->pacing) {
+    case PCAP_REPLAY_PACE_RECORDED:
+        return replay->pending.ts_ns - replay->first_ts_ns;
+    case PCAP_REPLAY_PACE_PPS:
+        return (int64_t)(((unsigned __int128)replay->stats.packets * NSEC_PER_SEC) / replay->rate);
+    case PCAP_REPLAY_PACE_BPS:
+        return (int64_t)(((unsigned __int128)replay->bits_scheduled * NSEC_PER_SEC) / replay->rate);
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Open a pcap or pcapng file for replay.
+ * Returns replay handle on success, NULL on error (errno set; ENOTSUP for
+ * non-Ethernet pcap files or unknown formats).
+ */
+struct pcap_replay *pcap_replay_open(const struct pcap_replay_config *config) {
+    struct pcap_replay *replay;
+    struct stat st;
+    uint32_t magic;
+
+    if (!config || !config->path || config->pacing < PCAP_REPLAY_PACE_RECORDED ||
+        config->pacing > PCAP_REPLAY_PACE_UNTHROTTLED ||
+        ((config->pacing == PCAP_REPLAY_PACE_PPS || config->pacing == PCAP_REPLAY_PACE_BPS) && config->rate == 0)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    replay = calloc(1, sizeof(*replay));
+    if (!replay) {
+        return NULL;
+    }
+    replay->map = MAP_FAILED;
+    replay->pacing = config->pacing;
+    replay->rate = config->rate;
+    replay->loops = config->loops;
+
+    replay->fd = open(config->path, O_RDONLY | O_CLOEXEC);
+    if (replay->fd < 0) {
+        free(replay);
+        return NULL;
+    }
+    if (fstat(replay->fd, &st) < 0) {
+        goto fail;
+    }
+    if (st.st_size < (off_t)PCAP_GLOBAL_HEADER_LEN) {
+        errno = ENOTSUP;
+        goto fail;
+    }
+    replay->map_len = (size_t)st.st_size;
+    replay->map = mmap(NULL, replay->map_len, PROT_READ, MAP_PRIVATE, replay->fd, 0);
+    if (replay->map == MAP_FAILED) {
+        goto fail;
+    }
+    // Streamed front to back; let the kernel read ahead and drop behind
+    madvise((void *)replay->map, replay->map_len, MADV_SEQUENTIAL);
+
+    memcpy(&magic, replay->map, sizeof(magic));
+    if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC ||
+        magic == __builtin_bswap32(PCAP_MAGIC_USEC) || magic == __builtin_bswap32(PCAP_MAGIC_NSEC)) {
+        replay->format = PCAP_FORMAT_PCAP;
+        replay->swapped = magic == __builtin_bswap32(PCAP_MAGIC_USEC) || magic == __builtin_bswap32(PCAP_MAGIC_NSEC);
+        replay->pcap_nsec = magic == PCAP_MAGIC_NSEC || magic == __builtin_bswap32(PCAP_MAGIC_NSEC);
+        if ((rd32(replay, replay->map + 20) & 0xFFFF) != LINKTYPE_ETHERNET) {
+            errno = ENOTSUP;
+            goto fail;
+        }
+        replay->data_start = PCAP_GLOBAL_HEADER_LEN;
+    } else if (magic == PCAPNG_BLOCK_SHB) {
+        replay->format = PCAP_FORMAT_PCAPNG;
+        replay->data_start = 0;
+    } else {
+        errno = ENOTSUP;
+        goto fail;
+    }
+    replay->cursor = replay->data_start;
+    return replay;
+
+fail:
+    {
+        int saved_errno = errno;
+        pcap_replay_close(replay);
+        errno = saved_errno;
+    }
+    return NULL;
+}
+
+/*
+ * Copy every frame that is due (up to max_descs) into buffer.
+ * The first call starts the replay clock. Waits up to timeout_ms (<0:
+ * indefinitely) for the next frame to fall due.
+ * Returns number of frames described, 0 on timeout or after the last
+ * pass (see pcap_replay_stats().finished), -1 on error.
+ */
+int pcap_replay_read_batch(struct pcap_replay *replay, int timeout_ms,
+                           unsigned char *buffer, uint32_t buffer_len, uint32_t snaplen,
+                           struct af_packet_frame_desc *descs, uint32_t max_descs) {
+    uint32_t count = 0;
+    uint32_t used = 0;
+    int64_t now_mono;
+    int64_t deadline = 0;
+    int64_t batch_real_ns;
+
+    if (!replay || !buffer || !descs || max_descs == 0 || snaplen == 0 || buffer_len < snaplen) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    now_mono = clock_ns(CLOCK_MONOTONIC);
+    batch_real_ns = clock_ns(CLOCK_REALTIME);
+    if (replay->start_mono_ns == 0) {
+        replay->start_mono_ns = now_mono;
+        replay->start_real_ns = batch_real_ns;
+    }
+    if (timeout_ms >= 0) {
+        deadline = now_mono + (int64_t)timeout_ms * 1000000LL;
+    }
+
+    while (count < max_descs) {
+        struct af_packet_frame_desc *desc = &descs[count];
+        int64_t due;
+        uint32_t copy_len;
+
+        if (!replay->have_pending && !pcap_replay_fetch(replay)) {
+            break;
+        }
+
+        due = replay->start_mono_ns + pcap_replay_due_offset(replay);
+        if (replay->pacing != PCAP_REPLAY_PACE_UNTHROTTLED && due > now_mono) {
+            if (count > 0) {
+                break;
+            }
+            if (timeout_ms >= 0 && due > deadline) {
+                sleep_until_mono(deadline);
+                return 0;
+            }
+            sleep_until_mono(due);
+            now_mono = clock_ns(CLOCK_MONOTONIC);
+            continue;
+        }
+
+        copy_len = replay->pending.caplen < snaplen ? replay->pending.caplen : snaplen;
+        if (copy_len > buffer_len - used) {
+            if (count > 0) {
+                break;
+            }
+            copy_len = buffer_len - used;
+        }
+        memcpy(buffer + used, replay->pending.data, copy_len);
+
+        desc->offset = used;
+        desc->caplen = copy_len;
+        desc->wirelen = replay->pending.wirelen;
+        desc->flags = copy_len < replay->pending.wirelen ? AF_PACKET_FRAME_TRUNCATED : 0;
+        desc->ts_ns = replay->pacing == PCAP_REPLAY_PACE_UNTHROTTLED
+                          ? batch_real_ns
+                          : replay->start_real_ns + (due - replay->start_mono_ns);
+        desc->source = replay->pending.source;
+        desc->reserved = 0;
+
+        used += copy_len;
+        count++;
+        replay->stats.packets++;
+        replay->stats.bytes += replay->pending.wirelen;
+        replay->bits_scheduled += (uint64_t)replay->pending.wirelen * 8;
+        replay->have_pending = 0;
+    }
+
+    // Finished replays behave like an idle interface rather than spinning the caller
+    if (count == 0 && replay->stats.finished && timeout_ms > 0) {
+        sleep_until_mono(deadline);
+    }
+    return (int)count;
+}
+
+int pcap_replay_stats(const struct pcap_replay *replay, struct pcap_replay_stats *out) {
+    if (!replay || !out) {
+        errno = EINVAL;
+        return -1;
+    }
+    *out = replay->stats;
+    return 0;
+}
+
+void pcap_replay_close(struct pcap_replay *replay) {
+    if (!replay) {
+        return;
+    }
+    if (replay->map != MAP_FAILED) {
+        munmap((void *)replay->map, replay->map_len);
+    }
+    if (replay->fd >= 0) {
+        close(replay->fd);
+    }
+    free(replay);
+}
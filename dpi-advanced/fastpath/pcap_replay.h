@@ -0,0 +1,52 @@
+/*
+ * RansomEye DPI Advanced - PCAP Replay
+ * AUTHORITATIVE: Native pcap/pcapng replay behind the capture descriptor interface
+ *
+ * NOTE:
+ * - The file is mmap'd read-only and streamed; nothing is loaded up front,
+ *   so multi-gigabyte captures replay in constant memory.
+ * - Output is the same frame batch the live backends produce, so replayed
+ *   traffic exercises the same parse and flow path.
+ * - Only Ethernet link types are replayed; other pcapng interfaces are skipped.
+ */
+
+#ifndef RANSOMEYE_PCAP_REPLAY_H
+#define RANSOMEYE_PCAP_REPLAY_H
+
+#include <stdint.h>
+
+#include "af_packet_capture.h"
+
+/* Pacing modes selectable from probe configuration */
+#define PCAP_REPLAY_PACE_RECORDED 0       /* Inter-packet gaps as captured */
+#define PCAP_REPLAY_PACE_PPS 1            /* rate packets per second */
+#define PCAP_REPLAY_PACE_BPS 2            /* rate on-wire bits per second */
+#define PCAP_REPLAY_PACE_UNTHROTTLED 3    /* As fast as the reader consumes */
+
+#define PCAP_REPLAY_MAX_INTERFACES 64u
+
+struct pcap_replay;
+
+struct pcap_replay_config {
+    const char *path;
+    int pacing;
+    uint64_t rate;                  /* Packets/s (PPS) or bits/s (BPS), ignored otherwise */
+    uint32_t loops;                 /* Passes over the file, 0 replays forever */
+};
+
+struct pcap_replay_stats {
+    uint64_t packets;               /* Frames handed out */
+    uint64_t bytes;                 /* On-wire bytes of those frames */
+    uint64_t skipped;               /* Records from non-Ethernet or unknown interfaces */
+    uint32_t passes;                /* Completed passes over the file */
+    uint32_t finished;              /* 1 once every pass has been replayed */
+};
+
+struct pcap_replay *pcap_replay_open(const struct pcap_replay_config *config);
+int pcap_replay_read_batch(struct pcap_replay *replay, int timeout_ms,
+                           unsigned char *buffer, uint32_t buffer_len, uint32_t snaplen,
+                           struct af_packet_frame_desc *descs, uint32_t max_descs);
+int pcap_replay_stats(const struct pcap_replay *replay, struct pcap_replay_stats *out);
+void pcap_replay_close(struct pcap_replay *replay);
+
+#endif /* RANSOMEYE_PCAP_REPLAY_H */
@@ -0,0 +1,267 @@
+/*
+ * RansomEye DPI Advanced - Privacy Redaction
+ * AUTHORITATIVE: Batch redaction of binary addresses and ports
+ *
+ * NOTE:
+ * - Masking and port truncation are straight loops over the columns with
+ *   no branches on the data (the per-version mask is picked by index), so
+ *   the compiler turns them into vector ANDs.
+ * - Hashing goes through flow_hash.c: SHA-NI when present, and the HMAC
+ *   key schedule is done once at open, so a miss costs two compression
+ *   rounds for a keyed pseudonym and one without a key.
+ * - The cache is direct-mapped: an address hashes to one slot and a miss
+ *   overwrites it. Lookups are one compare, and crafted addresses can only
+ *   cost extra hashing, never memory.
+ */
+
+#include "privacy_redact.h"
+#include "flow_hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define PRIVACY_REDACT_CHUNK 64u            /* Records gathered into columns per pass */
+
+/* 32 bytes; ip_version 0 marks an empty slot */
+struct privacy_redact_cache_entry {
+    uint8_t addr[16];
+    uint8_t token[PRIVACY_REDACT_TOKEN_SIZE];
+    uint8_t ip_version;
+    uint8_t pad[7];
+};
+
+struct privacy_redactor {
+    uint32_t ip_mode;
+    uint32_t port_mode;
+    uint32_t keyed;
+    uint32_t cache_mask;
+    uint64_t cache_seed;
+    struct privacy_redact_cache_entry *cache;
+    struct flow_hash_hmac hmac;
+    struct privacy_redact_stats stats;
+};
+
+_Static_assert(sizeof(struct privacy_redact_cache_entry) == 32, "two cache entries per cache line");
+_Static_assert(sizeof(struct privacy_redact_record) == 40, "privacy_redact_record is decoded by the probe");
+
+static inline uint64_t privacy_redact_word(const uint8_t *p) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+/* 64x64->128 multiply folded to 64 bits */
+static inline uint64_t privacy_redact_mix(uint64_t a, uint64_t b) {
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+/* Keyed cache slot of an address, two multiplies (as flow_table_hash) */
+static uint32_t privacy_redact_slot(const struct privacy_redactor *redactor, const uint8_t addr[16],
+                                    uint8_t ip_version) {
+    uint64_t h;
+
+    h = privacy_redact_mix(privacy_redact_word(addr) ^ redactor->cache_seed ^ 0xA0761D6478BD642FULL,
+                           privacy_redact_word(addr + 8) ^ ip_version ^ 0xE7037ED1A0B428DBULL);
+    h = privacy_redact_mix(h, redactor->cache_seed ^ 0x1D8E4E27C47D124FULL);
+    return ((uint32_t)h ^ (uint32_t)(h >> 32)) & redactor->cache_mask;
+}
+
+static void privacy_redact_hash(struct privacy_redactor *redactor, const uint8_t addr[16], uint8_t ip_version,
+                                uint8_t out[16]) {
+    struct privacy_redact_cache_entry *entry = NULL;
+    uint8_t digest[FLOW_HASH_DIGEST_SIZE];
+    size_t len = ip_version == 6 ? 16 : 4;
+
+    if (redactor->cache) {
+        entry = &redactor->cache[privacy_redact_slot(redactor, addr, ip_version)];
+        if (entry->ip_version == ip_version && memcmp(entry->addr, addr, 16) == 0) {
+            memcpy(out, entry->token, PRIVACY_REDACT_TOKEN_SIZE);
+            memset(out + PRIVACY_REDACT_TOKEN_SIZE, 0, 16 - PRIVACY_REDACT_TOKEN_SIZE);
+            redactor->stats.cache_hits++;
+            return;
+        }
+    }
+    if (redactor->keyed) {
+        flow_hash_hmac(&redactor->hmac, addr, len, digest);
+    } else {
+        flow_hash_sha256(addr, len, digest);
+    }
+    redactor->stats.hashed++;
+    // Fill the cache before out, which may overwrite addr
+    if (entry) {
+        memcpy(entry->addr, addr, 16);
+        memcpy(entry->token, digest, PRIVACY_REDACT_TOKEN_SIZE);
+        entry->ip_version = ip_version;
+    }
+    memcpy(out, digest, PRIVACY_REDACT_TOKEN_SIZE);
+    memset(out + PRIVACY_REDACT_TOKEN_SIZE, 0, 16 - PRIVACY_REDACT_TOKEN_SIZE);
+}
+
+struct privacy_redactor *privacy_redact_open(const struct privacy_redact_config *config) {
+    struct privacy_redactor *redactor;
+    uint32_t entries = 0;
+
+    if (!config || config->ip_mode > PRIVACY_REDACT_IP_PARTIAL || config->port_mode > PRIVACY_REDACT_PORT_TRUNCATE ||
+        config->key_len > PRIVACY_REDACT_KEY_MAX || config->cache_entries > PRIVACY_REDACT_MAX_CACHE_ENTRIES) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    redactor = calloc(1, sizeof(*redactor));
+    if (!redactor) {
+        return NULL;
+    }
+    if (config->ip_mode == PRIVACY_REDACT_IP_HASH && config->cache_entries) {
+        entries = 1;
+        while (entries < config->cache_entries) {
+            entries <<= 1;
+        }
+        redactor->cache = calloc(entries, sizeof(*redactor->cache));
+        if (!redactor->cache) {
+            free(redactor);
+            errno = ENOMEM;
+            return NULL;
+        }
+        redactor->cache_mask = entries - 1;
+    }
+    redactor->ip_mode = config->ip_mode;
+    redactor->port_mode = config->port_mode;
+    redactor->cache_seed = config->cache_seed;
+    if (config->key_len) {
+        flow_hash_hmac_init(&redactor->hmac, config->key, config->key_len);
+        redactor->keyed = 1;
+    }
+    redactor->stats.cache_entries = entries;
+    return redactor;
+}
+
+/*
+ * Redact count addresses into out (which may be addrs). Hashed addresses
+ * come back as a PRIVACY_REDACT_TOKEN_SIZE-byte pseudonym, zero padded.
+ * Returns 0 on success, -1 on error (errno set).
+ */
+int privacy_redact_addresses(struct privacy_redactor *redactor, const uint8_t (*addrs)[16],
+                             const uint8_t *ip_versions, uint32_t count, uint8_t (*out)[16]) {
+    uint32_t i;
+
+    if (!redactor || (count && (!addrs || !ip_versions || !out))) {
+        errno = EINVAL;
+        return -1;
+    }
+    redactor->stats.addresses += count;
+    switch (redactor->ip_mode) {
+    case PRIVACY_REDACT_IP_HASH:
+        for (i = 0; i < count; i++) {
+            privacy_redact_hash(redactor, addrs[i], ip_versions[i], out[i]);
+        }
+        break;
+    case PRIVACY_REDACT_IP_PARTIAL: {
+        // Index 0: IPv4, keep bytes 0-1 of 16; index 1: IPv6, keep all
+        static const uint8_t mask_bytes[2][16] = {
+            {0xff, 0xff},
+            {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff},
+        };
+        uint64_t masks[2][2];
+
+        memcpy(masks, mask_bytes, sizeof(masks));
+        for (i = 0; i < count; i++) {
+            const uint64_t *mask = masks[ip_versions[i] == 6];
+            uint64_t words[2];
+
+            memcpy(words, addrs[i], sizeof(words));
+            words[0] &= mask[0];
+            words[1] &= mask[1];
+            memcpy(out[i], words, sizeof(words));
+        }
+        break;
+    }
+    default:
+        if (out != addrs) {
+            memmove(out, addrs, (size_t)count * 16);
+        }
+        break;
+    }
+    return 0;
+}
+
+/* Redact count host-order ports into out (which may be ports). Returns 0, or -1 on error (errno set) */
+int privacy_redact_ports(const struct privacy_redactor *redactor, const uint16_t *ports, uint32_t count,
+                         uint16_t *out) {
+    uint16_t mask;
+    uint32_t i;
+
+    if (!redactor || (count && (!ports || !out))) {
+        errno = EINVAL;
+        return -1;
+    }
+    mask = redactor->port_mode == PRIVACY_REDACT_PORT_TRUNCATE ? 0xff00 : 0xffff;
+    for (i = 0; i < count; i++) {
+        out[i] = ports[i] & mask;
+    }
+    return 0;
+}
+
+/*
+ * Redact the endpoints of count flow table records, gathered into address
+ * and port columns PRIVACY_REDACT_CHUNK records at a time.
+ * Returns 0 on success, -1 on error (errno set).
+ */
+int privacy_redact_table_records(struct privacy_redactor *redactor, const struct flow_table_record *records,
+                                 uint32_t count, struct privacy_redact_record *out) {
+    uint8_t addrs[2 * PRIVACY_REDACT_CHUNK][16];
+    uint8_t ip_versions[2 * PRIVACY_REDACT_CHUNK];
+    uint16_t ports[2 * PRIVACY_REDACT_CHUNK];
+    uint32_t base;
+
+    if (!redactor || (count && (!records || !out))) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (base = 0; base < count; base += PRIVACY_REDACT_CHUNK) {
+        uint32_t n = count - base < PRIVACY_REDACT_CHUNK ? count - base : PRIVACY_REDACT_CHUNK;
+        uint32_t i;
+
+        // Column 2i is record i's src, 2i + 1 its dst
+        for (i = 0; i < n; i++) {
+            const struct flow_table_record *record = &records[base + i];
+
+            memcpy(addrs[2 * i], record->src_addr, 16);
+            memcpy(addrs[2 * i + 1], record->dst_addr, 16);
+            ip_versions[2 * i] = record->ip_version;
+            ip_versions[2 * i + 1] = record->ip_version;
+            ports[2 * i] = record->src_port;
+            ports[2 * i + 1] = record->dst_port;
+        }
+        privacy_redact_addresses(redactor, (const uint8_t (*)[16])addrs, ip_versions, 2 * n, addrs);
+        privacy_redact_ports(redactor, ports, 2 * n, ports);
+        for (i = 0; i < n; i++) {
+            struct privacy_redact_record *redacted = &out[base + i];
+
+            memcpy(redacted->src_addr, addrs[2 * i], 16);
+            memcpy(redacted->dst_addr, addrs[2 * i + 1], 16);
+            redacted->src_port = ports[2 * i];
+            redacted->dst_port = ports[2 * i + 1];
+            redacted->reserved = 0;
+        }
+    }
+    return 0;
+}
+
+int privacy_redact_stats(const struct privacy_redactor *redactor, struct privacy_redact_stats *out) {
+    if (!redactor || !out) {
+        errno = EINVAL;
+        return -1;
+    }
+    *out = redactor->stats;
+    return 0;
+}
+
+void privacy_redact_close(struct privacy_redactor *redactor) {
+    if (!redactor) {
+        return;
+    }
+    free(redactor->cache);
+    free(redactor);
+}
@@ -0,0 +1,80 @@
+/*
+ * RansomEye DPI Advanced - Privacy Redaction
+ * AUTHORITATIVE: Batch redaction of binary addresses and ports
+ *
+ * NOTE:
+ * - Native counterpart of PrivacyRedactor (dpi-advanced/engine/
+ *   privacy_redactor.py); for the same policy and key both produce the
+ *   same strings.
+ * - Works on columns: count 16-byte addresses (IPv4 in the first 4) with
+ *   their IP versions, and count ports, one call per batch.
+ * - PRIVACY_REDACT_IP_HASH (STRICT): the pseudonym is the first
+ *   PRIVACY_REDACT_TOKEN_SIZE bytes of HMAC-SHA256(key, packed address),
+ *   or of plain SHA-256 when no key is set; the packed address is 4
+ *   bytes for IPv4 and 16 for IPv6. Hashed addresses can be kept in a
+ *   fixed, direct-mapped per-run cache, since a link's address set is
+ *   small next to its flow count.
+ * - PRIVACY_REDACT_IP_PARTIAL (BALANCED): IPv4 keeps its first two
+ *   octets, the rest is masked to zero; IPv6 is left as is.
+ * - PRIVACY_REDACT_PORT_TRUNCATE keeps the high byte of each port.
+ * - Not thread-safe (the cache); one redactor per consuming thread.
+ */
+
+#ifndef RANSOMEYE_PRIVACY_REDACT_H
+#define RANSOMEYE_PRIVACY_REDACT_H
+
+#include <stdint.h>
+
+#include "flow_table.h"
+
+/* privacy_redact_config.ip_mode */
+#define PRIVACY_REDACT_IP_NONE 0
+#define PRIVACY_REDACT_IP_HASH 1
+#define PRIVACY_REDACT_IP_PARTIAL 2
+
+/* privacy_redact_config.port_mode */
+#define PRIVACY_REDACT_PORT_NONE 0
+#define PRIVACY_REDACT_PORT_TRUNCATE 1
+
+#define PRIVACY_REDACT_TOKEN_SIZE 8
+#define PRIVACY_REDACT_KEY_MAX 64
+#define PRIVACY_REDACT_MAX_CACHE_ENTRIES (1u << 24)
+
+struct privacy_redactor;
+
+struct privacy_redact_config {
+    uint32_t ip_mode;               /* PRIVACY_REDACT_IP_* */
+    uint32_t port_mode;             /* PRIVACY_REDACT_PORT_* */
+    uint32_t cache_entries;         /* Hashed-address cache, rounded up to a power of two; 0 disables */
+    uint32_t key_len;               /* Bytes of key used; 0 hashes without a key */
+    uint64_t cache_seed;            /* Keyed cache slot hash; use a random value per run */
+    uint8_t key[PRIVACY_REDACT_KEY_MAX];
+};
+
+/* Redacted endpoints of one flow_table_record, 40 bytes */
+struct privacy_redact_record {
+    uint8_t src_addr[16];           /* Pseudonym (first PRIVACY_REDACT_TOKEN_SIZE bytes) or address */
+    uint8_t dst_addr[16];
+    uint16_t src_port;              /* Host order */
+    uint16_t dst_port;
+    uint32_t reserved;
+};
+
+struct privacy_redact_stats {
+    uint64_t addresses;             /* Addresses redacted */
+    uint64_t hashed;                /* ... of which hashed (cache misses included) */
+    uint64_t cache_hits;            /* ... of which answered from the cache */
+    uint64_t cache_entries;
+};
+
+struct privacy_redactor *privacy_redact_open(const struct privacy_redact_config *config);
+int privacy_redact_addresses(struct privacy_redactor *redactor, const uint8_t (*addrs)[16],
+                             const uint8_t *ip_versions, uint32_t count, uint8_t (*out)[16]);
+int privacy_redact_ports(const struct privacy_redactor *redactor, const uint16_t *ports, uint32_t count,
+                         uint16_t *out);
+int privacy_redact_table_records(struct privacy_redactor *redactor, const struct flow_table_record *records,
+                                 uint32_t count, struct privacy_redact_record *out);
+int privacy_redact_stats(const struct privacy_redactor *redactor, struct privacy_redact_stats *out);
+void privacy_redact_close(struct privacy_redactor *redactor);
+
+#endif /* RANSOMEYE_PRIVACY_REDACT_H */
@@ -0,0 +1,469 @@
+/*
+ * RansomEye DPI Advanced - AF_XDP Capture
+ * AUTHORITATIVE: AF_XDP (XSK) capture backend with shared UMEM
+ *
+ * NOTE:
+ * - Raw AF_XDP socket API only (no libxdp dependency).
+ * - The UMEM is split into one frame partition per queue. Every socket owns
+ *   its own fill and completion ring, so a received frame is always recycled
+ *   into the fill ring it came from and partitions never mix.
+ * - Copy mode works on any XDP-capable driver (including veth);
+ *   zero-copy requires driver support and fails the bind otherwise.
+ */
+
+#define _GNU_SOURCE
+
+#include "xsk_capture.h"
+
+#include <linux/if_xdp.h>
+#include <linux/bpf.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+struct xsk_ring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *descs;
+    uint32_t mask;
+    void *map;
+    size_t map_len;
+};
+
+struct xsk_queue {
+    int fd;
+    uint32_t queue_id;
+    struct xsk_ring rx;
+    struct xsk_ring fill;
+    struct xsk_ring comp;
+    uint64_t *free_frames;          /* Frames owned by userspace, not in any ring */
+    uint32_t free_count;
+};
+
+struct xsk_capture {
+    unsigned char *umem;
+    size_t umem_len;
+    uint32_t frames_per_queue;
+    struct xsk_queue queues[XSK_CAPTURE_MAX_QUEUES];
+    uint32_t queue_count;
+    uint32_t next_queue;
+    int xskmap_fd;
+};
+
+static long xsk_bpf(int cmd, union bpf_attr *attr) {
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int xsk_ring_map(struct xsk_ring *ring, int fd, const struct xdp_ring_offset *off,
+                        uint32_t size, size_t desc_size, off_t pgoff) {
+    unsigned char *map;
+
+    ring->map_len = off->desc + (size_t)size * desc_size;
+    map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (map == MAP_FAILED) {
+        ring->map = NULL;
+        return -1;
+    }
+    ring->map = map;
+    ring->producer = (uint32_t *)(map + off->producer);
+    ring->consumer = (uint32_t *)(map + off->consumer);
+    ring->flags = (uint32_t *)(map + off->flags);
+    ring->descs = map + off->desc;
+    ring->mask = size - 1;
+    return 0;
+}
+
+static void xsk_ring_unmap(struct xsk_ring *ring) {
+    if (ring->map) {
+        munmap(ring->map, ring->map_len);
+        ring->map = NULL;
+    }
+}
+
+/*
+ * Move every userspace-owned frame into the fill ring.
+ */
+static void xsk_queue_refill(struct xsk_queue *queue) {
+    uint32_t prod = *queue->fill.producer;
+    uint32_t cons = __atomic_load_n(queue->fill.consumer, __ATOMIC_ACQUIRE);
+    uint32_t space = (queue->fill.mask + 1) - (prod - cons);
+    uint64_t *addrs = queue->fill.descs;
+
+    while (space > 0 && queue->free_count > 0) {
+        addrs[prod & queue->fill.mask] = queue->free_frames[--queue->free_count];
+        prod++;
+        space--;
+    }
+    __atomic_store_n(queue->fill.producer, prod, __ATOMIC_RELEASE);
+}
+
+/*
+ * Reclaim frames the kernel reports on the completion ring.
+ */
+static void xsk_queue_reclaim(struct xsk_queue *queue) {
+    uint32_t cons = *queue->comp.consumer;
+    uint32_t prod = __atomic_load_n(queue->comp.producer, __ATOMIC_ACQUIRE);
+    uint64_t *addrs = queue->comp.descs;
+
+    while (cons != prod) {
+        queue->free_frames[queue->free_count++] = addrs[cons & queue->comp.mask];
+        cons++;
+    }
+    __atomic_store_n(queue->comp.consumer, cons, __ATOMIC_RELEASE);
+}
+
+static int xsk_queue_setup(struct xsk_capture *capture, struct xsk_queue *queue, uint32_t index,
+                           unsigned int ifindex, int bind_mode) {
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp;
+    socklen_t optlen = sizeof(off);
+    uint32_t size = capture->frames_per_queue;
+    uint64_t base = (uint64_t)index * capture->frames_per_queue * XSK_CAPTURE_FRAME_SIZE;
+    uint32_t i;
+
+    queue->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (queue->fd < 0) {
+        return -1;
+    }
+
+    // First socket registers the UMEM; the others attach to it at bind time
+    if (index == 0) {
+        struct xdp_umem_reg reg;
+
+        memset(&reg, 0, sizeof(reg));
+        reg.addr = (uint64_t)(uintptr_t)capture->umem;
+        reg.len = capture->umem_len;
+        reg.chunk_size = XSK_CAPTURE_FRAME_SIZE;
+        reg.headroom = 0;
+        if (setsockopt(queue->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) {
+            return -1;
+        }
+    }
+
+    if (setsockopt(queue->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) < 0 ||
+        setsockopt(queue->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) < 0 ||
+        setsockopt(queue->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) < 0) {
+        return -1;
+    }
+    if (getsockopt(queue->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) {
+        return -1;
+    }
+    if (xsk_ring_map(&queue->rx, queue->fd, &off.rx, size, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) < 0 ||
+        xsk_ring_map(&queue->fill, queue->fd, &off.fr, size, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) < 0 ||
+        xsk_ring_map(&queue->comp, queue->fd, &off.cr, size, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) < 0) {
+        return -1;
+    }
+
+    // Stock this queue's UMEM partition into its fill ring
+    queue->free_frames = calloc(size, sizeof(uint64_t));
+    if (!queue->free_frames) {
+        return -1;
+    }
+    for (i = 0; i < size; i++) {
+        queue->free_frames[i] = base + (uint64_t)i * XSK_CAPTURE_FRAME_SIZE;
+    }
+    queue->free_count = size;
+    xsk_queue_refill(queue);
+
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = ifindex;
+    sxdp.sxdp_queue_id = queue->queue_id;
+    if (index == 0) {
+        sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP |
+                          (bind_mode == XSK_BIND_MODE_ZEROCOPY ? XDP_ZEROCOPY : XDP_COPY);
+    } else {
+        // Bind mode and wakeup behaviour are inherited from the UMEM owner
+        sxdp.sxdp_flags = XDP_SHARED_UMEM;
+        sxdp.sxdp_shared_umem_fd = (uint32_t)capture->queues[0].fd;
+    }
+    if (bind(queue->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int xsk_register(struct xsk_capture *capture, const char *xskmap_path) {
+    union bpf_attr attr;
+    uint32_t i;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.pathname = (uint64_t)(uintptr_t)xskmap_path;
+    capture->xskmap_fd = (int)xsk_bpf(BPF_OBJ_GET, &attr);
+    if (capture->xskmap_fd < 0) {
+        return -1;
+    }
+
+    for (i = 0; i < capture->queue_count; i++) {
+        uint32_t key = capture->queues[i].queue_id;
+        uint32_t value = (uint32_t)capture->queues[i].fd;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = (uint32_t)capture->xskmap_fd;
+        attr.key = (uint64_t)(uintptr_t)&key;
+        attr.value = (uint64_t)(uintptr_t)&value;
+        attr.flags = BPF_ANY;
+        if (xsk_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Create the shared UMEM, one socket per queue, and register the sockets
+ * in the tracker's XSKMAP. Returns handle on success, NULL on error (errno set).
+ */
+struct xsk_capture *xsk_capture_open(const struct xsk_capture_config *config) {
+    struct xsk_capture *capture;
+    unsigned int ifindex;
+    uint32_t frames;
+    uint32_t i;
+
+    if (!config || !config->interface || !config->xskmap_path || !config->queue_ids ||
+        config->queue_count == 0 || config->queue_count > XSK_CAPTURE_MAX_QUEUES ||
+        (config->bind_mode != XSK_BIND_MODE_COPY && config->bind_mode != XSK_BIND_MODE_ZEROCOPY)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    frames = config->frames_per_queue ? config->frames_per_queue : XSK_CAPTURE_DEFAULT_FRAMES_PER_QUEUE;
+    if ((frames & (frames - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    ifindex = if_nametoindex(config->interface);
+    if (ifindex == 0) {
+        return NULL;
+    }
+
+    capture = calloc(1, sizeof(*capture));
+    if (!capture) {
+        return NULL;
+    }
+    capture->xskmap_fd = -1;
+    capture->frames_per_queue = frames;
+    capture->umem_len = (size_t)frames * XSK_CAPTURE_FRAME_SIZE * config->queue_count;
+    capture->umem = mmap(NULL, capture->umem_len, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (capture->umem == MAP_FAILED) {
+        capture->umem = NULL;
+        free(capture);
+        return NULL;
+    }
+
+    for (i = 0; i < config->queue_count; i++) {
+        capture->queues[i].fd = -1;
+        capture->queues[i].queue_id = config->queue_ids[i];
+    }
+    capture->queue_count = config->queue_count;
+
+    for (i = 0; i < config->queue_count; i++) {
+        if (xsk_queue_setup(capture, &capture->queues[i], i, ifindex, config->bind_mode) < 0) {
+            goto fail;
+        }
+    }
+    if (xsk_register(capture, config->xskmap_path) < 0) {
+        goto fail;
+    }
+    return capture;
+
+fail:
+    {
+        int saved_errno = errno;
+        xsk_capture_close(capture);
+        errno = saved_errno;
+    }
+    return NULL;
+}
+
+/*
+ * Copy up to max_descs received frames (at most snaplen bytes each) out of
+ * the UMEM, round-robin across queues, recycling every frame into its fill ring.
+ * Returns number of frames described.
+ */
+static uint32_t xsk_capture_pop(struct xsk_capture *capture, unsigned char *buffer, uint32_t buffer_len,
+                                uint32_t snaplen, struct af_packet_frame_desc *descs, uint32_t max_descs) {
+    uint32_t count = 0;
+    uint32_t used = 0;
+    uint32_t n;
+    struct timespec ts;
+    int64_t now_ns;
+
+    if (clock_gettime(CLOCK_REALTIME, &ts) != 0) {
+        ts.tv_sec = 0;
+        ts.tv_nsec = 0;
+    }
+    now_ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+    for (n = 0; n < capture->queue_count && count < max_descs; n++) {
+        uint32_t index = (capture->next_queue + n) % capture->queue_count;
+        struct xsk_queue *queue = &capture->queues[index];
+        uint32_t cons = *queue->rx.consumer;
+        uint32_t prod = __atomic_load_n(queue->rx.producer, __ATOMIC_ACQUIRE);
+        uint32_t taken = 0;
+
+        while (cons != prod && count < max_descs && buffer_len - used >= snaplen) {
+            const struct xdp_desc *desc = &((const struct xdp_desc *)queue->rx.descs)[cons & queue->rx.mask];
+            struct af_packet_frame_desc *out = &descs[count];
+            uint32_t copy_len = desc->len < snaplen ? desc->len : snaplen;
+
+            memcpy(buffer + used, capture->umem + desc->addr, copy_len);
+            out->offset = used;
+            out->caplen = copy_len;
+            out->wirelen = desc->len;
+            out->flags = copy_len < desc->len ? AF_PACKET_FRAME_TRUNCATED : 0;
+            out->ts_ns = now_ns;
+            out->source = queue->queue_id;
+            out->reserved = 0;
+            used += copy_len;
+            count++;
+
+            // Aligned mode: the frame base is the chunk start of the descriptor address
+            queue->free_frames[queue->free_count++] = desc->addr & ~((uint64_t)XSK_CAPTURE_FRAME_SIZE - 1);
+            cons++;
+            taken++;
+        }
+        if (taken == 0) {
+            continue;
+        }
+
+        __atomic_store_n(queue->rx.consumer, cons, __ATOMIC_RELEASE);
+        xsk_queue_reclaim(queue);
+        xsk_queue_refill(queue);
+        if (__atomic_load_n(queue->fill.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP) {
+            recvfrom(queue->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+        }
+    }
+    capture->next_queue = (capture->next_queue + 1) % capture->queue_count;
+    return count;
+}
+
+static int xsk_capture_wait(struct xsk_capture *capture, int timeout_ms) {
+    struct pollfd pfds[XSK_CAPTURE_MAX_QUEUES];
+    uint32_t i;
+    int rc;
+
+    for (i = 0; i < capture->queue_count; i++) {
+        pfds[i].fd = capture->queues[i].fd;
+        pfds[i].events = POLLIN;
+        pfds[i].revents = 0;
+    }
+    rc = poll(pfds, capture->queue_count, timeout_ms);
+    if (rc < 0 && errno != EINTR) {
+        return -1;
+    }
+    for (i = 0; i < capture->queue_count; i++) {
+        if (pfds[i].revents & (POLLERR | POLLNVAL)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Read one frame from any queue (round-robin across queues).
+ * Returns 1 when a frame was copied, 0 on timeout, -1 on error.
+ */
+int xsk_capture_read(struct xsk_capture *capture, int timeout_ms,
+                     unsigned char *buffer, uint32_t buffer_len,
+                     uint32_t *out_caplen, uint32_t *out_wirelen,
+                     long *out_sec, long *out_nsec, uint32_t *out_queue) {
+    struct af_packet_frame_desc desc;
+    int count;
+
+    if (!out_caplen) {
+        return -1;
+    }
+    count = xsk_capture_read_batch(capture, timeout_ms, buffer, buffer_len, buffer_len, &desc, 1);
+    if (count <= 0) {
+        return count;
+    }
+
+    *out_caplen = desc.caplen;
+    if (out_wirelen) {
+        *out_wirelen = desc.wirelen;
+    }
+    if (out_sec) {
+        *out_sec = (long)(desc.ts_ns / 1000000000LL);
+    }
+    if (out_nsec) {
+        *out_nsec = (long)(desc.ts_ns % 1000000000LL);
+    }
+    if (out_queue) {
+        *out_queue = desc.source;
+    }
+    return 1;
+}
+
+/*
+ * Read up to max_descs frames from all queues in one call.
+ * Returns number of frames described (0 on timeout), -1 on error.
+ */
+int xsk_capture_read_batch(struct xsk_capture *capture, int timeout_ms,
+                           unsigned char *buffer, uint32_t buffer_len, uint32_t snaplen,
+                           struct af_packet_frame_desc *descs, uint32_t max_descs) {
+    uint32_t count;
+
+    if (!capture || !buffer || !descs || max_descs == 0 || snaplen == 0 || buffer_len < snaplen) {
+        errno = EINVAL;
+        return -1;
+    }
+    count = xsk_capture_pop(capture, buffer, buffer_len, snaplen, descs, max_descs);
+    if (count == 0) {
+        if (xsk_capture_wait(capture, timeout_ms) < 0) {
+            return -1;
+        }
+        count = xsk_capture_pop(capture, buffer, buffer_len, snaplen, descs, max_descs);
+    }
+    return (int)count;
+}
+
+void xsk_capture_close(struct xsk_capture *capture) {
+    uint32_t i;
+
+    if (!capture) {
+        return;
+    }
+    for (i = 0; i < capture->queue_count; i++) {
+        struct xsk_queue *queue = &capture->queues[i];
+
+        if (capture->xskmap_fd >= 0) {
+            union bpf_attr attr;
+            uint32_t key = queue->queue_id;
+
+            memset(&attr, 0, sizeof(attr));
+            attr.map_fd = (uint32_t)capture->xskmap_fd;
+            attr.key = (uint64_t)(uintptr_t)&key;
+            xsk_bpf(BPF_MAP_DELETE_ELEM, &attr);
+        }
+        xsk_ring_unmap(&queue->rx);
+        xsk_ring_unmap(&queue->fill);
+        xsk_ring_unmap(&queue->comp);
+        free(queue->free_frames);
+    }
+    // Sockets sharing the UMEM are closed before its owner
+    for (i = capture->queue_count; i > 0; i--) {
+        if (capture->queues[i - 1].fd >= 0) {
+            close(capture->queues[i - 1].fd);
+        }
+    }
+    if (capture->xskmap_fd >= 0) {
+        close(capture->xskmap_fd);
+    }
+    if (capture->umem) {
+        munmap(capture->umem, capture->umem_len);
+    }
+    free(capture);
+}
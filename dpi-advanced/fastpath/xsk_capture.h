@@ -0,0 +1,49 @@
+/*
+ * RansomEye DPI Advanced - AF_XDP Capture
+ * AUTHORITATIVE: AF_XDP (XSK) capture backend with shared UMEM
+ *
+ * NOTE:
+ * - One XSK socket per RX queue, all sockets share one UMEM frame pool.
+ * - Frames arrive via the XSKMAP redirect in ebpf_flow_tracker.c; the pinned
+ *   map is looked up by path and each socket is registered under its queue id.
+ * - Output is the same frame stream the capture engine produces
+ *   (headers, on-wire length, timestamp, source queue).
+ */
+
+#ifndef RANSOMEYE_XSK_CAPTURE_H
+#define RANSOMEYE_XSK_CAPTURE_H
+
+#include <stdint.h>
+
+#include "af_packet_capture.h"
+
+#define XSK_CAPTURE_MAX_QUEUES 64u
+#define XSK_CAPTURE_FRAME_SIZE 4096u
+#define XSK_CAPTURE_DEFAULT_FRAMES_PER_QUEUE 4096u
+
+/* Bind modes selectable from probe configuration */
+#define XSK_BIND_MODE_COPY 0
+#define XSK_BIND_MODE_ZEROCOPY 1
+
+struct xsk_capture;
+
+struct xsk_capture_config {
+    const char *interface;
+    const char *xskmap_path;        /* Pinned XSKMAP of the XDP flow tracker */
+    const uint32_t *queue_ids;
+    uint32_t queue_count;
+    uint32_t frames_per_queue;      /* Power of two, 0 selects the default */
+    int bind_mode;
+};
+
+struct xsk_capture *xsk_capture_open(const struct xsk_capture_config *config);
+int xsk_capture_read(struct xsk_capture *capture, int timeout_ms,
+                     unsigned char *buffer, uint32_t buffer_len,
+                     uint32_t *out_caplen, uint32_t *out_wirelen,
+                     long *out_sec, long *out_nsec, uint32_t *out_queue);
+int xsk_capture_read_batch(struct xsk_capture *capture, int timeout_ms,
+                           unsigned char *buffer, uint32_t buffer_len, uint32_t snaplen,
+                           struct af_packet_frame_desc *descs, uint32_t max_descs);
+void xsk_capture_close(struct xsk_capture *capture);
+
+#endif /* RANSOMEYE_XSK_CAPTURE_H */
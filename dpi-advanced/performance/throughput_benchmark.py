@@ -2,78 +2,447 @@
 """
 RansomEye DPI Advanced - Throughput Benchmark
 AUTHORITATIVE: Reproducible throughput benchmark
+
+Traffic is generated natively (bench_driver.c) on one end of a veth pair and
+captured on the other through the probe's own capture -> parse -> flow path.
+Flows go through the native flow table, as in the probe; --python-flows
+measures the FlowAssembler fallback instead. Requires root (veth creation and
+AF_PACKET) and the fastpath bench library (make -C dpi-advanced/fastpath bench).
 """
 
+import argparse
+import ctypes
+import json
+import os
+import resource
+import subprocess
+import sys
 import time
-import statistics
-from typing import List, Dict, Any
+from datetime import datetime, timezone
+from pathlib import Path
+from typing import List, Dict, Any, Optional, Union
+
+_project_root = Path(__file__).resolve().parents[2]
+if str(_project_root) not in sys.path:
+    sys.path.insert(0, str(_project_root))
+
+from dpi.probe.main import (  # noqa: E402
+    AFPacketRingCapture,
+    FanoutCapture,
+    FlowAssembler,
+    NativeFlowTable,
+)
+
+# Frame lengths per profile (Ethernet header to end of payload). IMIX is the
+# classic 7:4:1 mix of small, medium and full-size frames.
+PACKET_PROFILES = {
+    "64": [64],
+    "512": [512],
+    "1500": [1500],
+    "imix": [64] * 7 + [576] * 4 + [1500],
+}
+
+# Output of `make -C dpi-advanced/fastpath bench`: capture sources plus the benchmark sender
+DEFAULT_BENCH_LIB = Path(__file__).resolve().parents[1] / "fastpath" / "build" / "libransomeye_dpi_bench.so"
+BENCH_LIB_HINT = "build it with `make -C dpi-advanced/fastpath bench` or set RANSOMEYE_DPI_BENCH_LIB"
+
+# Must match BENCH_TX_MAX_SIZES in bench_driver.h
+BENCH_TX_MAX_SIZES = 16
+
+STAGES = ("capture", "parse", "flow")
+
+# Flow table sizing and timeouts as run_dpi_probe's defaults
+FLOW_TABLE_MAX_FLOWS = 262144
+FLOW_ACTIVE_TIMEOUT = 300
+FLOW_IDLE_TIMEOUT = 30
+
+
+class BenchTxConfig(ctypes.Structure):
+    _fields_ = [
+        ("interface", ctypes.c_char_p),
+        ("pcap_path", ctypes.c_char_p),
+        ("frame_sizes", ctypes.POINTER(ctypes.c_uint32)),
+        ("frame_size_count", ctypes.c_uint32),
+        ("flows", ctypes.c_uint32),
+        ("rate_pps", ctypes.c_uint64),
+        ("packets", ctypes.c_uint64),
+        ("cpu", ctypes.c_int),
+    ]
+
+
+class BenchTxStats(ctypes.Structure):
+    _fields_ = [
+        ("packets", ctypes.c_uint64),
+        ("bytes", ctypes.c_uint64),
+        ("errors", ctypes.c_uint64),
+        ("cpu_ns", ctypes.c_uint64),
+        ("running", ctypes.c_uint32),
+        ("reserved", ctypes.c_uint32),
+    ]
+
+
+def _resolve_bench_lib(lib_path: Optional[Path]) -> Path:
+    """The probe's capture library lacks the sender, so benchmarks default to the bench build."""
+    return lib_path or Path(os.getenv("RANSOMEYE_DPI_BENCH_LIB", str(DEFAULT_BENCH_LIB)))
+
+
+def _require_bench_symbols(lib: ctypes.CDLL, prefix: str, symbols: List[str]) -> None:
+    missing = [symbol for symbol in symbols if not hasattr(lib, symbol)]
+    if missing:
+        raise RuntimeError(f"{lib._name} has no {prefix}* symbols ({', '.join(missing)}); {BENCH_LIB_HINT}")
+
+
+def _bind_bench_driver(lib: ctypes.CDLL) -> None:
+    _require_bench_symbols(lib, "bench_", [
+        "bench_tx_open", "bench_tx_start", "bench_tx_stop", "bench_tx_stats", "bench_tx_close",
+        "bench_cycle_counter_open",
+    ])
+    lib.bench_tx_open.argtypes = [ctypes.POINTER(BenchTxConfig)]
+    lib.bench_tx_open.restype = ctypes.c_void_p
+    lib.bench_tx_start.argtypes = [ctypes.c_void_p]
+    lib.bench_tx_start.restype = ctypes.c_int
+    lib.bench_tx_stop.argtypes = [ctypes.c_void_p]
+    lib.bench_tx_stop.restype = ctypes.c_int
+    lib.bench_tx_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(BenchTxStats)]
+    lib.bench_tx_stats.restype = ctypes.c_int
+    lib.bench_tx_close.argtypes = [ctypes.c_void_p]
+    lib.bench_tx_close.restype = None
+    lib.bench_cycle_counter_open.argtypes = []
+    lib.bench_cycle_counter_open.restype = ctypes.c_int
+
+
+class CycleCounter:
+    """Per-thread CPU cycles from perf; thread CPU time when hardware counters are unavailable."""
+
+    def __init__(self, lib: ctypes.CDLL):
+        self.fd = lib.bench_cycle_counter_open()
+        self.source = "perf" if self.fd >= 0 else "thread_time"
+
+    def read(self) -> int:
+        if self.fd >= 0:
+            return int.from_bytes(os.read(self.fd, 8), sys.byteorder)
+        return time.thread_time_ns()
+
+    def close(self) -> None:
+        if self.fd >= 0:
+            os.close(self.fd)
+            self.fd = -1
+
+
+def _memory_mb() -> Dict[str, float]:
+    memory = {"memory_mb": 0.0, "peak_memory_mb": 0.0}
+    with open("/proc/self/status", encoding="utf-8") as status:
+        for line in status:
+            if line.startswith("VmRSS:"):
+                memory["memory_mb"] = int(line.split()[1]) / 1024.0
+            elif line.startswith("VmHWM:"):
+                memory["peak_memory_mb"] = int(line.split()[1]) / 1024.0
+    return memory
+
+
+def _process_cpu_ns() -> int:
+    usage = resource.getrusage(resource.RUSAGE_SELF)
+    return int((usage.ru_utime + usage.ru_stime) * 1e9)
+
+
+class VethPair:
+    """Temporary veth pair; the sender transmits on tx_interface and the probe captures on rx_interface."""
+
+    def __init__(self, tx_interface: str, rx_interface: str):
+        self.tx_interface = tx_interface
+        self.rx_interface = rx_interface
+
+    def __enter__(self) -> "VethPair":
+        subprocess.run(
+            ["ip", "link", "add", self.tx_interface, "type", "veth", "peer", "name", self.rx_interface],
+            check=True
+        )
+        for interface in (self.tx_interface, self.rx_interface):
+            # Keep IPv6 autoconfiguration chatter out of the measured traffic
+            subprocess.run(["sysctl", "-qw", f"net.ipv6.conf.{interface}.disable_ipv6=1"], check=False)
+            subprocess.run(["ip", "link", "set", interface, "up"], check=True)
+        return self
+
+    def __exit__(self, *exc_info) -> None:
+        subprocess.run(["ip", "link", "del", self.tx_interface], check=False)
 
 
 class ThroughputBenchmark:
     """
     Throughput benchmark for DPI probe.
-    
+
     Performance targets:
     - 10 Gbps sustained throughput
     - <5% CPU per 1 Gbps
     - Zero packet drops at 64-byte packets
     """
-    
-    def __init__(self):
+
+    def __init__(
+        self,
+        lib_path: Optional[Path] = None,
+        tx_interface: str = "rebench0",
+        rx_interface: str = "rebench1",
+        create_veth: bool = True,
+        fanout_workers: int = 0,
+        batch_size: int = 256,
+        flows: int = 1024,
+        rate_pps: int = 0,
+        pcap_path: Optional[Path] = None,
+        sender_cpu: int = -1,
+        python_flows: bool = False
+    ):
         """Initialize throughput benchmark."""
-        pass
-    
+        self.lib_path = _resolve_bench_lib(lib_path)
+        self.tx_interface = tx_interface
+        self.rx_interface = rx_interface
+        self.create_veth = create_veth
+        self.fanout_workers = fanout_workers
+        self.batch_size = batch_size
+        self.flows = flows
+        self.rate_pps = rate_pps
+        self.pcap_path = pcap_path
+        self.sender_cpu = sender_cpu
+        # FlowAssembler per packet instead of the native flow table, the probe's fallback path
+        self.python_flows = python_flows
+
     def run_benchmark(
         self,
         duration_seconds: int = 60,
-        packet_size: int = 64
+        packet_size: Union[int, str] = 64
     ) -> Dict[str, Any]:
         """
         Run throughput benchmark.
-        
+
         Args:
             duration_seconds: Benchmark duration in seconds
-            packet_size: Packet size in bytes
-        
+            packet_size: Packet size in bytes, or a PACKET_PROFILES name such as "imix"
+                (ignored when replaying a pcap file)
+
         Returns:
             Benchmark results dictionary
         """
-        # Stub implementation for Phase L
-        # In production, would measure actual packet processing throughput
-        
+        profile = "pcap" if self.pcap_path else str(packet_size)
+        frame_sizes = PACKET_PROFILES.get(profile, [int(packet_size)] if profile.isdigit() else None)
+        if self.pcap_path:
+            frame_sizes = []
+        elif not frame_sizes or len(frame_sizes) > BENCH_TX_MAX_SIZES:
+            raise ValueError(f"Unsupported packet size profile: {packet_size}")
+
+        if not self.create_veth:
+            return self._run(duration_seconds, profile, frame_sizes)
+        with VethPair(self.tx_interface, self.rx_interface):
+            return self._run(duration_seconds, profile, frame_sizes)
+
+    def run_profiles(
+        self,
+        duration_seconds: int = 60,
+        profiles: Optional[List[str]] = None
+    ) -> List[Dict[str, Any]]:
+        """Run run_benchmark once per packet-size profile (all of PACKET_PROFILES by default)."""
+        return [self.run_benchmark(duration_seconds, profile) for profile in (profiles or list(PACKET_PROFILES))]
+
+    def open_capture(self):
+        """Open the configured capture on rx_interface."""
+        if not self.lib_path.exists():
+            raise RuntimeError(f"Benchmark library not found: {self.lib_path}; {BENCH_LIB_HINT}")
+        if self.fanout_workers > 0:
+            return FanoutCapture(
+                interface=self.rx_interface, lib_path=self.lib_path, workers=self.fanout_workers,
+                fanout_mode="hash", worker_cpus=[], queue_slots=4096, block_size=1 << 20, block_count=64,
+                retire_timeout_ms=10, batch_size=self.batch_size
+            )
+        return AFPacketRingCapture(
+            interface=self.rx_interface, lib_path=self.lib_path, block_size=1 << 20, block_count=64,
+            retire_timeout_ms=10, batch_size=self.batch_size
+        )
+
+    def _run(self, duration_seconds: int, profile: str, frame_sizes: List[int]) -> Dict[str, Any]:
+        capture = self.open_capture()
+        lib = capture.library.lib
+        _bind_bench_driver(lib)
+        counter = CycleCounter(lib)
+        flow_assembler = None
+        flow_table = None
+        if self.python_flows:
+            flow_assembler = FlowAssembler(flow_timeout=FLOW_ACTIVE_TIMEOUT)
+        else:
+            try:
+                flow_table = NativeFlowTable(
+                    library=capture.library, max_flows=FLOW_TABLE_MAX_FLOWS, flow_timeout=FLOW_ACTIVE_TIMEOUT,
+                    idle_timeout=FLOW_IDLE_TIMEOUT, batch_size=self.batch_size
+                )
+            except RuntimeError:
+                counter.close()
+                capture.close()
+                raise
+        sizes = (ctypes.c_uint32 * len(frame_sizes))(*frame_sizes)
+        config = BenchTxConfig(
+            interface=self.tx_interface.encode("utf-8"),
+            pcap_path=str(self.pcap_path).encode("utf-8") if self.pcap_path else None,
+            frame_sizes=ctypes.cast(sizes, ctypes.POINTER(ctypes.c_uint32)) if frame_sizes else None,
+            frame_size_count=len(frame_sizes),
+            flows=self.flows,
+            rate_pps=self.rate_pps,
+            packets=0,
+            cpu=self.sender_cpu
+        )
+        sender = lib.bench_tx_open(ctypes.byref(config))
+        if not sender:
+            if flow_table is not None:
+                flow_table.close()
+            counter.close()
+            capture.close()
+            raise RuntimeError(f"Benchmark sender open failed on {self.tx_interface} (errno {ctypes.get_errno()})")
+
+        stage_cost = dict.fromkeys(STAGES, 0)
+        rx_packets = 0
+        rx_bytes = 0
+        parsed_packets = 0
+        tx_stats = BenchTxStats()
+        try:
+            cpu_start = _process_cpu_ns()
+            wall_start = time.monotonic()
+            if lib.bench_tx_start(sender) != 0:
+                raise RuntimeError(f"Benchmark sender failed to start (errno {ctypes.get_errno()})")
+            deadline = wall_start + duration_seconds
+            draining_until = None
+            while True:
+                now = time.monotonic()
+                if draining_until is None and now >= deadline:
+                    lib.bench_tx_stop(sender)
+                    # Frames already handed to the veth are still counted
+                    draining_until = now + 0.5
+                c0 = counter.read()
+                count = capture.read_frame_count(0.05)
+                c1 = counter.read()
+                if flow_table is not None:
+                    capture.batch.parse_descs(capture.library, count)
+                    c2 = counter.read()
+                    _flows, accounted = flow_table.update(capture.batch, count)
+                    flow_table.expire()
+                else:
+                    packets = capture.batch.parse(capture.library, count)
+                    c2 = counter.read()
+                    for packet in packets:
+                        flow_assembler.process_packet(**packet)
+                    accounted = len(packets)
+                c3 = counter.read()
+                stage_cost["capture"] += c1 - c0
+                stage_cost["parse"] += c2 - c1
+                stage_cost["flow"] += c3 - c2
+                rx_packets += count
+                parsed_packets += accounted
+                rx_bytes += capture.batch.wire_bytes(count)
+                if draining_until is not None and (count == 0 or now >= draining_until):
+                    break
+            wall_seconds = time.monotonic() - wall_start
+            lib.bench_tx_stats(sender, ctypes.byref(tx_stats))
+            capture_stats = capture.stats()
+            flows_tracked = flow_table.stats()["live_flows"] if flow_table is not None else len(flow_assembler.active_flows)
+            # Sender runs in-process; its thread is not part of the probe's CPU cost
+            probe_cpu_ns = max(_process_cpu_ns() - cpu_start - tx_stats.cpu_ns, 0)
+        finally:
+            lib.bench_tx_close(sender)
+            if flow_table is not None:
+                flow_table.close()
+            counter.close()
+            capture.close()
+
+        seconds = max(wall_seconds, 1e-9)
+        throughput_gbps = rx_bytes * 8 / seconds / 1e9
+        cpu_percent = probe_cpu_ns / (seconds * 1e9) * 100.0
+        per_packet = {stage: (cost / rx_packets if rx_packets else 0.0) for stage, cost in stage_cost.items()}
+        per_packet["total"] = sum(per_packet.values())
+
         results = {
-            'duration_seconds': duration_seconds,
-            'packet_size_bytes': packet_size,
-            'total_packets': 0,
-            'total_bytes': 0,
-            'throughput_gbps': 0.0,
-            'packet_rate_pps': 0,
-            'packet_drops': 0,
-            'cpu_percent': 0.0,
-            'memory_mb': 0.0
+            'profile': profile,
+            'frame_sizes': sorted(set(frame_sizes)),
+            'pcap_path': str(self.pcap_path) if self.pcap_path else None,
+            'duration_seconds': round(seconds, 3),
+            'packet_size_bytes': round(rx_bytes / rx_packets, 1) if rx_packets else 0,
+            'total_packets': rx_packets,
+            'total_bytes': rx_bytes,
+            'parsed_packets': parsed_packets,
+            'flow_path': 'python' if self.python_flows else 'native',
+            'flows_tracked': flows_tracked,
+            'throughput_gbps': throughput_gbps,
+            'packet_rate_pps': int(rx_packets / seconds),
+            'tx_packets': tx_stats.packets,
+            'tx_errors': tx_stats.errors,
+            'packet_drops': max(tx_stats.packets - rx_packets, 0),
+            'kernel_drops': capture_stats.get('kernel_drops', 0),
+            'queue_drops': capture_stats.get('queue_drops', 0),
+            'cpu_percent': cpu_percent,
+            'cpu_percent_per_gbps': cpu_percent / throughput_gbps if throughput_gbps else 0.0,
+            'stage_cost_source': counter.source,
+            ('stage_cycles_per_packet' if counter.source == "perf" else 'stage_cpu_ns_per_packet'): per_packet,
+            'timestamp': datetime.now(timezone.utc).isoformat(),
+            **_memory_mb()
         }
-        
-        # Simulate benchmark
-        # In production, would use actual packet capture and processing
-        
         return results
-    
+
     def verify_targets(self, results: Dict[str, Any]) -> Dict[str, bool]:
         """
         Verify performance targets.
-        
+
         Args:
             results: Benchmark results
-        
+
         Returns:
             Dictionary of target verification results
         """
         throughput_gbps = results.get('throughput_gbps', 0.0)
-        cpu_percent = results.get('cpu_percent', 0.0)
+        cpu_percent_per_gbps = results.get('cpu_percent_per_gbps', results.get('cpu_percent', 0.0))
         packet_drops = results.get('packet_drops', 0)
-        
+
         return {
             'throughput_10gbps': throughput_gbps >= 10.0,
-            'cpu_efficiency': cpu_percent < 5.0,  # <5% CPU per 1 Gbps
+            'cpu_efficiency': 0.0 < cpu_percent_per_gbps < 5.0,  # <5% CPU per 1 Gbps
             'zero_packet_drops': packet_drops == 0
         }
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description="RansomEye DPI fastpath throughput benchmark")
+    parser.add_argument("--duration", type=int, default=10, help="Seconds per profile")
+    parser.add_argument("--profiles", default=",".join(PACKET_PROFILES),
+                        help="Comma-separated profiles: 64, 512, 1500, imix or a frame length")
+    parser.add_argument("--pcap", type=Path, help="Replay this pcap/pcapng file instead of synthetic frames")
+    parser.add_argument("--rate-pps", type=int, default=0, help="Sender rate, 0 for as fast as possible")
+    parser.add_argument("--flows", type=int, default=1024, help="Distinct synthetic flows")
+    parser.add_argument("--fanout-workers", type=int, default=0, help="Capture through N PACKET_FANOUT workers")
+    parser.add_argument("--batch-size", type=int, default=256)
+    parser.add_argument("--sender-cpu", type=int, default=-1)
+    parser.add_argument("--python-flows", action="store_true",
+                        help="Track flows with FlowAssembler per packet (fallback path) instead of the native table")
+    parser.add_argument("--lib", type=Path, help="Bench library (default: RANSOMEYE_DPI_BENCH_LIB, else fastpath/build)")
+    parser.add_argument("--output", type=Path, help="Write JSON results here instead of stdout")
+    args = parser.parse_args()
+
+    benchmark = ThroughputBenchmark(
+        lib_path=args.lib,
+        fanout_workers=args.fanout_workers,
+        batch_size=args.batch_size,
+        flows=args.flows,
+        rate_pps=args.rate_pps,
+        pcap_path=args.pcap,
+        sender_cpu=args.sender_cpu,
+        python_flows=args.python_flows
+    )
+    profiles = ["pcap"] if args.pcap else args.profiles.split(",")
+    results = []
+    for profile in profiles:
+        result = benchmark.run_benchmark(args.duration, profile)
+        result["targets"] = benchmark.verify_targets(result)
+        results.append(result)
+
+    report = json.dumps({"benchmark": "throughput", "results": results}, indent=2)
+    if args.output:
+        args.output.write_text(report + "\n", encoding="utf-8")
+    else:
+        print(report)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -7,9 +7,12 @@ Python 3.10+ only
 
 import base64
 import ctypes
+import errno
 import hashlib
+import ipaddress
 import json
 import os
+import resource
 import select
 import socket
 import struct
@@ -18,7 +21,7 @@ import threading
 import time
 import uuid
 import urllib.request
-from datetime import datetime, timezone
+from datetime import datetime, timedelta, timezone
 from pathlib import Path
 from typing import Dict, Any, Optional, Tuple, List
 
@@ -213,37 +216,522 @@ class EventEnvelopeBuilder:
         self._prev_hash = hash_value
 
 
+class CaptureEngineConfig(ctypes.Structure):
+    _fields_ = [
+        ("interface", ctypes.c_char_p),
+        ("workers", ctypes.c_uint32),
+        ("fanout_mode", ctypes.c_int),
+        ("fanout_group_id", ctypes.c_uint16),
+        ("worker_cpus", ctypes.POINTER(ctypes.c_int)),
+        ("queue_slots", ctypes.c_uint32),
+        ("ring_block_size", ctypes.c_uint32),
+        ("ring_block_count", ctypes.c_uint32),
+        ("ring_retire_timeout_ms", ctypes.c_uint32),
+        ("timestamp_source", ctypes.c_int),
+        ("filter", ctypes.c_void_p),
+        ("filter_len", ctypes.c_uint32),
+    ]
+
+
+class AFPacketStats(ctypes.Structure):
+    _fields_ = [
+        ("packets", ctypes.c_uint64),
+        ("drops", ctypes.c_uint64),
+        ("freeze_q_cnt", ctypes.c_uint64),
+        ("blocks_in_use", ctypes.c_uint32),
+        ("block_count", ctypes.c_uint32),
+    ]
+
+
+class CaptureWorkerStats(ctypes.Structure):
+    _fields_ = [
+        ("packets", ctypes.c_uint64),
+        ("queue_drops", ctypes.c_uint64),
+        ("ring_errors", ctypes.c_uint64),
+        ("ring", AFPacketStats),
+        ("queue_depth", ctypes.c_uint32),
+        ("queue_slots", ctypes.c_uint32),
+        ("last_error", ctypes.c_int32),
+        ("state", ctypes.c_uint32),
+    ]
+
+
+class XSKCaptureConfig(ctypes.Structure):
+    _fields_ = [
+        ("interface", ctypes.c_char_p),
+        ("xskmap_path", ctypes.c_char_p),
+        ("queue_ids", ctypes.POINTER(ctypes.c_uint32)),
+        ("queue_count", ctypes.c_uint32),
+        ("frames_per_queue", ctypes.c_uint32),
+        ("bind_mode", ctypes.c_int),
+    ]
+
+
+class PcapReplayConfig(ctypes.Structure):
+    _fields_ = [
+        ("path", ctypes.c_char_p),
+        ("pacing", ctypes.c_int),
+        ("rate", ctypes.c_uint64),
+        ("loops", ctypes.c_uint32),
+    ]
+
+
+class PcapReplayStats(ctypes.Structure):
+    _fields_ = [
+        ("packets", ctypes.c_uint64),
+        ("bytes", ctypes.c_uint64),
+        ("skipped", ctypes.c_uint64),
+        ("passes", ctypes.c_uint32),
+        ("finished", ctypes.c_uint32),
+    ]
+
+
+class FlowExportConfig(ctypes.Structure):
+    _fields_ = [
+        ("pin_dir", ctypes.c_char_p),
+        ("idle_timeout_ns", ctypes.c_uint64),
+        ("sweep_interval_ns", ctypes.c_uint64),
+    ]
+
+
+class FlowExportStats(ctypes.Structure):
+    _fields_ = [
+        ("records", ctypes.c_uint64),
+        ("fin_records", ctypes.c_uint64),
+        ("rst_records", ctypes.c_uint64),
+        ("idle_records", ctypes.c_uint64),
+        ("detach_records", ctypes.c_uint64),
+        ("stale_records", ctypes.c_uint64),
+        ("datapath_packets", ctypes.c_uint64),
+        ("flow_inserts", ctypes.c_uint64),
+        ("insert_failures", ctypes.c_uint64),
+        ("ring_drops", ctypes.c_uint64),
+        ("live_flows", ctypes.c_uint64),
+        ("evictions", ctypes.c_uint64),
+        ("sweeps", ctypes.c_uint64),
+    ]
+
+
+class FlowSketchEntry(ctypes.Structure):
+    _fields_ = [
+        ("src_ip", ctypes.c_uint32),
+        ("reserved", ctypes.c_uint32),
+        ("value", ctypes.c_uint64),
+    ]
+
+
+class FlowLoaderConfig(ctypes.Structure):
+    _fields_ = [
+        ("object_path", ctypes.c_char_p),
+        ("pin_dir", ctypes.c_char_p),
+        ("interface", ctypes.c_char_p),
+        ("attach_mode", ctypes.c_uint32),
+        ("flow_map_max_entries", ctypes.c_uint32),
+    ]
+
+
+class FlowTableConfig(ctypes.Structure):
+    _fields_ = [
+        ("max_flows", ctypes.c_uint32),
+        ("overload_policy", ctypes.c_uint32),
+        ("active_timeout_ns", ctypes.c_int64),
+        ("idle_timeout_ns", ctypes.c_int64),
+        ("hash_seed", ctypes.c_uint64),
+        ("memory_budget", ctypes.c_uint64),
+    ]
+
+
+class FlowTableStats(ctypes.Structure):
+    _fields_ = [
+        ("packets", ctypes.c_uint64),
+        ("flows", ctypes.c_uint64),
+        ("records", ctypes.c_uint64),
+        ("insert_failures", ctypes.c_uint64),
+        ("aggregate_packets", ctypes.c_uint64),
+        ("aggregate_bytes", ctypes.c_uint64),
+        ("active_records", ctypes.c_uint64),
+        ("idle_records", ctypes.c_uint64),
+        ("fin_records", ctypes.c_uint64),
+        ("rst_records", ctypes.c_uint64),
+        ("evicted_records", ctypes.c_uint64),
+        ("single_packet_evictions", ctypes.c_uint64),
+        ("timer_reschedules", ctypes.c_uint64),
+        ("live_flows", ctypes.c_uint64),
+        ("max_flows", ctypes.c_uint64),
+        ("index_slots", ctypes.c_uint64),
+        ("memory_bytes", ctypes.c_uint64),
+        ("clock_ns", ctypes.c_int64),
+    ]
+
+
+class PrivacyRedactConfig(ctypes.Structure):
+    _fields_ = [
+        ("ip_mode", ctypes.c_uint32),
+        ("port_mode", ctypes.c_uint32),
+        ("cache_entries", ctypes.c_uint32),
+        ("key_len", ctypes.c_uint32),
+        ("cache_seed", ctypes.c_uint64),
+        ("key", ctypes.c_uint8 * 64),
+    ]
+
+
+class PrivacyRedactStats(ctypes.Structure):
+    _fields_ = [
+        ("addresses", ctypes.c_uint64),
+        ("hashed", ctypes.c_uint64),
+        ("cache_hits", ctypes.c_uint64),
+        ("cache_entries", ctypes.c_uint64),
+    ]
+
+
+# Limits from capture_filter.h
+CAPTURE_FILTER_MAX_CIDRS = 32
+CAPTURE_FILTER_MAX_PORT_RANGES = 32
+CAPTURE_FILTER_MAX_INSNS = 1024
+CAPTURE_FILTER_PROTOCOLS = {"tcp": 0x1, "udp": 0x2, "icmp": 0x4}
+
+
+class CaptureFilterCidr(ctypes.Structure):
+    _fields_ = [
+        ("addr", ctypes.c_uint32),
+        ("prefix_len", ctypes.c_uint32),
+    ]
+
+
+class CaptureFilterPortRange(ctypes.Structure):
+    _fields_ = [
+        ("first", ctypes.c_uint16),
+        ("last", ctypes.c_uint16),
+    ]
+
+
+class CaptureFilterSpec(ctypes.Structure):
+    _fields_ = [
+        ("protocols", ctypes.c_uint32),
+        ("snaplen", ctypes.c_uint32),
+        ("include_count", ctypes.c_uint32),
+        ("exclude_count", ctypes.c_uint32),
+        ("port_range_count", ctypes.c_uint32),
+        ("include", CaptureFilterCidr * CAPTURE_FILTER_MAX_CIDRS),
+        ("exclude", CaptureFilterCidr * CAPTURE_FILTER_MAX_CIDRS),
+        ("ports", CaptureFilterPortRange * CAPTURE_FILTER_MAX_PORT_RANGES),
+    ]
+
+
+class SockFilter(ctypes.Structure):
+    _fields_ = [
+        ("code", ctypes.c_uint16),
+        ("jt", ctypes.c_uint8),
+        ("jf", ctypes.c_uint8),
+        ("k", ctypes.c_uint32),
+    ]
+
+
+# struct af_packet_frame_desc: offset, caplen, wirelen, flags, ts_ns, source, reserved
+FRAME_DESC_FORMAT = "<IIIIqII"
+FRAME_DESC_SIZE = struct.calcsize(FRAME_DESC_FORMAT)
+
+# struct frame_packet_desc: src_addr, dst_addr, src_port, dst_port, outer_vlan, inner_vlan,
+# l3_offset, l4_offset, payload_offset, flags, mpls_label, ip_version, protocol, vlan_count,
+# mpls_count, tcp_flags, icmp_type, icmp_code, ttl, reserved
+PACKET_DESC_FORMAT = "<16s16sHHHHHHHHIBBBBBBBBI"
+PACKET_DESC_SIZE = struct.calcsize(PACKET_DESC_FORMAT)
+
+PROTOCOL_NAMES = {1: 'icmp', 6: 'tcp', 17: 'udp', 58: 'icmp'}
+
+# struct flow_record (ebpf_flow_tracker.h): src_ip, dst_ip, src_port, dst_port (network order,
+# src is the initiator), protocol, packets[forward, reverse], bytes[forward, reverse], first_seen,
+# last_seen, l7_protocol, flags, size_hist[8], iat_hist[8], tcp_flags[8], end_reason, cpu
+FLOW_RECORD_FORMAT = "<4s4s2s2sB3xQQQQQQII8I8I8III"
+FLOW_RECORD_SIZE = struct.calcsize(FLOW_RECORD_FORMAT)
+# FLOW_HIST_BUCKETS, and FLOW_TCP_* in bit order
+FLOW_HIST_BUCKETS = 8
+FLOW_TCP_FLAG_NAMES = ("fin", "syn", "rst", "psh", "ack", "urg", "ece", "cwr")
+# FLOW_END_* in ebpf_flow_tracker.h
+FLOW_END_REASONS = {1: "fin", 2: "rst", 3: "idle", 4: "detach"}
+# L7_PROTO_* in ebpf_flow_tracker.h; 0 (unclassified) maps to ''
+L7_PROTOCOL_NAMES = {
+    1: "tls", 2: "http", 3: "dns", 4: "smb", 5: "rdp", 6: "ssh", 7: "kerberos", 8: "ldap"
+}
+
+# struct flow_table_record (flow_table.h): src_addr, dst_addr (IPv4 in the first 4 bytes), src_port,
+# dst_port (host order, src is the initiator), ip_version, protocol, end_reason, segment,
+# packets[forward, reverse], bytes[forward, reverse], first_ns, last_ns, origin_ns
+FLOW_TABLE_RECORD_FORMAT = "<16s16sHHBBBxI4xQQQQqqq"
+FLOW_TABLE_RECORD_SIZE = struct.calcsize(FLOW_TABLE_RECORD_FORMAT)
+# FLOW_TABLE_RECORDS_PER_PACKET in flow_table.h
+FLOW_TABLE_RECORDS_PER_PACKET = 2
+# FLOW_TABLE_END_* in flow_table.h
+FLOW_TABLE_END_REASONS = {1: "active", 2: "idle", 3: "fin", 4: "rst", 5: "evicted"}
+# FLOW_TABLE_OVERLOAD_* in flow_table.h
+FLOW_TABLE_OVERLOAD_POLICIES = {"aggregate": 0, "evict_oldest": 1, "evict_single_packet": 2}
+# Seconds without packets before flow table expiry follows the wall clock instead of packet time
+FLOW_TABLE_QUIET_SECONDS = 1.0
+# struct flow_hash_digest (flow_hash.h): flow_id, origin_flow_id, immutable_hash
+FLOW_HASH_DIGEST_FORMAT = "16s16s32s"
+FLOW_HASH_DIGEST_SIZE = struct.calcsize(FLOW_HASH_DIGEST_FORMAT)
+# PRIVACY_REDACT_IP_* / PRIVACY_REDACT_PORT_* in privacy_redact.h, keyed by PrivacyRedactor policy value
+PRIVACY_REDACT_IP_MODES = {"none": 0, "hash": 1, "partial": 2}
+PRIVACY_REDACT_PORT_MODES = {"none": 0, "truncate": 1}
+# struct privacy_redact_record (privacy_redact.h): src_addr, dst_addr (a PRIVACY_REDACT_TOKEN_SIZE-byte
+# pseudonym when hashed), src_port, dst_port
+PRIVACY_REDACT_RECORD_FORMAT = "<16s16sHH4x"
+PRIVACY_REDACT_RECORD_SIZE = struct.calcsize(PRIVACY_REDACT_RECORD_FORMAT)
+PRIVACY_REDACT_TOKEN_SIZE = 8
+
+FANOUT_MODES = {"hash": 0, "cpu": 1, "rollover": 2}
+# AF_PACKET_TS_SOURCE_* in af_packet_capture.h
+TIMESTAMP_SOURCES = {"userspace": 0, "software": 1, "hardware": 2}
+TIMESTAMP_SOURCE_NAMES = {code: name for name, code in TIMESTAMP_SOURCES.items()}
+XSK_BIND_MODES = {"copy": 0, "zerocopy": 1}
+# XSK_CAPTURE_FRAME_SIZE in xsk_capture.h
+XSK_CAPTURE_FRAME_SIZE = 4096
+# FLOW_LOADER_ATTACH_* in flow_loader.h
+EBPF_ATTACH_MODES = {"xdp": 0, "tc": 1}
+# RANSOMEYE_DPI_EBPF_OBJECT value for the loader library's embedded tracker (make loader)
+EBPF_OBJECT_EMBEDDED = "embedded"
+# linux/capability.h bit numbers checked before the BPF-backed backends open
+CAP_NET_ADMIN = 12
+CAP_NET_RAW = 13
+CAP_IPC_LOCK = 14
+CAP_SYS_ADMIN = 21
+CAP_BPF = 39
+# PCAP_REPLAY_PACE_* in pcap_replay.h; gbps is converted to PCAP_REPLAY_PACE_BPS
+PCAP_PACING_MODES = {"recorded": 0, "pps": 1, "gbps": 2, "unthrottled": 3}
+# Must match CAPTURE_ENGINE_SLOT_SNAPLEN in capture_engine.h
+CAPTURE_ENGINE_SLOT_SNAPLEN = 256
+# CAPTURE_ENGINE_MAX_WORKERS / XSK_CAPTURE_MAX_QUEUES: bound on frame desc source ids
+CAPTURE_MAX_SOURCES = 64
+# CAPTURE_WORKER_STATE_* in capture_engine.h
+CAPTURE_WORKER_STATES = {0: "running", 1: "failed"}
+# FRAME_PACKET_TRUNCATED | FRAME_PACKET_MALFORMED in frame_parser.h
+FRAME_PACKET_ERROR_FLAGS = 0x8 | 0x20
+
+
 class AFPacketCLibrary:
     def __init__(self, lib_path: Path):
         if not lib_path.exists():
             raise RuntimeError(f"AF_PACKET library not found: {lib_path}")
-        self.lib = ctypes.CDLL(str(lib_path))
+        self.lib = ctypes.CDLL(str(lib_path), use_errno=True)
         self.lib.af_packet_open.argtypes = [ctypes.c_char_p]
         self.lib.af_packet_open.restype = ctypes.c_int
         self.lib.af_packet_read.argtypes = [
-            ctypes.c_int, ctypes.c_void_p, ctypes.c_int,
+            ctypes.c_int, ctypes.c_void_p, ctypes.c_int, ctypes.POINTER(ctypes.c_int),
             ctypes.POINTER(ctypes.c_int), ctypes.POINTER(ctypes.c_long), ctypes.POINTER(ctypes.c_long)
         ]
         self.lib.af_packet_read.restype = ctypes.c_int
         self.lib.af_packet_close.argtypes = [ctypes.c_int]
         self.lib.af_packet_close.restype = None
+        self.lib.af_packet_enable_timestamps.argtypes = [ctypes.c_int, ctypes.c_char_p, ctypes.c_int]
+        self.lib.af_packet_enable_timestamps.restype = ctypes.c_int
+        self.lib.af_packet_socket_stats.argtypes = [ctypes.c_int, ctypes.POINTER(AFPacketStats)]
+        self.lib.af_packet_socket_stats.restype = ctypes.c_int
+        self.lib.af_packet_ring_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(AFPacketStats)]
+        self.lib.af_packet_ring_stats.restype = ctypes.c_int
+        self.lib.af_packet_ring_open.argtypes = [ctypes.c_char_p, ctypes.c_uint32, ctypes.c_uint32, ctypes.c_uint32]
+        self.lib.af_packet_ring_open.restype = ctypes.c_void_p
+        self.lib.af_packet_ring_fd.argtypes = [ctypes.c_void_p]
+        self.lib.af_packet_ring_fd.restype = ctypes.c_int
+        self.lib.af_packet_ring_next_block.argtypes = [ctypes.c_void_p, ctypes.c_int]
+        self.lib.af_packet_ring_next_block.restype = ctypes.c_int
+        self.lib.af_packet_ring_next_frame.argtypes = [
+            ctypes.c_void_p, ctypes.POINTER(ctypes.POINTER(ctypes.c_ubyte)),
+            ctypes.POINTER(ctypes.c_uint32), ctypes.POINTER(ctypes.c_uint32),
+            ctypes.POINTER(ctypes.c_long), ctypes.POINTER(ctypes.c_long)
+        ]
+        self.lib.af_packet_ring_next_frame.restype = ctypes.c_int
+        self.lib.af_packet_ring_release_block.argtypes = [ctypes.c_void_p]
+        self.lib.af_packet_ring_release_block.restype = None
+        self.lib.af_packet_read_batch.argtypes = [
+            ctypes.c_void_p, ctypes.c_int, ctypes.c_void_p, ctypes.c_uint32, ctypes.c_uint32,
+            ctypes.c_void_p, ctypes.c_uint32
+        ]
+        self.lib.af_packet_read_batch.restype = ctypes.c_int
+        self.lib.af_packet_ring_close.argtypes = [ctypes.c_void_p]
+        self.lib.af_packet_ring_close.restype = None
+        self.lib.capture_engine_open.argtypes = [ctypes.POINTER(CaptureEngineConfig)]
+        self.lib.capture_engine_open.restype = ctypes.c_void_p
+        self.lib.capture_engine_start.argtypes = [ctypes.c_void_p]
+        self.lib.capture_engine_start.restype = ctypes.c_int
+        self.lib.capture_engine_read.argtypes = [
+            ctypes.c_void_p, ctypes.c_int, ctypes.c_void_p, ctypes.c_uint32,
+            ctypes.POINTER(ctypes.c_uint32), ctypes.POINTER(ctypes.c_uint32),
+            ctypes.POINTER(ctypes.c_long), ctypes.POINTER(ctypes.c_long), ctypes.POINTER(ctypes.c_uint32)
+        ]
+        self.lib.capture_engine_read.restype = ctypes.c_int
+        self.lib.capture_engine_read_batch.argtypes = [
+            ctypes.c_void_p, ctypes.c_int, ctypes.c_void_p, ctypes.c_uint32, ctypes.c_void_p, ctypes.c_uint32
+        ]
+        self.lib.capture_engine_read_batch.restype = ctypes.c_int
+        self.lib.capture_engine_timestamp_source.argtypes = [ctypes.c_void_p]
+        self.lib.capture_engine_timestamp_source.restype = ctypes.c_int
+        self.lib.capture_engine_stats.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_uint32]
+        self.lib.capture_engine_stats.restype = ctypes.c_int
+        self.lib.capture_engine_close.argtypes = [ctypes.c_void_p]
+        self.lib.capture_engine_close.restype = None
+        self.lib.xsk_capture_open.argtypes = [ctypes.POINTER(XSKCaptureConfig)]
+        self.lib.xsk_capture_open.restype = ctypes.c_void_p
+        self.lib.xsk_capture_read.argtypes = self.lib.capture_engine_read.argtypes
+        self.lib.xsk_capture_read.restype = ctypes.c_int
+        self.lib.xsk_capture_read_batch.argtypes = self.lib.af_packet_read_batch.argtypes
+        self.lib.xsk_capture_read_batch.restype = ctypes.c_int
+        self.lib.xsk_capture_close.argtypes = [ctypes.c_void_p]
+        self.lib.xsk_capture_close.restype = None
+        self.lib.capture_filter_compile.argtypes = [
+            ctypes.POINTER(CaptureFilterSpec), ctypes.c_void_p, ctypes.c_uint32
+        ]
+        self.lib.capture_filter_compile.restype = ctypes.c_int
+        self.lib.capture_filter_attach.argtypes = [ctypes.c_int, ctypes.c_void_p, ctypes.c_uint32]
+        self.lib.capture_filter_attach.restype = ctypes.c_int
+        self.lib.frame_parse.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_void_p]
+        self.lib.frame_parse.restype = ctypes.c_int
+        self.lib.frame_parse_batch.argtypes = [
+            ctypes.c_void_p, ctypes.c_uint32, ctypes.c_void_p, ctypes.c_uint32, ctypes.c_void_p,
+            ctypes.c_void_p, ctypes.c_uint32
+        ]
+        self.lib.frame_parse_batch.restype = ctypes.c_int
+        self.lib.pcap_replay_open.argtypes = [ctypes.POINTER(PcapReplayConfig)]
+        self.lib.pcap_replay_open.restype = ctypes.c_void_p
+        self.lib.pcap_replay_read_batch.argtypes = self.lib.af_packet_read_batch.argtypes
+        self.lib.pcap_replay_read_batch.restype = ctypes.c_int
+        self.lib.pcap_replay_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(PcapReplayStats)]
+        self.lib.pcap_replay_stats.restype = ctypes.c_int
+        self.lib.pcap_replay_close.argtypes = [ctypes.c_void_p]
+        self.lib.pcap_replay_close.restype = None
+        self.lib.flow_table_open.argtypes = [ctypes.POINTER(FlowTableConfig)]
+        self.lib.flow_table_open.restype = ctypes.c_void_p
+        self.lib.flow_table_update_batch.argtypes = [
+            ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_uint32, ctypes.c_void_p,
+            ctypes.c_uint32, ctypes.POINTER(ctypes.c_uint32)
+        ]
+        self.lib.flow_table_update_batch.restype = ctypes.c_int
+        self.lib.flow_table_expire.argtypes = [ctypes.c_void_p, ctypes.c_int64, ctypes.c_void_p, ctypes.c_uint32]
+        self.lib.flow_table_expire.restype = ctypes.c_int
+        self.lib.flow_table_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(FlowTableStats)]
+        self.lib.flow_table_stats.restype = ctypes.c_int
+        self.lib.flow_table_close.argtypes = [ctypes.c_void_p]
+        self.lib.flow_table_close.restype = None
+        self.lib.flow_hash_table_records.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_void_p]
+        self.lib.flow_hash_table_records.restype = ctypes.c_int
+        self.lib.privacy_redact_open.argtypes = [ctypes.POINTER(PrivacyRedactConfig)]
+        self.lib.privacy_redact_open.restype = ctypes.c_void_p
+        self.lib.privacy_redact_table_records.argtypes = [
+            ctypes.c_void_p, ctypes.c_void_p, ctypes.c_uint32, ctypes.c_void_p
+        ]
+        self.lib.privacy_redact_table_records.restype = ctypes.c_int
+        self.lib.privacy_redact_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(PrivacyRedactStats)]
+        self.lib.privacy_redact_stats.restype = ctypes.c_int
+        self.lib.privacy_redact_close.argtypes = [ctypes.c_void_p]
+        self.lib.privacy_redact_close.restype = None
+        self.lib.flow_export_open.argtypes = [ctypes.POINTER(FlowExportConfig)]
+        self.lib.flow_export_open.restype = ctypes.c_void_p
+        self.lib.flow_export_read.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_void_p, ctypes.c_uint32]
+        self.lib.flow_export_read.restype = ctypes.c_int
+        self.lib.flow_export_drain.argtypes = [ctypes.c_void_p]
+        self.lib.flow_export_drain.restype = ctypes.c_int
+        self.lib.flow_export_sketches.argtypes = [
+            ctypes.c_void_p, ctypes.POINTER(FlowSketchEntry), ctypes.POINTER(ctypes.c_uint32),
+            ctypes.POINTER(FlowSketchEntry), ctypes.POINTER(ctypes.c_uint32)
+        ]
+        self.lib.flow_export_sketches.restype = ctypes.c_int
+        self.lib.flow_export_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(FlowExportStats)]
+        self.lib.flow_export_stats.restype = ctypes.c_int
+        self.lib.flow_export_close.argtypes = [ctypes.c_void_p]
+        self.lib.flow_export_close.restype = None
+
+
+class FlowLoaderLibrary:
+    """libbpf-based tracker loader; a separate library so the capture library needs no libbpf."""
+
+    def __init__(self, lib_path: Path):
+        if not lib_path.exists():
+            raise RuntimeError(f"eBPF loader library not found: {lib_path}")
+        self.lib = ctypes.CDLL(str(lib_path), use_errno=True)
+        self.lib.flow_loader_open.argtypes = [ctypes.POINTER(FlowLoaderConfig)]
+        self.lib.flow_loader_open.restype = ctypes.c_void_p
+        self.lib.flow_loader_close.argtypes = [ctypes.c_void_p]
+        self.lib.flow_loader_close.restype = None
+
+
+def _timestamp_source_code(timestamp_source: str) -> int:
+    if timestamp_source not in ("software", "hardware"):
+        raise RuntimeError(f"Unsupported timestamp source: {timestamp_source}")
+    return TIMESTAMP_SOURCES[timestamp_source]
+
+
+def _enable_kernel_timestamps(library: AFPacketCLibrary, fd: int, interface: str, timestamp_source: str) -> str:
+    """Request kernel/NIC RX timestamps; returns the source actually in effect."""
+    effective = library.lib.af_packet_enable_timestamps(
+        fd, interface.encode('utf-8'), _timestamp_source_code(timestamp_source)
+    )
+    if effective < 0:
+        err = ctypes.get_errno()
+        raise RuntimeError(f"SO_TIMESTAMPING setup failed for interface {interface} (errno {err})")
+    if effective != TIMESTAMP_SOURCES[timestamp_source]:
+        logger.warning("Hardware RX timestamps unavailable, using kernel software timestamps", interface=interface)
+    return TIMESTAMP_SOURCE_NAMES[effective]
+
+
+def _compile_capture_filter(library: AFPacketCLibrary, spec: CaptureFilterSpec) -> Tuple[ctypes.Array, int]:
+    insns = (SockFilter * CAPTURE_FILTER_MAX_INSNS)()
+    count = library.lib.capture_filter_compile(ctypes.byref(spec), ctypes.byref(insns), CAPTURE_FILTER_MAX_INSNS)
+    if count <= 0:
+        err = ctypes.get_errno()
+        raise RuntimeError(f"Capture filter compilation failed (errno {err})")
+    return insns, count
+
+
+def _attach_capture_filter(library: AFPacketCLibrary, fd: int, spec: Optional[CaptureFilterSpec]) -> None:
+    if spec is None:
+        return
+    insns, count = _compile_capture_filter(library, spec)
+    if library.lib.capture_filter_attach(fd, ctypes.byref(insns), count) != 0:
+        err = ctypes.get_errno()
+        raise RuntimeError(f"SO_ATTACH_FILTER failed (errno {err})")
+
+
+def _kernel_stats(stats: AFPacketStats) -> Dict[str, int]:
+    return {
+        "kernel_packets": stats.packets,
+        "kernel_drops": stats.drops,
+        "kernel_freeze_q_cnt": stats.freeze_q_cnt,
+        "ring_blocks_in_use": stats.blocks_in_use,
+        "ring_block_count": stats.block_count
+    }
 
 
 class AFPacketCapture:
-    def __init__(self, interface: str, lib_path: Path, buffer_size: int = 65535):
+    def __init__(
+        self,
+        interface: str,
+        lib_path: Path,
+        buffer_size: int = 65535,
+        timestamp_source: str = "software",
+        capture_filter: Optional[CaptureFilterSpec] = None
+    ):
         self.interface = interface
         self.buffer_size = buffer_size
         self.library = AFPacketCLibrary(lib_path)
         self.fd = self.library.lib.af_packet_open(interface.encode('utf-8'))
         if self.fd < 0:
             raise RuntimeError(f"AF_PACKET open failed for interface {interface}")
+        try:
+            _attach_capture_filter(self.library, self.fd, capture_filter)
+            self.timestamp_source = _enable_kernel_timestamps(self.library, self.fd, interface, timestamp_source)
+        except RuntimeError:
+            self.close()
+            raise
         self.buffer = (ctypes.c_ubyte * self.buffer_size)()
+        self._packet_desc = (ctypes.c_ubyte * PACKET_DESC_SIZE)()
+        self._stats = AFPacketStats()
+        self.parse_errors = 0
 
-    def read(self, timeout_seconds: float) -> Optional[Tuple[bytes, datetime]]:
+    def read(self, timeout_seconds: float) -> Optional[Tuple[bytes, datetime, int]]:
         ready, _, _ = select.select([self.fd], [], [], timeout_seconds)
         if not ready:
             return None
         out_len = ctypes.c_int(0)
+        out_wirelen = ctypes.c_int(0)
         out_sec = ctypes.c_long(0)
         out_nsec = ctypes.c_long(0)
         result = self.library.lib.af_packet_read(
@@ -251,6 +739,7 @@ class AFPacketCapture:
             ctypes.byref(self.buffer),
             self.buffer_size,
             ctypes.byref(out_len),
+            ctypes.byref(out_wirelen),
             ctypes.byref(out_sec),
             ctypes.byref(out_nsec)
         )
@@ -258,13 +747,1065 @@ class AFPacketCapture:
             raise RuntimeError("AF_PACKET read failed")
         timestamp = datetime.fromtimestamp(out_sec.value + (out_nsec.value / 1e9), tz=timezone.utc)
         frame = bytes(self.buffer[:out_len.value])
-        return frame, timestamp
+        return frame, timestamp, out_wirelen.value
+
+    def read_parsed_batch(self, timeout_seconds: float) -> List[Dict[str, Any]]:
+        frame_result = self.read(timeout_seconds)
+        if not frame_result:
+            return []
+        frame, timestamp, wirelen = frame_result
+        if self.library.lib.frame_parse(frame, len(frame), ctypes.byref(self._packet_desc)) != 0:
+            # flags sits at byte 46 of struct frame_packet_desc
+            if struct.unpack_from("<H", self._packet_desc, 46)[0] & FRAME_PACKET_ERROR_FLAGS:
+                self.parse_errors += 1
+            return []
+        return [_decode_packet_desc(bytes(self._packet_desc), timestamp, wirelen)]
+
+    def stats(self) -> Dict[str, Any]:
+        if self.library.lib.af_packet_socket_stats(self.fd, ctypes.byref(self._stats)) != 0:
+            raise RuntimeError(f"PACKET_STATISTICS read failed (errno {ctypes.get_errno()})")
+        return {**_kernel_stats(self._stats), "parse_errors": self.parse_errors}
 
     def close(self) -> None:
         self.library.lib.af_packet_close(self.fd)
 
 
+class FrameBatch:
+    """Caller-owned frame buffer and descriptor array filled by one native batch read."""
+
+    def __init__(self, batch_size: int, snaplen: int):
+        if batch_size <= 0 or snaplen <= 0:
+            raise RuntimeError("Batch size and snaplen must be positive")
+        self.batch_size = batch_size
+        self.snaplen = snaplen
+        self.buffer_len = batch_size * snaplen
+        self.buffer = (ctypes.c_ubyte * self.buffer_len)()
+        self.descs = (ctypes.c_ubyte * (batch_size * FRAME_DESC_SIZE))()
+        self.packets = (ctypes.c_ubyte * (batch_size * PACKET_DESC_SIZE))()
+        self.parse_errors = (ctypes.c_uint64 * CAPTURE_MAX_SOURCES)()
+        self._buffer_view = memoryview(self.buffer).cast('B')
+        self._desc_view = memoryview(self.descs).cast('B')
+        self._packet_view = memoryview(self.packets).cast('B')
+
+    def decode(self, count: int) -> List[Tuple[memoryview, datetime, int]]:
+        """Frames are views into the shared buffer, valid until the next batch read."""
+        frames = []
+        buffer_view = self._buffer_view
+        for offset, caplen, wirelen, _flags, ts_ns, _source, _ in struct.iter_unpack(
+            FRAME_DESC_FORMAT, self._desc_view[:count * FRAME_DESC_SIZE]
+        ):
+            timestamp = datetime.fromtimestamp(ts_ns / 1e9, tz=timezone.utc)
+            frames.append((buffer_view[offset:offset + caplen], timestamp, wirelen))
+        return frames
+
+    def wire_bytes(self, count: int) -> int:
+        """On-the-wire length of the last count frames."""
+        return sum(desc[2] for desc in struct.iter_unpack(FRAME_DESC_FORMAT, self._desc_view[:count * FRAME_DESC_SIZE]))
+
+    def parse_descs(self, library: AFPacketCLibrary, count: int) -> None:
+        """Fill the packet descriptors of the last count frames natively."""
+        if count <= 0:
+            return
+        library.lib.frame_parse_batch(
+            ctypes.byref(self.buffer),
+            self.buffer_len,
+            ctypes.byref(self.descs),
+            count,
+            ctypes.byref(self.packets),
+            ctypes.byref(self.parse_errors),
+            CAPTURE_MAX_SOURCES
+        )
+
+    def parse(self, library: AFPacketCLibrary, count: int) -> List[Dict[str, Any]]:
+        """Parse the last count frames natively and decode the IP packets among them."""
+        if count <= 0:
+            return []
+        self.parse_descs(library, count)
+        packets = []
+        frame_descs = struct.iter_unpack(FRAME_DESC_FORMAT, self._desc_view[:count * FRAME_DESC_SIZE])
+        for index, frame_desc in enumerate(frame_descs):
+            start = index * PACKET_DESC_SIZE
+            # ip_version sits at byte 52 of struct frame_packet_desc
+            if self._packet_view[start + 52] == 0:
+                continue
+            timestamp = datetime.fromtimestamp(frame_desc[4] / 1e9, tz=timezone.utc)
+            packets.append(_decode_packet_desc(self._packet_view[start:start + PACKET_DESC_SIZE], timestamp, frame_desc[2]))
+        return packets
+
+
+def _decode_packet_desc(packet_desc: bytes, timestamp: datetime, wirelen: int) -> Dict[str, Any]:
+    (src_addr, dst_addr, src_port, dst_port, _outer_vlan, _inner_vlan, _l3, _l4, _payload, _flags,
+     _mpls_label, ip_version, protocol, _vlan_count, _mpls_count, _tcp_flags, _icmp_type, _icmp_code,
+     _ttl, _reserved) = struct.unpack(PACKET_DESC_FORMAT, packet_desc)
+    if ip_version == 4:
+        src_ip = socket.inet_ntop(socket.AF_INET, src_addr[:4])
+        dst_ip = socket.inet_ntop(socket.AF_INET, dst_addr[:4])
+    else:
+        src_ip = socket.inet_ntop(socket.AF_INET6, src_addr)
+        dst_ip = socket.inet_ntop(socket.AF_INET6, dst_addr)
+    return {
+        "src_ip": src_ip,
+        "dst_ip": dst_ip,
+        "src_port": src_port,
+        "dst_port": dst_port,
+        "protocol": PROTOCOL_NAMES.get(protocol, 'other'),
+        "packet_size": wirelen,
+        "timestamp": timestamp
+    }
+
+
+class AFPacketRingCapture:
+    """TPACKET_V3 RX ring capture: frames are walked in place, one block at a time."""
+
+    def __init__(
+        self,
+        interface: str,
+        lib_path: Path,
+        block_size: int,
+        block_count: int,
+        retire_timeout_ms: int,
+        batch_size: int = 256,
+        timestamp_source: str = "software",
+        capture_filter: Optional[CaptureFilterSpec] = None
+    ):
+        self.interface = interface
+        self.library = AFPacketCLibrary(lib_path)
+        self.ring = self.library.lib.af_packet_ring_open(
+            interface.encode('utf-8'), block_size, block_count, retire_timeout_ms
+        )
+        if not self.ring:
+            err = ctypes.get_errno()
+            raise RuntimeError(f"AF_PACKET TPACKET_V3 ring open failed for interface {interface} (errno {err})")
+        try:
+            ring_fd = self.library.lib.af_packet_ring_fd(self.ring)
+            _attach_capture_filter(self.library, ring_fd, capture_filter)
+            self.timestamp_source = _enable_kernel_timestamps(self.library, ring_fd, interface, timestamp_source)
+        except RuntimeError:
+            self.close()
+            raise
+        self._block_held = False
+        self._data = ctypes.POINTER(ctypes.c_ubyte)()
+        self._caplen = ctypes.c_uint32(0)
+        self._wirelen = ctypes.c_uint32(0)
+        self._sec = ctypes.c_long(0)
+        self._nsec = ctypes.c_long(0)
+        self.batch = FrameBatch(batch_size, CAPTURE_ENGINE_SLOT_SNAPLEN)
+
+    def read_frame_count(self, timeout_seconds: float) -> int:
+        """Fill the frame batch without parsing it; returns the frame count."""
+        # The native batch walk continues any block left held by read()
+        self._block_held = False
+        count = self.library.lib.af_packet_read_batch(
+            self.ring,
+            int(timeout_seconds * 1000),
+            ctypes.byref(self.batch.buffer),
+            self.batch.buffer_len,
+            self.batch.snaplen,
+            ctypes.byref(self.batch.descs),
+            self.batch.batch_size
+        )
+        if count < 0:
+            raise RuntimeError("AF_PACKET ring batch read failed")
+        return count
+
+    def read_batch(self, timeout_seconds: float) -> List[Tuple[memoryview, datetime, int]]:
+        return self.batch.decode(self.read_frame_count(timeout_seconds))
+
+    def read_parsed_batch(self, timeout_seconds: float) -> List[Dict[str, Any]]:
+        return self.batch.parse(self.library, self.read_frame_count(timeout_seconds))
+
+    def read_frame_batch(self, timeout_seconds: float) -> int:
+        count = self.read_frame_count(timeout_seconds)
+        self.batch.parse_descs(self.library, count)
+        return count
+
+    def stats(self) -> Dict[str, Any]:
+        ring_stats = AFPacketStats()
+        if self.library.lib.af_packet_ring_stats(self.ring, ctypes.byref(ring_stats)) != 0:
+            raise RuntimeError(f"AF_PACKET ring statistics failed (errno {ctypes.get_errno()})")
+        return {**_kernel_stats(ring_stats), "parse_errors": self.batch.parse_errors[0]}
+
+    def read(self, timeout_seconds: float) -> Optional[Tuple[bytes, datetime, int]]:
+        lib = self.library.lib
+        timeout_ms = int(timeout_seconds * 1000)
+        while True:
+            if not self._block_held:
+                result = lib.af_packet_ring_next_block(self.ring, timeout_ms)
+                if result == 0:
+                    return None
+                if result < 0:
+                    raise RuntimeError("AF_PACKET ring poll failed")
+                self._block_held = True
+            result = lib.af_packet_ring_next_frame(
+                self.ring,
+                ctypes.byref(self._data),
+                ctypes.byref(self._caplen),
+                ctypes.byref(self._wirelen),
+                ctypes.byref(self._sec),
+                ctypes.byref(self._nsec)
+            )
+            if result == 1:
+                timestamp = datetime.fromtimestamp(self._sec.value + (self._nsec.value / 1e9), tz=timezone.utc)
+                frame = ctypes.string_at(self._data, self._caplen.value)
+                return frame, timestamp, self._wirelen.value
+            # Block exhausted: hand it back and pick up any block already retired
+            lib.af_packet_ring_release_block(self.ring)
+            self._block_held = False
+            timeout_ms = 0
+
+    def close(self) -> None:
+        if self.ring:
+            self.library.lib.af_packet_ring_close(self.ring)
+            self.ring = None
+
+
+class NativeQueueCapture:
+    """Common read path for native captures that copy header snapshots out of per-queue rings."""
+
+    buffer_size = CAPTURE_ENGINE_SLOT_SNAPLEN
+
+    def _init_buffers(self, batch_size: int) -> None:
+        self.batch = FrameBatch(batch_size, self.buffer_size)
+        self.buffer = (ctypes.c_ubyte * self.buffer_size)()
+        self._caplen = ctypes.c_uint32(0)
+        self._wirelen = ctypes.c_uint32(0)
+        self._sec = ctypes.c_long(0)
+        self._nsec = ctypes.c_long(0)
+        self._queue = ctypes.c_uint32(0)
+
+    def _read_native(self, read_fn, handle, timeout_seconds: float) -> Optional[Tuple[bytes, datetime, int]]:
+        result = read_fn(
+            handle,
+            int(timeout_seconds * 1000),
+            ctypes.byref(self.buffer),
+            self.buffer_size,
+            ctypes.byref(self._caplen),
+            ctypes.byref(self._wirelen),
+            ctypes.byref(self._sec),
+            ctypes.byref(self._nsec),
+            ctypes.byref(self._queue)
+        )
+        if result == 0:
+            return None
+        if result < 0:
+            raise RuntimeError(f"{type(self).__name__} read failed")
+        timestamp = datetime.fromtimestamp(self._sec.value + (self._nsec.value / 1e9), tz=timezone.utc)
+        frame = bytes(self.buffer[:self._caplen.value])
+        return frame, timestamp, self._wirelen.value
+
+    def _read_native_count(self, read_batch_fn, handle, timeout_seconds: float, *extra) -> int:
+        count = read_batch_fn(
+            handle,
+            int(timeout_seconds * 1000),
+            ctypes.byref(self.batch.buffer),
+            self.batch.buffer_len,
+            *extra,
+            ctypes.byref(self.batch.descs),
+            self.batch.batch_size
+        )
+        if count < 0:
+            err = ctypes.get_errno()
+            raise RuntimeError(f"{type(self).__name__} batch read failed (errno {err})")
+        return count
+
+    def _read_native_batch(self, read_batch_fn, handle, timeout_seconds: float, *extra) -> List[Tuple[memoryview, datetime, int]]:
+        return self.batch.decode(self._read_native_count(read_batch_fn, handle, timeout_seconds, *extra))
+
+    def _read_native_parsed_batch(self, read_batch_fn, handle, timeout_seconds: float, *extra) -> List[Dict[str, Any]]:
+        return self.batch.parse(self.library, self._read_native_count(read_batch_fn, handle, timeout_seconds, *extra))
+
+    def _read_native_frame_batch(self, read_batch_fn, handle, timeout_seconds: float, *extra) -> int:
+        count = self._read_native_count(read_batch_fn, handle, timeout_seconds, *extra)
+        self.batch.parse_descs(self.library, count)
+        return count
+
+
+class FanoutCapture(NativeQueueCapture):
+    """PACKET_FANOUT capture: N pinned native workers, one ring each, drained here."""
+
+    def __init__(
+        self,
+        interface: str,
+        lib_path: Path,
+        workers: int,
+        fanout_mode: str,
+        worker_cpus: List[int],
+        queue_slots: int,
+        block_size: int,
+        block_count: int,
+        retire_timeout_ms: int,
+        batch_size: int = 256,
+        timestamp_source: str = "software",
+        capture_filter: Optional[CaptureFilterSpec] = None
+    ):
+        if fanout_mode not in FANOUT_MODES:
+            raise RuntimeError(f"Unsupported fanout mode: {fanout_mode}")
+        if worker_cpus and len(worker_cpus) != workers:
+            raise RuntimeError(f"Fanout CPU list has {len(worker_cpus)} entries for {workers} workers")
+        self.interface = interface
+        self.library = AFPacketCLibrary(lib_path)
+        self._cpus = (ctypes.c_int * workers)(*worker_cpus) if worker_cpus else None
+        self._filter, filter_len = (
+            _compile_capture_filter(self.library, capture_filter) if capture_filter is not None else (None, 0)
+        )
+        config = CaptureEngineConfig(
+            interface=interface.encode('utf-8'),
+            workers=workers,
+            fanout_mode=FANOUT_MODES[fanout_mode],
+            fanout_group_id=0,
+            worker_cpus=ctypes.cast(self._cpus, ctypes.POINTER(ctypes.c_int)) if self._cpus else None,
+            queue_slots=queue_slots,
+            ring_block_size=block_size,
+            ring_block_count=block_count,
+            ring_retire_timeout_ms=retire_timeout_ms,
+            timestamp_source=_timestamp_source_code(timestamp_source),
+            filter=ctypes.addressof(self._filter) if self._filter is not None else None,
+            filter_len=filter_len
+        )
+        self.engine = self.library.lib.capture_engine_open(ctypes.byref(config))
+        if not self.engine:
+            err = ctypes.get_errno()
+            raise RuntimeError(f"AF_PACKET fanout open failed for interface {interface} (errno {err})")
+        if self.library.lib.capture_engine_start(self.engine) != 0:
+            err = ctypes.get_errno()
+            self.close()
+            raise RuntimeError(f"AF_PACKET fanout workers failed to start (errno {err})")
+        self.timestamp_source = TIMESTAMP_SOURCE_NAMES[self.library.lib.capture_engine_timestamp_source(self.engine)]
+        if self.timestamp_source != timestamp_source:
+            logger.warning("Hardware RX timestamps unavailable, using kernel software timestamps", interface=interface)
+        self._init_buffers(batch_size)
+
+    def read(self, timeout_seconds: float) -> Optional[Tuple[bytes, datetime, int]]:
+        return self._read_native(self.library.lib.capture_engine_read, self.engine, timeout_seconds)
+
+    def read_batch(self, timeout_seconds: float) -> List[Tuple[memoryview, datetime, int]]:
+        return self._read_native_batch(self.library.lib.capture_engine_read_batch, self.engine, timeout_seconds)
+
+    def read_parsed_batch(self, timeout_seconds: float) -> List[Dict[str, Any]]:
+        return self._read_native_parsed_batch(self.library.lib.capture_engine_read_batch, self.engine, timeout_seconds)
+
+    def read_frame_batch(self, timeout_seconds: float) -> int:
+        return self._read_native_frame_batch(self.library.lib.capture_engine_read_batch, self.engine, timeout_seconds)
+
+    def read_frame_count(self, timeout_seconds: float) -> int:
+        return self._read_native_count(self.library.lib.capture_engine_read_batch, self.engine, timeout_seconds)
+
+    def stats(self) -> Dict[str, Any]:
+        worker_stats = (CaptureWorkerStats * CAPTURE_MAX_SOURCES)()
+        count = self.library.lib.capture_engine_stats(self.engine, ctypes.byref(worker_stats), CAPTURE_MAX_SOURCES)
+        if count < 0:
+            raise RuntimeError(f"Capture engine statistics failed (errno {ctypes.get_errno()})")
+        workers = []
+        for index in range(count):
+            worker = worker_stats[index]
+            workers.append({
+                "worker": index,
+                "packets": worker.packets,
+                "queue_drops": worker.queue_drops,
+                "queue_depth": worker.queue_depth,
+                "queue_slots": worker.queue_slots,
+                "ring_errors": worker.ring_errors,
+                "last_error": errno.errorcode.get(worker.last_error, worker.last_error) if worker.last_error else None,
+                "state": CAPTURE_WORKER_STATES.get(worker.state, "unknown"),
+                **_kernel_stats(worker.ring),
+                "parse_errors": self.batch.parse_errors[index]
+            })
+        totals = {
+            key: sum(worker[key] for worker in workers)
+            for key in ("kernel_packets", "kernel_drops", "kernel_freeze_q_cnt", "queue_drops", "ring_errors", "parse_errors")
+        }
+        return {**totals, "workers": workers}
+
+    def close(self) -> None:
+        if self.engine:
+            self.library.lib.capture_engine_close(self.engine)
+            self.engine = None
+
+
+class XDPCapture(NativeQueueCapture):
+    """AF_XDP capture: one XSK socket per RX queue over a shared UMEM."""
+
+    # XSK descriptors carry no RX timestamp; frames are stamped at pickup
+    timestamp_source = "userspace"
+
+    def __init__(
+        self,
+        interface: str,
+        lib_path: Path,
+        xskmap_path: str,
+        queue_ids: List[int],
+        frames_per_queue: int,
+        bind_mode: str,
+        batch_size: int = 256
+    ):
+        if bind_mode not in XSK_BIND_MODES:
+            raise RuntimeError(f"Unsupported AF_XDP bind mode: {bind_mode}")
+        if not queue_ids:
+            raise RuntimeError("AF_XDP backend requires at least one RX queue")
+        # XSKMAP updates go through the pinned map; UMEM pages are charged to RLIMIT_MEMLOCK
+        _require_bpf_privileges("af_xdp", net_admin=False, net_raw=True)
+        _raise_memlock_limit()
+        umem_bytes = len(queue_ids) * frames_per_queue * XSK_CAPTURE_FRAME_SIZE
+        memlock, _ = resource.getrlimit(resource.RLIMIT_MEMLOCK)
+        if not _effective_capabilities() & (1 << CAP_IPC_LOCK) and memlock != resource.RLIM_INFINITY \
+                and memlock < umem_bytes:
+            raise RuntimeError(
+                f"The af_xdp backend needs CAP_IPC_LOCK or RLIMIT_MEMLOCK >= {umem_bytes} bytes for its UMEM "
+                f"(limit is {memlock}); rerun the DPI installer or run the probe from a privileged unit"
+            )
+        self.interface = interface
+        self.library = AFPacketCLibrary(lib_path)
+        self._queue_ids = (ctypes.c_uint32 * len(queue_ids))(*queue_ids)
+        config = XSKCaptureConfig(
+            interface=interface.encode('utf-8'),
+            xskmap_path=xskmap_path.encode('utf-8'),
+            queue_ids=ctypes.cast(self._queue_ids, ctypes.POINTER(ctypes.c_uint32)),
+            queue_count=len(queue_ids),
+            frames_per_queue=frames_per_queue,
+            bind_mode=XSK_BIND_MODES[bind_mode]
+        )
+        self.xsk = self.library.lib.xsk_capture_open(ctypes.byref(config))
+        if not self.xsk:
+            err = ctypes.get_errno()
+            raise RuntimeError(f"AF_XDP open failed for interface {interface} ({bind_mode}, errno {err})")
+        self._init_buffers(batch_size)
+
+    def read(self, timeout_seconds: float) -> Optional[Tuple[bytes, datetime, int]]:
+        return self._read_native(self.library.lib.xsk_capture_read, self.xsk, timeout_seconds)
+
+    def read_batch(self, timeout_seconds: float) -> List[Tuple[memoryview, datetime, int]]:
+        return self._read_native_batch(
+            self.library.lib.xsk_capture_read_batch, self.xsk, timeout_seconds, self.batch.snaplen
+        )
+
+    def read_parsed_batch(self, timeout_seconds: float) -> List[Dict[str, Any]]:
+        return self._read_native_parsed_batch(
+            self.library.lib.xsk_capture_read_batch, self.xsk, timeout_seconds, self.batch.snaplen
+        )
+
+    def read_frame_batch(self, timeout_seconds: float) -> int:
+        return self._read_native_frame_batch(
+            self.library.lib.xsk_capture_read_batch, self.xsk, timeout_seconds, self.batch.snaplen
+        )
+
+    def read_frame_count(self, timeout_seconds: float) -> int:
+        return self._read_native_count(
+            self.library.lib.xsk_capture_read_batch, self.xsk, timeout_seconds, self.batch.snaplen
+        )
+
+    def stats(self) -> Dict[str, Any]:
+        return {
+            "parse_errors": sum(self.batch.parse_errors),
+            "queues": [
+                {"queue": queue_id, "parse_errors": self.batch.parse_errors[queue_id]}
+                for queue_id in self._queue_ids if queue_id < CAPTURE_MAX_SOURCES
+            ]
+        }
+
+    def close(self) -> None:
+        if self.xsk:
+            self.library.lib.xsk_capture_close(self.xsk)
+            self.xsk = None
+
+
+class PcapReplayCapture(NativeQueueCapture):
+    """Native pcap/pcapng replay: the file is streamed from an mmap, paced in C."""
+
+    # Frames are stamped with their replay schedule, not a capture clock
+    timestamp_source = "replay"
+
+    def __init__(
+        self,
+        pcap_path: Path,
+        lib_path: Path,
+        pacing: str = "recorded",
+        rate: float = 0.0,
+        loops: int = 1,
+        batch_size: int = 256
+    ):
+        if pacing not in PCAP_PACING_MODES:
+            raise RuntimeError(f"Unsupported pcap pacing mode: {pacing}")
+        if pacing in ("pps", "gbps") and rate <= 0:
+            raise RuntimeError(f"Pcap pacing mode {pacing} requires a positive rate")
+        if loops < 0:
+            raise RuntimeError("Pcap loop count must be >= 0")
+        if not pcap_path.exists():
+            raise RuntimeError(f"Pcap file not found: {pcap_path}")
+        self.library = AFPacketCLibrary(lib_path)
+        config = PcapReplayConfig(
+            path=str(pcap_path).encode('utf-8'),
+            pacing=PCAP_PACING_MODES[pacing],
+            rate=int(rate * 1e9) if pacing == "gbps" else int(rate),
+            loops=loops
+        )
+        self.replay = self.library.lib.pcap_replay_open(ctypes.byref(config))
+        if not self.replay:
+            err = ctypes.get_errno()
+            raise RuntimeError(f"Pcap replay open failed for {pcap_path} (errno {err})")
+        self._init_buffers(batch_size)
+        self._pending: List[Tuple[memoryview, datetime, int]] = []
+
+    def read(self, timeout_seconds: float) -> Optional[Tuple[bytes, datetime, int]]:
+        if not self._pending:
+            self._pending = self.read_batch(timeout_seconds)[::-1]
+            if not self._pending:
+                return None
+        frame, timestamp, wirelen = self._pending.pop()
+        return bytes(frame), timestamp, wirelen
+
+    def read_batch(self, timeout_seconds: float) -> List[Tuple[memoryview, datetime, int]]:
+        return self._read_native_batch(
+            self.library.lib.pcap_replay_read_batch, self.replay, timeout_seconds, self.batch.snaplen
+        )
+
+    def read_parsed_batch(self, timeout_seconds: float) -> List[Dict[str, Any]]:
+        return self._read_native_parsed_batch(
+            self.library.lib.pcap_replay_read_batch, self.replay, timeout_seconds, self.batch.snaplen
+        )
+
+    def read_frame_batch(self, timeout_seconds: float) -> int:
+        return self._read_native_frame_batch(
+            self.library.lib.pcap_replay_read_batch, self.replay, timeout_seconds, self.batch.snaplen
+        )
+
+    def read_frame_count(self, timeout_seconds: float) -> int:
+        return self._read_native_count(
+            self.library.lib.pcap_replay_read_batch, self.replay, timeout_seconds, self.batch.snaplen
+        )
+
+    def stats(self) -> Dict[str, Any]:
+        stats = PcapReplayStats()
+        if self.library.lib.pcap_replay_stats(self.replay, ctypes.byref(stats)) != 0:
+            raise RuntimeError(f"Pcap replay statistics failed (errno {ctypes.get_errno()})")
+        return {
+            "replay_packets": stats.packets,
+            "replay_bytes": stats.bytes,
+            "replay_skipped": stats.skipped,
+            "replay_passes": stats.passes,
+            "replay_finished": bool(stats.finished),
+            "parse_errors": sum(self.batch.parse_errors)
+        }
+
+    def close(self) -> None:
+        if self.replay:
+            self.library.lib.pcap_replay_close(self.replay)
+            self.replay = None
+
+
+_UNIX_EPOCH = datetime(1970, 1, 1, tzinfo=timezone.utc)
+
+
+def _ns_to_datetime(ns: int) -> datetime:
+    # Exact to the microsecond (a float of epoch seconds is not), as flow_hash.c floors
+    return _UNIX_EPOCH + timedelta(microseconds=ns // 1000)
+
+
+def _decode_flow_table_record(record: Tuple) -> Dict[str, Any]:
+    (src_addr, dst_addr, src_port, dst_port, ip_version, protocol, end_reason, segment, packets_forward,
+     packets_reverse, bytes_forward, bytes_reverse, first_ns, last_ns, origin_ns) = record
+    if ip_version == 4:
+        src_ip = socket.inet_ntop(socket.AF_INET, src_addr[:4])
+        dst_ip = socket.inet_ntop(socket.AF_INET, dst_addr[:4])
+    else:
+        src_ip = socket.inet_ntop(socket.AF_INET6, src_addr)
+        dst_ip = socket.inet_ntop(socket.AF_INET6, dst_addr)
+    return {
+        "src_ip": src_ip,
+        "dst_ip": dst_ip,
+        "src_port": src_port,
+        "dst_port": dst_port,
+        "protocol": PROTOCOL_NAMES.get(protocol, 'other'),
+        "packet_count": packets_forward + packets_reverse,
+        "byte_count": bytes_forward + bytes_reverse,
+        # forward is src -> dst (initiator -> responder)
+        "directions": {
+            "forward": {"packets": packets_forward, "bytes": bytes_forward},
+            "reverse": {"packets": packets_reverse, "bytes": bytes_reverse}
+        },
+        "flow_start": _ns_to_datetime(first_ns),
+        "flow_end": _ns_to_datetime(last_ns),
+        "end_reason": FLOW_TABLE_END_REASONS.get(end_reason, "unknown"),
+        # Active timeouts split a long flow; segment 0 started at origin_start
+        "segment": segment,
+        "origin_start": _ns_to_datetime(origin_ns)
+    }
+
+
+class NativePrivacyRedactor:
+    """Native batch redaction of flow table records' endpoints, same output as PrivacyRedactor."""
+
+    def __init__(
+        self,
+        library: AFPacketCLibrary,
+        ip_redaction: str,
+        port_redaction: str,
+        ip_hash_key: bytes = b"",
+        cache_entries: int = 0
+    ):
+        if ip_redaction not in PRIVACY_REDACT_IP_MODES or port_redaction not in PRIVACY_REDACT_PORT_MODES:
+            raise RuntimeError(f"Unsupported redaction: ip {ip_redaction}, port {port_redaction}")
+        if len(ip_hash_key) > 64:
+            # As PrivacyRedactor (and HMAC) treat keys longer than a block
+            ip_hash_key = hashlib.sha256(ip_hash_key).digest()
+        self.library = library
+        self.hash_ips = ip_redaction == "hash"
+        config = PrivacyRedactConfig(
+            ip_mode=PRIVACY_REDACT_IP_MODES[ip_redaction],
+            port_mode=PRIVACY_REDACT_PORT_MODES[port_redaction],
+            cache_entries=cache_entries,
+            key_len=len(ip_hash_key),
+            cache_seed=int.from_bytes(os.urandom(8), "little")
+        )
+        ctypes.memmove(config.key, ip_hash_key, len(ip_hash_key))
+        self.redactor = library.lib.privacy_redact_open(ctypes.byref(config))
+        if not self.redactor:
+            raise RuntimeError(f"Privacy redactor open failed (errno {ctypes.get_errno()})")
+        self.redacted = (ctypes.c_ubyte * 0)()
+
+    def _address(self, addr: bytes, ip_version: int) -> str:
+        if self.hash_ips:
+            return addr[:PRIVACY_REDACT_TOKEN_SIZE].hex()
+        if ip_version == 4:
+            return socket.inet_ntop(socket.AF_INET, addr[:4])
+        return socket.inet_ntop(socket.AF_INET6, addr)
+
+    def redact_records(self, records: ctypes.Array, count: int, ip_versions: List[int]) -> List[Dict[str, Any]]:
+        """Redacted endpoints of the first count flow table records in records."""
+        if count * PRIVACY_REDACT_RECORD_SIZE > len(self.redacted):
+            self.redacted = (ctypes.c_ubyte * (count * PRIVACY_REDACT_RECORD_SIZE))()
+        if self.library.lib.privacy_redact_table_records(
+            self.redactor, ctypes.byref(records), count, ctypes.byref(self.redacted)
+        ) != 0:
+            raise RuntimeError(f"Privacy redaction failed (errno {ctypes.get_errno()})")
+        redacted = memoryview(self.redacted).cast('B')[:count * PRIVACY_REDACT_RECORD_SIZE]
+        return [
+            {
+                "src_ip": self._address(src_addr, ip_version),
+                "dst_ip": self._address(dst_addr, ip_version),
+                "src_port": src_port,
+                "dst_port": dst_port
+            }
+            for (src_addr, dst_addr, src_port, dst_port), ip_version in zip(
+                struct.iter_unpack(PRIVACY_REDACT_RECORD_FORMAT, redacted), ip_versions
+            )
+        ]
+
+    def stats(self) -> Dict[str, int]:
+        stats = PrivacyRedactStats()
+        if self.library.lib.privacy_redact_stats(self.redactor, ctypes.byref(stats)) != 0:
+            raise RuntimeError(f"Privacy redactor statistics failed (errno {ctypes.get_errno()})")
+        return {name: getattr(stats, name) for name, _ in PrivacyRedactStats._fields_}
+
+    def close(self) -> None:
+        if self.redactor:
+            self.library.lib.privacy_redact_close(self.redactor)
+            self.redactor = None
+
+
+class NativeFlowTable:
+    """Native flow table fed straight from a capture's FrameBatch; only completed flows reach Python."""
+
+    def __init__(
+        self,
+        library: AFPacketCLibrary,
+        max_flows: int,
+        flow_timeout: int,
+        idle_timeout: int,
+        batch_size: int,
+        memory_budget: int = 0,
+        overload_policy: str = "aggregate",
+        redactor: Optional[NativePrivacyRedactor] = None
+    ):
+        if max_flows < 0 or memory_budget < 0 or (max_flows == 0 and memory_budget == 0):
+            raise RuntimeError("Flow table needs a positive size or memory budget")
+        if overload_policy not in FLOW_TABLE_OVERLOAD_POLICIES:
+            raise RuntimeError(f"Unsupported flow table overload policy: {overload_policy}")
+        self.library = library
+        self.redactor = redactor
+        config = FlowTableConfig(
+            max_flows=max_flows,
+            overload_policy=FLOW_TABLE_OVERLOAD_POLICIES[overload_policy],
+            active_timeout_ns=flow_timeout * 1_000_000_000,
+            idle_timeout_ns=idle_timeout * 1_000_000_000,
+            # Keyed so crafted 5-tuples cannot target one probe sequence
+            hash_seed=int.from_bytes(os.urandom(8), "little"),
+            memory_budget=memory_budget
+        )
+        self.table = library.lib.flow_table_open(ctypes.byref(config))
+        if not self.table:
+            raise RuntimeError(
+                f"Flow table open failed for {max_flows} flows in {memory_budget} bytes (errno {ctypes.get_errno()})"
+            )
+        self.capacity = batch_size * FLOW_TABLE_RECORDS_PER_PACKET
+        self.records = (ctypes.c_ubyte * (self.capacity * FLOW_TABLE_RECORD_SIZE))()
+        self.digests = (ctypes.c_ubyte * (self.capacity * FLOW_HASH_DIGEST_SIZE))()
+        self._accounted = ctypes.c_uint32(0)
+        self._last_packet_at: Optional[float] = None
+        self._quiet_clock_ns: Optional[int] = None
+
+    def _decode(self, count: int) -> List[Dict[str, Any]]:
+        if count == 0:
+            return []
+        # flow_id and immutable_hash of the whole batch in C, same encoding as FlowAssembler
+        if self.library.lib.flow_hash_table_records(ctypes.byref(self.records), count, ctypes.byref(self.digests)) != 0:
+            raise RuntimeError(f"Flow record hashing failed (errno {ctypes.get_errno()})")
+        records = memoryview(self.records).cast('B')[:count * FLOW_TABLE_RECORD_SIZE]
+        digests = memoryview(self.digests).cast('B')[:count * FLOW_HASH_DIGEST_SIZE]
+        flows = []
+        ip_versions = []
+        for record, (flow_id, origin_flow_id, immutable_hash) in zip(
+            struct.iter_unpack(FLOW_TABLE_RECORD_FORMAT, records),
+            struct.iter_unpack(FLOW_HASH_DIGEST_FORMAT, digests)
+        ):
+            flow = _decode_flow_table_record(record)
+            flow["flow_id"] = flow_id.hex()
+            flow["origin_flow_id"] = origin_flow_id.hex()
+            flow["immutable_hash"] = immutable_hash.hex()
+            flows.append(flow)
+            ip_versions.append(record[4])
+        if self.redactor is not None:
+            # Endpoints as the privacy policy will emit them, redacted for the whole batch in C
+            redacted = self.redactor.redact_records(self.records, count, ip_versions)
+            for flow, endpoints in zip(flows, redacted):
+                flow["redacted_endpoints"] = endpoints
+        return flows
+
+    def update(self, batch: FrameBatch, count: int) -> Tuple[List[Dict[str, Any]], int]:
+        """Account the last count parsed frames of batch; returns (completed flows, IP packets)."""
+        if count <= 0:
+            return [], 0
+        written = self.library.lib.flow_table_update_batch(
+            self.table,
+            ctypes.byref(batch.descs),
+            ctypes.byref(batch.packets),
+            count,
+            ctypes.byref(self.records),
+            self.capacity,
+            ctypes.byref(self._accounted)
+        )
+        if written < 0:
+            raise RuntimeError(f"Flow table update failed (errno {ctypes.get_errno()})")
+        if self._accounted.value:
+            self._last_packet_at = time.monotonic()
+            self._quiet_clock_ns = None
+        return self._decode(written), self._accounted.value
+
+    def expire(self) -> List[Dict[str, Any]]:
+        """Collect flows whose idle, active or FIN linger deadline has passed in packet time."""
+        now_ns = 0
+        if self._last_packet_at is not None:
+            # A quiet link stops packet time; carry it forward by the wall time since the last packet
+            quiet = time.monotonic() - self._last_packet_at
+            if quiet >= FLOW_TABLE_QUIET_SECONDS:
+                if self._quiet_clock_ns is None:
+                    self._quiet_clock_ns = self.stats()["clock_ns"]
+                now_ns = self._quiet_clock_ns + int(quiet * 1_000_000_000)
+        flows = []
+        while True:
+            written = self.library.lib.flow_table_expire(self.table, now_ns, ctypes.byref(self.records), self.capacity)
+            if written < 0:
+                raise RuntimeError(f"Flow table expiry failed (errno {ctypes.get_errno()})")
+            flows.extend(self._decode(written))
+            if written < self.capacity:
+                return flows
+
+    def stats(self) -> Dict[str, int]:
+        stats = FlowTableStats()
+        if self.library.lib.flow_table_stats(self.table, ctypes.byref(stats)) != 0:
+            raise RuntimeError(f"Flow table statistics failed (errno {ctypes.get_errno()})")
+        table_stats = {name: getattr(stats, name) for name, _ in FlowTableStats._fields_}
+        if self.redactor is not None:
+            table_stats.update({f"redaction_{name}": value for name, value in self.redactor.stats().items()})
+        return table_stats
+
+    def close(self) -> None:
+        if self.table:
+            self.library.lib.flow_table_close(self.table)
+            self.table = None
+
+
+def _decode_flow_record(record: Tuple) -> Dict[str, Any]:
+    (src_addr, dst_addr, src_port, dst_port, protocol, packets_forward, packets_reverse, bytes_forward,
+     bytes_reverse, first_seen, last_seen, l7_protocol, _flags) = record[:13]
+    size_hist = record[13:13 + FLOW_HIST_BUCKETS]
+    iat_hist = record[13 + FLOW_HIST_BUCKETS:13 + 2 * FLOW_HIST_BUCKETS]
+    tcp_flags = record[13 + 2 * FLOW_HIST_BUCKETS:13 + 3 * FLOW_HIST_BUCKETS]
+    end_reason = record[13 + 3 * FLOW_HIST_BUCKETS]
+    return {
+        "src_ip": socket.inet_ntop(socket.AF_INET, src_addr),
+        "dst_ip": socket.inet_ntop(socket.AF_INET, dst_addr),
+        "src_port": int.from_bytes(src_port, "big"),
+        "dst_port": int.from_bytes(dst_port, "big"),
+        "protocol": PROTOCOL_NAMES.get(protocol, 'other'),
+        "packet_count": packets_forward + packets_reverse,
+        "byte_count": bytes_forward + bytes_reverse,
+        # forward is src -> dst (initiator -> responder)
+        "directions": {
+            "forward": {"packets": packets_forward, "bytes": bytes_forward},
+            "reverse": {"packets": packets_reverse, "bytes": bytes_reverse}
+        },
+        # log2 buckets, both directions (see FLOW_SIZE_HIST_SHIFT / FLOW_IAT_HIST_* in ebpf_flow_tracker.h)
+        "shape": {
+            "packet_size_histogram": list(size_hist),
+            "inter_arrival_histogram": list(iat_hist),
+            "tcp_flag_counts": dict(zip(FLOW_TCP_FLAG_NAMES, tcp_flags))
+        },
+        "flow_start": _ns_to_datetime(first_seen),
+        "flow_end": _ns_to_datetime(last_seen),
+        "l7_protocol": L7_PROTOCOL_NAMES.get(l7_protocol, ""),
+        "end_reason": FLOW_END_REASONS.get(end_reason, "unknown")
+    }
+
+
+def _effective_capabilities() -> int:
+    """CapEff bitmask of this process."""
+    with open("/proc/self/status") as status:
+        for line in status:
+            if line.startswith("CapEff:"):
+                return int(line.split()[1], 16)
+    return 0
+
+
+def _require_bpf_privileges(backend: str, net_admin: bool, net_raw: bool = False) -> None:
+    """Fail fast, naming what is missing, instead of on a bare bpf(2) EPERM."""
+    capabilities = _effective_capabilities()
+    missing = []
+    if net_raw and not capabilities & (1 << CAP_NET_RAW):
+        missing.append("CAP_NET_RAW")
+    if not capabilities & (1 << CAP_BPF | 1 << CAP_SYS_ADMIN):
+        missing.append("CAP_BPF (CAP_SYS_ADMIN before Linux 5.8)")
+    if net_admin and not capabilities & (1 << CAP_NET_ADMIN):
+        missing.append("CAP_NET_ADMIN")
+    if missing:
+        raise RuntimeError(
+            f"The {backend} backend needs {', '.join(missing)}; rerun the DPI installer to grant them "
+            "or run the probe from a privileged unit"
+        )
+
+
+def _raise_memlock_limit() -> None:
+    """Lift RLIMIT_MEMLOCK as far as allowed (LimitMEMLOCK=infinity); pre-5.11 kernels charge BPF maps to it."""
+    soft, hard = resource.getrlimit(resource.RLIMIT_MEMLOCK)
+    try:
+        resource.setrlimit(resource.RLIMIT_MEMLOCK, (resource.RLIM_INFINITY, resource.RLIM_INFINITY))
+    except (ValueError, OSError):
+        # Without CAP_SYS_RESOURCE only the soft limit can move, up to the hard one
+        if soft != hard:
+            resource.setrlimit(resource.RLIMIT_MEMLOCK, (hard, hard))
+
+
+class EbpfFlowCapture:
+    """eBPF flow tracker export: flows are counted in the kernel and read here once, when they end."""
+
+    # first_seen/last_seen come from bpf_ktime_get_ns() in the XDP/TC programs
+    timestamp_source = "kernel"
+
+    def __init__(
+        self,
+        lib_path: Path,
+        pin_dir: str,
+        idle_timeout: int,
+        batch_size: int = 256,
+        object_path: str = "",
+        loader_lib_path: Optional[Path] = None,
+        interface: str = "",
+        attach_mode: str = "xdp",
+        max_flows: int = 0,
+        top_k: int = 10
+    ):
+        if idle_timeout <= 0:
+            raise RuntimeError("eBPF flow idle timeout must be > 0")
+        if top_k < 0:
+            raise RuntimeError("eBPF sketch top-K must be >= 0")
+        if attach_mode not in EBPF_ATTACH_MODES:
+            raise RuntimeError(f"Unsupported eBPF attach mode: {attach_mode}")
+        # Loading attaches the tracker to the interface; opening only needs the pinned maps
+        _require_bpf_privileges("ebpf", net_admin=bool(object_path))
+        _raise_memlock_limit()
+        self.library = AFPacketCLibrary(lib_path)
+        self.export = None
+        # Without an object path the tracker is loaded and pinned by something else
+        self.loader_library = None
+        self.loader = None
+        if object_path:
+            self.loader_library = FlowLoaderLibrary(loader_lib_path)
+            loader_config = FlowLoaderConfig(
+                # NULL selects the tracker compiled into the loader library
+                object_path=None if object_path == EBPF_OBJECT_EMBEDDED else object_path.encode('utf-8'),
+                pin_dir=pin_dir.encode('utf-8'),
+                interface=interface.encode('utf-8'),
+                attach_mode=EBPF_ATTACH_MODES[attach_mode],
+                flow_map_max_entries=max_flows
+            )
+            self.loader = self.loader_library.lib.flow_loader_open(ctypes.byref(loader_config))
+            if not self.loader:
+                err = ctypes.get_errno()
+                raise RuntimeError(
+                    f"eBPF flow tracker load failed for {object_path} on {interface} ({attach_mode}, errno {err})"
+                )
+        config = FlowExportConfig(
+            pin_dir=pin_dir.encode('utf-8'),
+            idle_timeout_ns=idle_timeout * 1000000000,
+            sweep_interval_ns=0
+        )
+        self.export = self.library.lib.flow_export_open(ctypes.byref(config))
+        if not self.export:
+            err = ctypes.get_errno()
+            self.close()
+            raise RuntimeError(f"eBPF flow export open failed for {pin_dir} (errno {err})")
+        self.batch_size = batch_size
+        self._records = (ctypes.c_ubyte * (batch_size * FLOW_RECORD_SIZE))()
+        self.top_k = top_k
+        self._talkers = (FlowSketchEntry * max(top_k, 1))()
+        self._fanout = (FlowSketchEntry * max(top_k, 1))()
+
+    def read_flows(self, timeout_seconds: float) -> List[Dict[str, Any]]:
+        count = self.library.lib.flow_export_read(
+            self.export, int(timeout_seconds * 1000), ctypes.byref(self._records), self.batch_size
+        )
+        if count < 0:
+            raise RuntimeError(f"eBPF flow export read failed (errno {ctypes.get_errno()})")
+        records = memoryview(self._records).cast('B')[:count * FLOW_RECORD_SIZE]
+        return [_decode_flow_record(record) for record in struct.iter_unpack(FLOW_RECORD_FORMAT, records)]
+
+    def drain_flows(self) -> List[Dict[str, Any]]:
+        """Detach a tracker this capture loaded and return every flow it still held."""
+        if not self.loader:
+            return []
+        self.loader_library.lib.flow_loader_close(self.loader)
+        self.loader = None
+        if self.library.lib.flow_export_drain(self.export) < 0:
+            raise RuntimeError(f"eBPF flow export drain failed (errno {ctypes.get_errno()})")
+        flows = []
+        batch = self.read_flows(timeout_seconds=0)
+        while batch:
+            flows.extend(batch)
+            batch = self.read_flows(timeout_seconds=0)
+        return flows
+
+    def sketch_report(self) -> Optional[Dict[str, Any]]:
+        """Top sources by bytes and by distinct destinations since the previous report; None without sketches."""
+        if self.top_k == 0:
+            return None
+        talker_count = ctypes.c_uint32(self.top_k)
+        fanout_count = ctypes.c_uint32(self.top_k)
+        if self.library.lib.flow_export_sketches(
+            self.export, self._talkers, ctypes.byref(talker_count), self._fanout, ctypes.byref(fanout_count)
+        ) != 0:
+            err = ctypes.get_errno()
+            if err == errno.ENOENT:
+                return None
+            raise RuntimeError(f"eBPF sketch read failed (errno {err})")
+        return {
+            "top_talkers": [
+                {"src_ip": socket.inet_ntoa(struct.pack("=I", entry.src_ip)), "bytes": entry.value}
+                for entry in self._talkers[:talker_count.value]
+            ],
+            "top_fanout": [
+                {"src_ip": socket.inet_ntoa(struct.pack("=I", entry.src_ip)), "destinations": entry.value}
+                for entry in self._fanout[:fanout_count.value]
+            ]
+        }
+
+    def stats(self) -> Dict[str, Any]:
+        stats = FlowExportStats()
+        if self.library.lib.flow_export_stats(self.export, ctypes.byref(stats)) != 0:
+            raise RuntimeError(f"eBPF flow export statistics failed (errno {ctypes.get_errno()})")
+        return {name: getattr(stats, name) for name, _ in FlowExportStats._fields_}
+
+    def close(self) -> None:
+        if self.loader:
+            self.loader_library.lib.flow_loader_close(self.loader)
+            self.loader = None
+        if self.export:
+            self.library.lib.flow_export_close(self.export)
+            self.export = None
+
+
+def _parse_id_list(value: str) -> List[int]:
+    cpus = []
+    for part in value.split(','):
+        part = part.strip()
+        if not part:
+            continue
+        if '-' in part:
+            start, end = part.split('-', 1)
+            cpus.extend(range(int(start), int(end) + 1))
+        else:
+            cpus.append(int(part))
+    return cpus
+
+
+def _parse_port_ranges(value: str) -> List[Tuple[int, int]]:
+    ranges = []
+    for part in value.split(','):
+        part = part.strip()
+        if not part:
+            continue
+        if '-' in part:
+            first, last = (int(p) for p in part.split('-', 1))
+        else:
+            first = last = int(part)
+        if not 0 <= first <= last <= 65535:
+            raise RuntimeError(f"Invalid port range: {part}")
+        ranges.append((first, last))
+    return ranges
+
+
+def _parse_cidr_list(value: str) -> List[ipaddress.IPv4Network]:
+    networks = []
+    for part in value.split(','):
+        part = part.strip()
+        if part:
+            try:
+                networks.append(ipaddress.IPv4Network(part, strict=False))
+            except ValueError as exc:
+                raise RuntimeError(f"Invalid IPv4 CIDR: {part}") from exc
+    return networks
+
+
+def _build_capture_filter(
+    protocols: str,
+    include_cidrs: str,
+    exclude_cidrs: str,
+    ports: str,
+    snaplen: int
+) -> Optional[CaptureFilterSpec]:
+    """Translate filter configuration into a capture_filter_spec; None when nothing is filtered."""
+    spec = CaptureFilterSpec()
+    for name in (p.strip().lower() for p in protocols.split(',')):
+        if not name:
+            continue
+        if name not in CAPTURE_FILTER_PROTOCOLS:
+            raise RuntimeError(f"Unsupported capture filter protocol: {name}")
+        spec.protocols |= CAPTURE_FILTER_PROTOCOLS[name]
+
+    for field, count_field, networks in (
+        ("include", "include_count", _parse_cidr_list(include_cidrs)),
+        ("exclude", "exclude_count", _parse_cidr_list(exclude_cidrs)),
+    ):
+        if len(networks) > CAPTURE_FILTER_MAX_CIDRS:
+            raise RuntimeError(f"Capture filter {field} list exceeds {CAPTURE_FILTER_MAX_CIDRS} CIDRs")
+        for index, network in enumerate(networks):
+            getattr(spec, field)[index] = CaptureFilterCidr(int(network.network_address), network.prefixlen)
+        setattr(spec, count_field, len(networks))
+
+    port_ranges = _parse_port_ranges(ports)
+    if len(port_ranges) > CAPTURE_FILTER_MAX_PORT_RANGES:
+        raise RuntimeError(f"Capture filter port list exceeds {CAPTURE_FILTER_MAX_PORT_RANGES} ranges")
+    for index, (first, last) in enumerate(port_ranges):
+        spec.ports[index] = CaptureFilterPortRange(first, last)
+    spec.port_range_count = len(port_ranges)
+
+    spec.snaplen = snaplen
+    if not (spec.protocols or spec.include_count or spec.exclude_count or spec.port_range_count or spec.snaplen):
+        return None
+    return spec
+
+
 class ReplayCapture:
+    timestamp_source = "recorded"
+
     def __init__(self, replay_path: Path):
         if not replay_path.exists():
             raise RuntimeError(f"Replay file not found: {replay_path}")
@@ -317,7 +1858,7 @@ def _parse_frame(frame: bytes, timestamp: datetime) -> Optional[Dict[str, Any]]:
     dst_port = 0
     if protocol in (6, 17) and len(frame) >= payload_offset + 4:
         src_port, dst_port = struct.unpack("!HH", frame[payload_offset:payload_offset + 4])
-    protocol_name = {6: 'tcp', 17: 'udp'}.get(protocol, 'other')
+    protocol_name = PROTOCOL_NAMES.get(protocol, 'other')
 
     return {
         "src_ip": src_ip,
@@ -345,8 +1886,31 @@ def _send_event(ingest_url: str, envelope: Dict[str, Any], auth_manager: Service
         raise RuntimeError(f"Telemetry transmission failed: {exc}") from exc
 
 
-def _build_flow_payload(flow: Dict[str, Any], capture_meta: Dict[str, Any]) -> Dict[str, Any]:
-    return {
+def _complete_native_flow(flow_assembler: FlowAssembler, native_flow: Dict[str, Any]) -> Dict[str, Any]:
+    """Flow record of a flow assembled natively (kernel tracker or flow table)."""
+    return flow_assembler.complete_flow(
+        src_ip=native_flow["src_ip"],
+        dst_ip=native_flow["dst_ip"],
+        src_port=native_flow["src_port"],
+        dst_port=native_flow["dst_port"],
+        protocol=native_flow["protocol"],
+        packet_count=native_flow["packet_count"],
+        byte_count=native_flow["byte_count"],
+        flow_start=native_flow["flow_start"],
+        flow_end=native_flow["flow_end"],
+        l7_protocol=native_flow.get("l7_protocol", ""),
+        flow_id=native_flow.get("flow_id"),
+        immutable_hash=native_flow.get("immutable_hash")
+    )
+
+
+def _build_flow_payload(
+    flow: Dict[str, Any],
+    capture_meta: Dict[str, Any],
+    directions: Optional[Dict[str, Any]] = None,
+    continuation: Optional[Dict[str, Any]] = None
+) -> Dict[str, Any]:
+    payload = {
         "event_type": "dpi.flow",
         "capture": capture_meta,
         "flow": {
@@ -356,6 +1920,7 @@ def _build_flow_payload(flow: Dict[str, Any], capture_meta: Dict[str, Any]) -> D
             "src_port": flow.get("src_port"),
             "dst_port": flow.get("dst_port"),
             "protocol": flow.get("protocol"),
+            "l7_protocol": flow.get("l7_protocol", ""),
             "packet_count": flow.get("packet_count"),
             "byte_count": flow.get("byte_count"),
             "flow_start": flow.get("flow_start"),
@@ -364,14 +1929,37 @@ def _build_flow_payload(flow: Dict[str, Any], capture_meta: Dict[str, Any]) -> D
             "immutable_hash": flow.get("immutable_hash")
         }
     }
-
-
-def _build_heartbeat_payload(capture_meta: Dict[str, Any], counters: Dict[str, int]) -> Dict[str, Any]:
-    return {
+    # Per-direction counters are only known for flows assembled natively (kernel tracker or flow table)
+    if directions:
+        payload["flow"]["directions"] = directions
+    # Segments of a flow split by the native flow table's active timeout
+    if continuation:
+        payload["flow"]["continuation"] = continuation
+    return payload
+
+
+def _build_heartbeat_payload(
+    capture_meta: Dict[str, Any],
+    counters: Dict[str, int],
+    capture_stats: Optional[Dict[str, Any]] = None,
+    sketches: Optional[Dict[str, Any]] = None,
+    flow_table: Optional[Dict[str, int]] = None
+) -> Dict[str, Any]:
+    payload = {
         "event_type": "dpi.heartbeat",
         "capture": capture_meta,
         "counters": counters
     }
+    if capture_stats is not None:
+        # Kernel loss, ring occupancy and parse errors from the native capture layer
+        payload["capture_stats"] = capture_stats
+    if sketches is not None:
+        # Heaviest and widest-reaching sources of the interval, from the kernel tracker's sketches
+        payload["sketches"] = sketches
+    if flow_table is not None:
+        # Occupancy, evictions and aggregate-only traffic of the native flow table
+        payload["flow_table"] = flow_table
+    return payload
 
 
 def run_dpi_probe(config: Dict[str, Any]) -> None:
@@ -383,11 +1971,15 @@ def run_dpi_probe(config: Dict[str, Any]) -> None:
     heartbeat_seconds = int(config["RANSOMEYE_DPI_HEARTBEAT_SECONDS"])
     replay_path = config.get("RANSOMEYE_DPI_REPLAY_PATH")
 
-    if capture_backend == "replay":
+    pcap_path = config.get("RANSOMEYE_DPI_PCAP_PATH")
+
+    if capture_backend in ("replay", "pcap"):
         if os.getenv("CI") != "true" or os.getenv("RANSOMEYE_ENV") != "ci":
             raise RuntimeError("Replay backend is only allowed in CI with RANSOMEYE_ENV=ci")
-        if not replay_path:
+        if capture_backend == "replay" and not replay_path:
             raise RuntimeError("Replay backend requires RANSOMEYE_DPI_REPLAY_PATH")
+        if capture_backend == "pcap" and not pcap_path:
+            raise RuntimeError("Pcap backend requires RANSOMEYE_DPI_PCAP_PATH")
 
     machine_id = _get_machine_id()
     boot_id = _get_boot_id()
@@ -409,45 +2001,240 @@ def run_dpi_probe(config: Dict[str, Any]) -> None:
     except ServiceAuthError as exc:
         raise RuntimeError(f"Service auth initialization failed: {exc}") from exc
 
-    if capture_backend == "af_packet_c":
+    if capture_backend in ("af_packet_c", "af_xdp", "pcap", "ebpf"):
         if sys.platform != "linux":
-            raise RuntimeError("AF_PACKET capture requires Linux kernel")
+            raise RuntimeError("AF_PACKET/AF_XDP capture requires Linux kernel")
         lib_path = Path(os.getenv(
             "RANSOMEYE_DPI_FASTPATH_LIB",
             os.path.join(os.getenv("RANSOMEYE_INSTALL_ROOT", "/opt/ransomeye"), "lib", "libransomeye_dpi_af_packet.so")
         ))
-        capture = AFPacketCapture(interface=interface, lib_path=lib_path)
+        batch_size = int(config.get("RANSOMEYE_DPI_BATCH_SIZE", "256"))
+        timestamp_source = config.get("RANSOMEYE_DPI_TIMESTAMP_SOURCE", "software")
+        capture_filter = _build_capture_filter(
+            protocols=config.get("RANSOMEYE_DPI_FILTER_PROTOCOLS", ""),
+            include_cidrs=config.get("RANSOMEYE_DPI_FILTER_INCLUDE_CIDRS", ""),
+            exclude_cidrs=config.get("RANSOMEYE_DPI_FILTER_EXCLUDE_CIDRS", ""),
+            ports=config.get("RANSOMEYE_DPI_FILTER_PORTS", ""),
+            snaplen=int(config.get("RANSOMEYE_DPI_SNAPLEN", "0"))
+        )
+
+    if capture_backend == "af_xdp":
+        if capture_filter is not None:
+            raise RuntimeError("Capture filter and snaplen are not supported by the af_xdp backend")
+        capture = XDPCapture(
+            interface=interface,
+            lib_path=lib_path,
+            xskmap_path=config.get("RANSOMEYE_DPI_XSKMAP_PATH", "/sys/fs/bpf/ransomeye/xsks_map"),
+            queue_ids=_parse_id_list(config.get("RANSOMEYE_DPI_XDP_QUEUES", "0")),
+            frames_per_queue=int(config.get("RANSOMEYE_DPI_XDP_FRAMES_PER_QUEUE", "4096")),
+            bind_mode=config.get("RANSOMEYE_DPI_XDP_BIND_MODE", "copy"),
+            batch_size=batch_size
+        )
+    elif capture_backend == "af_packet_c":
+        af_packet_mode = config.get("RANSOMEYE_DPI_AF_PACKET_MODE", "tpacket_v3")
+        fanout_workers = int(config.get("RANSOMEYE_DPI_FANOUT_WORKERS", "0"))
+        if fanout_workers > 0:
+            if af_packet_mode != "tpacket_v3":
+                raise RuntimeError("PACKET_FANOUT workers require RANSOMEYE_DPI_AF_PACKET_MODE=tpacket_v3")
+            capture = FanoutCapture(
+                interface=interface,
+                lib_path=lib_path,
+                workers=fanout_workers,
+                fanout_mode=config.get("RANSOMEYE_DPI_FANOUT_MODE", "hash"),
+                worker_cpus=_parse_id_list(config.get("RANSOMEYE_DPI_FANOUT_CPUS", "")),
+                queue_slots=int(config.get("RANSOMEYE_DPI_FANOUT_QUEUE_SLOTS", "4096")),
+                block_size=int(config.get("RANSOMEYE_DPI_RING_BLOCK_SIZE", "1048576")),
+                block_count=int(config.get("RANSOMEYE_DPI_RING_BLOCK_COUNT", "64")),
+                retire_timeout_ms=int(config.get("RANSOMEYE_DPI_RING_RETIRE_TIMEOUT_MS", "50")),
+                batch_size=batch_size,
+                timestamp_source=timestamp_source,
+                capture_filter=capture_filter
+            )
+        elif af_packet_mode == "tpacket_v3":
+            capture = AFPacketRingCapture(
+                interface=interface,
+                lib_path=lib_path,
+                block_size=int(config.get("RANSOMEYE_DPI_RING_BLOCK_SIZE", "1048576")),
+                block_count=int(config.get("RANSOMEYE_DPI_RING_BLOCK_COUNT", "64")),
+                retire_timeout_ms=int(config.get("RANSOMEYE_DPI_RING_RETIRE_TIMEOUT_MS", "50")),
+                batch_size=batch_size,
+                timestamp_source=timestamp_source,
+                capture_filter=capture_filter
+            )
+        elif af_packet_mode == "recvfrom":
+            capture = AFPacketCapture(
+                interface=interface,
+                lib_path=lib_path,
+                timestamp_source=timestamp_source,
+                capture_filter=capture_filter
+            )
+        else:
+            raise RuntimeError(f"Unsupported AF_PACKET mode: {af_packet_mode}")
     elif capture_backend == "replay":
         capture = ReplayCapture(Path(replay_path))
+    elif capture_backend == "ebpf":
+        if capture_filter is not None:
+            raise RuntimeError("Capture filter and snaplen are not supported by the ebpf backend")
+        capture = EbpfFlowCapture(
+            lib_path=lib_path,
+            pin_dir=config.get("RANSOMEYE_DPI_EBPF_PIN_DIR", "/sys/fs/bpf/ransomeye"),
+            idle_timeout=int(config.get("RANSOMEYE_DPI_EBPF_IDLE_TIMEOUT", "30")),
+            batch_size=batch_size,
+            object_path=config.get("RANSOMEYE_DPI_EBPF_OBJECT", ""),
+            loader_lib_path=Path(os.getenv(
+                "RANSOMEYE_DPI_EBPF_LOADER_LIB",
+                os.path.join(os.getenv("RANSOMEYE_INSTALL_ROOT", "/opt/ransomeye"), "lib", "libransomeye_dpi_ebpf_loader.so")
+            )),
+            interface=interface,
+            attach_mode=config.get("RANSOMEYE_DPI_EBPF_ATTACH", "xdp"),
+            max_flows=int(config.get("RANSOMEYE_DPI_EBPF_MAX_FLOWS", "0")),
+            top_k=int(config.get("RANSOMEYE_DPI_EBPF_TOP_K", "10"))
+        )
+    elif capture_backend == "pcap":
+        if capture_filter is not None:
+            raise RuntimeError("Capture filter and snaplen are not supported by the pcap backend")
+        capture = PcapReplayCapture(
+            pcap_path=Path(pcap_path),
+            lib_path=lib_path,
+            pacing=config.get("RANSOMEYE_DPI_PCAP_PACING", "recorded"),
+            rate=float(config.get("RANSOMEYE_DPI_PCAP_RATE", "0")),
+            loops=int(config.get("RANSOMEYE_DPI_PCAP_LOOPS", "1")),
+            batch_size=batch_size
+        )
     else:
         raise RuntimeError(f"Unsupported capture backend: {capture_backend}")
 
-    flow_assembler = FlowAssembler(flow_timeout=flow_timeout)
-    behavior_model = BehaviorModel()
+    ip_hash_key = b""
+    ip_hash_key_path = config.get("RANSOMEYE_DPI_IP_HASH_KEY_PATH", "")
+    if ip_hash_key_path:
+        ip_hash_key = Path(ip_hash_key_path).read_bytes()
+        if not ip_hash_key:
+            raise RuntimeError(f"IP hash key file is empty: {ip_hash_key_path}")
+    redaction_cache = int(config.get("RANSOMEYE_DPI_REDACTION_CACHE", "65536"))
     privacy_redactor = PrivacyRedactor({
         "privacy_mode": config["RANSOMEYE_DPI_PRIVACY_MODE"],
         "ip_redaction": config["RANSOMEYE_DPI_IP_REDACTION"],
         "port_redaction": config["RANSOMEYE_DPI_PORT_REDACTION"],
-        "dns_redaction": "none"
+        "dns_redaction": "none",
+        "ip_hash_key": ip_hash_key,
+        "ip_cache_size": redaction_cache
     })
 
+    flow_assembler = FlowAssembler(flow_timeout=flow_timeout)
+    # Native captures hand parsed descriptors straight to the C flow table; FlowAssembler
+    # keeps the flow_id / hash derivation and the fallback path for the Python readers
+    flow_table = None
+    native_redactor = None
+    if hasattr(capture, "read_frame_batch"):
+        if config["RANSOMEYE_DPI_IP_REDACTION"] != "none" or config["RANSOMEYE_DPI_PORT_REDACTION"] != "none":
+            native_redactor = NativePrivacyRedactor(
+                library=capture.library,
+                ip_redaction=config["RANSOMEYE_DPI_IP_REDACTION"],
+                port_redaction=config["RANSOMEYE_DPI_PORT_REDACTION"],
+                ip_hash_key=ip_hash_key,
+                cache_entries=redaction_cache
+            )
+        flow_table = NativeFlowTable(
+            library=capture.library,
+            max_flows=int(config.get("RANSOMEYE_DPI_FLOW_TABLE_MAX_FLOWS", "262144")),
+            flow_timeout=flow_timeout,
+            idle_timeout=int(config.get("RANSOMEYE_DPI_FLOW_IDLE_TIMEOUT", "30")),
+            batch_size=batch_size,
+            memory_budget=int(config.get("RANSOMEYE_DPI_FLOW_TABLE_MEMORY_MB", "0")) * 1024 * 1024,
+            overload_policy=config.get("RANSOMEYE_DPI_FLOW_TABLE_OVERLOAD", "aggregate"),
+            redactor=native_redactor
+        )
+    behavior_model = BehaviorModel()
+
     capture_meta = {
         "backend": capture_backend,
-        "interface": interface
+        "interface": interface,
+        "timestamp_source": getattr(capture, "timestamp_source", "userspace")
     }
+    if capture_backend == "af_packet_c":
+        capture_meta["af_packet_mode"] = af_packet_mode
+        if fanout_workers > 0:
+            capture_meta["fanout_workers"] = fanout_workers
+            capture_meta["fanout_mode"] = config.get("RANSOMEYE_DPI_FANOUT_MODE", "hash")
+    elif capture_backend == "pcap":
+        capture_meta["pcap_pacing"] = config.get("RANSOMEYE_DPI_PCAP_PACING", "recorded")
+    elif capture_backend == "af_xdp":
+        capture_meta["xdp_bind_mode"] = config.get("RANSOMEYE_DPI_XDP_BIND_MODE", "copy")
+    if flow_table is not None:
+        capture_meta["flow_table_overload"] = config.get("RANSOMEYE_DPI_FLOW_TABLE_OVERLOAD", "aggregate")
     counters = {"packets_seen": 0, "flows_emitted": 0, "heartbeats_sent": 0}
     last_heartbeat = time.time()
 
+    def emit_flow(
+        completed_flow: Dict[str, Any],
+        observed_at: datetime,
+        directions: Optional[Dict[str, Any]] = None,
+        continuation: Optional[Dict[str, Any]] = None,
+        redacted_endpoints: Optional[Dict[str, Any]] = None
+    ) -> None:
+        behavior = behavior_model.analyze_flow(completed_flow)
+        completed_flow["behavioral_profile_id"] = behavior.get("profile_id", "")
+        redacted_flow = privacy_redactor.redact_flow(completed_flow, redacted_endpoints)
+        payload = _build_flow_payload(redacted_flow, capture_meta, directions, continuation)
+        envelope = envelope_builder.build(payload, observed_at=observed_at)
+        signed = signer.sign_envelope(envelope)
+        _send_event(ingest_url, signed, auth_manager)
+        envelope_builder.update_prev_hash(signed["integrity"]["hash_sha256"])
+        counters["flows_emitted"] += 1
+
+    def emit_kernel_flow(kernel_flow: Dict[str, Any]) -> None:
+        counters["packets_seen"] += kernel_flow["packet_count"]
+        completed_flow = _complete_native_flow(flow_assembler, kernel_flow)
+        # Histograms feed the behavior model; they are not part of the hashed flow record
+        completed_flow.update(kernel_flow["shape"])
+        emit_flow(completed_flow, kernel_flow["flow_end"], kernel_flow["directions"])
+
+    def emit_table_flow(table_flow: Dict[str, Any], observed_at: datetime) -> None:
+        continuation = None
+        if table_flow["segment"] or table_flow["end_reason"] == "active":
+            # Every segment gets its own flow_id; origin_flow_id is segment 0's
+            continuation = {
+                "origin_flow_id": table_flow["origin_flow_id"],
+                "segment": table_flow["segment"],
+                "continued": table_flow["end_reason"] == "active"
+            }
+        emit_flow(
+            _complete_native_flow(flow_assembler, table_flow),
+            observed_at,
+            table_flow["directions"],
+            continuation,
+            table_flow.get("redacted_endpoints")
+        )
+
     logger.startup("DPI Probe starting", backend=capture_backend, interface=interface)
 
     try:
         while not shutdown_handler.is_shutdown_requested():
             now = datetime.now(timezone.utc)
-            frame_result = capture.read(timeout_seconds=1.0)
-            if frame_result:
-                frame, timestamp = frame_result
-                parsed = _parse_frame(frame, timestamp)
+            if hasattr(capture, "read_flows"):
+                # Flows are counted (both directions in one entry) by the kernel tracker;
+                # only ended flows reach userspace
+                for kernel_flow in capture.read_flows(timeout_seconds=1.0):
+                    emit_kernel_flow(kernel_flow)
+                parsed_packets = []
+            elif flow_table is not None:
+                # Parsed descriptors go from the batch buffer to the flow table without
+                # per-packet Python objects; only completed flows come back
+                table_flows, accounted = flow_table.update(capture.batch, capture.read_frame_batch(timeout_seconds=1.0))
+                counters["packets_seen"] += accounted
+                for table_flow in table_flows:
+                    emit_table_flow(table_flow, table_flow["flow_end"])
+                parsed_packets = []
+            elif hasattr(capture, "read_parsed_batch"):
+                # Native captures read and parse a whole batch in C (VLAN/QinQ/MPLS/IPv6
+                # aware); packet_size is the on-wire length
+                parsed_packets = capture.read_parsed_batch(timeout_seconds=1.0)
+            else:
+                frame_result = capture.read(timeout_seconds=1.0)
+                parsed_packets = [_parse_frame(frame_result[0], frame_result[1])] if frame_result else []
+            for parsed in parsed_packets:
                 if parsed:
+                    timestamp = parsed["timestamp"]
                     counters["packets_seen"] += 1
                     completed_flow = flow_assembler.process_packet(
                         src_ip=parsed["src_ip"],
@@ -459,37 +2246,42 @@ def run_dpi_probe(config: Dict[str, Any]) -> None:
                         timestamp=parsed["timestamp"]
                     )
                     if completed_flow:
-                        behavior = behavior_model.analyze_flow(completed_flow)
-                        completed_flow["behavioral_profile_id"] = behavior.get("profile_id", "")
-                        redacted_flow = privacy_redactor.redact_flow(completed_flow)
-                        payload = _build_flow_payload(redacted_flow, capture_meta)
-                        envelope = envelope_builder.build(payload, observed_at=timestamp)
-                        signed = signer.sign_envelope(envelope)
-                        _send_event(ingest_url, signed, auth_manager)
-                        envelope_builder.update_prev_hash(signed["integrity"]["hash_sha256"])
-                        counters["flows_emitted"] += 1
-
-            expired_flows = flow_assembler.flush_expired(now)
-            for expired_flow in expired_flows:
-                behavior = behavior_model.analyze_flow(expired_flow)
-                expired_flow["behavioral_profile_id"] = behavior.get("profile_id", "")
-                redacted_flow = privacy_redactor.redact_flow(expired_flow)
-                payload = _build_flow_payload(redacted_flow, capture_meta)
-                envelope = envelope_builder.build(payload, observed_at=now)
-                signed = signer.sign_envelope(envelope)
-                _send_event(ingest_url, signed, auth_manager)
-                envelope_builder.update_prev_hash(signed["integrity"]["hash_sha256"])
-                counters["flows_emitted"] += 1
+                        emit_flow(completed_flow, timestamp)
+
+            if flow_table is not None:
+                for table_flow in flow_table.expire():
+                    emit_table_flow(table_flow, now)
+            else:
+                expired_flows = flow_assembler.flush_expired(now)
+                for expired_flow in expired_flows:
+                    emit_flow(expired_flow, now)
 
             if time.time() - last_heartbeat >= heartbeat_seconds:
-                heartbeat_payload = _build_heartbeat_payload(capture_meta, counters)
+                capture_stats = capture.stats() if hasattr(capture, "stats") else None
+                sketches = capture.sketch_report() if hasattr(capture, "sketch_report") else None
+                if sketches is not None:
+                    for entry in sketches["top_talkers"] + sketches["top_fanout"]:
+                        entry["src_ip"] = privacy_redactor.redact_ip(entry["src_ip"])
+                table_stats = flow_table.stats() if flow_table is not None else None
+                heartbeat_payload = _build_heartbeat_payload(
+                    capture_meta, counters, capture_stats, sketches, table_stats
+                )
                 envelope = envelope_builder.build(heartbeat_payload, observed_at=now)
                 signed = signer.sign_envelope(envelope)
                 _send_event(ingest_url, signed, auth_manager)
                 envelope_builder.update_prev_hash(signed["integrity"]["hash_sha256"])
                 counters["heartbeats_sent"] += 1
                 last_heartbeat = time.time()
+
+        # A tracker this probe loaded stops counting when it exits; export what it still holds
+        if hasattr(capture, "drain_flows"):
+            for kernel_flow in capture.drain_flows():
+                emit_kernel_flow(kernel_flow)
     finally:
+        if flow_table is not None:
+            flow_table.close()
+        if native_redactor is not None:
+            native_redactor.close()
         capture.close()
 
 
@@ -504,12 +2296,47 @@ if __name__ == "__main__":
         config_loader.require('RANSOMEYE_COMPONENT_INSTANCE_ID')
         config_loader.require('RANSOMEYE_DPI_INTERFACE')
         config_loader.optional('RANSOMEYE_DPI_CAPTURE_BACKEND', default='af_packet_c')
+        config_loader.optional('RANSOMEYE_DPI_AF_PACKET_MODE', default='tpacket_v3')
+        config_loader.optional('RANSOMEYE_DPI_RING_BLOCK_SIZE', default='1048576')
+        config_loader.optional('RANSOMEYE_DPI_RING_BLOCK_COUNT', default='64')
+        config_loader.optional('RANSOMEYE_DPI_RING_RETIRE_TIMEOUT_MS', default='50')
+        config_loader.optional('RANSOMEYE_DPI_FANOUT_WORKERS', default='0')
+        config_loader.optional('RANSOMEYE_DPI_FANOUT_MODE', default='hash')
+        config_loader.optional('RANSOMEYE_DPI_FANOUT_CPUS', default='')
+        config_loader.optional('RANSOMEYE_DPI_FANOUT_QUEUE_SLOTS', default='4096')
+        config_loader.optional('RANSOMEYE_DPI_XDP_QUEUES', default='0')
+        config_loader.optional('RANSOMEYE_DPI_XDP_BIND_MODE', default='copy')
+        config_loader.optional('RANSOMEYE_DPI_XDP_FRAMES_PER_QUEUE', default='4096')
+        config_loader.optional('RANSOMEYE_DPI_XSKMAP_PATH', default='/sys/fs/bpf/ransomeye/xsks_map')
+        config_loader.optional('RANSOMEYE_DPI_EBPF_PIN_DIR', default='/sys/fs/bpf/ransomeye')
+        config_loader.optional('RANSOMEYE_DPI_EBPF_IDLE_TIMEOUT', default='30')
+        config_loader.optional('RANSOMEYE_DPI_EBPF_OBJECT', default='')
+        config_loader.optional('RANSOMEYE_DPI_EBPF_ATTACH', default='xdp')
+        config_loader.optional('RANSOMEYE_DPI_EBPF_MAX_FLOWS', default='0')
+        config_loader.optional('RANSOMEYE_DPI_EBPF_TOP_K', default='10')
+        config_loader.optional('RANSOMEYE_DPI_BATCH_SIZE', default='256')
+        config_loader.optional('RANSOMEYE_DPI_TIMESTAMP_SOURCE', default='software')
+        config_loader.optional('RANSOMEYE_DPI_FILTER_PROTOCOLS', default='')
+        config_loader.optional('RANSOMEYE_DPI_FILTER_INCLUDE_CIDRS', default='')
+        config_loader.optional('RANSOMEYE_DPI_FILTER_EXCLUDE_CIDRS', default='')
+        config_loader.optional('RANSOMEYE_DPI_FILTER_PORTS', default='')
+        config_loader.optional('RANSOMEYE_DPI_SNAPLEN', default='0')
         config_loader.optional('RANSOMEYE_DPI_FLOW_TIMEOUT', default='300')
+        config_loader.optional('RANSOMEYE_DPI_FLOW_TABLE_MAX_FLOWS', default='262144')
+        config_loader.optional('RANSOMEYE_DPI_FLOW_TABLE_MEMORY_MB', default='0')
+        config_loader.optional('RANSOMEYE_DPI_FLOW_TABLE_OVERLOAD', default='aggregate')
+        config_loader.optional('RANSOMEYE_DPI_FLOW_IDLE_TIMEOUT', default='30')
         config_loader.optional('RANSOMEYE_DPI_HEARTBEAT_SECONDS', default='5')
         config_loader.optional('RANSOMEYE_DPI_REPLAY_PATH', default='')
+        config_loader.optional('RANSOMEYE_DPI_PCAP_PATH', default='')
+        config_loader.optional('RANSOMEYE_DPI_PCAP_PACING', default='recorded')
+        config_loader.optional('RANSOMEYE_DPI_PCAP_RATE', default='0')
+        config_loader.optional('RANSOMEYE_DPI_PCAP_LOOPS', default='1')
         config_loader.optional('RANSOMEYE_DPI_PRIVACY_MODE', default='FORENSIC')
         config_loader.optional('RANSOMEYE_DPI_IP_REDACTION', default='none')
         config_loader.optional('RANSOMEYE_DPI_PORT_REDACTION', default='none')
+        config_loader.optional('RANSOMEYE_DPI_IP_HASH_KEY_PATH', default='')
+        config_loader.optional('RANSOMEYE_DPI_REDACTION_CACHE', default='65536')
         config = config_loader.load()
 
         run_dpi_probe(config)
@@ -206,14 +206,29 @@ build_fastpath_library() {
         error_exit "gcc is required to build AF_PACKET fastpath (install build-essential)"
     fi
 
-    local fastpath_src="${INSTALLER_DIR}/../../dpi-advanced/fastpath/af_packet_capture.c"
+    local fastpath_dir="${INSTALLER_DIR}/../../dpi-advanced/fastpath"
+    local fastpath_srcs=(
+        "${fastpath_dir}/af_packet_capture.c"
+        "${fastpath_dir}/capture_engine.c"
+        "${fastpath_dir}/xsk_capture.c"
+        "${fastpath_dir}/capture_filter.c"
+        "${fastpath_dir}/frame_parser.c"
+        "${fastpath_dir}/pcap_replay.c"
+        "${fastpath_dir}/flow_export.c"
+        "${fastpath_dir}/flow_table.c"
+        "${fastpath_dir}/flow_hash.c"
+        "${fastpath_dir}/privacy_redact.c"
+    )
     local output_lib="${INSTALL_ROOT}/lib/libransomeye_dpi_af_packet.so"
 
-    if [[ ! -f "$fastpath_src" ]]; then
-        error_exit "AF_PACKET fastpath source not found: ${fastpath_src}"
-    fi
+    local fastpath_src
+    for fastpath_src in "${fastpath_srcs[@]}"; do
+        if [[ ! -f "$fastpath_src" ]]; then
+            error_exit "AF_PACKET fastpath source not found: ${fastpath_src}"
+        fi
+    done
 
-    gcc -shared -fPIC -O2 -o "$output_lib" "$fastpath_src" || \
+    gcc -shared -fPIC -O2 -pthread -o "$output_lib" "${fastpath_srcs[@]}" || \
         error_exit "Failed to build AF_PACKET fastpath library"
     chmod 755 "$output_lib" || error_exit "Failed to set permissions on fastpath library"
     chown ransomeye-dpi:ransomeye-dpi "$output_lib" || \
@@ -223,6 +238,48 @@ build_fastpath_library() {
     echo -e "${GREEN}✓${NC} Built: ${output_lib}"
 }
 
+# Build eBPF flow tracker loader library (optional: needs libbpf)
+build_ebpf_loader_library() {
+    echo ""
+    echo "Building eBPF flow tracker loader library..."
+
+    if ! command -v pkg-config &> /dev/null || ! pkg-config --exists libbpf; then
+        echo -e "${YELLOW}NOTE:${NC} libbpf not found (install libbpf-dev); the ebpf backend will need an externally loaded tracker"
+        return 0
+    fi
+
+    local fastpath_dir="${INSTALLER_DIR}/../../dpi-advanced/fastpath"
+    local loader_src="${fastpath_dir}/flow_loader.c"
+    local output_lib="${INSTALL_ROOT}/lib/libransomeye_dpi_ebpf_loader.so"
+
+    if [[ ! -f "$loader_src" ]]; then
+        error_exit "eBPF loader source not found: ${loader_src}"
+    fi
+
+    if command -v clang &> /dev/null && command -v bpftool &> /dev/null && [[ -r /sys/kernel/btf/vmlinux ]]; then
+        # Tracker compiled with BTF and embedded in the loader (RANSOMEYE_DPI_EBPF_OBJECT=embedded)
+        local build_dir
+        build_dir=$(mktemp -d) || error_exit "Failed to create eBPF build directory"
+        make -C "$fastpath_dir" OUTPUT="$build_dir" loader || \
+            error_exit "Failed to build eBPF tracker and loader library"
+        install -m 755 "${build_dir}/libransomeye_dpi_ebpf_loader.so" "$output_lib" || \
+            error_exit "Failed to install eBPF loader library"
+        rm -rf "$build_dir"
+    else
+        echo -e "${YELLOW}NOTE:${NC} clang, bpftool or kernel BTF not found; the loader will need RANSOMEYE_DPI_EBPF_OBJECT set to a compiled tracker"
+        # shellcheck disable=SC2046
+        gcc -shared -fPIC -O2 -o "$output_lib" "$loader_src" $(pkg-config --cflags --libs libbpf) || \
+            error_exit "Failed to build eBPF loader library"
+    fi
+
+    chmod 755 "$output_lib" || error_exit "Failed to set permissions on eBPF loader library"
+    chown ransomeye-dpi:ransomeye-dpi "$output_lib" || \
+        error_exit "Failed to set ownership on eBPF loader library"
+
+    record_step "build_ebpf_loader" "remove_path" --meta "path=${output_lib}" --rollback-meta "path=${output_lib}"
+    echo -e "${GREEN}✓${NC} Built: ${output_lib}"
+}
+
 # Generate telemetry signing keys
 generate_telemetry_keys() {
     echo ""
@@ -266,6 +323,32 @@ EOF
     record_step "create_telemetry_pubkey" "remove_path" --meta "path=${key_dir}/${key_id}.pub" --rollback-meta "path=${key_dir}/${key_id}.pub"
 }
 
+# Capabilities granted to the probe script, comma-separated setcap names
+# CAP_NET_RAW: Required for raw socket creation (packet capture)
+# CAP_NET_ADMIN: Required for network interface configuration and attaching XDP/TC programs
+# CAP_BPF + CAP_PERFMON (CAP_SYS_ADMIN before Linux 5.8): ebpf backend loads programs, pins maps, BPF_OBJ_GET;
+#   af_xdp updates the XSKMAP through its pinned map
+# CAP_SYS_RESOURCE: lets the probe raise RLIMIT_MEMLOCK (LimitMEMLOCK=infinity), which pre-5.11 kernels charge BPF maps to
+# CAP_IPC_LOCK: af_xdp UMEM registration, which is charged to RLIMIT_MEMLOCK without it
+dpi_capabilities() {
+    local major minor
+    IFS=. read -r major minor _ <<< "$(uname -r)"
+    if (( major > 5 || (major == 5 && minor >= 8) )); then
+        echo "cap_net_raw,cap_net_admin,cap_ipc_lock,cap_sys_resource,cap_perfmon,cap_bpf"
+    else
+        echo "cap_net_raw,cap_net_admin,cap_ipc_lock,cap_sys_admin,cap_sys_resource"
+    fi
+}
+
+# Verify every capability from dpi_capabilities() is set on the probe script
+verify_capabilities() {
+    local granted cap
+    granted="$(getcap "${INSTALL_ROOT}/bin/ransomeye-dpi-probe" 2>/dev/null)"
+    for cap in ${DPI_CAPABILITIES//,/ }; do
+        [[ "$granted" == *"$cap"* ]] || return 1
+    done
+}
+
 # Set Linux capabilities (CRITICAL for DPI Probe - network packet capture requires privileges)
 set_capabilities() {
     echo ""
@@ -276,15 +359,14 @@ set_capabilities() {
         error_exit "setcap command not found. Please install libcap2-bin: sudo apt-get install libcap2-bin"
     fi
     
-    # Set CAP_NET_RAW and CAP_NET_ADMIN for packet capture (not full root)
-    # CAP_NET_RAW: Required for raw socket creation (packet capture)
-    # CAP_NET_ADMIN: Required for network interface configuration
-    setcap cap_net_raw,cap_net_admin+ep "${INSTALL_ROOT}/bin/ransomeye-dpi-probe" 2>/dev/null || \
+    # Scoped capabilities for packet capture and the ebpf backend (not full root)
+    DPI_CAPABILITIES="$(dpi_capabilities)"
+    setcap "${DPI_CAPABILITIES}+ep" "${INSTALL_ROOT}/bin/ransomeye-dpi-probe" 2>/dev/null || \
         error_exit "Failed to set capabilities on DPI Probe script. Ensure file is not on a filesystem without capability support (e.g., NFS, tmpfs)."
     
     # Verify capabilities were set
-    if getcap "${INSTALL_ROOT}/bin/ransomeye-dpi-probe" | grep -q "cap_net_raw,cap_net_admin"; then
-        echo -e "${GREEN}✓${NC} Capabilities set: CAP_NET_RAW, CAP_NET_ADMIN"
+    if verify_capabilities; then
+        echo -e "${GREEN}✓${NC} Capabilities set: ${DPI_CAPABILITIES^^}"
     else
         error_exit "Failed to verify capabilities on DPI Probe script"
     fi
@@ -386,11 +468,43 @@ RANSOMEYE_INGEST_URL="${RANSOMEYE_INGEST_URL}"
 RANSOMEYE_DPI_CAPTURE_BACKEND="af_packet_c"
 RANSOMEYE_DPI_INTERFACE="${RANSOMEYE_DPI_INTERFACE}"
 RANSOMEYE_DPI_FASTPATH_LIB="${INSTALL_ROOT}/lib/libransomeye_dpi_af_packet.so"
+RANSOMEYE_DPI_AF_PACKET_MODE="tpacket_v3"
+RANSOMEYE_DPI_RING_BLOCK_SIZE="1048576"
+RANSOMEYE_DPI_RING_BLOCK_COUNT="64"
+RANSOMEYE_DPI_RING_RETIRE_TIMEOUT_MS="50"
+RANSOMEYE_DPI_BATCH_SIZE="256"
+RANSOMEYE_DPI_TIMESTAMP_SOURCE="software"
+RANSOMEYE_DPI_FILTER_PROTOCOLS=""
+RANSOMEYE_DPI_FILTER_INCLUDE_CIDRS=""
+RANSOMEYE_DPI_FILTER_EXCLUDE_CIDRS=""
+RANSOMEYE_DPI_FILTER_PORTS=""
+RANSOMEYE_DPI_SNAPLEN="0"
+RANSOMEYE_DPI_FANOUT_WORKERS="0"
+RANSOMEYE_DPI_FANOUT_MODE="hash"
+RANSOMEYE_DPI_FANOUT_CPUS=""
+RANSOMEYE_DPI_FANOUT_QUEUE_SLOTS="4096"
+RANSOMEYE_DPI_XDP_QUEUES="0"
+RANSOMEYE_DPI_XDP_BIND_MODE="copy"
+RANSOMEYE_DPI_XDP_FRAMES_PER_QUEUE="4096"
+RANSOMEYE_DPI_XSKMAP_PATH="/sys/fs/bpf/ransomeye/xsks_map"
+RANSOMEYE_DPI_EBPF_PIN_DIR="/sys/fs/bpf/ransomeye"
+RANSOMEYE_DPI_EBPF_IDLE_TIMEOUT="30"
+RANSOMEYE_DPI_EBPF_LOADER_LIB="${INSTALL_ROOT}/lib/libransomeye_dpi_ebpf_loader.so"
+RANSOMEYE_DPI_EBPF_OBJECT=""
+RANSOMEYE_DPI_EBPF_ATTACH="xdp"
+RANSOMEYE_DPI_EBPF_MAX_FLOWS="0"
+RANSOMEYE_DPI_EBPF_TOP_K="10"
 RANSOMEYE_DPI_FLOW_TIMEOUT="300"
+RANSOMEYE_DPI_FLOW_TABLE_MAX_FLOWS="262144"
+RANSOMEYE_DPI_FLOW_TABLE_MEMORY_MB="0"
+RANSOMEYE_DPI_FLOW_TABLE_OVERLOAD="aggregate"
+RANSOMEYE_DPI_FLOW_IDLE_TIMEOUT="30"
 RANSOMEYE_DPI_HEARTBEAT_SECONDS="5"
 RANSOMEYE_DPI_PRIVACY_MODE="FORENSIC"
 RANSOMEYE_DPI_IP_REDACTION="none"
 RANSOMEYE_DPI_PORT_REDACTION="none"
+RANSOMEYE_DPI_IP_HASH_KEY_PATH=""
+RANSOMEYE_DPI_REDACTION_CACHE="65536"
 
 # Component key directory (telemetry signing keys)
 RANSOMEYE_COMPONENT_KEY_DIR="${INSTALL_ROOT}/config/component-keys"
@@ -467,7 +581,7 @@ create_manifest() {
   "component_instance_id": "${COMPONENT_INSTANCE_ID}",
   "core_endpoint": "${RANSOMEYE_INGEST_URL}",
   "network_interface": "${RANSOMEYE_DPI_INTERFACE}",
-  "capabilities": ["CAP_NET_RAW", "CAP_NET_ADMIN"],
+  "capabilities": [$(sed 's/[^,]*/"&"/g; s/,/, /g' <<< "${DPI_CAPABILITIES^^}")],
   "component_key_dir": "${INSTALL_ROOT}/config/component-keys",
   "fastpath_library": "${INSTALL_ROOT}/lib/libransomeye_dpi_af_packet.so"
 }
@@ -486,8 +600,8 @@ validate_installation() {
     echo "Validating DPI Probe installation..."
     
     # Verify capabilities are set correctly
-    if getcap "${INSTALL_ROOT}/bin/ransomeye-dpi-probe" | grep -q "cap_net_raw,cap_net_admin"; then
-        echo -e "${GREEN}✓${NC} Capabilities verified: CAP_NET_RAW, CAP_NET_ADMIN"
+    if verify_capabilities; then
+        echo -e "${GREEN}✓${NC} Capabilities verified: ${DPI_CAPABILITIES^^}"
     else
         error_exit "Capabilities not verified on DPI Probe binary"
     fi
@@ -515,6 +629,7 @@ main() {
     create_system_user
     install_dpi_probe_script
     build_fastpath_library
+    build_ebpf_loader_library
     set_capabilities
     generate_telemetry_keys
     prompt_core_endpoint
@@ -533,7 +648,7 @@ main() {
     echo "================================================================================"
     echo ""
     echo "Installation root: ${INSTALL_ROOT}"
-    echo "Capabilities: CAP_NET_RAW, CAP_NET_ADMIN (scoped privileges, not full root)"
+    echo "Capabilities: ${DPI_CAPABILITIES^^} (scoped privileges, not full root)"
     echo ""
     echo "Logs location: ${INSTALL_ROOT}/logs/"
     echo ""
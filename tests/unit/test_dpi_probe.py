@@ -1,9 +1,21 @@
+import ctypes
+import errno
+import hashlib
+import hmac
 import os
+import platform
+import socket
 import struct
+import subprocess
+import tempfile
+import time
 from datetime import datetime, timezone
+from pathlib import Path
+
+import pytest
 
 from dpi.probe import main as dpi_main
-from dpi.probe.main import _parse_frame, EventEnvelopeBuilder, _build_flow_payload
+from dpi.probe.main import _parse_frame, EventEnvelopeBuilder, _build_flow_payload, _build_heartbeat_payload, _parse_id_list, _build_capture_filter, _decode_packet_desc, PACKET_DESC_FORMAT, _decode_flow_record, FLOW_RECORD_FORMAT, _decode_flow_table_record, FLOW_TABLE_RECORD_FORMAT
 
 
 def _build_ipv4_tcp_frame():
@@ -51,6 +63,760 @@ def test_parse_frame_extracts_flow_fields():
     assert parsed["protocol"] == "tcp"
 
 
+def test_decode_packet_desc_formats_ipv6():
+    timestamp = datetime(2025, 1, 1, tzinfo=timezone.utc)
+    src = bytes.fromhex("20010db8000000000000000000000001")
+    dst = bytes.fromhex("20010db8000000000000000000000002")
+    packet_desc = struct.pack(
+        PACKET_DESC_FORMAT, src, dst, 5353, 53, 100, 0, 18, 58, 66, 0x1, 0, 6, 17, 1, 0, 0, 0, 0, 64, 0
+    )
+    parsed = _decode_packet_desc(packet_desc, timestamp, 1500)
+    assert parsed["src_ip"] == "2001:db8::1"
+    assert parsed["dst_ip"] == "2001:db8::2"
+    assert (parsed["src_port"], parsed["dst_port"]) == (5353, 53)
+    assert parsed["protocol"] == "udp"
+    assert parsed["packet_size"] == 1500
+
+
+def test_decode_flow_record_reads_network_order_ports():
+    record = struct.pack(
+        FLOW_RECORD_FORMAT,
+        bytes([10, 0, 0, 1]), bytes([10, 0, 0, 2]), struct.pack("!H", 51515), struct.pack("!H", 443), 6,
+        8, 4, 2400, 1000, 1_700_000_000_000_000_000, 1_700_000_001_500_000_000, 1, 1,
+        3, 5, 0, 0, 0, 0, 4, 0,
+        0, 2, 9, 0, 0, 0, 0, 0,
+        0, 1, 1, 6, 11, 0, 0, 0,
+        2, 3
+    )
+    flow = _decode_flow_record(struct.unpack(FLOW_RECORD_FORMAT, record))
+    assert (flow["src_ip"], flow["dst_ip"]) == ("10.0.0.1", "10.0.0.2")
+    assert (flow["src_port"], flow["dst_port"], flow["protocol"]) == (51515, 443, "tcp")
+    assert (flow["packet_count"], flow["byte_count"], flow["end_reason"]) == (12, 3400, "rst")
+    assert flow["directions"]["forward"] == {"packets": 8, "bytes": 2400}
+    assert flow["directions"]["reverse"] == {"packets": 4, "bytes": 1000}
+    assert flow["l7_protocol"] == "tls"
+    assert flow["shape"]["packet_size_histogram"] == [3, 5, 0, 0, 0, 0, 4, 0]
+    assert flow["shape"]["inter_arrival_histogram"] == [0, 2, 9, 0, 0, 0, 0, 0]
+    assert flow["shape"]["tcp_flag_counts"]["rst"] == 1
+    assert flow["shape"]["tcp_flag_counts"]["ack"] == 11
+    assert (flow["flow_end"] - flow["flow_start"]).total_seconds() == 1.5
+
+
+def test_decode_flow_table_record_orients_by_initiator():
+    record = struct.pack(
+        FLOW_TABLE_RECORD_FORMAT,
+        bytes([192, 168, 1, 9]) + bytes(12), bytes([10, 0, 0, 2]) + bytes(12), 50000, 22, 4, 6, 1, 2,
+        5, 3, 700, 4200, 1_700_000_600_000_000_000, 1_700_000_602_000_000_000, 1_700_000_000_000_000_000
+    )
+    flow = _decode_flow_table_record(struct.unpack(FLOW_TABLE_RECORD_FORMAT, record))
+    assert len(record) == 104
+    assert (flow["src_ip"], flow["dst_ip"]) == ("192.168.1.9", "10.0.0.2")
+    assert (flow["src_port"], flow["dst_port"], flow["protocol"]) == (50000, 22, "tcp")
+    assert (flow["packet_count"], flow["byte_count"], flow["end_reason"]) == (8, 4900, "active")
+    assert flow["directions"]["reverse"] == {"packets": 3, "bytes": 4200}
+    assert (flow["flow_end"] - flow["flow_start"]).total_seconds() == 2.0
+    assert flow["segment"] == 2
+    assert (flow["flow_start"] - flow["origin_start"]).total_seconds() == 600.0
+
+    record = struct.pack(
+        FLOW_TABLE_RECORD_FORMAT,
+        bytes([192, 168, 1, 9]) + bytes(12), bytes([10, 0, 0, 2]) + bytes(12), 50001, 22, 4, 6, 4, 0,
+        1, 1, 60, 54, 1_700_000_000_000_000_000, 1_700_000_000_000_100_000, 1_700_000_000_000_000_000
+    )
+    assert _decode_flow_table_record(struct.unpack(FLOW_TABLE_RECORD_FORMAT, record))["end_reason"] == "rst"
+
+
+def test_flow_assembler_hashes_binary_encoding():
+    record = struct.pack(
+        FLOW_TABLE_RECORD_FORMAT,
+        bytes([192, 168, 1, 9]) + bytes(12), bytes([10, 0, 0, 2]) + bytes(12), 50000, 22, 4, 6, 2, 0,
+        5, 3, 700, 4200, 1_700_000_000_123_456_789, 1_700_000_002_000_000_999, 1_700_000_000_123_456_789
+    )
+    flow = _decode_flow_table_record(struct.unpack(FLOW_TABLE_RECORD_FORMAT, record))
+    # Nanoseconds floor to the microsecond exactly, as flow_hash.c does
+    assert flow["flow_start"].isoformat() == "2023-11-14T22:13:20.123456+00:00"
+
+    assembler = dpi_main.FlowAssembler()
+    encoded = struct.pack(
+        ">BBBx16s16sHHq", 1, 4, 6, bytes([10, 0, 0, 2]) + bytes(12), bytes([192, 168, 1, 9]) + bytes(12),
+        22, 50000, 1_700_000_000_123_456
+    )
+    flow_id = hashlib.sha256(encoded).hexdigest()[:32]
+    assert assembler.flow_id("192.168.1.9", "10.0.0.2", 50000, 22, "tcp", flow["flow_start"]) == flow_id
+    assert assembler.flow_id("10.0.0.2", "192.168.1.9", 22, 50000, "tcp", flow["flow_start"]) == flow_id
+
+    completed = assembler.complete_flow(
+        "192.168.1.9", "10.0.0.2", 50000, 22, "tcp", 8, 4900, flow["flow_start"], flow["flow_end"]
+    )
+    encoded = struct.pack(
+        ">BBBB16s16sHHqqQQ16s64s16s16s", 1, 4, 6, 3, bytes([192, 168, 1, 9]) + bytes(12),
+        bytes([10, 0, 0, 2]) + bytes(12), 50000, 22, 1_700_000_000_123_456, 1_700_000_002_000_000, 8, 4900,
+        bytes.fromhex(flow_id), b"", b"", b""
+    )
+    assert completed["flow_id"] == flow_id
+    assert completed["immutable_hash"] == hashlib.sha256(encoded).hexdigest()
+
+
+def test_native_flow_hash_matches_flow_assembler():
+    lib_path = Path(os.getenv("RANSOMEYE_DPI_FASTPATH_LIB", ""))
+    if not lib_path.is_file():
+        pytest.skip("Fastpath library not built (set RANSOMEYE_DPI_FASTPATH_LIB)")
+    library = dpi_main.AFPacketCLibrary(lib_path)
+    v6_client, v6_server = socket.inet_pton(socket.AF_INET6, "fd00::2"), socket.inet_pton(socket.AF_INET6, "fd00::1")
+    origin_ns = 1_700_000_000_123_456_789
+    # (src, dst, src_port, dst_port, ip_version, protocol, segment, first_ns, last_ns)
+    cases = [
+        (bytes([192, 168, 1, 9]), bytes([10, 0, 0, 2]), 50000, 22, 4, 6, 0, origin_ns, origin_ns + 2_000_000_999),
+        # A later segment: its own flow_id, linked to segment 0 by origin_flow_id
+        (bytes([10, 0, 0, 2]), bytes([10, 0, 0, 1]), 53000, 53, 4, 17, 3, origin_ns + 900_000_000_001,
+         origin_ns + 1_200_000_000_000),
+        (v6_client, v6_server, 40000, 443, 6, 6, 0, origin_ns + 999, origin_ns + 1999),
+        (v6_server, v6_client, 0, 0, 6, 58, 0, origin_ns, origin_ns),
+        (bytes([10, 0, 0, 3]), bytes([10, 0, 0, 4]), 0, 0, 4, 47, 1, origin_ns + 5_000_000_000, origin_ns + 6_000_000_000),
+    ]
+    records = (ctypes.c_ubyte * (len(cases) * dpi_main.FLOW_TABLE_RECORD_SIZE))()
+    for index, (src, dst, src_port, dst_port, ip_version, protocol, segment, first_ns, last_ns) in enumerate(cases):
+        struct.pack_into(FLOW_TABLE_RECORD_FORMAT, records, index * dpi_main.FLOW_TABLE_RECORD_SIZE,
+                         src.ljust(16, b"\0"), dst.ljust(16, b"\0"), src_port, dst_port, ip_version, protocol, 0,
+                         segment, 3 + index, 2, 900 + index, 4200, first_ns, last_ns,
+                         origin_ns if segment else first_ns)
+    digests = (ctypes.c_ubyte * (len(cases) * dpi_main.FLOW_HASH_DIGEST_SIZE))()
+    assert library.lib.flow_hash_table_records(ctypes.byref(records), len(cases), ctypes.byref(digests)) == 0
+
+    assembler = dpi_main.FlowAssembler()
+    for record, (flow_id, origin_flow_id, immutable_hash) in zip(
+        struct.iter_unpack(FLOW_TABLE_RECORD_FORMAT, memoryview(records).cast("B")),
+        struct.iter_unpack(dpi_main.FLOW_HASH_DIGEST_FORMAT, memoryview(digests).cast("B"))
+    ):
+        flow = _decode_flow_table_record(record)
+        completed = assembler.complete_flow(
+            flow["src_ip"], flow["dst_ip"], flow["src_port"], flow["dst_port"], flow["protocol"],
+            flow["packet_count"], flow["byte_count"], flow["flow_start"], flow["flow_end"]
+        )
+        assert completed["flow_id"] == flow_id.hex(), flow
+        assert assembler.flow_id(flow["src_ip"], flow["dst_ip"], flow["src_port"], flow["dst_port"],
+                                 flow["protocol"], flow["origin_start"]) == origin_flow_id.hex(), flow
+        assert completed["immutable_hash"] == immutable_hash.hex(), flow
+
+
+def test_privacy_redactor_keyed_hash_and_native_endpoints():
+    key = b"probe-run-key"
+    redactor = dpi_main.PrivacyRedactor(
+        {"ip_redaction": "hash", "port_redaction": "truncate", "ip_hash_key": key, "ip_cache_size": 2}
+    )
+    for ip, packed in (("10.0.0.2", bytes([10, 0, 0, 2])), ("fd00::1", bytes([0xfd]) + bytes(14) + b"\x01")):
+        expected = hmac.new(key, packed, hashlib.sha256).hexdigest()[:16]
+        assert redactor.redact_ip(ip) == expected
+        assert redactor.redact_ip(ip) == expected
+    redacted = redactor.redact_flow({"src_ip": "10.0.0.2", "dst_ip": "10.0.0.3", "src_port": 50001, "dst_port": 443})
+    assert (redacted["src_port"], redacted["dst_port"]) == (50001 & 0xFF00, 443 & 0xFF00)
+
+    endpoints = {"src_ip": "a" * 16, "dst_ip": "b" * 16, "src_port": 0xC300, "dst_port": 0x0100}
+    redacted = redactor.redact_flow({"src_ip": "10.0.0.2", "dst_ip": "10.0.0.3", "flow_id": "f"}, endpoints)
+    assert redacted == dict(endpoints, flow_id="f")
+
+    partial = dpi_main.PrivacyRedactor({"ip_redaction": "partial"})
+    assert partial.redact_ip("192.168.7.9") == "192.168.0.0"
+
+
+def test_native_flow_table_rejects_bad_sizing_and_policy():
+    for kwargs in ({"max_flows": 0}, {"max_flows": 1024, "overload_policy": "drop_everything"}):
+        arguments = {"max_flows": 1024, "flow_timeout": 300, "idle_timeout": 30, "batch_size": 64}
+        arguments.update(kwargs)
+        try:
+            dpi_main.NativeFlowTable(None, **arguments)
+        except RuntimeError as exc:
+            assert "memory budget" in str(exc) or "overload policy" in str(exc)
+        else:
+            raise AssertionError(f"flow table accepted {kwargs}")
+
+
+TCP_FIN, TCP_SYN, TCP_RST, TCP_ACK = 0x01, 0x02, 0x04, 0x10
+BASE_S = 1_700_000_000
+
+
+def _open_native_flow_table(**kwargs):
+    lib_path = Path(os.getenv("RANSOMEYE_DPI_FASTPATH_LIB", ""))
+    if not lib_path.is_file():
+        pytest.skip("Fastpath library not built (set RANSOMEYE_DPI_FASTPATH_LIB)")
+    arguments = {"max_flows": 64, "flow_timeout": 300, "idle_timeout": 30, "batch_size": 512}
+    arguments.update(kwargs)
+    return dpi_main.NativeFlowTable(dpi_main.AFPacketCLibrary(lib_path), **arguments)
+
+
+def _feed_flow_table(table, packets):
+    """packets: (seconds after BASE_S, (src_ip, src_port), (dst_ip, dst_port), protocol, tcp_flags)"""
+    batch = dpi_main.FrameBatch(len(packets), 1)
+    for index, (at, (src_ip, src_port), (dst_ip, dst_port), protocol, tcp_flags) in enumerate(packets):
+        ts_ns = BASE_S * 1_000_000_000 + round(at * 1_000_000_000)
+        struct.pack_into(
+            dpi_main.FRAME_DESC_FORMAT, batch.descs, index * dpi_main.FRAME_DESC_SIZE, 0, 1, 100, 0, ts_ns, 0, 0
+        )
+        struct.pack_into(
+            PACKET_DESC_FORMAT, batch.packets, index * dpi_main.PACKET_DESC_SIZE,
+            socket.inet_aton(src_ip), socket.inet_aton(dst_ip), src_port, dst_port,
+            0, 0, 14, 34, 54, 0, 0, 4, protocol, 0, 0, tcp_flags, 0, 0, 64, 0
+        )
+    return table.update(batch, len(packets))
+
+
+def test_native_flow_table_ends_tcp_on_fin_linger_rst_and_port_reuse():
+    table = _open_native_flow_table()
+    client, server = ("10.0.0.2", 40000), ("10.0.0.1", 443)
+    try:
+        # Graceful close: FIN, FIN/ACK, ACK stay in one flow until the linger has passed
+        flows, accounted = _feed_flow_table(table, [
+            (0.0, client, server, 6, TCP_SYN),
+            (0.001, server, client, 6, TCP_SYN | TCP_ACK),
+            (0.002, client, server, 6, TCP_ACK),
+            (0.5, client, server, 6, TCP_FIN | TCP_ACK),
+            (0.501, server, client, 6, TCP_FIN | TCP_ACK),
+            (0.502, client, server, 6, TCP_ACK),
+        ])
+        assert (flows, accounted) == ([], 6)
+        assert table.expire() == []
+        _feed_flow_table(table, [(1.7, ("10.0.0.9", 5000), ("10.0.0.8", 53), 17, 0)])
+        [closed] = table.expire()
+        assert closed["end_reason"] == "fin"
+        assert (closed["src_ip"], closed["src_port"]) == client
+        assert (closed["dst_ip"], closed["dst_port"]) == server
+        assert closed["directions"]["forward"]["packets"] == 4
+        assert closed["directions"]["reverse"]["packets"] == 2
+
+        # RST ends the flow in the update that carries it
+        flows, _ = _feed_flow_table(table, [
+            (2.0, ("10.0.0.3", 40001), server, 6, TCP_SYN),
+            (2.001, server, ("10.0.0.3", 40001), 6, TCP_RST | TCP_ACK),
+        ])
+        assert [(flow["end_reason"], flow["packet_count"]) for flow in flows] == [("rst", 2)]
+
+        # A bare SYN on a closing flow completes it and starts a new one
+        flows, _ = _feed_flow_table(table, [
+            (3.0, ("10.0.0.4", 40002), server, 6, TCP_SYN),
+            (3.1, ("10.0.0.4", 40002), server, 6, TCP_FIN | TCP_ACK),
+            (3.101, server, ("10.0.0.4", 40002), 6, TCP_FIN | TCP_ACK),
+            (3.2, ("10.0.0.4", 40002), server, 6, TCP_SYN),
+        ])
+        assert [(flow["end_reason"], flow["packet_count"]) for flow in flows] == [("fin", 3)]
+        stats = table.stats()
+        assert (stats["fin_records"], stats["rst_records"], stats["live_flows"]) == (2, 1, 2)
+    finally:
+        table.close()
+
+
+def test_native_flow_table_links_active_segments_and_expires_idle_on_the_wheel():
+    table = _open_native_flow_table(flow_timeout=1)
+    long_flow = (("10.1.0.1", 5353), ("10.1.0.2", 53))
+    try:
+        # Active timeout: the flow is exported and continues in segment + 1
+        flows, _ = _feed_flow_table(table, [
+            (0.0, *long_flow, 17, 0),
+            (0.5, *long_flow, 17, 0),
+            (1.2, *long_flow, 17, 0),
+            (1.9, *long_flow, 17, 0),
+            (2.4, *long_flow, 17, 0),
+        ])
+        assert [(flow["end_reason"], flow["segment"], flow["packet_count"]) for flow in flows] == [
+            ("active", 0, 2), ("active", 1, 2)
+        ]
+        first, second = flows
+        assert first["origin_start"] == second["origin_start"] == first["flow_start"]
+        assert second["origin_flow_id"] == first["origin_flow_id"] == first["flow_id"]
+        assert second["flow_id"] != first["flow_id"]
+    finally:
+        table.close()
+
+    # Idle timeout from the wheel; a flow with a later packet is rescheduled, not expired
+    table = _open_native_flow_table(idle_timeout=2)
+    try:
+        _feed_flow_table(table, [
+            (10.0, ("10.1.0.3", 1000), ("10.1.0.4", 2000), 17, 0),
+            (10.0, ("10.1.0.5", 1000), ("10.1.0.6", 2000), 17, 0),
+            (11.5, ("10.1.0.5", 1000), ("10.1.0.6", 2000), 17, 0),
+            (12.3, ("10.1.0.7", 1000), ("10.1.0.8", 2000), 17, 0),
+        ])
+        assert [(flow["src_ip"], flow["end_reason"], flow["packet_count"]) for flow in table.expire()] == [
+            ("10.1.0.3", "idle", 1)
+        ]
+        stats = table.stats()
+        assert (stats["idle_records"], stats["timer_reschedules"], stats["live_flows"]) == (1, 1, 2)
+    finally:
+        table.close()
+
+
+def test_native_flow_table_overload_policies():
+    def fill(table, single_packet_last):
+        packets = []
+        for index in range(4):
+            flow = (("10.2.0.1", 1000 + index), ("10.2.0.2", 80))
+            packets.append((index * 0.1, *flow, 17, 0))
+            if not (single_packet_last and index == 3):
+                packets.append((index * 0.1 + 0.01, *flow, 17, 0))
+        packets.append((1.0, ("10.2.0.1", 2000), ("10.2.0.2", 80), 17, 0))
+        return _feed_flow_table(table, packets)[0]
+
+    table = _open_native_flow_table(max_flows=4)
+    try:
+        assert fill(table, False) == []
+        stats = table.stats()
+        assert (stats["insert_failures"], stats["aggregate_packets"], stats["live_flows"]) == (1, 1, 4)
+    finally:
+        table.close()
+
+    table = _open_native_flow_table(max_flows=4, overload_policy="evict_oldest")
+    try:
+        [evicted] = fill(table, False)
+        assert (evicted["end_reason"], evicted["src_port"]) == ("evicted", 1000)
+        assert table.stats()["evicted_records"] == 1
+    finally:
+        table.close()
+
+    table = _open_native_flow_table(max_flows=4, overload_policy="evict_single_packet")
+    try:
+        [evicted] = fill(table, True)
+        assert (evicted["end_reason"], evicted["src_port"], evicted["packet_count"]) == ("evicted", 1003, 1)
+        stats = table.stats()
+        assert (stats["evicted_records"], stats["single_packet_evictions"]) == (1, 1)
+    finally:
+        table.close()
+
+
+def test_native_flow_table_sizes_to_memory_budget():
+    budget = 64 * 1024
+    table = _open_native_flow_table(max_flows=0, memory_budget=budget)
+    try:
+        stats = table.stats()
+        max_flows = stats["max_flows"]
+        assert 0 < max_flows < budget // 128
+        assert stats["memory_bytes"] <= budget
+        assert stats["index_slots"] * 7 >= max_flows * 8
+        # Every flow the budget allows is admitted, the next one is counted in aggregate
+        packets = [(0.0, ("10.3.0.1", 1024 + index), ("10.3.0.2", 80), 17, 0) for index in range(max_flows + 1)]
+        for start in range(0, len(packets), 512):
+            _feed_flow_table(table, packets[start:start + 512])
+        stats = table.stats()
+        assert (stats["live_flows"], stats["insert_failures"]) == (max_flows, 1)
+    finally:
+        table.close()
+    # An explicit max_flows is lowered to fit the budget, never raised
+    table = _open_native_flow_table(max_flows=1_000_000, memory_budget=budget)
+    try:
+        assert table.stats()["max_flows"] == max_flows
+    finally:
+        table.close()
+    table = _open_native_flow_table(max_flows=16, memory_budget=budget)
+    try:
+        assert table.stats()["max_flows"] == 16
+    finally:
+        table.close()
+
+
+def test_ebpf_capture_rejects_unknown_attach_mode(tmp_path):
+    try:
+        dpi_main.EbpfFlowCapture(tmp_path / "missing.so", str(tmp_path), 30, attach_mode="sideways")
+    except RuntimeError as exc:
+        assert "attach mode" in str(exc)
+    else:
+        raise AssertionError("unknown attach mode accepted")
+
+
+def test_ebpf_capture_names_missing_bpf_capabilities(monkeypatch, tmp_path):
+    monkeypatch.setattr(dpi_main, "_effective_capabilities", lambda: 1 << dpi_main.CAP_NET_ADMIN)
+    try:
+        dpi_main.EbpfFlowCapture(tmp_path / "missing.so", str(tmp_path), 30)
+    except RuntimeError as exc:
+        assert "CAP_BPF" in str(exc) and "CAP_NET_ADMIN" not in str(exc)
+    else:
+        raise AssertionError("ebpf backend opened without CAP_BPF")
+
+
+def test_xdp_capture_fails_fast_without_umem_memlock(monkeypatch, tmp_path):
+    capabilities = 1 << dpi_main.CAP_NET_RAW | 1 << dpi_main.CAP_BPF
+    monkeypatch.setattr(dpi_main, "_effective_capabilities", lambda: capabilities)
+    monkeypatch.setattr(dpi_main, "_raise_memlock_limit", lambda: None)
+    monkeypatch.setattr(dpi_main.resource, "getrlimit", lambda limit: (65536, 65536))
+    try:
+        dpi_main.XDPCapture("eth0", tmp_path / "missing.so", str(tmp_path / "xsks_map"), [0, 1], 4096, "copy")
+    except RuntimeError as exc:
+        assert "CAP_IPC_LOCK" in str(exc) and str(2 * 4096 * 4096) in str(exc)
+    else:
+        raise AssertionError("af_xdp backend opened without room for its UMEM")
+
+
+# bpf(2) by hand, enough to stand up the tracker's pinned maps without loading it
+BPF_SYSCALL = {"x86_64": 321, "aarch64": 280}
+BPF_MAP_CREATE, BPF_MAP_LOOKUP_ELEM, BPF_MAP_UPDATE_ELEM, BPF_OBJ_PIN = 0, 1, 2, 6
+BPF_MAP_TYPE_PERCPU_ARRAY, BPF_MAP_TYPE_LRU_PERCPU_HASH, BPF_MAP_TYPE_RINGBUF = 6, 10, 27
+FLOW_STATS_FORMAT = "<QQQQQQII24I"
+FLOW_STATS_ORIGIN_REVERSE, FLOW_STATS_FIN_FORWARD, FLOW_STATS_FIN_REVERSE = 0x4, 0x100, 0x200
+
+
+class _BpfMaps:
+    def __init__(self):
+        if os.geteuid() != 0 or not os.path.ismount("/sys/fs/bpf") or platform.machine() not in BPF_SYSCALL:
+            pytest.skip("Needs root, bpffs and a known bpf(2) syscall number")
+        self.libc = ctypes.CDLL(None, use_errno=True)
+        self.nr = BPF_SYSCALL[platform.machine()]
+        with open("/sys/devices/system/cpu/possible") as possible:
+            self.ncpus = int(possible.read().strip().split(",")[-1].split("-")[-1]) + 1
+        self.pin_dir = tempfile.mkdtemp(dir="/sys/fs/bpf")
+        self.fds = {}
+
+    def _bpf(self, cmd, attr):
+        buf = ctypes.create_string_buffer(bytes(attr).ljust(128, b"\0"), 128)
+        rc = self.libc.syscall(self.nr, cmd, buf, 128)
+        if rc < 0:
+            raise OSError(ctypes.get_errno(), f"bpf({cmd})")
+        return rc
+
+    def create(self, name, map_type, key_size, value_size, max_entries):
+        fd = self._bpf(BPF_MAP_CREATE, struct.pack("<IIII", map_type, key_size, value_size, max_entries))
+        self.fds[name] = fd
+        path = ctypes.create_string_buffer(os.path.join(self.pin_dir, name).encode())
+        self._bpf(BPF_OBJ_PIN, struct.pack("<QI", ctypes.addressof(path), fd))
+
+    def _elem(self, cmd, name, key, value):
+        key_buf = ctypes.create_string_buffer(key, len(key))
+        self._bpf(cmd, struct.pack("<IIQQQ", self.fds[name], 0, ctypes.addressof(key_buf), ctypes.addressof(value), 0))
+
+    def update_percpu(self, name, key, values):
+        value = ctypes.create_string_buffer(b"".join(values), len(values[0]) * self.ncpus)
+        self._elem(BPF_MAP_UPDATE_ELEM, name, key, value)
+
+    def contains(self, name, key, value_size):
+        value = ctypes.create_string_buffer(value_size * self.ncpus)
+        try:
+            self._elem(BPF_MAP_LOOKUP_ELEM, name, key, value)
+        except OSError:
+            return False
+        return True
+
+    def close(self):
+        for name, fd in self.fds.items():
+            os.unlink(os.path.join(self.pin_dir, name))
+            os.close(fd)
+        os.rmdir(self.pin_dir)
+
+
+def _flow_stats(packets, first_seen, last_seen, flags):
+    return struct.pack(FLOW_STATS_FORMAT, packets[0], packets[1], 100 * packets[0], 100 * packets[1],
+                       first_seen, last_seen, 0, flags, *([0] * 24))
+
+
+def test_ebpf_export_completes_graceful_close_as_one_record():
+    lib_path = Path(os.getenv("RANSOMEYE_DPI_FASTPATH_LIB", ""))
+    if not lib_path.is_file():
+        pytest.skip("Fastpath library not built (set RANSOMEYE_DPI_FASTPATH_LIB)")
+    maps = _BpfMaps()
+    library = dpi_main.AFPacketCLibrary(lib_path)
+    export = None
+    try:
+        maps.create("flow_map", BPF_MAP_TYPE_LRU_PERCPU_HASH, 16, struct.calcsize(FLOW_STATS_FORMAT), 1024)
+        maps.create("flow_events", BPF_MAP_TYPE_RINGBUF, 0, 0, 4096)
+        maps.create("flow_counters", BPF_MAP_TYPE_PERCPU_ARRAY, 4, 8, 5)
+        config = dpi_main.FlowExportConfig(pin_dir=maps.pin_dir.encode(), idle_timeout_ns=60 * 1_000_000_000,
+                                           sweep_interval_ns=1_000_000)
+        export = library.lib.flow_export_open(ctypes.byref(config))
+        assert export, f"flow_export_open failed (errno {ctypes.get_errno()})"
+        records = (ctypes.c_ubyte * (4 * dpi_main.FLOW_RECORD_SIZE))()
+
+        def read(timeout_ms):
+            count = library.lib.flow_export_read(export, timeout_ms, records, 4)
+            assert count >= 0
+            data = memoryview(records).cast("B")[:count * dpi_main.FLOW_RECORD_SIZE]
+            return [_decode_flow_record(record) for record in struct.iter_unpack(FLOW_RECORD_FORMAT, data)]
+
+        # Canonical key 10.0.0.1:443 -> 10.0.0.2:40000: the client is the reverse direction
+        key = socket.inet_aton("10.0.0.1") + socket.inet_aton("10.0.0.2") + struct.pack(">HHB3x", 443, 40000, 6)
+        idle = _flow_stats((0, 0), 0, 0, 0)
+        start = time.monotonic_ns()
+        # SYN, SYN/ACK, ACK and the client's FIN on CPU 0
+        cpu0 = ((1, 3), start, start + 3_000_000, FLOW_STATS_ORIGIN_REVERSE | FLOW_STATS_FIN_REVERSE)
+        maps.update_percpu("flow_map", key, [_flow_stats(*cpu0)] + [idle] * (maps.ncpus - 1))
+        assert read(10) == []
+        # The server's FIN/ACK on another CPU: closed, but the last ACK has yet to come
+        cpu1 = ((1, 0), start + 4_000_000, start + 4_000_000, FLOW_STATS_FIN_FORWARD)
+        values = [_flow_stats(*cpu0), _flow_stats(*cpu1)] if maps.ncpus > 1 else [
+            _flow_stats((2, 3), start, start + 4_000_000, cpu0[3] | cpu1[3])]
+        maps.update_percpu("flow_map", key, values + [idle] * (maps.ncpus - len(values)))
+        assert read(10) == []
+        # The final ACK, then the linger passes (timestamps moved back instead of sleeping)
+        shift = 2_000_000_000
+        cpu0 = ((1, 4), start - shift, start + 5_000_000 - shift, cpu0[3])
+        cpu1 = (cpu1[0], cpu1[1] - shift, cpu1[2] - shift, cpu1[3])
+        values = [_flow_stats(*cpu0), _flow_stats(*cpu1)] if maps.ncpus > 1 else [
+            _flow_stats((2, 4), start - shift, start + 5_000_000 - shift, cpu0[3] | cpu1[3])]
+        maps.update_percpu("flow_map", key, values + [idle] * (maps.ncpus - len(values)))
+        [closed] = read(200)
+        assert closed["end_reason"] == "fin"
+        assert (closed["src_ip"], closed["src_port"]) == ("10.0.0.2", 40000)
+        assert closed["directions"]["forward"]["packets"] == 4
+        assert closed["directions"]["reverse"]["packets"] == 2
+        assert not maps.contains("flow_map", key, struct.calcsize(FLOW_STATS_FORMAT))
+        assert read(10) == []
+    finally:
+        if export:
+            library.lib.flow_export_close(export)
+        maps.close()
+
+
+FANOUT_SLOT_FORMAT = "<4sIII64B"
+
+
+def test_ebpf_fanout_sketch_reports_only_the_slot_owner_destinations():
+    lib_path = Path(os.getenv("RANSOMEYE_DPI_FASTPATH_LIB", ""))
+    if not lib_path.is_file():
+        pytest.skip("Fastpath library not built (set RANSOMEYE_DPI_FASTPATH_LIB)")
+    maps = _BpfMaps()
+    if maps.ncpus < 3:
+        maps.close()
+        pytest.skip("Needs three possible CPUs to disagree on a slot owner")
+    library = dpi_main.AFPacketCLibrary(lib_path)
+    export = None
+    try:
+        maps.create("flow_map", BPF_MAP_TYPE_LRU_PERCPU_HASH, 16, struct.calcsize(FLOW_STATS_FORMAT), 1024)
+        maps.create("flow_events", BPF_MAP_TYPE_RINGBUF, 0, 0, 4096)
+        maps.create("flow_counters", BPF_MAP_TYPE_PERCPU_ARRAY, 4, 8, 5)
+        maps.create("talker_cms", BPF_MAP_TYPE_PERCPU_ARRAY, 4, 8, 4 * 4096)
+        maps.create("talker_candidates", BPF_MAP_TYPE_PERCPU_ARRAY, 4, 16, 1024)
+        maps.create("fanout_hll", BPF_MAP_TYPE_PERCPU_ARRAY, 4, struct.calcsize(FANOUT_SLOT_FORMAT), 4096)
+        config = dpi_main.FlowExportConfig(pin_dir=maps.pin_dir.encode(), idle_timeout_ns=60 * 1_000_000_000,
+                                           sweep_interval_ns=1_000_000)
+        export = library.lib.flow_export_open(ctypes.byref(config))
+        assert export, f"flow_export_open failed (errno {ctypes.get_errno()})"
+        talkers, fanout = (dpi_main.FlowSketchEntry * 4)(), (dpi_main.FlowSketchEntry * 4)()
+
+        def top_fanout(copies):
+            empty = struct.pack(FANOUT_SLOT_FORMAT, bytes(4), 0, 0, 0, *([0] * 64))
+            values = [struct.pack(FANOUT_SLOT_FORMAT, socket.inet_aton(ip), updates, updates, 0, *registers)
+                      for ip, updates, registers in copies]
+            maps.update_percpu("fanout_hll", struct.pack("<I", 7), values + [empty] * (maps.ncpus - len(values)))
+            talker_count, fanout_count = ctypes.c_uint32(4), ctypes.c_uint32(4)
+            assert library.lib.flow_export_sketches(export, talkers, ctypes.byref(talker_count),
+                                                    fanout, ctypes.byref(fanout_count)) == 0
+            return [(socket.inet_ntoa(struct.pack("<I", entry.src_ip)), entry.value)
+                    for entry in fanout[:fanout_count.value]]
+
+        scanner = [1 + index % 4 for index in range(64)]
+        [(owner, destinations)] = top_fanout([("10.0.0.9", 500, scanner)])
+        assert owner == "10.0.0.9" and destinations > 0
+        # A colliding source that won the slot on two CPUs is outweighed, and its
+        # registers (set far higher) do not inflate the scanner's estimate
+        noisy = [12] * 64
+        assert top_fanout([("10.0.0.9", 500, scanner), ("10.0.0.7", 20, noisy), ("10.0.0.7", 30, noisy)]) == [
+            ("10.0.0.9", destinations)
+        ]
+        # Outweighed itself, the scanner's copy is left out the same way
+        [(owner, _)] = top_fanout([("10.0.0.9", 5, scanner), ("10.0.0.7", 200, [1] * 64), ("10.0.0.7", 300, [1] * 64)])
+        assert owner == "10.0.0.7"
+    finally:
+        if export:
+            library.lib.flow_export_close(export)
+        maps.close()
+
+
+def test_fanout_capture_stops_workers_when_interface_is_removed():
+    lib_path = Path(os.getenv("RANSOMEYE_DPI_FASTPATH_LIB", ""))
+    if not lib_path.is_file():
+        pytest.skip("Fastpath library not built (set RANSOMEYE_DPI_FASTPATH_LIB)")
+    interface = f"re{os.getpid() % 100000}a"
+    peer = interface[:-1] + "b"
+    if os.geteuid() != 0 or subprocess.run(["ip", "link", "add", interface, "type", "veth", "peer", "name", peer],
+                                           capture_output=True).returncode != 0:
+        pytest.skip("Needs root and veth support")
+    capture = None
+    try:
+        subprocess.run(["ip", "link", "set", interface, "up"], check=True)
+        capture = dpi_main.FanoutCapture(interface, lib_path, workers=2, fanout_mode="hash", worker_cpus=[],
+                                         queue_slots=64, block_size=1 << 16, block_count=4, retire_timeout_ms=10,
+                                         timestamp_source="software")
+        # A link that goes down comes back: counted and backed off, workers keep running
+        subprocess.run(["ip", "link", "set", interface, "down"], check=True)
+        time.sleep(0.3)
+        stats = capture.stats()
+        assert stats["ring_errors"] >= 2
+        assert [worker["state"] for worker in stats["workers"]] == ["running", "running"]
+        assert capture.read_frame_count(timeout_seconds=0.05) >= 0
+        # A removed device never does: workers stop and reads fail instead of spinning
+        subprocess.run(["ip", "link", "del", interface], check=True)
+        deadline = time.monotonic() + 3.0
+        while any(worker["state"] != "failed" for worker in capture.stats()["workers"]):
+            assert time.monotonic() < deadline, capture.stats()
+            time.sleep(0.05)
+        assert {worker["last_error"] for worker in capture.stats()["workers"]} == {"ENETDOWN"}
+        # Frames queued before the removal drain first
+        for _ in range(100):
+            try:
+                capture.read_frame_count(timeout_seconds=0.05)
+            except RuntimeError as exc:
+                assert "batch read failed" in str(exc)
+                break
+        else:
+            raise AssertionError("reads kept succeeding after every worker stopped")
+    finally:
+        if capture:
+            capture.close()
+        subprocess.run(["ip", "link", "del", interface], capture_output=True)
+
+
+def test_af_packet_read_batch_rejects_buffer_shorter_than_snaplen():
+    lib_path = Path(os.getenv("RANSOMEYE_DPI_FASTPATH_LIB", ""))
+    if not lib_path.is_file():
+        pytest.skip("Fastpath library not built (set RANSOMEYE_DPI_FASTPATH_LIB)")
+    if os.geteuid() != 0:
+        pytest.skip("Needs root for an AF_PACKET ring")
+    lib = dpi_main.AFPacketCLibrary(lib_path).lib
+    ring = lib.af_packet_ring_open(b"lo", 1 << 16, 4, 10)
+    assert ring, f"af_packet_ring_open failed (errno {ctypes.get_errno()})"
+    try:
+        batch = dpi_main.FrameBatch(4, 256)
+        ctypes.set_errno(0)
+        assert lib.af_packet_read_batch(ring, 0, ctypes.byref(batch.buffer), 255, 256,
+                                        ctypes.byref(batch.descs), 4) == -1
+        assert ctypes.get_errno() == errno.EINVAL
+        assert lib.af_packet_read_batch(ring, 0, ctypes.byref(batch.buffer), 256, 256,
+                                        ctypes.byref(batch.descs), 4) >= 0
+    finally:
+        lib.af_packet_ring_close(ring)
+
+
+def _pcapng_block(block_type, body):
+    body += bytes(-len(body) % 4)
+    return struct.pack("<II", block_type, len(body) + 12) + body + struct.pack("<I", len(body) + 12)
+
+
+def test_pcap_replay_keeps_simple_packet_times_across_passes(tmp_path):
+    lib_path = Path(os.getenv("RANSOMEYE_DPI_FASTPATH_LIB", ""))
+    if not lib_path.is_file():
+        pytest.skip("Fastpath library not built (set RANSOMEYE_DPI_FASTPATH_LIB)")
+    frame = bytes(12) + b"\x08\x00" + _filter_ipv4("10.0.0.2", "10.0.0.1", 17, 53) + bytes(6)
+    base_us = BASE_S * 1_000_000
+    pcap_path = tmp_path / "spb.pcapng"
+    pcap_path.write_bytes(
+        _pcapng_block(0x0A0D0D0A, struct.pack("<IHHq", 0x1A2B3C4D, 1, 0, -1))
+        + _pcapng_block(0x00000001, struct.pack("<HHI", 1, 0, 0))
+        + b"".join(
+            _pcapng_block(0x00000006, struct.pack("<IIIII", 0, ts >> 32, ts & 0xFFFFFFFF, len(frame), len(frame)) + frame)
+            for ts in (base_us, base_us + 1000)
+        )
+        # Simple packet blocks carry no timestamp: each takes the previous frame's time
+        + _pcapng_block(0x00000003, struct.pack("<I", len(frame)) + frame)
+    )
+    capture = dpi_main.PcapReplayCapture(pcap_path, lib_path, pacing="recorded", loops=2)
+    try:
+        stamps = []
+        while not capture.stats()["replay_finished"] or stamps == []:
+            count = capture.read_frame_count(timeout_seconds=0.1)
+            stamps += [struct.unpack_from(dpi_main.FRAME_DESC_FORMAT, capture.batch.descs,
+                                          index * dpi_main.FRAME_DESC_SIZE)[4] for index in range(count)]
+        # The second pass starts 1 us after the first ended and keeps the recorded spacing
+        pass_ns = 1_000_000 + 1000
+        assert [stamp - stamps[0] for stamp in stamps] == [
+            0, 1_000_000, 1_000_000, pass_ns, pass_ns + 1_000_000, pass_ns + 1_000_000
+        ]
+    finally:
+        capture.close()
+
+
+def test_parse_id_list_expands_ranges():
+    assert _parse_id_list("") == []
+    assert _parse_id_list("2-5") == [2, 3, 4, 5]
+    assert _parse_id_list("1, 3,8-9") == [1, 3, 8, 9]
+
+
+def test_build_capture_filter_translates_config():
+    assert _build_capture_filter("", "", "", "", 0) is None
+
+    spec = _build_capture_filter("tcp, UDP", "10.1.2.3/16", "10.1.9.0/24", "443,8000-8100", 128)
+    assert spec.protocols == 0x3
+    assert spec.snaplen == 128
+    assert spec.include_count == 1
+    assert (spec.include[0].addr, spec.include[0].prefix_len) == (0x0A010000, 16)
+    assert spec.exclude_count == 1
+    assert (spec.exclude[0].addr, spec.exclude[0].prefix_len) == (0x0A010900, 24)
+    assert spec.port_range_count == 2
+    assert (spec.ports[0].first, spec.ports[0].last) == (443, 443)
+    assert (spec.ports[1].first, spec.ports[1].last) == (8000, 8100)
+
+
+def _filter_frame(tags, ethertype, network):
+    header = bytes(12) + b"".join(struct.pack(">HH", tpid, 5) for tpid in tags)
+    return header + struct.pack(">H", ethertype) + network + bytes(120)
+
+
+def _filter_ipv4(src, dst, protocol, dst_port, frag=0):
+    return struct.pack(">BBHHHBBH4s4sHH", 0x45, 0, 144, 0, frag, 64, protocol, 0,
+                       socket.inet_aton(src), socket.inet_aton(dst), 40000, dst_port)
+
+
+def _filter_ipv6(next_header, dst_port, extension=None):
+    upper = struct.pack(">HH", 40000, dst_port)
+    if extension is not None:
+        upper, next_header = bytes([next_header]) + bytes(7) + upper, extension
+    return struct.pack(">IHBB16s16s", 6 << 28, 124, next_header, 64, bytes(15) + b"\1", bytes(15) + b"\2") + upper
+
+
+def test_capture_filter_sees_through_vlan_tags_and_ipv6():
+    lib_path = Path(os.getenv("RANSOMEYE_DPI_FASTPATH_LIB", ""))
+    if not lib_path.is_file():
+        pytest.skip("Fastpath library not built (set RANSOMEYE_DPI_FASTPATH_LIB)")
+    library = dpi_main.AFPacketCLibrary(lib_path)
+    insns, count = dpi_main._compile_capture_filter(
+        library, _build_capture_filter("tcp", "10.0.0.0/8", "", "443", 96)
+    )
+    # A socket filter runs on datagrams too, so frames can be fed through a socketpair
+    sender, receiver = socket.socketpair(socket.AF_UNIX, socket.SOCK_DGRAM)
+    try:
+        assert library.lib.capture_filter_attach(receiver.fileno(), ctypes.byref(insns), count) == 0
+        receiver.setblocking(False)
+        cases = [
+            ([], 0x0800, _filter_ipv4("10.0.0.1", "10.0.0.2", 6, 443), 96),
+            ([0x8100], 0x0800, _filter_ipv4("10.0.0.1", "10.0.0.2", 6, 443), 96),
+            ([0x88A8, 0x8100], 0x0800, _filter_ipv4("10.0.0.1", "10.0.0.2", 6, 443), 96),
+            ([0x88A8, 0x8100], 0x0800, _filter_ipv4("10.0.0.1", "10.0.0.2", 6, 80), 0),
+            ([0x8100], 0x0800, _filter_ipv4("192.168.0.1", "192.168.0.2", 6, 443), 0),
+            ([], 0x0800, _filter_ipv4("10.0.0.1", "10.0.0.2", 17, 443), 0),
+            ([], 0x0800, _filter_ipv4("10.0.0.1", "10.0.0.2", 6, 443, frag=10), 0),
+            ([0x8100], 0x86DD, _filter_ipv6(6, 443), 96),
+            ([0x8100], 0x86DD, _filter_ipv6(6, 80), 0),
+            ([], 0x86DD, _filter_ipv6(17, 443), 0),
+            # Frames the filter cannot see into are left to the parser
+            ([], 0x86DD, _filter_ipv6(6, 80, extension=0), 96),
+            ([0x88A8, 0x8100, 0x8100], 0x0800, _filter_ipv4("10.0.0.1", "10.0.0.2", 6, 80), 96),
+            ([], 0x8847, bytes(40), 96),
+            ([], 0x0806, bytes(40), 0),
+        ]
+        for tags, ethertype, network, expected in cases:
+            sender.send(_filter_frame(tags, ethertype, network))
+            try:
+                received = len(receiver.recv(4096))
+            except BlockingIOError:
+                received = 0
+            assert received == expected, (tags, hex(ethertype), network[:8].hex())
+    finally:
+        sender.close()
+        receiver.close()
+
+
+def test_pcap_backend_requires_ci(monkeypatch):
+    monkeypatch.delenv("CI", raising=False)
+    config = {
+        "RANSOMEYE_INGEST_URL": "http://127.0.0.1:8000/events",
+        "RANSOMEYE_DPI_INTERFACE": "lo",
+        "RANSOMEYE_COMPONENT_INSTANCE_ID": "component-1",
+        "RANSOMEYE_DPI_CAPTURE_BACKEND": "pcap",
+        "RANSOMEYE_DPI_FLOW_TIMEOUT": "1",
+        "RANSOMEYE_DPI_HEARTBEAT_SECONDS": "1",
+        "RANSOMEYE_DPI_PCAP_PATH": "/tmp/capture.pcap",
+    }
+    try:
+        dpi_main.run_dpi_probe(config)
+    except RuntimeError as exc:
+        assert "only allowed in CI" in str(exc)
+    else:
+        raise AssertionError("pcap backend started outside CI")
+
+
 def test_event_envelope_builder_tracks_sequence():
     builder = EventEnvelopeBuilder(
         machine_id="machine-a",
@@ -89,6 +855,31 @@ def test_build_flow_payload_shape():
     assert payload["flow"]["src_ip"] == "10.0.0.1"
 
 
+def test_build_heartbeat_payload_includes_capture_stats():
+    counters = {"packets_seen": 3, "flows_emitted": 1, "heartbeats_sent": 0}
+    meta = {"backend": "af_packet_c", "interface": "eth0"}
+    assert "capture_stats" not in _build_heartbeat_payload(meta, counters)
+
+    stats = {"kernel_packets": 10, "kernel_drops": 2, "kernel_freeze_q_cnt": 0, "parse_errors": 1}
+    payload = _build_heartbeat_payload(meta, counters, stats)
+    assert payload["event_type"] == "dpi.heartbeat"
+    assert payload["counters"] == counters
+    assert payload["capture_stats"]["kernel_drops"] == 2
+
+
+def test_build_heartbeat_payload_includes_sketches():
+    counters = {"packets_seen": 0, "flows_emitted": 4, "heartbeats_sent": 1}
+    meta = {"backend": "ebpf", "interface": "eth0"}
+    assert "sketches" not in _build_heartbeat_payload(meta, counters, {"records": 4})
+
+    sketches = {
+        "top_talkers": [{"src_ip": "10.0.0.3", "bytes": 4200000}],
+        "top_fanout": [{"src_ip": "10.0.0.1", "destinations": 1898}],
+    }
+    payload = _build_heartbeat_payload(meta, counters, {"records": 4}, sketches)
+    assert payload["sketches"]["top_fanout"][0]["destinations"] == 1898
+
+
 def test_run_dpi_probe_emits_events(monkeypatch, tmp_path):
     events = []
 
@@ -135,7 +926,7 @@ def test_run_dpi_probe_emits_events(monkeypatch, tmp_path):
         def __init__(self, config):
             return None
 
-        def redact_flow(self, flow):
+        def redact_flow(self, flow, redacted_endpoints=None):
             return flow
 
     class _FakeSigner: